@@ -248,6 +248,28 @@ private:
                                 long            CheckHighBlock,                 // Highest block & tuple allowed in the page
                                 long            CheckHighTuple
                                 );
+    int                 KeyInLeaf(                                              // Internal routine to tell if a key that sorts after the leaf's keys so far is sure to belong in the leaf- caller holds the leaf
+                                volatile ATBTPH *Page,                          // Leaf page
+                                void            *inKey,                         // Key to check
+                                long            inBlock,                        // Its table block & tuple
+                                long            inTuple
+                                );
+    long                CompareEntry(                                           // Internal routine to compare two keys the way the tree orders them- secondaries go by table block & tuple as well
+                                void            *inKey1,                        // First key
+                                long            inBlock1,                       // and its table block & tuple
+                                long            inTuple1,
+                                void            *inKey2,                        // Second key
+                                long            inBlock2,                       // and its table block & tuple
+                                long            inTuple2
+                                );
+    void                SortBatch(                                              // Internal routine to sort a batch of keys into tree order- a bottom up merge sort, so runs already in order cost next to nothing
+                                long            *ioOrder,                       // The key numbers to sort
+                                long            *inSpare,                       // Room for as many again
+                                long            inCount,                        // Number of keys
+                                char            *inKeys,                        // The keys, KeyLength apart
+                                long            *inBlocks,                      // Their table blocks & tuples
+                                long            *inTuples
+                                );
     int                 TestCrabLock(                                           // Internal routine for getting a BTree crab share lock
                                 ATLOCK          *HeldLock,                      // Ptr to the lock you currently hold
                                 ATLOCK          *DesiredLock                    // Ptr to lock caller's wants to crab to
@@ -256,6 +278,28 @@ private:
                                 volatile ATBTPH *HeldPage,                      // Page you hold a share lock on
                                 volatile ATBTPH *DesiredPage                    // Page you want an exclusive lock on
                                 );
+    int                 GetPageShare(                                           // Get a share lock on a page- the root's readers go through its big-reader slots
+                                ATLOCK          *ALock                          // The page's lock
+                                );
+    int                 BouncePageShare(                                        // Try for a share lock on a page, return immediately if failed
+                                ATLOCK          *ALock                          // The page's lock
+                                );
+    int                 FreePageShare(                                          // Free a share lock on a page
+                                ATLOCK          *ALock                          // The page's lock
+                                );
+    int                 QueuePageExclusive(                                     // Queue an exclusive on a page- fails at once if someone else has one
+                                ATLOCK          *ALock                          // The page's lock
+                                );
+    int                 WaitPageExclusive(                                      // With an exclusive queued on a page, wait for its readers to leave
+                                ATLOCK          *ALock                          // The page's lock
+                                );
+    int                 RemovePageExclusive(                                    // Take our queued or held exclusive back off of a page
+                                ATLOCK          *ALock                          // The page's lock
+                                );
+    int                 ReclaimPageExclusive(                                   // Clear a dead writer's exclusive off of a page- ATERR_SUCCESS means it is gone
+                                ATLOCK          *ALock,                         // The page's lock
+                                long            Attempts                        // Number of tries made at the lock so far
+                                );
 
 public:
     ATBTree();
@@ -264,6 +308,12 @@ public:
     // *************************************************************************
     //                          UTILITY ROUTINES
     // *************************************************************************
+    int                 SetCreateOptions(                                       // Set the AT_TABLE_* options for the page table made by the next Create() call
+                                long            inOptions                       // Any of the AT_TABLE_* flags or'd together, zero for the defaults
+                                );
+    int                 PreAttachPages(                                         // Attach every block of the page table now, rather than as each is first touched- for a warm start after Open()
+                                int             inThreads                       // Threads to spread the attaching over, zero for one per processor we can run on
+                                );
     int                 Create(                                                 // Create a BTree
                                 int              inKey,                         // Systemwide unique IPC ID for this BTree- BECOMES A SHARED MEMORY KEY as well, so, again, it must be system wide IPC unique
                                                                                 // !!IMPORTANT!! The key that you specify here will be incremented by 1 each time a new section needs to be allocated,
@@ -364,6 +414,14 @@ public:
                                 long            inBlock,                        // The unique block & tuple ID
                                 long            inTuple
                                 );
+    int                 InsertTuples(                                           // Called when a run of tuples has been inserted into the associated table- sorts their keys & inserts them in one pass
+                                                                                // NOTE: GENERALLY NOT USER CALLED!  CALL THE TABLE's AddTuples() FUNCTION!!
+                                long            inCount,                        // Number of tuples in the run
+                                ATTuple         **inTuples,                     // Ptrs to the tuples to insert
+                                long            *inBlocks,                      // The unique block & tuple ID of each
+                                long            *inTupleNumbers,
+                                int             *ioResults                      // Each tuple's result- any not already ATERR_SUCCESS coming in are skipped
+                                );
     int                 DeleteTuple(                                            // Called when a tuple is deleted
                                                                                 // USUALLY NOT CALLED BY USER- USE THE TABLE'S DeleteTuple() INSTEAD
                                 ATTuple         *Tuple,                         // Key of tuple to delete
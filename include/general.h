@@ -40,7 +40,8 @@
 
 // **************************************************************************** Defines
 // The atlas version string- do not change the length...
-#define     AT_ATLAS_VERSION        "01.30\0"
+// ...and give every change to the saved table layout a new one, since LoadTable() & CreateFromFile() refuse any other
+#define     AT_ATLAS_VERSION        "01.40\0"
 
 // Basic memory alignment (very important for many processors)
 #define     AT_MEM_ALIGN            ((int)4)
@@ -47,30 +47,159 @@ Here is the relevant bit from the Kernel source header for RedHat 7.2:
 #define SHMSEG SHMMNI			 /* max shared segs per process
 
 So as you can see, some of these COULD be an issue.
+
+Or skip all that- SetBackend(AT_SHMEM_POSIX, ...) puts the memory in a POSIX shared memory
+object (shm_open + mmap) instead, which is only bounded by the size of /dev/shm.  Either kind
+can ask for AT_SHMEM_HUGEPAGES: SysV uses SHM_HUGETLB, POSIX uses a file on the hugetlbfs
+mount (AT_SHMEM_HUGE_DIR), and if no huge pages are reserved we settle for normal pages with
+madvise(MADV_HUGEPAGE), so transparent huge pages can still kick in.  Attaching looks in all
+the places a key could live, so only the creator needs to know which kind it asked for.
+
+CreateArena() makes a POSIX block that can grow in place: it maps a big reserve of address space
+up front (MAP_NORESERVE- nothing is backed until GrowArena() says so), and everyone who attaches
+maps it at the very same address.  So pointers into an arena are good in every process, and
+growing it needs nobody to re-attach.  Objects in the same process share the one mapping.
+Attaching fails with ATERR_UNSAFE_OPERATION if something else already sits at that address in
+the caller- make your arenas early in the life of a process.
+
+CreateFileArena() is the same thing kept in a regular file instead of shared memory, so it
+outlives every process and a reboot: SyncSharedMem() pushes it out to disk (the kernel only
+writes the pages that changed), and nothing ever deletes the file- that is up to you.  After a
+restart the first process up attaches with inRestart set, which maps the file wherever it fits
+and makes that the address everyone else uses from then on.
+
+ATScratchMem never runs dry: when a chunk fills up it chains on another of the same size, and a
+request bigger than a quarter of that (AT_SCRATCH_BIG_SHARE) gets a block of its own from the
+heap, so it doesn't waste the rest of a chunk.  ResetScratchMem() keeps the chunks around for the
+next go, so a scratch object that gets reset over and over settles down to no heap calls at all.
+Nested work can MarkScratchMem() on the way in and RewindScratchMem() on the way out, to give
+back its temporaries without disturbing what the caller got before the mark.
 */
 
+// Where the memory lives (see SetBackend)
+#define     AT_SHMEM_SYSV               (0)
+#define     AT_SHMEM_POSIX              (1)
+// Where it lives when POSIX asked for huge pages and got them- never passed to SetBackend
+#define     AT_SHMEM_HUGEFS             (2)
+// Where it lives when it is an arena (see CreateArena)- never passed to SetBackend
+#define     AT_SHMEM_ARENA              (3)
+// Where it lives when it is an arena in a file (see CreateFileArena)- never passed to SetBackend
+#define     AT_SHMEM_FILE               (4)
+// Backend flags- try to back the memory with huge pages
+#define     AT_SHMEM_HUGEPAGES          (0x00000001)
+// Where the hugetlbfs mount is
+#define     AT_SHMEM_HUGE_DIR           "/dev/hugepages"
+// Huge page size to assume if /proc/meminfo doesn't say
+#define     AT_SHMEM_HUGE_SIZE          (2 * 1024 * 1024)
+
+struct ATSharedMemHeader {                                                      // Kept at the true base of every shared memory block, ahead of the user memory
+    long            Allocated;                                                  // Bytes of user memory
+    long            Kind;                                                       // The AT_SHMEM_* the memory really lives in
+    long            Mapped;                                                     // Bytes actually mapped- header & huge page rounding included
+    long            SysID;                                                      // The SysV ID, or the key that names the POSIX object
+    char            *Address;                                                   // Where everyone maps an arena
+};
+typedef struct ATSharedMemHeader    ATSMHeader;
+
+// A scratch request bigger than its chunk size over this goes straight to the heap (see ATScratchMem)
+#define     AT_SCRATCH_BIG_SHARE        (4)
+
+struct ATScratchChunk {                                                         // Kept at the base of every scratch memory chunk, ahead of the memory it hands out
+    ATScratchChunk  *Next;                                                      // Next chunk in the chain, NULL for the last
+    char            *Data;                                                      // First byte handed out, aligned
+    char            *Top;                                                       // Top + 1 of the memory handed out
+};
+struct ATScratchBig {                                                           // Kept at the base of every large scratch allocation
+    ATScratchBig    *Next;                                                      // Next older large allocation, NULL for the oldest
+    long            Size;                                                       // Bytes asked for
+};
+struct ATScratchMark {                                                          // A save point in a scratch memory object (see MarkScratchMem)
+    ATScratchChunk  *Chunk;                                                     // Chunk that was being carved
+    char            *Offset;                                                    // Where in it
+    ATScratchBig    *Big;                                                       // Newest large allocation at the time
+    long            InUse;                                                      // Bytes in use at the time
+};
+struct ATScratchStatistics {                                                    // What a scratch memory object has been up to
+    long            Allocs;                                                     // Number of GetScratchMem() calls that got their memory
+    long            Failures;                                                   // Number that didn't (out of memory)
+    long            BigAllocs;                                                  // Number of those that went straight to the heap
+    long            Chunks;                                                     // Chunks in the chain now
+    long            BigBlocks;                                                  // Large allocations still held now
+    long            Reserved;                                                   // Bytes held from the heap now, chunks & large allocations both
+    long            InUse;                                                      // Bytes handed out since the last reset or rewind
+    long            HighWater;                                                  // Most bytes ever handed out at once
+    long            Rewinds;                                                    // Number of resets & rewinds
+};
+typedef struct ATScratchStatistics  ATScratchStats;
+
 // ****************************************************************************
 //                             ATSharedMem
 // ****************************************************************************
 class   ATSharedMem {                                                           // Shared memory object
 private:
-    int             Allocated;                                                  // Size of this object
+    long            Allocated;                                                  // Size of this object
     char            *Base;                                                      // True base of this object
     char            *UserBase;                                                  // Base of the object reported externally
     int             SysID;                                                      // The system ID for the object
     int             IAmCreator;                                                 // Flag indicating whether this proc is the one that created the block
+    int             Backend;                                                    // The AT_SHMEM_* to create new memory in- survives Reset()
+    int             BackendFlags;                                               // The AT_SHMEM_* flags to create it with- survives Reset()
+    int             Handle;                                                     // Open file for a file arena, so we can grow it- -1 for anything else
 
     void            Reset();                                                    // Reset the object members
+    int             CreatePOSIX(                                                // Internal routine to create the memory as a POSIX shared memory object
+                            int             Key,                                // Key ID for the object
+                            long            Size                                // Size in bytes to be allocated, header included
+                            );
+    int             AttachPOSIX(                                                // Internal routine to attach to a POSIX shared memory object
+                            int             Key                                 // Key ID for the object
+                            );
+    int             SetUpArena(                                                 // Internal routine to size, map & stamp a new arena- the caller cleans up the handle if it fails
+                            int             inHandle,                           // Open shared memory object or file
+                            long            Reserve,                            // Most bytes it can ever grow to
+                            long            Size,                               // Size in bytes usable right away
+                            int             inKind                              // AT_SHMEM_ARENA or AT_SHMEM_FILE
+                            );
+    int             MapArena(                                                   // Internal routine to map an existing arena, where its header says to
+                            int             inHandle,                           // Open shared memory object or file
+                            ATSMHeader      *inHeader,                          // Copy of its header
+                            int             inAnywhere                          // Set to true to map it wherever it fits, and make that its address from now on
+                            );
 public:
     ATSharedMem();
     ~ATSharedMem();
+    int             SetBackend(                                                 // Set where the next CreateSharedMem() puts the memory- attaching finds it wherever it is
+                            int             inBackend,                          // AT_SHMEM_SYSV (the default) or AT_SHMEM_POSIX
+                            int             inFlags                             // AT_SHMEM_* flags or'd together, zero for none
+                            );
     int             CreateSharedMem(                                            // Create a shared memory object- automatically attaches to it
                             int             Key,                                // Key ID for the object
-                            int             Size                                // Size in bytes to be allocated
+                            long            Size                                // Size in bytes to be allocated
+                            );
+    int             CreateArena(                                                // Create a POSIX shared memory object that grows in place, at the same address in every process- automatically attaches to it
+                            int             Key,                                // Key ID for the object
+                            long            Reserve,                            // Most bytes it can ever grow to- address space only, until grown into
+                            long            Size                                // Size in bytes usable right away
+                            );
+    int             CreateFileArena(                                            // Create an arena kept in a file, so it outlives us- automatically attaches to it
+                            char            *inPath,                            // File to keep it in- must not exist yet
+                            long            Reserve,                            // Most bytes it can ever grow to- address space only, until grown into
+                            long            Size                                // Size in bytes usable right away
+                            );
+    int             AttachFileArena(                                            // Attach to an arena kept in a file
+                            char            *inPath,                            // File it is kept in
+                            int             inRestart                           // Set to true if nobody has it attached (first one up after a restart)- maps it wherever it fits
+                            );
+    int             SyncSharedMem();                                            // Write a file arena's changes out to its file, returning once they are there- nothing to do for the other kinds
+    int             GrowArena(                                                  // Make more of an arena usable- every process attached sees it at once
+                            long            Size                                // Size in bytes it should have- it never shrinks
                             );
     int             AttachSharedMem(                                            // Attach to an already created shared memory object- returns a handle
                             int             Key                                 // Key ID for the object
                             );
+    int             AttachSharedMemID(                                          // Attach to an already created SysV shared memory object by its system ID- skips looking the key up
+                            int             inSysID                             // System ID for the object (see GetSystemID)
+                            );
     volatile void   *GetBasePointer();                                          // Returns a pointer to the base of the allocated memory
     int             DetachSharedMem();                                          // Detach from a shared memory object
     int             FreeSharedMem();                                            // Frees/destroys shared mem object after detaching from it
@@ -85,23 +214,38 @@ public:
 // ****************************************************************************
 class   ATScratchMem {                                                          // Scratch memory object
 private:
-    int             Allocated;                                                  // Bytes allocated in this object
-    char            *Base;                                                      // Ptr to the base of the alloc'd memory for the object
-    char            *Top;                                                       // Top + 1 of the allocated memory
-    char            *CurrentOffset;                                             // Ptr to the current offset within the block
-    char            *HighWater;                                                 // Highest offset ever reached by this object
+    int             Allocated;                                                  // Bytes in each chunk of this object
+    ATScratchChunk  *First;                                                     // First chunk in the chain
+    ATScratchChunk  *Current;                                                   // Chunk being carved, NULL if there is none yet
+    char            *Top;                                                       // Top + 1 of the current chunk
+    char            *CurrentOffset;                                             // Ptr to the current offset within the current chunk
+    ATScratchBig    *Big;                                                       // Newest large allocation, NULL for none
+    ATScratchStats  Stats;                                                      // What we've been up to
 
     void            Reset();                                                    // Reset the object members
+    ATScratchChunk  *NextChunk();                                               // Move on to the next chunk in the chain, adding one if need be- returns NULL if out of memory
+    void            FreeBig(                                                    // Free the large allocations newer than a given one
+                            ATScratchBig    *inKeep                             // Newest one to keep, NULL to free them all
+                            );
 public:
     ATScratchMem(                                                               // Construct the object with a given size in bytes
-                            int             Size                                // Size in bytes to construct
+                            int             Size                                // Size in bytes of each chunk- the first is allocated now
                             );
     ~ATScratchMem();
-    void            *GetScratchMem(                                             // Get a block of the scratch area- returns a ptr to the block, will be processor aligned
+    void            *GetScratchMem(                                             // Get a block of the scratch area- returns a ptr to the block, will be processor aligned, NULL if out of memory
                             int             Size                                // Size in bytes to get
                             );
-    void            ResetScratchMem();                                          // Reset the scratch memory object (does not reset high water mark)
-    int             GetHighWater();                                             // Returns the high water mark in bytes for the object (highest point allocated for the object)
+    void            ResetScratchMem();                                          // Reset the scratch memory object (does not reset high water mark)- keeps the chunks for reuse, frees the large allocations
+    void            MarkScratchMem(                                             // Take a save point, to rewind to later
+                            ATScratchMark   *outMark                            // Where to put the save point
+                            );
+    void            RewindScratchMem(                                           // Give back everything gotten since a save point- later save points are no good after this
+                            ATScratchMark   *inMark                             // Save point from MarkScratchMem(), since the last reset
+                            );
+    int             GetHighWater();                                             // Returns the high water mark in bytes for the object (most bytes ever handed out at once)
+    void            GetScratchStats(                                            // Get the statistics for the object
+                            ATScratchStats  *outStats                           // Where to put them
+                            );
 };
 
 
@@ -119,7 +263,12 @@ int     ATDestroySharedMem(
                     );
 // **************************************************************************** ATDetachSharedMem
 int     ATDetachSharedMem(                                                      // Detach from a shared memory alloc
-                    volatile void *Base                                         // Base ptr of the alloc to detach from
+                    volatile void *Base                                         // Base ptr of the alloc to detach from- the TRUE base
+                    );
+// **************************************************************************** ATDestroySharedMemAt
+int     ATDestroySharedMemAt(                                                   // Like ATDestroySharedMem, but works out which kind of memory it is from the block itself- still attached
+                                                                                // Only the owner, creator, or superuser can call.
+                    volatile void *Base                                         // TRUE base ptr of the alloc to destroy
                     );
 
 
@@ -31,14 +31,137 @@
 #define     AT_SHARE_EXC    ((unsigned long)0xF0000000)
 // Inverse mask for exclusive
 #define     AT_SHARE_EXC_I  ((unsigned long)0x0FFFFFFF)
+// Flag set in a lock word by anyone parked (sleeping in the kernel) on it, so the releaser knows to wake them- reserved, so no Kilroy may have it set
+#define     AT_LOCK_WAITERS ((unsigned long)0x08000000)
+// Mask for the reader count of a sharelock
+#define     AT_SHARE_COUNT  ((unsigned long)0x07FFFFFF)
+// Amount added to a ticket lock to take the next ticket
+#define     AT_TICKET_NEXT  ((unsigned long)0x00010000)
+// Mask for the ticket now being served by a ticket lock
+#define     AT_TICKET_MASK  ((unsigned long)0x0000FFFF)
+// Number of reader slots spread behind a big-reader sharelock
+#define     AT_BRLOCK_SLOTS ((int)8)
+// Size of a big-reader slot- one cache line, so readers on different slots never share a line
+#define     AT_BRLOCK_SLOTSIZE ((int)64)
+
+// Lock classes the contention statistics are kept by (see ATSetLockClass)
+// Anything not tagged with a class
+#define     AT_LOCKCLASS_OTHER      ((long)0)
+// Table block header locks
+#define     AT_LOCKCLASS_TABLEBLOCK ((long)1)
+// Table add segment locks
+#define     AT_LOCKCLASS_ADDSEG     ((long)2)
+// Table delete segment locks (unused since the delete lists went lock-free- kept so the class numbers stay put)
+#define     AT_LOCKCLASS_DELSEG     ((long)3)
+// BTree page locks
+#define     AT_LOCKCLASS_BTREEPAGE  ((long)4)
+// Template cache lock
+#define     AT_LOCKCLASS_TEMPLATE   ((long)5)
+// Number of lock classes
+#define     AT_LOCKCLASSES          ((long)6)
+
+// Lock backoff policies (see ATSetLockPolicy)
+// Spin with a growing backoff, yielding once the backoff tops out, but never sleep- for locks that are only ever held briefly
+#define     AT_LOCKPOLICY_SPIN      ((long)0)
+// Spin with a growing backoff for a few tries, then sleep (park) on the lock
+#define     AT_LOCKPOLICY_SPINPARK  ((long)1)
+// Sleep on the lock at once- for locks held across long operations
+#define     AT_LOCKPOLICY_PARK      ((long)2)
+
+// Default number of entries a free list moves to a neighbor at a time (see ATNLFreeList::Create)
+#define     AT_NLFL_BALANCE         ((long)32)
+// A free list forwards to its neighbor once its private list grows past this many balance sized batches
+#define     AT_NLFL_HIGHWATER       ((long)4)
+
+// Number of tries at a held lock before a waiter looks to see if the holder has died (see ATEnableOwnerRegistry)
+#define     AT_DEADOWNER_ATTEMPTS   ((long)16)
+// Number of Kilroys the owner registry can hold
+#define     AT_MAX_OWNERS           ((long)1024)
 
 struct ATCPUInformation {                                                       // A struct used to hold information on the host system
-    int             NumberProcs;                                                // Number of processors
+    int             NumberProcs;                                                // Number of processors (hardware threads)
+    int             NumberCores;                                                // Number of physical cores
+    int             ThreadsPerCore;                                             // Hardware threads (SMT siblings) per core
+    int             NumberNodes;                                                // Number of NUMA nodes
+    int             CacheLine;                                                  // Size of a cache line in bytes
+    int             CPUQuota;                                                   // CPU time our cgroup may use, in hundredths of a processor- zero if unlimited
+    int             UsableProcs;                                                // Processors we can really run on at once- our affinity, cut down to the quota
     int             CPUMHz;                                                     // Speed of the CPU(s)
     int             bogomips;                                                   // Horsepower of the CPU(s), as lame a benchmark as any other, but at least some general idea
+    long            PausePicos;                                                 // Time one spin (pause) iteration takes, in picoseconds- measured by ATInitSems
 };
 typedef struct ATCPUInformation ATCPUInfo;
 
+struct ATBigReaderSlot {                                                        // One reader slot of a big-reader sharelock
+    ATLOCK          Readers;                                                    // Readers that came in through this slot
+    char            Pad[AT_BRLOCK_SLOTSIZE - sizeof(unsigned long)];            // Keep the next slot off of our cache line
+};
+typedef struct ATBigReaderSlot ATBRSLOT;
+
+struct ATLockStatistics {                                                       // Contention counts for one class of locks
+    volatile unsigned long  Acquisitions;                                       // Number of times a lock of this class was taken
+    volatile unsigned long  FailedCAS;                                          // Number of tries that lost the race for the lock
+    volatile unsigned long  Spins;                                              // Number of spin loops made waiting on locks of this class
+    volatile unsigned long  Sleeps;                                             // Number of times a waiter slept (parked or napped)
+    volatile unsigned long  MaxWaitTicks;                                       // Longest single wait for a lock of this class, in clock ticks (see ATTicksToNanos)
+    char                    Pad[AT_BRLOCK_SLOTSIZE - (5 * sizeof(unsigned long))];// One class per cache line
+};
+typedef struct ATLockStatistics ATLockStats;
+struct ATLockStatBlock {                                                        // Layout of the lock statistics segment
+    ATLockStats     Classes[AT_LOCKCLASSES];                                    // Indexed by AT_LOCKCLASS_*
+};
+
+struct ATLockPolicy {                                                           // How waiters back off from a contended lock of one class
+    long            Mode;                                                       // One of AT_LOCKPOLICY_*
+    long            MinSpinNanos;                                               // Length of the first backoff spin, in nanoseconds- it doubles with each try
+    long            MaxSpinNanos;                                               // Longest a single backoff spin gets
+    long            ParkAttempts;                                               // For AT_LOCKPOLICY_SPINPARK, the tries made before parking
+    long            YieldAttempts;                                              // Tries made at the longest spin, yielding between, before a waiter that can't park starts napping
+    long            MaxNapMicros;                                               // Longest nap taken by a waiter that can't park, in microseconds
+};
+typedef struct ATLockPolicy ATLockPolicy;
+
+struct ATOwnerEntry {                                                           // One Kilroy in the owner registry
+    volatile unsigned long  Kilroy;                                             // The Kilroy, zero for a free entry
+    volatile long           PID;                                                // Process the Kilroy belongs to, zero while it is being filled in
+};
+typedef struct ATOwnerEntry ATOwner;
+struct ATOwnerBlock {                                                           // Layout of the owner registry segment
+    ATOwner         Owners[AT_MAX_OWNERS];
+};
+
+struct  ATNLFreeListList {                                                      // Each list should have this structure
+    volatile int64          Start;                                              // Public list anyone can push onto- the two values of the first entry, packed into 32 bits apiece
+    volatile long           Private1;                                           // First entry in my private list (first of two values)- only the owner ever touches it
+    volatile long           Private2;
+    volatile long           PrivateCount;                                       // Number of entries in my private list
+    volatile unsigned long  Taken;                                              // Number of items I have taken from the list
+    volatile unsigned long  Added;                                              // Number of items that have been added to the list
+    volatile unsigned long  InUse;                                              // True if this list is in use
+    volatile long           ForwardRequest;                                     // Set by a list that has run dry, asking the list below it to forward some entries
+    char                    Pad[AT_BRLOCK_SLOTSIZE - sizeof(int64) - (7 * sizeof(long))];// One list per cache line
+};
+typedef struct ATNLFreeListList ATNLFLL;
+
+struct ATNLFreeListInfo {
+    volatile long           AllocatedLists;                                     // Number of lists allocated
+    volatile long           NullValue;                                          // Value to use for the null value
+    volatile long           Balance;                                            // Number of entries moved to a neighbor at a time
+};
+typedef struct ATNLFreeListInfo ATNLFLI;
+
+struct ATNLFreeListChain {                                                      // Structure that defines a chain for the class- every item on a free list needs one
+    volatile long           Value1;                                             // User defined & used value- the class only passes it, and doesn't care what is in it
+    volatile long           Value2;                                             // User defined & used value- the class only passes it, and doesn't care what is in it
+};
+typedef struct ATNLFreeListChain ATNLFLC;
+
+typedef volatile ATNLFLC *(*ATNLFLNEXT)(                                        // Function that takes the 2 user specified longs and returns a pointer to that item's chain
+                    void            *Context,                                   // The context pointer the caller gave Create()/Open()
+                    long            Value1,                                     // First value of the item
+                    long            Value2                                      // Second value of the item
+                    );
+
 
 // ****************************************************************************
 // ****************************************************************************
@@ -81,6 +204,13 @@ public:
 // ****************************************************************************
 /*  Spinlocks are simple, fast, exclusive locks.  If you need mixed read/write
 locks, see the sharelocks below.
+A contended ATGetSpinLock spins for a short while, and then parks in the kernel on the lock word
+(a futex under Linux) until the holder frees it- how long it spins is set by the lock class's
+backoff policy (see ATSetLockPolicy).  While parked, the AT_LOCK_WAITERS bit is or'd into
+the lock, so don't compare a held lock against your Kilroy directly- ATFreeSpinLock handles it.
+ATInitSems() also looks the box over- cores, SMT siblings, NUMA nodes and cache line size from
+sysfs, plus any CPU quota on our cgroup- and keeps the processors we can really run on at once as
+UsableProcs, which the spin decisions and default backoff policies go by.
 DON'T FORGET TO CALL ATInitSems().
 */
 // **************************************************************************** ATInitSems
@@ -93,6 +223,7 @@ int ATGetSpinLock(
                                                                                 // These are process local locks, UNLESS they are located in shared memory
                     unsigned long   Kilroy,                                     // Unique, non-zero ID, such a the Proc ID and ThreadID rolled into one, etc.
                                                                                 // Can't figure out a reasonable way to auto-gen this under Linux.  Too many possibilities for thread libraries, etc.
+                                                                                // The AT_LOCK_WAITERS bit (bit 27) is reserved for the lock itself- a Kilroy with it set is refused with ATERR_BAD_PARAMETERS
                     ATLOCK          *ALock                                      // Ptr to the lock (any 32bit sized piece of memory initialized to zero will do just fine, shared memory if you want a global lock)
                     );
 // **************************************************************************** ATBounceSpinLock
@@ -100,6 +231,7 @@ int ATBounceSpinLock(
                                                                                 // These are process local locks, UNLESS they are located in shared memory
                     unsigned long   Kilroy,                                     // Unique, non-zero ID, such a the Proc ID and ThreadID rolled into one, etc.
                                                                                 // Can't figure out a reasonable way to auto-gen this under Linux.  Too many possibilities for thread libraries, etc.
+                                                                                // The AT_LOCK_WAITERS bit (bit 27) is reserved for the lock itself- a Kilroy with it set is refused with ATERR_BAD_PARAMETERS
                     ATLOCK          *ALock                                      // Ptr to the lock (any 32bit sized piece of memory initialized to zero will do just fine, shared memory if you want a global lock)
                     );
 // **************************************************************************** ATFreeSpinLock
@@ -121,6 +253,8 @@ int ATSpinLockArbitrate(
 // ****************************************************************************
 /* Sharelocks can have any number of readers (sharers), but only one writer (exclusive).
 Very useful for shared data structures.  More overhead, but increased parallelism.
+Blocked callers park on the lock word just like spinlocks do, so the reader count is limited to
+AT_SHARE_COUNT, and the AT_LOCK_WAITERS bit may show up in a lock that has sleepers.
 DON'T FORGET TO CALL ATInitSems().
 */
 // **************************************************************************** ATBounceShare
@@ -166,6 +300,288 @@ int ATFreeShareExclusive(
                     ATLOCK          *ALock                                      // The lock to free
                     );
 
+
+// ****************************************************************************
+// ****************************************************************************
+//                         BIG-READER SHARELOCKS
+// ****************************************************************************
+// ****************************************************************************
+/*  A big-reader sharelock is an ordinary sharelock plus an array of AT_BRLOCK_SLOTS reader slots,
+each on its own cache line.  Readers count themselves in the slot for the CPU they are running on
+instead of in the lock word, so a read-mostly lock that every caller passes through (a BTree root,
+the template cache) stops bouncing one cache line between all the CPUs.  Writers pay for it: they
+flag the lock word exactly like a normal sharelock exclusive, and then wait for every slot to drain.
+Use these for locks that are read constantly and written rarely- for anything else the plain
+sharelock is cheaper.
+    - The lock word and the slots must both be zeroed (or use ATInitBRLock) before first use.
+    - A share taken with ATGetBRShare/ATBounceBRShare MUST be freed with ATFreeBRShare.  The plain
+      sharelock share calls still work on the lock word, and writers wait them out too.
+    - Writers use ATGetBRShareExclusive, or ATQueueShareExclusive followed by ATWaitQueueBRShareExclusive.
+      ATRemoveQueueShareExclusive and ATFreeShareExclusive are used as-is on the lock word.
+DON'T FORGET TO CALL ATInitSems().
+*/
+// **************************************************************************** ATInitBRLock
+int ATInitBRLock(                                                               // Zero out a big-reader sharelock and its slots
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    );
+// **************************************************************************** ATBounceBRShare
+int ATBounceBRShare(                                                            // Try to get a big-reader share, return immediately if failed
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    );
+// **************************************************************************** ATGetBRShare
+int ATGetBRShare(                                                               // Get a big-reader share, don't return until you get it
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    );
+// **************************************************************************** ATFreeBRShare
+int ATFreeBRShare(                                                              // Frees a big-reader share
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    );
+// **************************************************************************** ATGetBRShareExclusive
+int ATGetBRShareExclusive(                                                      // Gets a big-reader sharelock in exclusive mode, blocks until all readers in the word AND the slots are out
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    );
+// **************************************************************************** ATWaitQueueBRShareExclusive
+int ATWaitQueueBRShareExclusive(                                                // After a successful ATQueueShareExclusive on the lock word, wait for the readers in the word AND the slots to leave
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    );
+
+
+// ****************************************************************************
+// ****************************************************************************
+//                               TICKET LOCKS
+// ****************************************************************************
+// ****************************************************************************
+/*  Ticket locks are fair exclusive locks- callers get the lock in the order they asked for it,
+so a hot lock can't starve anyone.  They fit in a single ATLOCK (the high 16 bits hand out tickets,
+the low 16 bits hold the ticket being served), so just like spinlocks they work across processes
+when they live in shared memory, and a zeroed lock is a free lock.  They do NOT track a Kilroy and
+they never park in the kernel- waiters back off in proportion to their place in line- so keep the
+holds short.  Never mix these calls with the spinlock calls on the same lock.
+DON'T FORGET TO CALL ATInitSems().
+*/
+// **************************************************************************** ATGetTicketLock
+int ATGetTicketLock(                                                            // Take a ticket and don't return until it is served
+                    ATLOCK          *ALock                                      // Ptr to the lock (any 32bit sized piece of memory initialized to zero, shared memory if you want a global lock)
+                    );
+// **************************************************************************** ATBounceTicketLock
+int ATBounceTicketLock(                                                         // Get the lock only if nobody holds it or is waiting in line, else return immediately
+                    ATLOCK          *ALock                                      // Ptr to the lock
+                    );
+// **************************************************************************** ATFreeTicketLock
+int ATFreeTicketLock(                                                           // Free up a ticket lock- MAKE SURE YOU HAVE IT FIRST!  Serves the next ticket in line.
+                    ATLOCK          *ALock                                      // Ptr to the lock
+                    );
+// ****************************************************************************
+// ****************************************************************************
+//                             LOCK STATISTICS
+// ****************************************************************************
+// ****************************************************************************
+/*  Optional contention counts, kept per lock class (AT_LOCKCLASS_*).  They are off until
+ATEnableLockStats() is called, and while off the lock calls pay a single test of a pointer.
+Once on, the spinlock, sharelock, big-reader and ticket lock "get" and "bounce" calls count
+acquisitions and lost races, and the time from the first lost race until the lock was had.  Spins
+and sleeps made while waiting are counted against the same class.
+A lock call counts against the class set by the last ATSetLockClass() call on the same thread, and
+the tag is used up by that lock call, so anything untagged lands in AT_LOCKCLASS_OTHER.
+With a key, the counts live in a SysV segment (an ATLockStatBlock) that every process enabling with
+the same key shares, so outside tools can attach to it and read them.  As with the other Atlas
+shared memory, the process that created the segment removes it when it disables the stats.  A
+disable detaches the segment, so don't make the call while other threads of the process are locking.
+*/
+// **************************************************************************** ATEnableLockStats
+int ATEnableLockStats(                                                          // Start keeping lock contention statistics
+                    int             Key                                         // IPC key of the shared statistics segment (created or attached), zero to keep them for this process only
+                    );
+// **************************************************************************** ATDisableLockStats
+int ATDisableLockStats();                                                       // Stop keeping lock contention statistics, detaching from (or removing, if we created it) the segment
+// **************************************************************************** ATSetLockClass
+void ATSetLockClass(                                                            // Tag the calling thread's next lock acquisition with a lock class
+                    long            Class                                       // One of AT_LOCKCLASS_*
+                    );
+// **************************************************************************** ATGetLockStats
+int ATGetLockStats(                                                             // Copy out the current statistics for a lock class
+                    long            Class,                                      // One of AT_LOCKCLASS_*
+                    ATLockStats     *Stats                                      // Where to copy them
+                    );
+// **************************************************************************** ATResetLockStats
+int ATResetLockStats();                                                         // Zero all the lock statistics
+
+
+// ****************************************************************************
+// ****************************************************************************
+//                            LOCK BACKOFF POLICIES
+// ****************************************************************************
+// ****************************************************************************
+/*  How a waiter backs off from a contended lock is set per lock class (AT_LOCKCLASS_*), going by the
+class the lock call was tagged with through ATSetLockClass.  A waiter spins for MinSpinNanos, doubling
+each try up to MaxSpinNanos, each spin shortened by a random amount of up to half so that waiters
+woken together don't all come back at once.  ATInitSems times a spin iteration, so the times hold on
+any CPU.  What happens after that depends on the mode:
+    AT_LOCKPOLICY_SPIN      keeps spinning at the longest spin, yielding the CPU between tries
+    AT_LOCKPOLICY_SPINPARK  sleeps on the lock word after ParkAttempts tries
+    AT_LOCKPOLICY_PARK      sleeps on the lock word at once
+Some waits can't sleep on the lock word (a CAS that keeps losing, a caller's own retry loop through
+ATSpinLockArbitrate), so once their spin tops out they yield for YieldAttempts tries and then nap,
+doubling from 10 microseconds up to MaxNapMicros.  On a single processor a spin can't help, so
+the spins become yields there.
+The policies are kept per process, and may be changed at any time.
+*/
+// **************************************************************************** ATSetLockPolicy
+int ATSetLockPolicy(                                                            // Set the backoff policy for a lock class
+                    long            Class,                                      // One of AT_LOCKCLASS_*
+                    ATLockPolicy    *Policy                                     // The policy to use
+                    );
+// **************************************************************************** ATGetLockPolicy
+int ATGetLockPolicy(                                                            // Copy out the backoff policy for a lock class
+                    long            Class,                                      // One of AT_LOCKCLASS_*
+                    ATLockPolicy    *Policy                                     // Where to copy it
+                    );
+
+
+// ****************************************************************************
+// ****************************************************************************
+//                            DEAD OWNER RECOVERY
+// ****************************************************************************
+// ****************************************************************************
+/*  A process that dies holding a lock would otherwise leave everyone after it waiting forever.  With
+the owner registry on, each Kilroy is registered along with the process it belongs to, and a waiter
+that has made AT_DEADOWNER_ATTEMPTS tries at a lock checks whether the holder's process is still
+alive.  If it is gone, the waiter takes the lock over (a spinlock) or strips the exclusive off of it
+(a sharelock), and goes on as if the holder had freed it.
+Spinlocks carry the holder's Kilroy, so ATGetSpinLock does this on its own, and callers spinning on
+ATBounceSpinLock (or a tuple lock) can call ATReclaimSpinLock from their retry loop.  Sharelocks
+carry no Kilroy, so the holder of an exclusive must keep its Kilroy in an owner cell next to the
+lock, set after it gets the exclusive and cleared BEFORE it frees it.  Tag the next wait with the
+cell with ATSetLockOwner, or call ATReclaimShareExclusive from a retry loop.
+Only the Kilroys registered are ever reclaimed from, and only once their process is gone- a thread
+that dies in a live process is not detected.  Shares held by a dead reader can't be traced to it,
+and ticket locks carry no owner, so neither is recovered.  A reclaimed lock guards whatever the dead
+holder left half done, so use it for locks whose data can stand that, or check it after.
+*/
+// **************************************************************************** ATEnableOwnerRegistry
+int ATEnableOwnerRegistry(                                                      // Start the owner registry, so waiters can recover locks from dead processes
+                    int             Key                                         // IPC key of the shared registry segment (created or attached), zero to keep it for this process only
+                    );
+// **************************************************************************** ATDisableOwnerRegistry
+int ATDisableOwnerRegistry();                                                   // Stop using the owner registry, detaching from (or removing, if we created it) the segment
+// **************************************************************************** ATRegisterKilroy
+int ATRegisterKilroy(                                                           // Register a Kilroy as belonging to the calling process
+                    unsigned long   Kilroy                                      // The Kilroy the caller's locks will carry- non-zero, with the AT_LOCK_WAITERS bit clear
+                    );
+// **************************************************************************** ATUnregisterKilroy
+int ATUnregisterKilroy(                                                         // Drop a Kilroy from the registry- free its locks first
+                    unsigned long   Kilroy                                      // The Kilroy to drop
+                    );
+// **************************************************************************** ATIsKilroyDead
+int ATIsKilroyDead(                                                             // Returns true if the Kilroy is registered to a process that no longer exists
+                    unsigned long   Kilroy                                      // The Kilroy to look up
+                    );
+// **************************************************************************** ATReclaimSpinLock
+int ATReclaimSpinLock(                                                          // Take a spinlock over from a dead holder- ATERR_SUCCESS means the caller now holds it
+                    unsigned long   Kilroy,                                     // The caller's Kilroy, put in the lock if we take it
+                    ATLOCK          *ALock,                                     // Lock to take over
+                    long            Attempts                                    // Number of tries the caller has made at the lock- nothing is done before AT_DEADOWNER_ATTEMPTS
+                    );
+// **************************************************************************** ATReclaimShareExclusive
+int ATReclaimShareExclusive(                                                    // Strip a dead holder's exclusive off of a sharelock- ATERR_SUCCESS means it is gone, and the caller should try for the lock again
+                    ATLOCK          *ALock,                                     // The sharelock
+                    volatile unsigned long *Owner,                              // The lock's owner cell
+                    long            Attempts                                    // Number of tries the caller has made at the lock- nothing is done before AT_DEADOWNER_ATTEMPTS
+                    );
+// **************************************************************************** ATSetLockOwner
+void ATSetLockOwner(                                                            // Give the calling thread's next blocking sharelock call the lock's owner cell, so it can recover a dead exclusive
+                    volatile unsigned long *Owner                               // The lock's owner cell
+                    );
+
+
+// ****************************************************************************
+// ****************************************************************************
+//                           NO LOCKING FREE LISTS
+// ****************************************************************************
+// ****************************************************************************
+/*  A free list of items named by two longs (a block & tuple, say), split into one list per owner.
+Each thread or process that opens the free list owns a list of its own, and frees & allocs go
+to & from its private chain, which only the owner ever touches- so the common case is zero locking
+and zero shared cache lines.  The balancing is done with two thresholds:
+- When a private chain grows past AT_NLFL_HIGHWATER batches of Balance entries, the owner forwards a
+  batch onto the public list of its neighbor (the next list up that is in use).
+- When an owner runs dry, it takes its own public list whole, and failing that it raises its
+  ForwardRequest flag (so the list below it sends a batch the next time it frees) and takes the
+  public list of anyone else that has something.
+Public lists are only ever pushed onto or taken whole, so a single 64bit CAS makes them safe with no
+ABA worries.  That also means both values must fit in 32 bits (signed).  Closing a list puts its
+private chain up on its public list, where it is there for the taking.
+Each item links to the next through an ATNLFLC kept in the item, which the caller's ATNLFLNEXT
+function finds for the class.  The lists & info block live wherever the caller puts them (shared
+memory for use across processes), and the lists must be 8 byte aligned.
+Like the tables, each thread should have its own ATNLFreeList object.
+*/
+// **************************************************************************** ATNLFreeList
+class   ATNLFreeList {                                                          // No locking free list class
+private:
+    volatile ATNLFLL *Lists;                                                    // Ptr to the base of the lists in memory
+    volatile ATNLFLI *Info;                                                     // Ptr to the base of the free list info in memory
+    long            MyList;                                                     // My list handle
+    long            NumberLists;                                                // The number of lists being tracked
+    long            Null;                                                       // My locally cached NULL value
+    long            Balance;                                                    // My locally cached balance batch size
+    long            MyNeighbor;                                                 // Cached value of my neighbor
+    ATNLFLNEXT      GetNext;                                                    // Function to get our next list location from stored values
+    void            *Context;                                                   // Passed back to GetNext
+
+    void            Reset();
+    int             DetermineNextNeighbor();                                    // Finds the nearest occupied neighbor above you- the one you will write to
+    int             ServeNeighbor();                                            // Forward a batch if my neighbor has asked for one and I can spare it- returns true if I did
+    void            PushChain(                                                  // Push a chain of entries onto a list's public list
+                            long        List,                                   // List to push onto
+                            long        First1,                                 // First entry of the chain
+                            long        First2,
+                            long        Last1,                                  // Last entry of the chain
+                            long        Last2
+                            );
+    int             TakeChain(                                                  // Take a list's public list whole, as my private chain (WHICH MUST BE EMPTY)- returns true if it got anything
+                            long        List                                    // List to take from
+                            );
+    void            Forward(                                                    // Move entries off of my private chain to my neighbor
+                            long        Count                                   // Number of entries to move
+                            );
+public:
+    ATNLFreeList();
+    ~ATNLFreeList();
+    int             Create(                                                     // Call to create the freelist, and open the first list for the caller (OUTSIDE ATOMICITY ASSUMED- ONLY CALL ONCE)
+                            int         inLists,                                // Number of lists to maintain- one per concurrent owner
+                            char        *inListsMemory,                         // A chunk of global memory, (inLists * sizeof(ATNLFLL)) in size & 8 byte aligned, for the class to use
+                            ATNLFLI     *inInfo,                                // Ptr to a global section of memory that has the info struct allocated
+                            ATNLFLNEXT  inNext,                                 // Function that takes the 2 user specified longs and returns a pointer to the item's chain
+                                                                                // Should look something like: volatile ATNLFLC *NextPtr(void *Context, long V1, long V2);
+                            void        *inContext,                             // Passed back to inNext, untouched
+                            long        inNull,                                 // Value1 to use for NULL- never a real item
+                            long        inBalance                               // Entries moved to a neighbor at a time, zero for AT_NLFL_BALANCE
+                            );
+    int             Open(                                                       // Call to open an initialized free list, claiming a list of my own
+                            char        *inListsMemory,                         // The same chunk of global memory given to Create()
+                            ATNLFLI     *inInfo,                                // Ptr to a global section of memory that has the info struct allocated
+                            ATNLFLNEXT  inNext,                                 // Function that takes the 2 user specified longs and returns a pointer to the item's chain
+                            void        *inContext                              // Passed back to inNext, untouched
+                            );
+    int             Close();                                                    // Call to detach from the freelist- anything on my private chain is left up for the others
+    int             AddToList(                                                  // Call to add 2 values to the list
+                            long        Value1,                                 // First value to add
+                            long        Value2
+                            );
+    int             TakeFromList(                                               // Returns the next item on caller's list, if anything- ATERR_NOT_FOUND if every list is empty
+                            long        *Value1,                                // Ptr to return first value
+                            long        *Value2                                 // Ptr to return next value
+                            );
+};
+
+
 // ****************************************************************************
 // ****************************************************************************
 //                              ATOMIC PRIMITIVES
@@ -186,6 +602,22 @@ static inline unsigned long ATCompareAndExchange(
     if ( Orig == Old )  return ATERR_SUCCESS;
     else                return ATERR_OBJECT_IN_USE;
 }
+// **************************************************************************** ATCompareAndExchange64
+static inline unsigned long ATCompareAndExchange64(                             // Atomic compare and exchange for IA compatibles, 64bit.  Compare OLD with CELL, and if identical, store NEW in CELL.
+                                                                                // CELL must be 8 byte aligned, or the locked op will split across cache lines.
+                                volatile int64 *Cell,                           // Ptr to mem location where the op will be performed
+                                int64 Old,                                      // Original value (what the caller sees now)
+                                int64 New                                       // New value (what the caller wants to be there)
+                                ) {
+    unsigned int OldLow = (unsigned int)Old, OldHigh = (unsigned int)(Old >> 32);
+    unsigned int OrigLow = OldLow, OrigHigh = OldHigh;
+    __asm__ __volatile__(   "lock ; cmpxchg8b %0"                               // Same op on IA-32 and x86-64, so the halves go in explicitly
+                            : "+m"(*Cell), "+a"(OrigLow), "+d"(OrigHigh)
+                            : "b"((unsigned int)New), "c"((unsigned int)(New >> 32))
+                            : "memory");
+    if ( OrigLow == OldLow && OrigHigh == OldHigh ) return ATERR_SUCCESS;
+    else                                            return ATERR_OBJECT_IN_USE;
+}
 // **************************************************************************** ATAtomicAdd
 static __inline__ void ATAtomicAdd(                                             // Atomically add 32bit int to variable
                                 long Value,                                     // Value to add to variable
@@ -220,12 +652,34 @@ static __inline__ void ATAtomicDec(
                             :"=m" (*Variable)
                             :"m" (*Variable));
 }
+// **************************************************************************** ATAtomicExchange
+static __inline__ unsigned long ATAtomicExchange(                               // Atomically swap a value into a lock sized cell- returns the previous contents
+                                volatile unsigned long *Cell,                   // Ptr to mem location where the op will be performed
+                                unsigned long Value                             // Value to store
+                                ) {
+    __asm__ __volatile__(   "xchg %0,%1"                                        // xchg with memory is always locked
+                            : "=r"(Value), "=m"(*Cell)
+                            : "0"(Value), "m"(*Cell)
+                            : "memory");
+    return Value;
+}
+// **************************************************************************** ATAtomicExchangeAdd
+static __inline__ unsigned long ATAtomicExchangeAdd(                            // Atomically add to a lock sized cell- returns the contents BEFORE the add
+                                volatile unsigned long *Cell,                   // Ptr to mem location where the op will be performed
+                                unsigned long Value                             // Value to add (use a negative cast to subtract)
+                                ) {
+    __asm__ __volatile__(   "lock ; xadd %0,%1"
+                            : "=r"(Value), "=m"(*Cell)
+                            : "0"(Value), "m"(*Cell)
+                            : "memory");
+    return Value;
+}
 // **************************************************************************** ATGetCPUTicks
-static __inline__ int64 ATGetCPUTicks() {                                       // Returns the 64bit value of the current CPU ticks
-    int64 Result;
-    __asm__ __volatile__(  ".byte 0x0f, 0x31"
-                        : "=A" (Result));
-    return Result;
+static __inline__ int64 ATGetCPUTicks() {                                       // Returns the 64bit value of the current CPU ticks- for timing, see ATGetTicks (timing.h)
+    unsigned int Low, High;
+    __asm__ __volatile__(  "rdtsc"                                              // Halves named explicitly- "=A" means only rax on x86-64, and rdx is lost
+                        : "=a" (Low), "=d" (High));
+    return ((int64)High << 32) | Low;
 }
 
 #endif
@@ -40,7 +40,7 @@ public:
                             );
     ~ATLog();
     void            Write(  	                                                // Write a string to the log file
-                        char *Format,                                           // Format of string, printf style flags standard
+                        const char *Format,                                     // Format of string, printf style flags standard
                         ...                                                     // Variable # of following arguments
                         );
     void            Flush();                                                    // Flush log to disk
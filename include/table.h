@@ -39,6 +39,8 @@ struct ATTableAllocHeaderGlobal {
     ATLOCK          ALock;                                                      // The lock for this header
     volatile long   SHMID;                                                      // The shared memory ID for this block
     volatile long   NextSHMID;                                                  // The shared memory ID for the NEXT block in the chain
+    volatile long   Epoch;                                                      // Table epoch this block's tuple locks were last good for (see FreshenBlock)
+    volatile long   HighWater;                                                  // One past the highest tuple ever handed out of this block- scans stop here
 };
 typedef struct ATTableAllocHeaderGlobal ATTBAHG;
 struct ATTableInformation {
@@ -53,9 +55,18 @@ struct ATTableInformation {
     volatile long   InstanceCount;                                              // Number of open instances to table
     volatile long   NumDelLists;                                                // Number of segments used for delete lists
     volatile long   NumAddLists;                                                // Number of segments used for add lists
+    volatile long   Options;                                                    // The AT_TABLE_* creation options the table was made with
+    volatile long   PadSize;                                                    // Bytes each list & block lock is padded out to (AT_TABLE_PAD_LOCKS), zero if they are packed
+    volatile long   ArenaFirst;                                                 // Arena offset of the first growth block (AT_TABLE_ARENA), zero if the blocks are apart
+    volatile long   ArenaShift;                                                 // Each growth block after that is this power of two bytes further along
+    volatile long   Epoch;                                                      // Bumped each time a persistent table is restarted- any tuple lock from before is stale
+    volatile long   DirectorySize;                                              // Entries in the block directory that follows the delete lists, zero for none (see AttachBlock)
+    volatile long   AheadTuples;                                                // Make the next block once a tuple this close to the end of the last one is handed out, zero for never (see PrepareBlock)
+    volatile long   SpareBlock;                                                 // Number of the block made ahead of need but not yet part of the table, zero for none
 };
 typedef struct ATTableInformation       ATTableInfo;
 typedef struct ATTableListSegments      ATTListSegs;
+typedef struct ATTableDeleteList        ATTDelList;
 
 // The maximum number of BTrees allowed per table- if you need more, simply make this higher & recompile all
 #define     AT_MAX_BTREES               (20)
@@ -63,6 +74,107 @@ typedef struct ATTableListSegments      ATTListSegs;
 #define     AT_BTREE_PRIMARY            (1)
 #define     AT_BTREE_SECONDARY          (2)
 
+// Table creation options (see SetCreateOptions)- or them together
+// Use fair ticket locks for the block header and add segment locks, instead of spinlocks
+#define     AT_TABLE_FAIR_LOCKS         (0x00000001)
+// Give each add segment, delete list and block header lock a cache line of its own- costs a line per list,
+// but procs working different lists stop fighting over the same line
+#define     AT_TABLE_PAD_LOCKS          (0x00000002)
+// Keep the tuple control blocks (lock & status) in a dense array of their own, apart from the tuple data- scans
+// & tuple locks then walk the control blocks without dragging the data lines along
+#define     AT_TABLE_SPLIT_CBS          (0x00000004)
+// Put the table's blocks in POSIX shared memory instead of SysV (see ATSharedMem::SetBackend)- no shmmax to raise
+#define     AT_TABLE_POSIX_SHM          (0x00000008)
+// Back the table's blocks with huge pages if the system has any to give (see ATSharedMem::SetBackend)
+#define     AT_TABLE_HUGE_PAGES         (0x00000010)
+// Lay the blocks end to end in one POSIX arena, mapped at the same address in every process (see ATSharedMem::CreateArena)-
+// finding a tuple is then a shift & add, and nobody attaches anything when the table grows.  Implies AT_TABLE_POSIX_SHM.
+#define     AT_TABLE_ARENA              (0x00000020)
+// Keep the arena in a file (see SetTableFile)- the table outlives every process, Checkpoint() saves it, and
+// OpenTableFile() picks it back up after a restart without reading it all in.  Implies AT_TABLE_ARENA.
+#define     AT_TABLE_PERSISTENT         (0x00000040)
+// Every option there is
+#define     AT_TABLE_ALL_OPTIONS        (AT_TABLE_FAIR_LOCKS | AT_TABLE_PAD_LOCKS | AT_TABLE_SPLIT_CBS | \
+                                         AT_TABLE_POSIX_SHM | AT_TABLE_HUGE_PAGES | AT_TABLE_ARENA | \
+                                         AT_TABLE_PERSISTENT)
+// Address space an arena table reserves unless told otherwise (see SetArenaReserve)- it can never grow past it
+#define     AT_TABLE_ARENA_RESERVE      ((long)1 << 30)
+
+// List counts CreateTable picks when passed zero- so many per processor we can run on, but no fewer than the minimum
+#define     AT_TABLE_DELLISTS_PER_PROC  (4)
+#define     AT_TABLE_DELLISTS_MIN       (20)
+#define     AT_TABLE_ADDLISTS_PER_PROC  (1)
+#define     AT_TABLE_ADDLISTS_MIN       (5)
+// Most lists CreateTable will pick on its own
+#define     AT_TABLE_LISTS_MAX          (256)
+// Growth blocks whose SysV segment IDs the first block keeps, so an opener can attach any of them straight off-
+// blocks past this are looked up by key
+#define     AT_TABLE_DIRECTORY_SIZE     (4096)
+// Most threads PreAttachBlocks(), ImportMappedTable() or ScanTable() will use
+#define     AT_TABLE_THREADS_MAX        (32)
+// Unless told otherwise (see SetAllocateAhead), the next block is made once the last one is handing out tuples
+// from its final 1/AT_TABLE_AHEAD_SHARE
+#define     AT_TABLE_AHEAD_SHARE        (8)
+// Tuples AddTuples() takes & indexes at a time
+#define     AT_TABLE_BULK_BATCH         (4096)
+// Records ImportMappedTable() takes, copies & indexes at a time
+#define     AT_TABLE_IMPORT_CHUNK       (262144)
+// Tuples ahead of the one being checked whose control blocks ScanBlock() prefetches
+#define     AT_TABLE_SCAN_AHEAD         (64)
+// Bits in each word of a ScanBlock() validity bitmap
+#define     AT_TABLE_SCAN_BITS          ((long)(sizeof(unsigned long) * 8))
+// Field types a SelectTuples() term can compare- a long, or an ATCurrency (a long long- see arithmetic.h)
+#define     AT_SCAN_LONG                (1)
+#define     AT_SCAN_CURRENCY            (2)
+// Comparisons a SelectTuples() term can make- the test is (field OP value)
+#define     AT_SCAN_EQ                  (1)
+#define     AT_SCAN_NE                  (2)
+#define     AT_SCAN_LT                  (3)
+#define     AT_SCAN_LE                  (4)
+#define     AT_SCAN_GT                  (5)
+#define     AT_SCAN_GE                  (6)
+
+struct ATTableScanTerm {                                                        // One comparison in a SelectTuples() predicate- a tuple has to pass them all
+    long            Offset;                                                     // Where the field starts in the tuple, in bytes
+    long            Type;                                                       // AT_SCAN_LONG or AT_SCAN_CURRENCY
+    long            Op;                                                         // AT_SCAN_EQ, AT_SCAN_LT, etc.
+    int64           Value;                                                      // Value to compare the field with- a currency in its raw form (see ATLongToCurrency)
+};
+typedef struct ATTableScanTerm          ATScanTerm;
+struct ATTableScanField {                                                       // One field SelectTuples() copies out of each tuple that passes
+    long            Offset;                                                     // Where the field starts in the tuple, in bytes
+    long            Length;                                                     // Bytes in the field
+};
+typedef struct ATTableScanField         ATScanField;
+
+typedef int (*ATSCANFILTER)(                                                    // Function ScanTable() asks whether a live tuple should be accumulated- returns true if so
+                    void            *Context,                                   // The context pointer the caller gave ScanTable()
+                    long            Worker,                                     // Which worker is asking, zero based
+                    ATTuple         *Tuple                                      // The tuple
+                    );
+typedef void (*ATSCANACCUMULATE)(                                               // Function ScanTable() folds each tuple that passed the filter into a worker's own accumulator with
+                    void            *Context,                                   // The context pointer the caller gave ScanTable()
+                    long            Worker,                                     // Which worker is calling, zero based- the same one each time for this accumulator
+                    ATTuple         *Tuple,                                     // The tuple
+                    void            *Accum                                      // The worker's accumulator
+                    );
+typedef void (*ATSCANMERGE)(                                                    // Function ScanTable() folds one worker's accumulator into the result with, on the calling thread once the workers are all done
+                    void            *Context,                                   // The context pointer the caller gave ScanTable()
+                    long            Worker,                                     // Which worker's accumulator it is, zero based
+                    void            *Into,                                      // The result
+                    void            *From                                       // The worker's accumulator
+                    );
+
+struct ATTableBlockScan {                                                       // One block of a table, as ScanBlock() hands it back
+    long            Block;                                                      // Which block this is
+    ATTuple         *Tuples;                                                    // The first tuple's data in the block
+    long            Stride;                                                     // Bytes from one tuple's data to the next
+    long            Count;                                                      // Tuples the bitmap covers- none past here has ever been handed out
+    long            Live;                                                       // Number of bits set in the bitmap
+    unsigned long   *Valid;                                                     // Bit (N % AT_TABLE_SCAN_BITS) of word (N / AT_TABLE_SCAN_BITS) is set if tuple N was live when scanned
+};
+typedef struct ATTableBlockScan         ATBlockScan;
+
 
 // ****************************************************************************
 // ****************************************************************************
@@ -94,12 +206,12 @@ private:
     long            CursorTupleNumber;                                          // My tuple position within this block
     volatile ATTBAH *CursorTBAH;                                                // Ptr to the cursor's block header
     volatile ATTableInfo *TB;                                                   // Pointer to this table info structure (located in shared memory)
-    volatile ATTListSegs *DelSegs;                                              // Pointer to the delete list segments
+    volatile ATTDelList *DelSegs;                                               // Pointer to the delete list segments
     long            NumDelLists;                                                // Locally cached number of delete lists in the table
     long            NumAddLists;                                                // Locally cached number of add lists per block
     long            LastDelSegment;                                             // Last delete segment I used (just round robins things a bit)
     long            LastAddSegment;                                             // Last add segment I used (just round robins things a bit)
-    long            MyNumberBlocks;                                             // The number of blocks that I have mapped access for- VERY IMPORTANT
+    long            MyNumberBlocks;                                             // The number of blocks that I have headers for- VERY IMPORTANT.  Not all of them need be attached yet (see GetHeaderPointer)
     volatile ATTBAH *LastTBAH;                                                  // A ptr to the last TBAH allocated
     long            NumberBTrees;                                               // The number of BTrees that are registered with us
     ATBTree         *BTrees[AT_MAX_BTREES];                                     // All BTrees that are registered with us
@@ -110,6 +222,28 @@ private:
     volatile ATTBAH **TBAHBlocks;                                               // The blocks containing individual TBAHs
     ATSharedMem     Mem;                                                        // If I created this, then it is the shared memory object for the first block.  Otherwise it is nothing.
     long            IAmCreator;                                                 // Flag to save whether or not I am the one who created the table
+    long            CreateOptions;                                              // The AT_TABLE_* options to use on the next create
+    long            FairLocks;                                                  // Locally cached flag- the segment locks are ticket locks
+    long            PadSize;                                                    // Locally cached line size the lists are padded to, zero if packed
+    long            AddStride;                                                  // Bytes from one add segment to the next
+    long            DelStride;                                                  // Bytes from one delete list to the next
+    long            SplitCBs;                                                   // Locally cached flag- the control blocks are kept apart from the tuple data
+    long            CBStride;                                                   // Bytes from one tuple control block to the next
+    long            TupleStride;                                                // Bytes from one tuple's data to the next
+    char            *ArenaBase;                                                 // Where the arena's user memory starts (the first block), NULL if the blocks are apart
+    long            ArenaFirst;                                                 // Locally cached arena offset of the first growth block
+    long            ArenaShift;                                                 // Locally cached shift from a growth block number to its arena offset
+    long            ArenaReserve;                                               // Bytes of address space the next CreateTable() reserves for an arena
+    long            AllocateAhead;                                              // Tuples from the end of a block the next CreateTable() makes the next one at, -1 to pick
+    volatile char   *ArenaCBs0;                                                 // The first block's control blocks...
+    volatile char   *ArenaTuples0;                                              // ...and tuple data
+    volatile char   *ArenaCBsN;                                                 // The first growth block's control blocks- later ones are just further along...
+    volatile char   *ArenaTuplesN;                                              // ...and tuple data
+    char            TableFile[AT_MAX_PATH];                                     // File the next CreateTable() keeps a persistent table in
+    volatile long   *Directory;                                                 // The block directory- segment ID + 1 of each growth block, zero if not known
+    long            DirectorySize;                                              // Locally cached number of entries in it
+    unsigned long   *ScanValid;                                                 // ScanBlock()'s validity bitmap...
+    long            ScanWords;                                                  // ...and the words it has room for
 
     ATTBAH          *GetNewTBAH();                                              // Routine to allocate and initialize the chain portion of a new TBAH
     void            ResetVariables();                                           // Internal routine to reset the variables
@@ -117,7 +251,33 @@ private:
                                                                                 // We do it this way to help make sure we ALWAYS use locked access- never access the list directly!
                             int         Header                                  // Header to get
                             );
-    void            SynchBlockAccess();                                         // Internal routine to synch the local process memory allocs to global memory allocs
+    void            SynchBlockAccess();                                         // Internal routine to give us headers for the blocks added since we last looked- they are attached when first touched
+    volatile ATTBAH *HeaderSlot(                                                // Internal routine to find our header for a block, attached or not
+                            long        Header                                  // Header to find- must be one we have
+                            );
+    int             AttachBlock(                                                // Internal routine to attach a growth block & set up its header
+                            volatile ATTBAH *TBAH,                              // Its header, not yet attached
+                            long        Block,                                  // Which block it is
+                            ATSharedMem *inMem                                  // Shared memory object to attach with- left free again
+                            );
+    static int      WorkerThreads(                                              // Internal routine to settle how many threads a job is spread over- from 1 to AT_TABLE_THREADS_MAX
+                            int         inThreads                               // Threads asked for, zero for one per processor we can run on
+                            );
+    static void     RunWorkers(                                                 // Internal routine to run a worker per job, one on this thread & the rest on threads of their own, and wait for them all
+                            int         inThreads,                              // Number of jobs, no more than AT_TABLE_THREADS_MAX
+                            void        *(*inWorker)(void *),                   // Thread routine to run each job
+                            void        *inJobs,                                // The jobs, one after another
+                            long        inJobSize                               // Bytes in each job
+                            );
+    static void     *PreAttachWorker(                                           // Internal thread routine for PreAttachBlocks()
+                            void        *inJob                                  // The blocks to attach
+                            );
+    static void     *ImportWorker(                                              // Internal thread routine for ImportMappedTable()
+                            void        *inJob                                  // The records to copy
+                            );
+    static void     *ScanWorker(                                                // Internal thread routine for ScanTable()
+                            void        *inJob                                  // The worker's share of the scan
+                            );
     int             FirstDeterminePointers(                                     // An internal function to make sure everyone looks for structures in the same place when a table is first created/opened
                             int         Create                                  // Set to true if calling from Create(), false if calling from Open()
                             );
@@ -125,16 +285,117 @@ private:
                             ATTuple     *Base,                                  // Ptr to the base of the block
                             ATTBAH      *TBAH                                   // Block header to initialize
                             );
+    void            SetArena();                                                 // Internal routine to cache where the blocks sit in an arena table, once the first is up
+    void            FreshenBlock(                                               // Internal routine to clear the tuple locks a block kept from before a restart- call before locking anything in a block whose epoch is behind
+                            volatile ATTBAH *TBAH                               // Block to freshen
+                            );
+    long            GrowthBlockSize(                                            // Internal routine to work out the bytes a growth block needs
+                            long        inTrueTupleSize,                        // Bytes per tuple, control block included
+                            long        inGrowthAlloc                           // Tuples per growth block
+                            );
     ATTBAH          *AddBlock();                                                // Internal call to add a block to the table- complete with header & pointers for the calling process, which it returns
                                                                                 // CALLER SHOULD HOLD ANY NEEDED LOCKS
+    int             MakeBlock(                                                  // Internal routine to create & init a growth block, ready to be linked onto the table
+                            long        inBlock,                                // Which block it will be
+                            volatile ATTBAH *TBAH                               // Header to set up for it- it stays attached
+                            );
+    void            PrepareBlock(                                               // Internal routine to make the next block ahead of need, unless someone is already at it
+                            volatile ATTBAH *EndTBAH                            // The last block in the table
+                            );
+    long            ReserveTuples(                                              // Internal routine to reserve up to inWanted tuples from one add list of the last block- returns how many it got, zero if out of space
+                                                                                // They all come back locked, in the block at CursorBlock, with the cursor on the last one
+                            long        inWanted,                               // Most tuples to reserve
+                            long        *outTuples                              // Gets the tuple numbers of the ones reserved
+                            );
+    char            *BatchLists(                                                // Internal routine to allocate the lists a bulk add works a batch at a time thru- returns the one allocation to delete[], NULL if out of memory
+                            long        inSize,                                 // Most tuples in a batch
+                            ATTuple     ***outPtrs,                             // Gets the list of tuple ptrs
+                            long        **outBlocks,                            // Gets the list of blocks
+                            long        **outTuples,                            // Gets the list of tuple numbers
+                            int         **outResults                            // Gets the list of results
+                            );
+    int             IndexBatch(                                                 // Internal routine to hand a batch of locked tuples to every index, then let them go- returns the first failure, if any
+                                                                                // Tuples an index turns away are deleted, the rest are unlocked, and the cursor is left on the last one
+                            long        inCount,                                // Tuples in the batch
+                            ATTuple     **inPtrs,                               // Ptr to each tuple
+                            long        *inBlocks,                              // Block of each tuple
+                            long        *inTuples,                              // Tuple number of each tuple
+                            int         *ioResults,                             // Result for each tuple- must come in as ATERR_SUCCESS
+                            long        *ioAdded                                // Has the number of tuples kept added to it
+                            );
+    unsigned long   *ScanBitmap(                                                // Internal routine to make sure ScanValid has room for a block's bitmap- returns it, NULL if out of memory
+                            volatile ATTBAH *TBAH                               // Block it has to hold
+                            );
+    void            FilterTerm(                                                 // Internal routine to clear the bit of every tuple in a block's bitmap that fails a SelectTuples() term
+                            volatile ATTBAH *TBAH,                              // Block the bitmap is for
+                            ATScanTerm  *inTerm,                                // Term to test
+                            long        inFirst,                                // First tuple that matters
+                            long        inCount,                                // Tuples the bitmap covers
+                            unsigned long *ioValid                              // The bitmap
+                            );
+    long            MarkLive(                                                   // Internal routine to build the validity bitmap of a block's tuples- returns how many are live
+                            volatile ATTBAH *TBAH,                              // Block to check
+                            long        inCount,                                // Tuples to check, from the first
+                            unsigned long *outValid                             // Gets a bit per tuple, set if it is live- needs room for inCount bits, rounded up to a whole word
+                            );
     ATTuple         *GetDeletedRecord();                                        // Internal call to try to reclaim deleted records- returns NULL if none found, otherwise a ptr to a reclaimed tuple
     volatile ATTupleCB *MakeCBPointer(                                          // Internal routine to return a CB pointer from a block/tuple combo
                             long        Block,                                  // Block to use
                             long        Tuple                                   // Tuple to use
                             );
+    unsigned long   MakeTupleRef(                                               // Internal routine to pack a block/tuple combo into a delete list reference
+                            long        Block,                                  // Block to use
+                            long        Tuple                                   // Tuple to use
+                            );
+    void            SplitTupleRef(                                              // Internal routine to unpack a delete list reference into a block/tuple combo
+                            unsigned long Ref,                                  // Reference to unpack (never the empty one)
+                            long        *Block,                                 // Gets the block
+                            long        *Tuple                                  // Gets the tuple
+                            );
+    void            SetPadding(                                                 // Internal routine to set up the list strides for a padded or packed layout
+                            long        inPadSize                               // Line size to pad to, zero to pack
+                            );
+    volatile ATTListSegs *AddSeg(                                               // Internal routine to find an add segment in a block
+                            volatile ATTBAH *TBAH,                              // Block the segment is in
+                            long        Seg                                     // Segment to find
+                            );
+    volatile ATTDelList *DelSeg(                                                // Internal routine to find a delete list
+                            long        Seg                                     // List to find
+                            );
+    void            SetTupleLayout(                                             // Internal routine to set up the control block & tuple strides
+                            long        inTrueTupleSize,                        // Bytes per tuple, control block included
+                            long        inSplit                                 // Set to true if the control blocks are kept apart from the data
+                            );
+    void            SetTuplePointers(                                           // Internal routine to find where the tuple data starts in a block
+                            volatile ATTBAH *TBAH,                              // Block to set up- its data ptr must already be set
+                            long        inTuples                                // Number of tuples the block holds
+                            );
+    volatile ATTupleCB *CBAt(                                                   // Internal routine to find a tuple's control block in a block
+                            volatile ATTBAH *TBAH,                              // Block the tuple is in
+                            long        Tuple                                   // Tuple to find
+                            );
+    ATTuple         *TupleAt(                                                   // Internal routine to find a tuple's data in a block
+                            volatile ATTBAH *TBAH,                              // Block the tuple is in
+                            long        Tuple                                   // Tuple to find
+                            );
     void            InitBlock(                                                  // Internal routine to init the structures in a new block
                             volatile ATTBAH  *TBAH                              // Block to init
                             );
+    int             GetSegmentLock(                                             // Internal routine to get a block header or add segment lock, whichever kind this table uses
+                            ATLOCK      *ALock,                                 // Lock to get
+                            long        inClass                                 // AT_LOCKCLASS_* the lock is counted under in the lock statistics
+                            );
+    int             BounceSegmentLock(                                          // Internal routine to try a block header or add segment lock, returning immediately if held
+                            ATLOCK      *ALock,                                 // Lock to get
+                            long        inClass                                 // AT_LOCKCLASS_* the lock is counted under in the lock statistics
+                            );
+    int             FreeSegmentLock(                                            // Internal routine to free a block header or add segment lock
+                            ATLOCK      *ALock                                  // Lock to free
+                            );
+    int             ReclaimSegmentLock(                                         // Internal routine to take a block header or add segment lock over from a dead holder
+                            ATLOCK      *ALock,                                 // Lock to take over
+                            long        inAttempts                              // Number of tries made at the lock so far
+                            );
 public:
     ATSharedTable();
     ~ATSharedTable();
@@ -142,6 +403,18 @@ public:
     // ****************************************************************************
     //                          CREATION/INITIALIZATION
     // ****************************************************************************
+    int             SetCreateOptions(                                           // Set the options used by the next CreateTable() call- CreateFromFile() always uses the options stored in the file
+                            long        inOptions                               // Any of the AT_TABLE_* flags or'd together, zero for the defaults
+                            );
+    int             SetArenaReserve(                                            // Set the address space the next CreateTable() reserves when AT_TABLE_ARENA is on
+                            long        inBytes                                 // Bytes to reserve- the table can never grow past this
+                            );
+    int             SetTableFile(                                               // Set the file the next CreateTable() keeps the table in when AT_TABLE_PERSISTENT is on
+                            char        *inPath                                 // File to keep it in- must not exist yet
+                            );
+    int             SetAllocateAhead(                                           // Set how near the end of the last block the next CreateTable()'d table makes the next one, so it is there before it is needed
+                            long        inTuples                                // Tuples from the end of the block, zero to only make blocks when one fills
+                            );
    int             CreateTable(                                                // Create a table
                             int         inKey,                                  // Systemwide unique IPC ID for this table- BECOMES A SHARED MEMORY KEY as well, so, again, it must be system wide IPC unique
                                                                                 // !!IMPORTANT!! The key that you specify here will be incremented by 1 each time a new section needs to be allocated,
@@ -150,14 +423,23 @@ public:
                             int         inInitialAlloc,                         // Number of records to alloc initially
                             int         inGrowthAlloc,                          // Chunks of records to alloc as the table grows
                             int         inSoftWrites,                           // Set to true means that changes made to the table are queued until flushed, false means always flush changes to disk
-                            int         inDelLists,                             // Number of delete lists to maintain for entire table- good default might be around 20- systems w/many procs might want even more
-                            int         inAddLists,                             // Number of add lists to maintain for each block- good default might be around 5- systems w/many procs might want even more
+                            int         inDelLists,                             // Number of delete lists to maintain for entire table- zero picks a number to suit the processors we can run on
+                            int         inAddLists,                             // Number of add lists to maintain for each block- zero picks a number to suit the processors we can run on
                             ULONG       inKilroy                                // My kilroy- a unique ID for the caller, like maybe the proc ID & the thread ID combined....
                             );
     int             OpenTable(                                                  // Open a table that already exists
                             int         inKey,                                  // Systemwide unique IPC ID for this table
                             ULONG       inKilroy                                // My kilroy- a unique ID for the caller, like maybe the proc ID & the thread ID combined....
                             );
+    int             OpenTableFile(                                              // Open a table kept in a file (AT_TABLE_PERSISTENT)
+                            char        *inPath,                                // File the table is kept in
+                            int         inRestart,                              // Set to true if nobody has it open- the first one up after a restart.  Every lock left in it goes stale.
+                            ULONG       inKilroy                                // My kilroy- a unique ID for the caller, like maybe the proc ID & the thread ID combined....
+                            );
+    int             Checkpoint();                                               // Write a persistent table's changes out to its file, returning once they are there- the CALLERS keep the table steady meanwhile
+    int             PreAttachBlocks(                                            // Attach every block now, rather than as each is first touched- for a warm start
+                            int         inThreads                               // Threads to spread the attaching over, zero for one per processor we can run on
+                            );
     int             CloseTable();                                               // Close the table- CHANGES WILL BE LOST IF NOT WRITTEN OUT!!!!
     int             ImportTable(                                                // Import a table from a disk file- this should be a binary file of fixed length records- NOT COMPATIBLE WITH INDICES!!!!!
                                                                                 // Function may be called any number of times to add more files sequentially into the table
@@ -165,6 +447,12 @@ public:
                             char        *inBuffer,                              // A buffer that may be used for file I/O
                             long        inBufferSize                            // The size of the I/O buffer provided (recommend at least 32-64k)
                             );
+    int             ImportMappedTable(                                          // Import a file of fixed length records by mapping it & copying it in with several threads- the same file ImportTable() takes
+                                                                                // Like AddTuples(), the tuples are NOT left locked, and the cursor is left wherever the last chunk ended
+                            char        *inFileName,                            // Filename to load the table from
+                            int         inThreads,                              // Threads to spread the copying over, zero for one per processor we can run on
+                            long        *outImported                            // If not NULL, gets the number of records actually added
+                            );
     int             ExportTable(                                                // Writes the table out as a binary file of fixed length records- NOT COMPATIBLE WITH INDICES!!!!!
                                                                                 // This also compresses the table- removing any empty space.  THE STATE OF THE TABLE (changing data, etc.) IS UP TO THE CALLERS.
                             char        *FileName,                              // Filename to write the table to
@@ -196,6 +484,12 @@ public:
                                                                                 // IMPORTANT: TUPLE IS ALWAYS RETURNED LOCKED- CALLER MUST FREE.  Returning them unlocked is just silly, really.  WAY too error prone.
                             void        *Tuple                                  // Ptr to the tuple to add to the table
                             );
+    int             AddTuples(                                                  // Add a run of tuples to the table- this call automatically inserts them into all associated BTrees
+                                                                                // Unlike AddTuple(), the tuples are NOT left locked, and the cursor is left wherever the last batch ended
+                            void        *inTuples,                              // Ptr to the tuples to add, one after another
+                            long        inCount,                                // Number of tuples to add
+                            long        *outAdded                               // If not NULL, gets the number actually added
+                            );
     int             DeleteTuple();                                              // Delete the tuple at the current record position- this call automatically removes the tuple from all associated BTrees
                                                                                 // WILL REFUSE TO WORK IF YOU DO NOT HAVE A LOCK ON THE TUPLE!
     ATTuple         *NextTuple();                                               // Return a ptr to the next tuple, no locking
@@ -214,6 +508,32 @@ public:
                                                                                 // In other words- do NOT expect tuples back in the order you added them.  If you MUST have that for some reason, set all your allocs to 1 at create and then never delete any tuples.
     ATTuple         *LockedPrevTuple();                                         // Return a ptr to the prev tuple- however this call ALWAYS locks the call for safety before returning, so DON'T forget to free it
                                                                                 // NOTE: This operation refers to the table as a linear list, not a chronological one.  For example, a new tuple insert that reclaims a deleted spot may NOT be at the end of the list...
+    int             ScanBlock(                                                  // Hand back a whole block at a time- where its tuples are, and which of them are live, no locking
+                                                                                // Returns ATERR_NOT_FOUND past the last block.  Like NextTuple(), a tuple seen live may change or go away at any time.  The cursor is left alone.
+                            long        inBlock,                                // Block to scan, zero based
+                            ATBlockScan *outScan                                // Gets the block- its bitmap is good until the next ScanBlock(), SelectTuples() or CloseTable()
+                            );
+    int             ScanTable(                                                  // Run the whole table through a filter & an accumulator, the blocks spread over several threads, no locking
+                                                                                // Like NextTuple(), a tuple may change or go away as it is looked at, and one added meanwhile may or may not be seen.  The cursor is left alone.
+                            int         inThreads,                              // Threads to spread the scan over, zero for one per processor we can run on
+                            ATSCANFILTER inFilter,                              // Picks the tuples to accumulate, NULL to take them all
+                            ATSCANACCUMULATE inAccumulate,                      // Folds a tuple into a worker's accumulator
+                            ATSCANMERGE inMerge,                                // Folds a worker's accumulator into the result
+                            void        *inContext,                             // Passed along to all three
+                            void        *ioAccum,                               // The result- must start out empty.  Each worker starts from a copy of it, and they all get merged back in.
+                            long        inAccumSize,                            // Bytes in an accumulator
+                            long        *outMatched                             // If not NULL, gets the number of tuples accumulated
+                            );
+    int             SelectTuples(                                               // Copy the chosen fields of each tuple that passes a predicate into a buffer, picking up after the cursor, no locking
+                                                                                // Returns ATERR_SUCCESS when the buffer fills, ATERR_NOT_FOUND once the end of the table is reached (with or without rows)- the cursor is left on the last tuple copied out
+                            ATScanTerm  *inTerms,                               // The predicate- every term has to hold
+                            long        inNumTerms,                             // Number of terms, zero to take every tuple
+                            ATScanField *inFields,                              // Fields to copy out of each tuple, in order, packed one after another- NULL for the whole tuple
+                            long        inNumFields,                            // Number of fields
+                            void        *outRows,                               // Gets the rows, one after another
+                            long        inRowSpace,                             // Bytes there is room for in outRows- at least one row
+                            long        *outRowCount                            // Gets the number of rows copied out
+                            );
 
     // ****************************************************************************
     //                          EXPERT LEVEL
@@ -221,7 +541,9 @@ public:
     // ************ Likely that the following calls are only made by the system's indexes, but they *could* be used otherwise....
     ATTuple         *AllocateTuple();                                           // Reserve a tuple in the table & return a ptr to its location- exactly like AddTuple() except it does not copy the new tuple over for the caller
                                                                                 // IMPORTANT: TUPLE IS ALWAYS RETURNED LOCKED- CALLER MUST FREE.  Returning them unlocked is just silly, really.  WAY too error prone.
-                                                                                // UNLIKE AddTuple(), this call obviously cannot add the tuple to the BTrees automatically for you
+                                                                                // UNLIKE AddTuple(), this call obviously cannot add the tuple to the BTrees automatically for you- build it in place, then call CommitTuple() to do that
+    int             CommitTuple();                                              // Insert the tuple at the cursor, reserved with AllocateTuple() & built in place, into all associated BTrees
+                                                                                // MUST STILL HOLD THE LOCK ALLOCATETUPLE() RETURNED IT WITH- it still holds it on success, and the tuple is deleted on failure
     ATTuple         *SetTuple(                                                  // Set the cursor to a given spot and return the tuple ptr- returns null if setting not valid
                             long        Block,                                  // Specific block
                             long        Tuple                                   // Specific tuple
@@ -122,6 +122,9 @@ public:
     // ****************************************************************************
     //                          USER CALLS
     // ****************************************************************************
+    int             SetCreateOptions(                                           // Set the AT_TABLE_* options for the tables (and index pages) made by the next Create() call
+                            long            inOptions                           // Any of the AT_TABLE_* flags or'd together, zero for the defaults
+                            );
     int             Create(                                                     // Call to create
                             long            inAvgPageSize,                      // Your best guess at the average page size (probably 50k - 80k)
                             long            inPagesPerBlock,                    // Number of pages to allocate for at once (probably 50 - 100)
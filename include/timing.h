@@ -0,0 +1,141 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+// ****************************************************************************
+// * timing.h - The timing code for Atlas.                                    *
+// * (c) 2002,2003 Shawn Houser, All Rights Reserved                          *
+// * This property and it's ancillary properties are completely and solely    *
+// * owned by Shawn Houser, and no part of it is a work for hire or the work  *
+// * of any other.                                                            *
+// ****************************************************************************
+// ****************************************************************************
+// *  This program is free software; you can redistribute it and/or modify    *
+// *  it under the terms of the GNU General Public License as published by    *
+// *  the Free Software Foundation, version 2 of the License.                 *
+// *                                                                          *
+// *  This program is distributed in the hope that it will be useful,         *
+// *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+// *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+// *  GNU Library General Public License for more details.                    *
+// *                                                                          *
+// *  You should have received a copy of the GNU General Public License       *
+// *  along with this program; if not, write to the Free Software             *
+// *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,   *
+// *  USA.                                                                    *
+// *                                                                          *
+// *  Other license options may possibly be arranged with the author.         *
+// ****************************************************************************
+
+
+/* ****************************************************************************
+The Atlas clock.  ATInitTiming picks the cheapest clock this box can trust, and works out once how
+fast it ticks, so ticks can be read and differenced in the hot paths and only turned into
+nanoseconds when someone looks at them:
+    AT_CLOCK_RDTSCP     the CPU's time stamp counter through rdtscp, which waits for the work ahead
+                        of it to finish, so a time never includes work that was still in flight
+    AT_CLOCK_TSC        the time stamp counter through rdtsc, for CPUs without rdtscp
+    AT_CLOCK_MONOTONIC  clock_gettime(CLOCK_MONOTONIC_RAW), where the counter's rate can't be
+                        trusted (no invariant TSC)- a tick is then a nanosecond
+The counter is only used when the CPU says it is invariant (runs at a fixed rate through
+frequency changes and sleep states), and it is calibrated against CLOCK_MONOTONIC_RAW.
+ATInitSems calls ATInitTiming, so anything that has set up the locks has the clock.
+*/
+
+// Clock sources (see ATTimingInformation::Source)
+// clock_gettime(CLOCK_MONOTONIC_RAW)- one tick per nanosecond
+#define     AT_CLOCK_MONOTONIC      ((int)0)
+// The time stamp counter through rdtsc
+#define     AT_CLOCK_TSC            ((int)1)
+// The time stamp counter through rdtscp
+#define     AT_CLOCK_RDTSCP         ((int)2)
+// How long ATInitTiming watches the counter against the system clock, in nanoseconds
+#define     AT_CLOCK_CALIBRATE      ((int64)20000000)
+
+struct ATTimingInformation {                                                    // What ATInitTiming found out about the clock
+    int             Source;                                                     // One of AT_CLOCK_*
+    int64           TicksPerSecond;                                             // Rate of the clock
+    unsigned int64  NanosPerTick;                                               // Nanoseconds per tick, fixed point with 32 bits of fraction
+    unsigned int64  TicksPerNano;                                               // Ticks per nanosecond, fixed point with 32 bits of fraction
+};
+typedef struct ATTimingInformation ATTimingInfo;
+
+extern ATTimingInfo TimingInfo;                                                 // Read by the inlines below- set up by ATInitTiming
+class ATLog;
+
+// ****************************************************************************
+//                             CLOCK ROUTINES
+// ****************************************************************************
+// **************************************************************************** ATInitTiming
+int ATInitTiming();                                                             // Pick and calibrate the clock- only the first call does anything
+// **************************************************************************** ATGetTimingInfo
+ATTimingInfo *ATGetTimingInfo();                                                // Returns ptr to the clock information
+// **************************************************************************** ATGetClockNanos
+int64 ATGetClockNanos();                                                        // Read the system's monotonic clock, in nanoseconds- slower than ATGetTicks, but always right
+// **************************************************************************** ATGetTicks
+static inline int64 ATGetTicks() {                                              // Read the Atlas clock- only differences between two reads mean anything
+    unsigned int    Low, High;
+
+    if ( TimingInfo.Source == AT_CLOCK_RDTSCP ) {
+        __asm__ __volatile__( "rdtscp" : "=a"(Low), "=d"(High) : : "ecx" );     // ecx gets the CPU number, which we don't want
+        return ((int64)High << 32) | Low;
+    }
+    if ( TimingInfo.Source == AT_CLOCK_TSC ) {
+        __asm__ __volatile__( "rdtsc" : "=a"(Low), "=d"(High) );
+        return ((int64)High << 32) | Low;
+    }
+    return ATGetClockNanos();
+}
+// **************************************************************************** ATScaleTicks
+static inline int64 ATScaleTicks(                                               // Multiply by a 32.32 fixed point rate without overflowing
+                    int64           Value,                                      // Value to scale
+                    unsigned int64  Rate                                        // Fixed point rate
+                    ) {
+    unsigned int64  Magnitude = (unsigned int64)(Value < 0 ? -Value : Value);
+    int64           Result;
+
+    Result = (int64)(((Magnitude >> 32) * Rate) + (((Magnitude & 0xFFFFFFFFULL) * Rate) >> 32));
+    return ( Value < 0 ) ? -Result : Result;
+}
+// **************************************************************************** ATTicksToNanos
+static inline int64 ATTicksToNanos(                                             // Turn a difference of clock ticks into nanoseconds
+                    int64           Ticks                                       // Ticks to convert
+                    ) {
+    return ATScaleTicks(Ticks, TimingInfo.NanosPerTick);
+}
+// **************************************************************************** ATNanosToTicks
+static inline int64 ATNanosToTicks(                                             // Turn nanoseconds into clock ticks
+                    int64           Nanos                                       // Nanoseconds to convert
+                    ) {
+    return ATScaleTicks(Nanos, TimingInfo.TicksPerNano);
+}
+
+// ****************************************************************************
+//                             ATScopedTimer
+// ****************************************************************************
+/*  Times the scope it is declared in.  When it goes out of scope, the time is added (in nanoseconds)
+to the caller's total, and if a log was given and the time reached the slow threshold, a line is
+written to the log naming the operation.
+*/
+class   ATScopedTimer {                                                         // Timer for a scope
+private:
+    int64           Start;                                                      // Clock ticks when the timer started
+    int64           *Total;                                                     // Where to add the time, NULL if nowhere
+    ATLog           *Log;                                                       // Where to report a slow time, NULL if nowhere
+    const char      *Name;                                                      // Name of what is being timed, for the log
+    int64           SlowTicks;                                                  // Times at least this long are logged
+public:
+    ATScopedTimer(                                                              // Time the scope into a total
+                            int64           *inTotal                            // Total to add the nanoseconds to, NULL if just using Elapsed()
+                            );
+    ATScopedTimer(                                                              // Time the scope, logging it if it is slow
+                            int64           *inTotal,                           // Total to add the nanoseconds to, NULL if none
+                            ATLog           *inLog,                             // Log to write slow times to
+                            const char      *inName,                            // Name of what is being timed
+                            int64           inSlowNanos                         // Times at least this long are logged
+                            );
+    ~ATScopedTimer();
+    int64           Elapsed();                                                  // Nanoseconds since the timer started
+};
+
+
+#endif
@@ -26,6 +26,7 @@
 
 #include <stdlib.h>                                                             // Standard library header we need
 #include <string.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <memory.h>
 #include <assert.h>
@@ -44,6 +45,7 @@
 
 #include "general.h"                                                            // Atlas specific headers
 #include "sem.h"
+#include "timing.h"
 #include "memory.h"
 #include "cgi.h"
 #include "support.h"
@@ -94,6 +96,11 @@ struct  ConcurrencyDemo {
     struct  ConcurrencyDemo *CD;                                                // Ptr to this record where it is stored in the table
 };
 typedef struct ConcurrencyDemo CDemo;
+struct  FreeListDemo {                                                          // The structure used for the free list test
+    ATNLFLC             Link;                                                   // The free list chain
+    volatile    ULONG   Owner;                                                  // Kilroy of whoever has this item taken, zero when it is free
+};
+typedef struct FreeListDemo FLDemo;
 
 Demo    *Users = NULL;                                                          // An often shared allocation of memory for test data
 int     CreateData(int Number, Demo *Allocated);                                // This routine creates test data for our tests
@@ -127,6 +134,7 @@ ATBTree         BTree, Email;
 ATSharedTable   Table;
 ATKernelSem     Sem;
 ATSharedMem     Mem;
+ATNLFreeList    FreeList;
 ATXTemplate     Template;
 ATSession	    Session;
 #ifdef  AT_USE_BKDB
@@ -139,6 +147,8 @@ void *MakeCustomerIDKey(void *Tuple);
 void *MakeEmailKey(void *Tuple);                                                // This is one of our test make key routines
 long StringCompare(void *P1, void *P2, long Size);                              // This is one of our test comparison routines
 void *VTMakeKey(void *inKey);
+void SumCustomerIDs(void *, long, ATTuple *Tuple, void *Accum);                 // This is our test scan accumulator
+void MergeCustomerIDs(void *, long, void *Into, void *From);                    // This is our test scan merge
 
 
 
@@ -157,6 +167,11 @@ void *VTMakeKey(void *inKey);
 #define SCRATCH_MEM_ALLOCS      500                                             // Number of allocs to attempt in the pool each reset (note the object must be large enough to allow)
 #define SCRATCH_MEM_SIZE        1024000                                         // Size of the scratch mem object to create
 #define SCRATCH_MEM_GET         1000                                            // Number of bytes for each alloc (never less than 7 bytes for this test purpose)
+#define SCRATCH_MEM_CHUNK       4096                                            // Chunk size of the small object used to test chaining & save points
+
+                                                                                // *** Timing Config
+#define TIMING_SLEEP            100000                                          // Microseconds to sleep for the timed interval
+#define TIMING_SLACK            50000000                                        // Nanoseconds a timed sleep may run over before we call the timing wrong (the scheduler takes its time waking us)
 
                                                                                 // *** SpinLocks Config
 #define SPIN_LOCK_LOOPS         10                                              // Number of reps for the spin lock tests
@@ -168,6 +183,13 @@ void *VTMakeKey(void *inKey);
 #define ATOMIC_REPS             10                                              // Number of times to repeat the atomics tests
 #define ATOMIC_OPS              2000000                                         // Number of operations to perform for each step of the tests
 
+                                                                                // *** FreeLists Config
+#define FREE_LIST_LOOPS         10                                              // Number of reps for the free list test
+#define FREE_LIST_ITEMS         1000                                            // Number of items to put on the free list
+#define FREE_LIST_LISTS         4                                               // Number of lists (owners) the free list allows
+#define FREE_LIST_TAKE          600                                             // Number of items each process takes per rep- more than half, so the processes have to fight for them
+#define FREE_LIST_BALANCE       16                                              // Entries moved to a neighbor at a time
+
                                                                                 // *** Tables Config
 #define TABLE_FASTLOOSE                                                         // Leave defined for fast/loose operation in the table test, or comment out see more laid back approach
 #define TABLE_CONCURRENCY_RUN   1500000                                         // Number of reps to make on the table concurrency test
@@ -175,6 +197,7 @@ void *VTMakeKey(void *inKey);
 #define TABLE_CONCURRENCY_DATA  25                                              // Size of the table to create (per process) for the concurrency test
                                                                                 // Note we should use a fairly small number for this test to ensure there is LOTS of contention
 #define TABLE_IPC               (787129 + BTINC)                                // A unique IPC for the tables test
+#define TABLE_FILE              "../testdata/testtable.arena"                   // Where the persistent table test keeps its table
 #define CTIALLOCSIZE            9                                               // Concurrency test initial alloc size
 #define CTGALLOCSIZE            11                                              // Concurrency test growth alloc size
 // NOTE: If TABLE_DATA <= (DELETETIPS * 2) there will be failures!!!
@@ -193,6 +216,7 @@ Demo    Dels[DELETETIPS];
 #define BTTEST2KEYSPER          50                                              // Keys per page in the second BTree test
 #define BTTEST2ALLOC            ((BTTEST2SIZE / BTTEST2KEYSPER) / 5 )           // Pages to alloc each time for the 2nd Btree test
 //#define BTTEST2ALLOC            5                                               // Pages to alloc each time for the 2nd Btree test
+#define BTBULKSIZE              5000                                            // Number of fresh tuples to bulk add in the second BTree test- more than AT_TABLE_BULK_BATCH, so it takes several batches
 #define BTTEST3SIZE             1000                                            // Number of tuples to create for the 2rd BTree test
 #define BTTEST3KEYSPER          25                                             // Keys per page in the third BTree test
 //#define BTTEST3ALLOC            ((BTTEST3SIZE / BTTEST3KEYSPER) / 7 )         // Pages to alloc each time for the 3rd Btree test
@@ -209,8 +233,8 @@ int     BTrees() {
     long    Kilroy = 1, i, Result, Adds = 0, Deletes = 0, o;
     ATTuple *Found, *CData;
     char    Scratch[64];
-    Demo    Test, *Dptr;
-    long    Interval = 0, Cumu = 0, Validate = 0;
+    Demo    Test, *Dptr, *Bulk;
+    long    Interval = 0, Cumu = 0, Validate = 0, Added, Expected;
 
     printf("Testing BTrees...\r\n");
     printf("This uses tables, so test them first!\r\n");
@@ -398,6 +422,19 @@ int     BTrees() {
     }
     printf("Passed.\r\n");
 
+    printf("Testing primary key constraint with a bulk add...\r\n");          // Same again, as one batch- every tuple must come back out
+    if ( (Result = Table.AddTuples((void*)Users, BTTEST2SIZE, &Added)) != ATERR_OBJECT_IN_USE || Added ) {
+        printf("Failed bulk primary key constraint (%i, %i added)!  Test failure!\r\n", Result, Added); return 0;}
+    printf("Passed.\r\n");
+
+    printf("Testing primary key constraint with a tuple built in place...\r\n");// Same again, built right in the table- it must come back out on commit
+    if ( !(Dptr = (Demo*)Table.AllocateTuple()) ) {
+        printf("Failed AllocateTuple!  Test failure!\r\n"); return 0;}
+    memcpy((void*)Dptr, (void*)&(Users[0]), sizeof(Demo));
+    if ( (Result = Table.CommitTuple()) != ATERR_OBJECT_IN_USE ) {
+        printf("Failed emplaced primary key constraint (%i)!  Test failure!\r\n", Result); return 0;}
+    printf("Passed.\r\n");
+
     printf("Checking primary integrity...\r\n");                                // Now make sure the above did not alter the table integrity
     for ( i = 0; i < BTTEST2SIZE; ++i ) {                                       // Run thru every record number
     Found = BTree.FindTuple((void*)&i, AT_BTREE_READ_OPTIMISTIC,AT_BTREE_FINDDIRECT, sizeof(long));
@@ -533,6 +570,47 @@ int     BTrees() {
     Email.CheckBTree();
     printf("Passed.\r\n");
 
+    printf("Bulk adding %i fresh records out of order...\r\n", BTBULKSIZE);    // Now a bulk add that has to succeed
+    if ( !(Bulk = new Demo[BTBULKSIZE]) ) {
+        printf("Out of memory!\r\nStopping test!\r\n"); return 0;}
+    for ( i = 0; i < BTBULKSIZE; ++i ) {                                        // Copies of the test data, with new IDs past the old ones, scrambled
+        memcpy((void*)&(Bulk[i]), (void*)&(Users[i % BTTEST2SIZE]), sizeof(Demo));
+        Bulk[i].CustomerID = BTTEST2SIZE + ((i * 7919) % BTBULKSIZE);           // 7919 is prime, so every ID comes up once
+    }
+    if ( (Result = Table.AddTuples((void*)Bulk, BTBULKSIZE, &Added)) != ATERR_SUCCESS || Added != BTBULKSIZE ) {
+        printf("Failed bulk add (%i, %i added)!  Test failure!\r\n", Result, Added); return 0;}
+    delete[] Bulk;
+    for ( i = BTTEST2SIZE; i < BTTEST2SIZE + BTBULKSIZE; ++i ) {                // Every one had better be found by its key
+        if ( !(Found = BTree.FindTuple((void*)&i, AT_BTREE_READ_OPTIMISTIC, AT_BTREE_FINDDIRECT, sizeof(long))) ) {
+            printf("Bulk added tuple not found at %i!  Test failure!\r\n", i); return 0;}
+        if ( ((Demo*)Found)->CustomerID != i ) {
+            printf("Return tuple %i for request %i!  Test failure!\r\n", ((Demo*)Found)->CustomerID, i); return 0;}
+    }
+    Expected = BTTEST2SIZE - ((BTTEST2SIZE + 4) / 5) + BTBULKSIZE;              // What should be left- the deletes took every fifth one
+    if ( !(Dptr = (Demo*)BTree.SetCursorToStart()) ) {                          // The primary had better walk in order...
+        printf("Failed SetCursor! Test failure!\r\n");return 0;}
+    for ( i = 1, o = Dptr->CustomerID; (Dptr = (Demo*)BTree.CursorNext()); ++i, o = Dptr->CustomerID ) {
+        if ( Dptr->CustomerID <= o ) {
+            printf("Out of order! O: %i N: %i Test failure!\r\n", o, Dptr->CustomerID); return 0;}
+    }
+    if ( i != Expected ) {
+        printf("Found %i instead of %i!  Test failure!\r\n", i, Expected); return 0;}
+    if ( !(Dptr = (Demo*)Email.SetCursorToStart()) ) {                          // ...and so had the secondary
+        printf("Failed SetCursor! Test failure!\r\n");return 0;}
+    strcpy(Scratch, (char*)(Dptr->Email));
+    for ( i = 1; (Dptr = (Demo*)Email.CursorNext()); ++i ) {
+        if ( stricmp(Scratch, (char*)(Dptr->Email)) > 0 ) {
+            printf("Out of order! O: %s N: %s Test failure!\r\n", Scratch, Dptr->Email); return 0;}
+        strcpy(Scratch, (char*)(Dptr->Email));
+    }
+    if ( i != Expected ) {
+        printf("Found %i instead of %i!  Test failure!\r\n", i, Expected); return 0;}
+    BTree.FreeCursor();                                                         // Release our cursors (and their locks!)
+    Email.FreeCursor();
+    BTree.CheckBTree();
+    Email.CheckBTree();
+    printf("Passed.\r\n");
+
     printf("Closing...\r\n");                                                   // Close both the BTrees and the table
     if ( ((Result = BTree.Close()) != ATERR_SUCCESS) || (Email.Close()) || (Table.CloseTable()) ) {
         printf("Close failed!  Test Failure!\r\n"); return 0;}
@@ -929,6 +1007,16 @@ long LongCompare(void *P1, void *P2, long Size) {
         return 1;
     return -1;
 }
+// ****************************************************************************
+void SumCustomerIDs(void *, long, ATTuple *Tuple, void *Accum) {                // This is our test scan accumulator- counts the tuples & sums their customer IDs
+    ((long*)Accum)[0]++;
+    ((long*)Accum)[1] += ((Demo*)Tuple)->CustomerID;
+}
+// ****************************************************************************
+void MergeCustomerIDs(void *, long, void *Into, void *From) {                   // This is our test scan merge
+    ((long*)Into)[0] += ((long*)From)[0];
+    ((long*)Into)[1] += ((long*)From)[1];
+}
 
 // **************************************************************************** Tables
 int     Tables() {                                                              // Test the ATSharedTables class
@@ -937,8 +1025,13 @@ int     Tables() {
     long            Result, i, inner, CB, CT, Kilroy, Inserts = 0, Deletes = 0, NumberTuples = 0;
     ATTuple         *Tuple, *Tuple2;
     volatile CDemo  *CTT, *CurrCD, *CTIC;
-    long            Interval = 0, Cumu = 0;
+    long            Interval = 0, Cumu = 0, Imported;
     Demo            *DB;
+    ATBlockScan     Scan;
+    long            Sums[2], Expected, Rows;
+    ATScanTerm      Term;
+    ATScanField     Field;
+    ATSharedTable   Other;
 
     srand( time(NULL) );                                                        // Make sure we generate random results
 
@@ -1037,13 +1130,13 @@ int     Tables() {
                             )) != ATERR_SUCCESS) {
         printf("Could not create table!  Test failure!\r\n");return 0;}
 
-    printf("Testing Table Import (from previously exported table)...\r\n");
-    if ( ( Result = Table.ImportTable(                                          // Import the data once again
+    printf("Testing mapped Table Import (from previously exported table)...\r\n");
+    if ( ( Result = Table.ImportMappedTable(                                    // Import the data once again, the fast way this time
                             "../testdata/testdata.dat",                         // Filename to load the table from
-                            Buffer,                                             // A buffer that may be used for file I/O
-                            BUFFERSIZE                                          // The size of the I/O buffer provided (recommend at least 32-64k)
-                            )) != ATERR_SUCCESS) {
-        printf("Could not import table!  Test failure!\r\n");return 0;}
+                            0,                                                  // Threads to spread the copying over, zero for one per processor we can run on
+                            &Imported                                           // Gets the number of records actually added
+                            )) != ATERR_SUCCESS || Imported != TABLE_DATA ) {
+        printf("Could not import table (%i of %i)!  Test failure!\r\n", Imported, TABLE_DATA);return 0;}
     printf("Table imported successfully.\r\n");
 
     printf("Doing an integrity check forwards (may take a while)...\r\n");      // After the above imports & exports, make sure out data is still exactly as it started out
@@ -1109,6 +1202,45 @@ int     Tables() {
     printf("%i records left, %i SHOULD be left.\r\n", i, TABLE_DATA - DELETETIPS);
     if ( i != (TABLE_DATA - DELETETIPS) ) {                                     // If the number remaining is not correct
         printf("Test failure!\r\n"); return 0;}
+    i = 0;
+    for ( inner = 0; Table.ScanBlock(inner, &Scan) == ATERR_SUCCESS; ++inner )  // Count them again a block at a time
+        i += Scan.Live;
+    printf("%i records found by block scan.\r\n", i);
+    if ( i != (TABLE_DATA - DELETETIPS) ) {                                     // Better be the same
+        printf("Test failure!\r\n"); return 0;}
+    Expected = Sums[0] = Sums[1] = 0;
+    Table.ResetCursor();
+    while ( (DB = (Demo*)Table.NextTuple()) ) Expected += DB->CustomerID;       // Sum them up the slow way
+    if ( (Result = Table.ScanTable(0, NULL, SumCustomerIDs, MergeCustomerIDs,   // Then again with every processor we have
+            NULL, Sums, sizeof(Sums), &inner)) != ATERR_SUCCESS ||
+            Sums[0] != i || Sums[1] != Expected || inner != i ) {
+        printf("Parallel scan failed (%i records, %i)!  Test failure!\r\n", Sums[0], Result); return 0;}
+    printf("%i records found by parallel scan.\r\n", Sums[0]);
+    Term.Offset = offsetof(Demo, CustomerID);                                   // Now pick out the ones over the average customer ID...
+    Term.Type = AT_SCAN_LONG;
+    Term.Op = AT_SCAN_GT;
+    Term.Value = Expected / i;
+    Field.Offset = offsetof(Demo, CustomerID);                                  // ...copying out just their IDs
+    Field.Length = sizeof(long);
+    Sums[0] = Sums[1] = 0;
+    Table.ResetCursor();
+    while ( (DB = (Demo*)Table.NextTuple()) ) {                                 // The slow way first
+        if ( DB->CustomerID > Term.Value ) {
+            Sums[0]++;
+            Sums[1] += DB->CustomerID;
+        }
+    }
+    Table.ResetCursor();
+    do {                                                                        // Then a hundred at a time, and they had better cancel out
+        Result = Table.SelectTuples(&Term, 1, &Field, 1, Buffer, sizeof(long) * 100, &Rows);
+        for ( inner = 0; inner < Rows; ++inner ) {
+            Sums[0]--;
+            Sums[1] -= ((long*)Buffer)[inner];
+        }
+    } while ( Result == ATERR_SUCCESS );
+    if ( Result != ATERR_NOT_FOUND || Sums[0] || Sums[1] ) {
+        printf("Select failed (%i records off, %i)!  Test failure!\r\n", Sums[0], Result); return 0;}
+    printf("Passed select.\r\n");
 
     printf("Now reinserting them...\r\n");                                      // Let's put all the deleted records back in the table
     for ( i = 0; i < DELETETIPS; i++) {                                         // Run thru the whole lsit
@@ -1271,6 +1403,105 @@ int     Tables() {
     if ( ( Result = Table.CloseTable()) != ATERR_SUCCESS ) {
         printf("Could not close table!  Test failure!\r\n");return 0;}
 
+    printf("Testing block scans with split control blocks...\r\n");           // The control blocks get checked four at a time in this layout
+    Table.SetCreateOptions(AT_TABLE_SPLIT_CBS);
+    if ( (Result = Table.CreateTable(TABLE_IPC, sizeof(Demo), IALLOCSIZE, GALLOCSIZE, 1, 3, 3, Kilroy)) != ATERR_SUCCESS ||
+            (Result = Table.ImportMappedTable("../testdata/testdata.dat", 0, &Imported)) != ATERR_SUCCESS ) {
+        printf("Could not create & import the split table (%i)!  Test failure!\r\n", Result);return 0;}
+    Table.ResetCursor();
+    for ( i = 0; (Tuple = Table.NextTuple()); ++i ) {                           // Delete whole runs of four, and scatter some more in between
+        if ( ((i / 4) % 3) == 1 || !(i % 7) ) {
+            Table.LockTuple();
+            if ( (Result = Table.DeleteTuple()) != ATERR_SUCCESS ) {
+                printf("Failed delete at %i!! Test Failure!!\r\n", i); return 0;}
+        }
+    }
+    Rows = 0;
+    for ( inner = 0; Table.ScanBlock(inner, &Scan) == ATERR_SUCCESS; ++inner ) {// Every bit set had better be counted...
+        for ( i = 0, CT = 0; i < Scan.Count; ++i )
+            if ( (Scan.Valid[i / AT_TABLE_SCAN_BITS] >> (i % AT_TABLE_SCAN_BITS)) & 1 ) CT++;
+        if ( CT != Scan.Live ) {
+            printf("Block %i has %i bits set but %i live!  Test failure!\r\n", inner, CT, Scan.Live); return 0;}
+        Rows += Scan.Live;
+    }
+    Expected = -1;
+    Table.ResetCursor();
+    for ( i = 0; (Tuple = Table.NextTuple()); ++i ) {                           // ...and every tuple the cursor finds had better have its bit set
+        Table.GetTupleLong(&CB, &CT);
+        if ( CB != Expected && (Result = Table.ScanBlock((Expected = CB), &Scan)) != ATERR_SUCCESS ) {
+            printf("Could not scan block %i (%i)!  Test failure!\r\n", CB, Result); return 0;}
+        if ( !((Scan.Valid[CT / AT_TABLE_SCAN_BITS] >> (CT % AT_TABLE_SCAN_BITS)) & 1) ) {
+            printf("Tuple %i of block %i missing from its bitmap!  Test failure!\r\n", CT, CB); return 0;}
+    }
+    printf("%i records found by block scan, %i by cursor.\r\n", Rows, i);
+    if ( i != Rows ) {
+        printf("Test failure!\r\n"); return 0;}
+    if ( ( Result = Table.CloseTable()) != ATERR_SUCCESS ) {
+        printf("Could not close table!  Test failure!\r\n");return 0;}
+    printf("Passed.\r\n");
+
+    printf("Testing an arena table...\r\n");                                    // Every block at the same address for everyone, found by arithmetic rather than looked up
+    Table.SetCreateOptions(AT_TABLE_ARENA);
+    if ( (Result = Table.CreateTable(TABLE_IPC, sizeof(Demo), IALLOCSIZE, GALLOCSIZE, 1, 3, 3, Kilroy)) != ATERR_SUCCESS ||
+            (Result = Table.ImportMappedTable("../testdata/testdata.dat", 0, &Imported)) != ATERR_SUCCESS || Imported != TABLE_DATA ) {
+        printf("Could not create & import the arena table (%i)!  Test failure!\r\n", Result);return 0;}
+    if ( (Result = Other.OpenTable(TABLE_IPC, Kilroy + 1)) != ATERR_SUCCESS ) { // Attach a second object...
+        printf("Could not open the arena table (%i)!  Test failure!\r\n", Result);return 0;}
+    for ( i = 0; i < TABLE_DATA; ++i ) {                                        // ...and grow it some more, so the other one has blocks to find that it never saw made
+        if ( !(Tuple = Table.AddTuple((void*)&(Users[i]))) ) {
+            printf("Could not grow the arena table at %i!  Test failure!\r\n", i);return 0;}
+        Table.UnlockTuple();
+    }
+    Table.ResetCursor();
+    Other.ResetCursor();
+    for ( i = 0; (Tuple = Table.NextTuple()); ++i ) {                           // It has to find every tuple right where we put it
+        if ( (Tuple2 = Other.NextTuple()) != Tuple ) {
+            printf("Tuple %i is at %p, but the other object has it at %p!  Test failure!\r\n", i, Tuple, Tuple2);return 0;}
+    }
+    if ( Other.NextTuple() || i != TABLE_DATA * 2 ) {
+        printf("Found %i tuples in the arena table, not %i!  Test failure!\r\n", i, TABLE_DATA * 2);return 0;}
+    if ( (Result = Other.CloseTable()) != ATERR_SUCCESS || (Result = Table.CloseTable()) != ATERR_SUCCESS ) {
+        printf("Could not close the arena table!  Test failure!\r\n");return 0;}
+    printf("Passed.\r\n");
+
+    printf("Testing a persistent table...\r\n");                                // Kept in a file, so it outlives us & comes back after a restart
+    remove(TABLE_FILE);                                                         // It must not be there yet
+    Table.SetCreateOptions(AT_TABLE_PERSISTENT);
+    Table.SetTableFile(TABLE_FILE);
+    if ( (Result = Table.CreateTable(TABLE_IPC, sizeof(Demo), IALLOCSIZE, GALLOCSIZE, 1, 3, 3, Kilroy)) != ATERR_SUCCESS ||
+            (Result = Table.ImportMappedTable("../testdata/testdata.dat", 0, &Imported)) != ATERR_SUCCESS || Imported != TABLE_DATA ) {
+        printf("Could not create & import the persistent table (%i)!  Test failure!\r\n", Result);return 0;}
+    Sums[0] = Sums[1] = 0;
+    Rows = 0;
+    Table.ResetCursor();
+    for ( i = 0; (Tuple = Table.NextTuple()); ++i ) {                           // Leave every tenth tuple locked, as if we went down holding them
+        Sums[0] += ((Demo*)Tuple)->CustomerID;
+        if ( !(i % 10) && Table.LockTuple() ) ++Rows;
+    }
+    if ( (Result = Table.Checkpoint()) != ATERR_SUCCESS ) {
+        printf("Could not checkpoint the persistent table (%i)!  Test failure!\r\n", Result);return 0;}
+    if ( (Result = Table.CloseTable()) != ATERR_SUCCESS ) {                     // The file stays behind, locks & all
+        printf("Could not close the persistent table!  Test failure!\r\n");return 0;}
+    if ( (Result = Table.OpenTableFile(TABLE_FILE, 1, Kilroy + 1)) != ATERR_SUCCESS ) {// Now someone else is first up after the "restart"
+        printf("Could not reopen the persistent table (%i)!  Test failure!\r\n", Result);return 0;}
+    Table.ResetCursor();
+    for ( i = 0, CT = 0; (Tuple = Table.NextTuple()); ++i ) {                   // Everything has to still be there...
+        Sums[1] += ((Demo*)Tuple)->CustomerID;
+        if ( !(i % 10) ) {                                                      // ...and every lock we left has to have gone stale
+            if ( !Table.BounceLockTuple() ) {
+                printf("Tuple %i is still locked after the restart!  Test failure!\r\n", i);return 0;}
+            Table.UnlockTuple();
+            ++CT;
+        }
+    }
+    if ( i != TABLE_DATA || Sums[0] != Sums[1] || CT != Rows ) {
+        printf("Found %i tuples (sum %i, %i relocked) after the restart, not %i (sum %i, %i locked)!  Test failure!\r\n",
+            i, Sums[1], CT, TABLE_DATA, Sums[0], Rows);return 0;}
+    if ( (Result = Table.CloseTable()) != ATERR_SUCCESS ) {
+        printf("Could not close the persistent table!  Test failure!\r\n");return 0;}
+    remove(TABLE_FILE);
+    printf("Passed.\r\n");
+
     printf("Now preparing for concurrency tests.\r\n");
     printf("Note these tests help validate the table structures and algorithms, but\r\n");
     printf("NOT the tuple atomicity- that is up to the USER via locking.\r\n");
@@ -1592,28 +1823,34 @@ int     Logs() {
 }
 // **************************************************************************** Timing
 int     Timing() {                                                              // Tests timing ops
-    long long   Test[6], Avg[5], Result;
-    int i;
+    ATTimingInfo    *Info;
+    int64           Start, Ticks, Total = 0;
+    int             i;
 
     printf("Testing Timing...\r\n");
-    printf("Testing CPUTicks.  This will take a few seconds...\r\n");
-
-    for ( i = 0; i < 6; i++) {
-        Test[i] = ATGetCPUTicks();
-        if (i < 5) sleep(1);
-    }
-    Avg[0] = Test[1] - Test[0];
-    Avg[1] = Test[2] - Test[1];
-    Avg[2] = Test[3] - Test[2];
-    Avg[3] = Test[4] - Test[3];
-    Avg[4] = Test[5] - Test[4];
-
-    Result = Avg[0] + Avg[1] + Avg[2] + Avg[3] + Avg[4];
-    Result /= 5;
-    Result /= 1000000;
-
-    printf("CPU Ticks shows your CPU MHz at about %i.\r\n", Result);
-    printf("If that is reasonably close (won't be precise), then you are\r\ngood to go!\r\n");
+    ATInitTiming();                                                             // Pick & calibrate the clock
+    Info = ATGetTimingInfo();
+    printf("Clock source is %s, at %lld ticks per second.\r\n",
+        Info->Source == AT_CLOCK_RDTSCP ? "rdtscp" : Info->Source == AT_CLOCK_TSC ? "rdtsc" : "CLOCK_MONOTONIC_RAW",
+        Info->TicksPerSecond);
+    if ( Info->TicksPerSecond / 1000000 <= 0 ) {                                // Anything that can time a lock hold has to tick at least once a microsecond
+        printf("The clock ticks less than once a microsecond!  Test failure!\r\n"); return 0;}
+
+    Start = ATGetTicks();                                                       // How much does a clock read cost?
+    for ( i = 0; i < 1000000; i++ )
+        Ticks = ATGetTicks();
+    Ticks = ATGetTicks() - Start;
+    printf("A clock read takes about %lld ns.\r\n", ATTicksToNanos(Ticks) / 1000000);
+
+    {
+        ATScopedTimer   Timer(&Total);                                          // Time a known interval
+        usleep(TIMING_SLEEP);
+    }
+    printf("A %i us sleep timed at %lld ns.\r\n", TIMING_SLEEP, Total);
+    if ( Total < (int64)TIMING_SLEEP * 990 || Total > ((int64)TIMING_SLEEP * 1000) + TIMING_SLACK ) {// Never short (but for a hair of calibration), and not too far over
+        printf("That is not between %lld and %lld ns!  Test failure!\r\n", (int64)TIMING_SLEEP * 990, ((int64)TIMING_SLEEP * 1000) + TIMING_SLACK); return 0;}
+    printf("100000000 ns is %lld ticks, and back again is %lld ns.\r\n",
+        ATNanosToTicks(100000000), ATTicksToNanos(ATNanosToTicks(100000000)));
 
     return 1;
 }
@@ -1839,6 +2076,13 @@ int     SpinLocks() {
         return 0;
     }
 
+    printf("Making sure a Kilroy with the waiter bit is refused...\r\n");
+    if ( ATGetSpinLock(Kilroy | AT_LOCK_WAITERS, ALock) != ATERR_BAD_PARAMETERS ||// It would be taken for a sleeper's flag
+            ATBounceSpinLock(Kilroy | AT_LOCK_WAITERS, ALock) != ATERR_BAD_PARAMETERS ) {
+        printf("Took a lock with a reserved Kilroy!\r\nTest failure.\r\n");
+        return 0;
+    }
+
     printf("Test the following %i times...\r\n", SPIN_LOCK_LOOPS);
     for ( i = 0; i < SPIN_LOCK_LOOPS; i++) {                                    // Repeat this loop as specified
         printf("Try to GetSpinLock()...\r\n");
@@ -1880,6 +2124,106 @@ int     SpinLocks() {
     printf("\r\nAll SpinLock tests successful!\r\n");
     return 1;
 }
+// **************************************************************************** FreeListNext
+volatile ATNLFLC *FreeListNext(void *Context, long Value1, long) {              // The free list test's routine to find an item's chain
+    return &(((FLDemo*)Context)[Value1].Link);
+}
+// **************************************************************************** FreeLists
+int     FreeLists() {                                                           // Tests the no locking free lists
+    volatile void *Data;
+    int     i, x, Result, Taken;
+    long    Kilroy, Value1, Value2;
+    ATNLFLI *Info;
+    char    *ListsMemory;
+    FLDemo  *Items;
+    long    Held[FREE_LIST_TAKE];
+
+    printf("Testing Free Lists...\r\n");
+    printf("This test requires Shared Memory, so make you have tested it first!\r\n");
+    printf("You should run another atlas_test process at the same time to\r\n");
+    printf("verify operation (start it after the first says it is ready).\r\n\r\n");
+
+    printf("Create a shared memory object..\r\n");                              // The lists and the items both have to be where both processes can see them
+    Result = Mem.CreateSharedMem(32135, sizeof(ATNLFLI) + 8 + (FREE_LIST_LISTS * sizeof(ATNLFLL)) + (FREE_LIST_ITEMS * sizeof(FLDemo)));
+    if ( Result != ATERR_SUCCESS ) {
+        printf("Create() failed- trying Attach() in case it already exists...\r\n");
+        Result = Mem.AttachSharedMem(32135);                                    // If it failed, maybe I am the second guy up, so try attaching instead
+        if ( Result != ATERR_SUCCESS ) {
+            printf("Attach() also failed- test failure.\r\n");
+            return 0;
+        }
+        printf("Attach() successful!\r\n");
+        Kilroy = 2;                                                             // If I am the second guy up, make my kilroy 2
+    }
+    else {
+        printf("Create() successful!\r\n");
+        Kilroy = 1;                                                             // If I am the first guy up, make my kilroy 1
+    }
+    Data = Mem.GetBasePointer();                                                // Carve up the shared memory
+    Info = (ATNLFLI *)Data;
+    ListsMemory = (char *)((((unsigned long)(Info + 1)) + 7) & ~((unsigned long)7));// The lists must be 8 byte aligned
+    Items = (FLDemo *)(ListsMemory + (FREE_LIST_LISTS * sizeof(ATNLFLL)));
+
+    if ( Kilroy == 1 ) {                                                        // First one up builds the free list
+        printf("Creating the free list and adding %i items...\r\n", FREE_LIST_ITEMS);
+        for ( i = 0; i < FREE_LIST_ITEMS; ++i )
+            Items[i].Owner = 0;
+        if ( (Result = FreeList.Create(FREE_LIST_LISTS, ListsMemory, Info, FreeListNext, (void*)Items, -1, FREE_LIST_BALANCE)) != ATERR_SUCCESS ) {
+            printf("Failed to Create() the free list!\r\nTest failure.\r\n");
+            return 0;
+        }
+        for ( i = 0; i < FREE_LIST_ITEMS; ++i ) {
+            if ( (Result = FreeList.AddToList(i, 0)) != ATERR_SUCCESS ) {
+                printf("Failed to AddToList()!\r\nTest failure.\r\n");
+                return 0;
+            }
+        }
+        printf("Ready!\r\n");
+        sleep(3);                                                               // Give the other process a chance to get going
+    }
+    else {
+        printf("Opening the free list...\r\n");
+        if ( (Result = FreeList.Open(ListsMemory, Info, FreeListNext, (void*)Items)) != ATERR_SUCCESS ) {
+            printf("Failed to Open() the free list!\r\nTest failure.\r\n");
+            return 0;
+        }
+    }
+
+    printf("Test the following %i times...\r\n", FREE_LIST_LOOPS);
+    for ( x = 0; x < FREE_LIST_LOOPS; x++) {                                    // Repeat this loop as specified
+        for ( Taken = 0; Taken < FREE_LIST_TAKE; ++Taken ) {                    // Take as many items as I can get
+            if ( (Result = FreeList.TakeFromList(&Value1, &Value2)) != ATERR_SUCCESS )
+                break;
+            if ( Value1 < 0 || Value1 >= FREE_LIST_ITEMS || Value2 != 0 ) {     // Make sure it is one of ours
+                printf("TakeFromList() returned a bad item (%li, %li)!\r\nTest failure.\r\n", Value1, Value2);
+                return 0;
+            }
+            if ( ATCompareAndExchange(&(Items[Value1].Owner), 0, Kilroy) != ATERR_SUCCESS ) {// And that nobody else has it
+                printf("Item %li was handed out twice!\r\nTest failure.\r\n", Value1);
+                return 0;
+            }
+            Held[Taken] = Value1;
+        }
+        printf("Took %i items...\r\n", Taken);
+        sleep(1);                                                               // Sleep a bit (to stagger w/ the other process)
+        for ( i = 0; i < Taken; ++i ) {                                         // Now give them all back
+            Items[Held[i]].Owner = 0;
+            if ( (Result = FreeList.AddToList(Held[i], 0)) != ATERR_SUCCESS ) {
+                printf("Failed to AddToList()!\r\nTest failure.\r\n");
+                return 0;
+            }
+        }
+        printf("Gave them back!\r\n");
+        sleep(1);
+    }
+
+    printf("Closing the free list...\r\n");
+    FreeList.Close();
+    if ( Kilroy == 1 ) sleep(5);                                                // Make sure the other guy is done before the memory goes away
+
+    printf("\r\nAll FreeList tests successful!\r\n");
+    return 1;
+}
 // **************************************************************************** ScratchMemory
 int     ScratchMemory() {                                                       // Tests the scratch memory pool object
 
@@ -1923,6 +2267,40 @@ int     ScratchMemory() {
         Mem.ResetScratchMem();                                                  // Now reset the object and start over
     }
     printf("Success!\r\nHighWater = %i\r\n", Mem.GetHighWater());               // Show our high water mark
+
+    ATScratchMem    Small(SCRATCH_MEM_CHUNK);                                   // Small enough to make it chain
+    ATScratchMark   Mark;
+    ATScratchStats  Stats;
+    char            *Keep, *Temp;
+
+    printf("Chain chunks & rewind to a save point in a %i byte object (%i resets)...\r\n",
+        SCRATCH_MEM_CHUNK, SCRATCH_MEM_RESETS);
+    for ( o = 0; o < SCRATCH_MEM_RESETS; o++) {                                 // Set up outer loop for requested resets
+        Keep = (char *)Small.GetScratchMem(SCRATCH_MEM_GET);                    // Something the "caller" holds on to
+        memset(Keep, 3, SCRATCH_MEM_GET);
+        Small.MarkScratchMem(&Mark);                                            // The "callee" marks...
+        for ( i = 0; i < SCRATCH_MEM_ALLOCS / 10; i++) {                        // ...makes plenty of temporaries, enough to chain...
+            Temp = (char *)Small.GetScratchMem(SCRATCH_MEM_GET);
+            memset(Temp, 7, SCRATCH_MEM_GET);
+        }
+        Temp = (char *)Small.GetScratchMem(SCRATCH_MEM_CHUNK * 2);              // ...one too big for a chunk...
+        memset(Temp, 7, SCRATCH_MEM_CHUNK * 2);
+        Small.RewindScratchMem(&Mark);                                          // ...and gives them back
+        Temp = (char *)Small.GetScratchMem(SCRATCH_MEM_GET);                    // Next alloc must land right where the mark was
+        if ( Keep[0] != 3 || Keep[SCRATCH_MEM_GET - 1] != 3 || Temp != Keep + SCRATCH_MEM_GET ) {
+            printf("Rewind Failed!\r\nTest Failure...\r\n");
+            return 0;
+        }
+        Small.ResetScratchMem();                                                // Now reset the object and start over
+    }
+    Small.GetScratchStats(&Stats);
+    if ( Stats.Failures || Stats.BigBlocks || Stats.BigAllocs != SCRATCH_MEM_RESETS ||
+        Stats.Chunks > (SCRATCH_MEM_ALLOCS / 10 + 1) * SCRATCH_MEM_GET / (SCRATCH_MEM_CHUNK / 2) ) {
+        printf("Statistics Failed!\r\nTest Failure...\r\n");            // Chunks must be reused, not piled up every reset
+        return 0;
+    }
+    printf("Success!\r\n%li allocs, %li big, %li chunks, %li bytes held, HighWater = %li\r\n",
+        Stats.Allocs, Stats.BigAllocs, Stats.Chunks, Stats.Reserved, Stats.HighWater);
     printf("\r\nAll Scratch Memory tests successful!\r\n");
     return 0;
 }
@@ -2901,6 +3279,7 @@ int main(int argc, char *argv[ ]) {
         printf("ScratchMemory\r\n");
         printf("SpinLocks\r\n");
         printf("Atomics\r\n");
+        printf("FreeLists\r\n");
         printf("ShareLocks\r\n");
         printf("Timing\r\n");
         printf("Logs\r\n");
@@ -2926,6 +3305,8 @@ int main(int argc, char *argv[ ]) {
         Return = SpinLocks();
     else if ( !stricmp(argv[1], "Atomics") )
         Return = Atomics();
+    else if ( !stricmp(argv[1], "FreeLists") )
+        Return = FreeLists();
     else if ( !stricmp(argv[1], "ShareLocks") )
         Return = ShareLocks();
     else if ( !stricmp(argv[1], "Timing") )
@@ -2968,5 +3349,6 @@ void    Cleanup() {
     Email.Close();
     Table.CloseTable();
     Sem.Close();
+    FreeList.Close();
     Mem.FreeSharedMem();
 }
@@ -55,6 +55,7 @@ struct ATBTreeInformationBlock {
     volatile long       IndexType;                                              // Either AT_BTREE_PRIMARY or AT_BTREE_SECONDARY
     volatile long       SystemKey;                                              // System IPC key
     volatile long       TotalPageSize;                                          // Total size of a BTree page
+    ATBRSLOT            RootSlots[AT_BRLOCK_SLOTS];                             // Reader slots for the root's big-reader sharelock- every search passes through the root
 };
 
 /* BTree Page Layout
@@ -99,6 +100,7 @@ struct ATBTreePageHeader {
     volatile ATBTSHCB   Low;                                                    // The low CB for the page
     volatile ATBTSHCB   PrevPage;                                               // The prev page in this sequence
     volatile ATBTSHCB   NextPage;                                               // The prev page in this sequence
+    volatile ULONG      Owner;                                                  // Kilroy of the exclusive's holder, so a dead one can be cleared off (see ATReclaimShareExclusive)
 };
 
 struct testkey {
@@ -221,7 +223,10 @@ int ATBTree::LoadBTree(
     while ( PH = (volatile ATBTPH*)PageMan.NextTuple() ) {                      // Keep grabbing tuples
         if ( PH->PageKey != AT_BTREE_INFO ) {                                   // For everyone except the info page
             PH->ALock = 0;                                                      // Make sure the locks are zeroed
+            PH->Owner = 0;
         }
+        else                                                                    // The info page holds the root's reader slots
+            memset((void*)(((ATBTInfo*)PH)->RootSlots), 0, sizeof(ATBTInfo::RootSlots));
     }
 
     return ATERR_SUCCESS;
@@ -290,7 +295,10 @@ int ATBTree::CreateFromFile(
     while ( PH = (volatile ATBTPH*)PageMan.NextTuple() ) {                      // Keep grabbing tuples
         if ( PH->PageKey != AT_BTREE_INFO ) {                                   // For everyone except the info page
             PH->ALock = 0;                                                      // Make sure the locks are zeroed
+            PH->Owner = 0;
         }
+        else                                                                    // The info page holds the root's reader slots
+            memset((void*)(((ATBTInfo*)PH)->RootSlots), 0, sizeof(ATBTInfo::RootSlots));
     }
 
     if ( (Result = Table->RegisterBTree(this, IndexType)) != ATERR_SUCCESS)     // Register the BTree with the table
@@ -305,10 +313,11 @@ int ATBTree::TestCrabLock(
                             ) {
     long    Result, Attempts = 0;
 retry:
-    if ( (Result = ATBounceShare(DesiredLock)) == ATERR_SUCCESS)                // Try to get the lock below this page
+    if ( (Result = BouncePageShare(DesiredLock)) == ATERR_SUCCESS)              // Try to get the lock below this page
         return ATERR_SUCCESS;                                                   // Return if I get it
     else {
         if ( !(*HeldLock & AT_SHARE_EXC) )  {                                   // As long as nobody has gotten an exclusive on our page
+            ReclaimPageExclusive(DesiredLock, Attempts);                        // Clears the exclusive off if its holder has died
             ATSpinLockArbitrate(Attempts);                                      // We'll just keep trying
             Attempts++;
             goto retry;
@@ -317,6 +326,66 @@ retry:
             return ATERR_OBJECT_IN_USE;                                         // So give it up- we don't want a deadlock
     }
 }
+// **************************************************************************** GetPageShare
+int ATBTree::GetPageShare(                                                      // Get a share lock on a page- the root's readers go through its big-reader slots
+                                ATLOCK          *ALock                          // The page's lock
+                            ) {
+    ATSetLockClass(AT_LOCKCLASS_BTREEPAGE);
+    ATSetLockOwner(&(((volatile ATBTPH*)ALock)->Owner));                        // So we can clear off the exclusive of a writer that died
+    if ( ALock == &(Root->ALock) )                                              // Every search starts here, so keep the readers off the lock word
+        return ATGetBRShare(ALock, (ATBRSLOT*)(Info->RootSlots));
+    return ATGetShare(ALock);
+}
+// **************************************************************************** BouncePageShare
+int ATBTree::BouncePageShare(                                                   // Try for a share lock on a page, return immediately if failed
+                                ATLOCK          *ALock                          // The page's lock
+                            ) {
+    ATSetLockClass(AT_LOCKCLASS_BTREEPAGE);
+    if ( ALock == &(Root->ALock) )
+        return ATBounceBRShare(ALock, (ATBRSLOT*)(Info->RootSlots));
+    return ATBounceShare(ALock);
+}
+// **************************************************************************** FreePageShare
+int ATBTree::FreePageShare(                                                     // Free a share lock on a page
+                                ATLOCK          *ALock                          // The page's lock
+                            ) {
+    if ( ALock == &(Root->ALock) )
+        return ATFreeBRShare(ALock, (ATBRSLOT*)(Info->RootSlots));
+    return ATFreeShare(ALock);
+}
+// **************************************************************************** QueuePageExclusive
+int ATBTree::QueuePageExclusive(                                                // Queue an exclusive on a page- fails at once if someone else has one
+                                ATLOCK          *ALock                          // The page's lock
+                            ) {
+    int             Result;
+
+    ATSetLockClass(AT_LOCKCLASS_BTREEPAGE);
+    if ( (Result = ATQueueShareExclusive(ALock)) == ATERR_SUCCESS )             // The same for the root- the slots only matter to the wait
+        ((volatile ATBTPH*)ALock)->Owner = Kilroy;                              // The lock is the first thing in the page header
+    return Result;
+}
+// **************************************************************************** RemovePageExclusive
+int ATBTree::RemovePageExclusive(                                               // Take our queued or held exclusive back off of a page
+                                ATLOCK          *ALock                          // The page's lock
+                            ) {
+    ((volatile ATBTPH*)ALock)->Owner = 0;                                       // Clear it before we let go, so nobody takes a later holder for us
+    return ATRemoveQueueShareExclusive(ALock);
+}
+// **************************************************************************** ReclaimPageExclusive
+int ATBTree::ReclaimPageExclusive(                                              // Clear a dead writer's exclusive off of a page- ATERR_SUCCESS means it is gone
+                                ATLOCK          *ALock,                         // The page's lock
+                                long            Attempts                        // Number of tries made at the lock so far
+                            ) {
+    return ATReclaimShareExclusive(ALock, &(((volatile ATBTPH*)ALock)->Owner), Attempts);
+}
+// **************************************************************************** WaitPageExclusive
+int ATBTree::WaitPageExclusive(                                                 // With an exclusive queued on a page, wait for its readers to leave
+                                ATLOCK          *ALock                          // The page's lock
+                            ) {
+    if ( ALock == &(Root->ALock) )                                              // The root's readers may be in the slots as well as the word
+        return ATWaitQueueBRShareExclusive(ALock, (ATBRSLOT*)(Info->RootSlots));
+    return ATWaitQueueShareExclusive(ALock);
+}
 // **************************************************************************** FindInPage
 int ATBTree::FindInPage(                                                        // Find a key in the page- most parameters are set in the class members- check there for info.
                         volatile ATBTPH     *Page,                              // Page to search
@@ -424,9 +493,9 @@ retry_ff:
                         CB = ATBTreeKey(TKeyPtrs, TKeysBase, PH->NumberKeys - 1);// Get a CB to the last entry
                         PH2 = (volatile ATBTPH*)PageMan.LocateTuple(CB->BBlock, CB->BTuple);// Now load the page it points to
                         if ( (Count = TestCrabLock(&(PH->ALock), &(PH2->ALock))) != ATERR_SUCCESS) { // Not worried about contention between Page->Alock & PH locks- they are different paths
-                            ATFreeShare(&(PH->ALock));                              // Free its parent
+                            FreePageShare(&(PH->ALock));                        // Free its parent
                             LockAlert = AT_BTREE_SHIFTFAILED; return 0;}
-                        ATFreeShare(&(PH->ALock));                              // Free its parent
+                        FreePageShare(&(PH->ALock));                            // Free its parent
                         PH = PH2;                                               // Now we are back to having only one page open
                         TKeyPtrs = ATBTreeKeyPtrBase(PH);                       // Figure out where everything is
                         TKeysBase = ATBTreeKeyBase(TKeyPtrs);                   // Note that we'll always have at least one record in this page
@@ -449,7 +518,7 @@ retry_ff:
                             return Found;
                         }
                     }
-                    ATFreeShare(&(PH->ALock));                                  // Not a fit! Free the share and return
+                    FreePageShare(&(PH->ALock));                                // Not a fit! Free the share and return
                     LockAlert = 0;
                 }
             }
@@ -510,7 +579,7 @@ int ATBTree::PagedFindKey(
 start_over:
     SearchFoundPage = Root;                                                     // Start at the root
     if ( SearchLockMode )                                                       // For any actual locking mode at all
-        ATGetShare(&(Root->ALock));                                             // Start with a share lock on the root
+        GetPageShare(&(Root->ALock));                                           // Start with a share lock on the root
 
     while ( SearchFoundPage->PageType != AT_BTREE_LEAF ) {                      // Until we get to the leaf page...
         Found = FindInPage(SearchFoundPage,inKey, Block, Tuple);                // Try to find it in this page
@@ -528,7 +597,7 @@ start_over:
             }
             else {                                                              // Crap- shift left must have failed- we need to roll back locks
                 LockAlert = 0;                                                  // Clear the flag
-                ATFreeShare(&(SearchFoundPage->ALock));                         // Free our lock
+                FreePageShare(&(SearchFoundPage->ALock));                       // Free our lock
                 goto start_over;                                                // And restart
             }
         }
@@ -587,19 +656,19 @@ int ATBTree::GetCrabDownWriteLock(
             if ( (Result = CrabShareToExclusive(CPage, DPage)) != ATERR_SUCCESS )// Get an exclusive queued up on it
                 return Result;
             if ( DPage->AvailableChain != AT_BTREE_END_CHAIN) {                 // Now that we actually have it locked, we need to make SURE it has free space
-                ATFreeShare(&(CPage->ALock));
+                FreePageShare(&(CPage->ALock));
                 return ATERR_SUCCESS;                                           // And return
             }
             // Rats!  Someone inserted a record before I could get it locked! Before doing anything drastic, let's look around...
             if ( CPage->AvailableChain != AT_BTREE_END_CHAIN ) {                // If there is room in this page to insert a split key
                 if ( (Result = UpgradeShareToExclusiveQueuedRB(CPage)) != ATERR_SUCCESS){// Then let's try to upgrade my lock
-                    ATRemoveQueueShareExclusive(&(DPage->ALock));               // Didn't work- I have to start over anyway
+                    RemovePageExclusive(&(DPage->ALock));                       // Didn't work- I have to start over anyway
                     return Result;
                 }
                 return ATERR_SUCCESS;                                           // Great!  Got them both!
             }
-            ATFreeShare(&(CPage->ALock));
-            ATRemoveQueueShareExclusive(&(DPage->ALock));                       // No use- the page above the leaf is full too- just need to start over
+            FreePageShare(&(CPage->ALock));
+            RemovePageExclusive(&(DPage->ALock));                               // No use- the page above the leaf is full too- just need to start over
             return ATERR_UNSAFE_OPERATION;
         }
         // Before doing anything drastic, let's look around
@@ -610,7 +679,7 @@ int ATBTree::GetCrabDownWriteLock(
             GetQueuedExclusive(DPage);                                          // I managed to get an upgrade, so now let's just get the next page locked too...
             return ATERR_SUCCESS;
         }
-        ATFreeShare(&(CPage->ALock));                                           // The page is already full- we are going to have to split it AND the page beneath it.
+        FreePageShare(&(CPage->ALock));                                         // The page is already full- we are going to have to split it AND the page beneath it.
         return ATERR_UNSAFE_OPERATION;                                          // So we will have to escalate and start all over
     }
 
@@ -618,22 +687,22 @@ int ATBTree::GetCrabDownWriteLock(
     else if ( SearchLockMode == AT_BTREE_WRITE_HOLDLOCK ) {                     // Am I in WRITE_HOLDLOCK mode?
         if ( !PathDepth ) {                                                     // If I haven't yet started into lock accrual mode (when that starts I just lock everything exc on the way down)
             if ( (Result = TestCrabLock(&(CPage->ALock), &DPage->ALock)) != ATERR_SUCCESS) {
-                ATFreeShare(&(CPage->ALock));
+                FreePageShare(&(CPage->ALock));
                 return Result;
             }
             if ( DPage->AvailableChain != AT_BTREE_END_CHAIN ) {                // If I can enter here, I DO NOT need an exclusive on the current page.
                                                                                 // So now the question is, what about the next page?
                 if ( DPage->PageType != AT_BTREE_LEAF ) {                       // If it ISN'T the leaf, we are free to go
-                    ATFreeShare(&(CPage->ALock));
+                    FreePageShare(&(CPage->ALock));
                     return ATERR_SUCCESS;                                       // And return
                 }
                 Result = UpgradeShareToExclusiveQueuedRB(DPage);                // Upgrade my lock
-                ATFreeShare(&(CPage->ALock));                                   // Free prior lock regardless
+                FreePageShare(&(CPage->ALock));                                 // Free prior lock regardless
                 return Result;
             }
             else {// Since I got here, I know that I have to lock the CURRENT page, because the next page is full, and this kicks off lock accrual mode
                 if ( (Result = UpgradeShareToExclusiveQueuedRB(CPage)) != ATERR_SUCCESS) {// If I can't upgrade, I have to start over
-                    ATFreeShare(&(DPage->ALock));                               // Have to free this too
+                    FreePageShare(&(DPage->ALock));                             // Have to free this too
                     return Result;
                 }
                 // Now that I have checked the exc lock on the current page, I need to exc lock the next page as well, but it is much easier!
@@ -651,7 +720,7 @@ int ATBTree::GetCrabDownWriteLock(
             return GetCrabDownReadLock(&(CPage->ALock), &(DPage->ALock));       // Then I just want to crab down with share locks
         else {                                                                  // I have arrived at the leaf page
             CrabShareToExclusive(CPage, DPage);                                 // Crab from a share to an exclusive
-            ATFreeShare(&(CPage->ALock));
+            FreePageShare(&(CPage->ALock));
         }
         return ATERR_SUCCESS;                                                   // And return
     }
@@ -663,13 +732,14 @@ int ATBTree::CrabShareToExclusive(
                                 volatile ATBTPH *DesiredPage                    // Page you want an exclusive lock on
                                 ) {
     long    Attempts = 0, Result;
-    while ( (Result = ATQueueShareExclusive(&(DesiredPage->ALock))) != ATERR_SUCCESS ){// Try to queue up an exclusive lock
+    while ( (Result = QueuePageExclusive(&(DesiredPage->ALock))) != ATERR_SUCCESS ){// Try to queue up an exclusive lock
         if ( !( (HeldPage->ALock) & AT_SHARE_EXC) ) {                           // AS long a nobody has gotten our lock
+            ReclaimPageExclusive(&(DesiredPage->ALock), Attempts);              // Clears the exclusive off if its holder has died
             ATSpinLockArbitrate(Attempts);                                      // We just retry
             Attempts++;
         }
         else {
-            ATFreeShare(&(HeldPage->ALock));                                     // Someone else got an exc on our page- we have to restart
+            FreePageShare(&(HeldPage->ALock));                                  // Someone else got an exc on our page- we have to restart
             return ATERR_OBJECT_IN_USE;
         }
     }
@@ -693,7 +763,8 @@ int ATBTree::GetQueuedExclusive(
                                 volatile ATBTPH *Page                           // Page to lock
                                 ) {
     long    Attempts = 0, Result;
-    while ( (Result = ATQueueShareExclusive(&(Page->ALock))) ) {                // Try to queue up an exclusive lock
+    while ( (Result = QueuePageExclusive(&(Page->ALock))) ) {                   // Try to queue up an exclusive lock
+        ReclaimPageExclusive(&(Page->ALock), Attempts);                         // Clears the exclusive off if its holder has died
         ATSpinLockArbitrate(Attempts);
         Attempts++;
     }
@@ -717,12 +788,12 @@ int ATBTree::UpgradeShareToExclusiveQueuedRB(
                                 volatile ATBTPH *Page                           // Page to lock
                                 ) {
     long    Result;
-    Result = ATQueueShareExclusive(&(Page->ALock));                             // Try to queue up an exclusive lock
-    ATFreeShare(&(Page->ALock));                                                // Whether I got it or not, I can't hold the share anymore
+    Result = QueuePageExclusive(&(Page->ALock));                                // Try to queue up an exclusive lock
+    FreePageShare(&(Page->ALock));                                              // Whether I got it or not, I can't hold the share anymore
     if ( Result != ATERR_SUCCESS ) {                                            // Unfortunately, if I did not get the exc, I MUST free my share, which means the world could have changed, so I have to start over
         if ( PathDepth ) {                                                      // Did I accrue any locks?  Unusual, if not rare.
             for ( int i = 0; i < PathDepth; ++i)                                // Loop thru any locks we may need to free up
-                ATRemoveQueueShareExclusive((LockedPath[i].ALock));             // Remove the queue on our lock
+                RemovePageExclusive((LockedPath[i].ALock));                     // Remove the queue on our lock
             PathDepth = 0;                                                      // Reset the PathDepth counter
         }
         ATSpinLockArbitrate(EscalationFailures);                                // This is, after all, a lock we are fighting for, so let's not behave badly
@@ -753,10 +824,11 @@ int ATBTree::UpgradeShareToExclusiveQueuedSP(
                                 volatile ATBTPH *Page                           // Page to lock
                                 ) {
     long    Result, Attempts = 0;
-    Result = ATQueueShareExclusive(&(Page->ALock));                             // Try to queue up an exclusive lock
-    ATFreeShare(&(Page->ALock));                                                // Whether I got it or not, I can't hold the share anymore, since a fail would mean someone else is trying to write
+    Result = QueuePageExclusive(&(Page->ALock));                                // Try to queue up an exclusive lock
+    FreePageShare(&(Page->ALock));                                              // Whether I got it or not, I can't hold the share anymore, since a fail would mean someone else is trying to write
     if ( Result != ATERR_SUCCESS ) {
-        while ( (Result = ATQueueShareExclusive(&(Page->ALock))) ) {            // Try to queue up an exclusive lock
+        while ( (Result = QueuePageExclusive(&(Page->ALock))) ) {               // Try to queue up an exclusive lock
+            ReclaimPageExclusive(&(Page->ALock), Attempts);                     // Clears the exclusive off if its holder has died
             ATSpinLockArbitrate(Attempts);
             Attempts++;
         }
@@ -785,25 +857,26 @@ int ATBTree::GetCrabDownReadLock(
 
     if ( SearchMode != AT_BTREE_FINDFIRST ) {                                   // As long as we are in any other find mode...
 retry:
-        if ( (Result = ATBounceShare(DesiredLock)) == ATERR_SUCCESS) {          // Try to get the lock below
-            ATFreeShare(HeldLock);                                              // Just free our old lock & head out
+        if ( (Result = BouncePageShare(DesiredLock)) == ATERR_SUCCESS) {        // Try to get the lock below
+            FreePageShare(HeldLock);                                            // Just free our old lock & head out
             return ATERR_SUCCESS;
         }
         else {
             if ( !(*HeldLock & AT_SHARE_EXC) )  {                               // As long as nobody has gotten an exclusive on our page
+                ReclaimPageExclusive(DesiredLock, Attempts);                    // Clears the exclusive off if its holder has died
                 ATSpinLockArbitrate(Attempts);                                  // We'll just keep trying
                 Attempts++;
                 goto retry;
             }
             else {                                                              // Crap- someone has an exclusive on our page
-                ATFreeShare(HeldLock);                                          // Free our old lock & return an error
+                FreePageShare(HeldLock);                                        // Free our old lock & return an error
                 return ATERR_OBJECT_IN_USE;
             }
         }
     }
     if ( LockAlert ) {                                                          // We must be in a FINDFIRST mode
                                                                                 // Further, we are going down the low page, which means we already have a read lock acquired on the new page
-        ATFreeShare(HeldLock);                                                  // So just release the old lock
+        FreePageShare(HeldLock);                                                // So just release the old lock
         LockAlert = 0;
         return ATERR_SUCCESS;
     }
@@ -897,6 +970,7 @@ volatile ATBTPH  *ATBTree::MakePageCopy(
     PageMan.UnlockTuple();                                                      // Unlock it before we forget about it
     PageMan.GetTupleLong((long int*)&(NewPage->Block), (long int*)&(NewPage->Tuple));// Ask the table where this tuple is
     NewPage->ALock =        0;                                                  // Init the lock (to exclusive)
+    NewPage->Owner =        0;
     NewPage->PageType =     Page->PageType;                                     // Our page type stays the same
     NewPage->Low.BBlock =   AT_BTREE_END_CHAIN;
     NewPage->Low.BTuple =   AT_BTREE_END_CHAIN;
@@ -908,7 +982,7 @@ volatile ATBTPH  *ATBTree::MakePageCopy(
     NewKeyPtrs = ATBTreeKeyPtrBase(NewPage);                                    // Figure out where the key ptrs are in the new page
     NewKeysBase = ATBTreeKeyBase(NewKeyPtrs);                                   // and where the keys themselves are
 
-    ATWaitQueueShareExclusive(&(Page->ALock));                                  // We now need to change something other readers might see, so make sure everyone is now out
+    WaitPageExclusive(&(Page->ALock));                                          // We now need to change something other readers might see, so make sure everyone is now out
                                                                                 // The TTuple field can be read by any readers...
     for ( i = 0; i < ToMove; ++i) {                                             // Loop through all the keys we have to move
         FreeSpot = NewPage->AvailableChain;                                     // Get a free spot in the new page
@@ -963,7 +1037,7 @@ retry_insert:
         CB->BBlock = inBBlock;                                                   // Set the block & tuple references from the tuple's home table
         CB->BTuple = inBTuple;
 
-        if ( !IsSplitPage ) ATWaitQueueShareExclusive(&(Page->ALock));          // Unless this is a newly created split, we now need to wait to make sure the share locks are all cleared before we modify the metadata
+        if ( !IsSplitPage ) WaitPageExclusive(&(Page->ALock));                  // Unless this is a newly created split, we now need to wait to make sure the share locks are all cleared before we modify the metadata
         for ( i = Page->NumberKeys; i > InsertPoint; i--)                       // Loop thru all ptrs above our insert point (backwards)
             KeyPtrs[i] = KeyPtrs[i - 1];                                        // Move them up to make a spot available
         KeyPtrs[InsertPoint] = FreeSpot;                                        // Stick our value into the ptrs list
@@ -1012,10 +1086,10 @@ int ATBTree::InsertKey(
 
     if ( PathDepth ) {                                                          // Did I accrue any locks?  Unusual, if not rare.
         for ( i = 0; i < PathDepth; ++i)                                        // Loop thru any locks we may need to free up
-            ATRemoveQueueShareExclusive((LockedPath[i].ALock));                 // Note remove and not free in case of an error condition where I did not wait
+            RemovePageExclusive((LockedPath[i].ALock));                         // Note remove and not free in case of an error condition where I did not wait
         PathDepth = 0;                                                          // Reset the PathDepth counter
     }
-    ATRemoveQueueShareExclusive(&(SearchFoundPage->ALock));                     // Release the lock on the leaf page- cautiously in case of an error where I did not wait
+    RemovePageExclusive(&(SearchFoundPage->ALock));                             // Release the lock on the leaf page- cautiously in case of an error where I did not wait
     return Result;
 }
 // **************************************************************************** InsertTuple
@@ -1028,6 +1102,146 @@ int ATBTree::InsertTuple(
     void *Key = ((MakeKey)((void*)Tuple));                                      // Get a key made from the tuple
     return InsertKey(Key, inBlock, inTuple);                                    // And insert it
 }
+// **************************************************************************** InsertTuples
+/*  The batch version of InsertTuple(), for bulk loads.  The keys are made and sorted up front, and then walked
+into the tree in order.  After each insert we keep our exclusive on the leaf, and as long as the next key is
+sure to belong there too- it sorts below the leaf's last key, or the leaf is the last one in the tree- and
+there is room for it, it goes straight in without another descent.  Anything else (a split, or a key past
+the leaf) lets go of the leaf and descends normally.  We never hold more than the one leaf between keys,
+so we can't deadlock anyone coming down the tree meanwhile.
+*/
+int ATBTree::InsertTuples(                                                      // Called when a run of tuples has been inserted into the associated table
+                                                                                // NOTE: GENERALLY NOT USER CALLED!  CALL THE TABLE's AddTuples() FUNCTION
+                                long            inCount,                        // Number of tuples in the run
+                                ATTuple         **inTuples,                     // Ptrs to the tuples to insert
+                                long            *inBlocks,                      // The unique block & tuple ID of each
+                                long            *inTupleNumbers,
+                                int             *ioResults                      // Each tuple's result- any not already ATERR_SUCCESS coming in are skipped
+                                ) {
+    volatile ATBTPH  *Page = NULL;
+    char    *Scratch, *Keys, *Key;
+    long    *Order, *Spare, Number = 0, i, j, k;
+
+    if ( inCount <= 0 ) return ATERR_SUCCESS;
+    if ( !(Scratch = new char[(inCount * KeyLength) + (2 * inCount * sizeof(long))]) ) {// Room for the keys & the sort
+        for ( i = 0; i < inCount; ++i )                                         // No room to sort- just do them one at a time
+            if ( ioResults[i] == ATERR_SUCCESS )
+                ioResults[i] = InsertTuple(inTuples[i], inBlocks[i], inTupleNumbers[i]);
+        return ATERR_SUCCESS;
+    }
+    Order = (long*)Scratch;
+    Spare = Order + inCount;
+    Keys = (char*)(Spare + inCount);
+    for ( i = 0; i < inCount; ++i ) {                                           // Make all of the keys
+        if ( ioResults[i] != ATERR_SUCCESS ) continue;                          // Somebody before us already turned this one away
+        memcpy((void*)(Keys + (i * KeyLength)), (MakeKey)((void*)inTuples[i]), KeyLength);// Copy it, since MakeKey may hand back the same spot every time
+        Order[Number++] = i;
+    }
+    SortBatch(Order, Spare, Number, Keys, inBlocks, inTupleNumbers);            // Put them in tree order
+
+    // NEVER EVER EVER DO AN INSERT WITH ANYTHING OTHER THAN FINDDIRECT- for example, FINDFIRST could really hose the lock tracking.
+    SearchCompareLength =   KeyLength;      SearchMode =    AT_BTREE_FINDDIRECT;// SEE NOTE ABOVE
+    for ( j = 0; j < Number; ++j ) {                                            // Now walk them into the tree
+        i = Order[j];
+        Key = Keys + (i * KeyLength);
+        PagesSplit = 0;                                                         // Make sure our page split ctr is starting from zero
+        if ( Page ) {                                                           // Still holding the last key's leaf?
+            if ( Page->AvailableChain != AT_BTREE_END_CHAIN &&                  // As long as it has room, and this key is sure to belong in it
+                    KeyInLeaf(Page, Key, inBlocks[i], inTupleNumbers[i]) ) {
+                ioResults[i] = InsertKeyIntoPage(Page, (void*)Key, Page->Block, Page->Tuple, inBlocks[i], inTupleNumbers[i], 0);
+                continue;                                                       // No split could have happened- there was room
+            }
+            RemovePageExclusive(&(Page->ALock));                                // Otherwise let go of it and go down the normal way
+            Page = NULL;
+        }
+        SearchLockMode =    AT_BTREE_WRITE_OPTIMISTIC;
+        PagedFindKey((void*)Key, inBlocks[i], inTupleNumbers[i]);               // Find the location for insertion
+        ioResults[i] = InsertKeyIntoPage(SearchFoundPage, (void*)Key, SearchFoundPage->Block,// Insert the key into the page we located
+                    SearchFoundPage->Tuple, inBlocks[i], inTupleNumbers[i], 0);
+
+        if ( PathDepth || PagesSplit ) {                                        // Split pages move keys around (even the root)- don't trust this leaf for the next key
+            for ( k = 0; k < PathDepth; ++k)                                    // Loop thru any locks we may need to free up
+                RemovePageExclusive((LockedPath[k].ALock));                     // Note remove and not free in case of an error condition where I did not wait
+            PathDepth = 0;                                                      // Reset the PathDepth counter
+            RemovePageExclusive(&(SearchFoundPage->ALock));                     // Release the lock on the leaf page- cautiously in case of an error where I did not wait
+        }
+        else
+            Page = SearchFoundPage;                                             // Hang on to the leaf for the next key
+    }
+    if ( Page )
+        RemovePageExclusive(&(Page->ALock));                                    // Release the last leaf
+    delete[] Scratch;
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** KeyInLeaf
+int ATBTree::KeyInLeaf(                                                         // Internal routine to tell if a key that sorts after the leaf's keys so far is sure to belong in the leaf- caller holds the leaf
+                                volatile ATBTPH *Page,                          // Leaf page
+                                void            *inKey,                         // Key to check
+                                long            inBlock,                        // Its table block & tuple
+                                long            inTuple
+                                ) {
+    long            *KeyPtrs, *KeysBase;
+    volatile ATBTCB *CB;
+
+    if ( Page->NextPage.BBlock == AT_BTREE_END_CHAIN )                          // The last leaf takes everything past its first key
+        return 1;
+    if ( !Page->NumberKeys )
+        return 0;
+    KeyPtrs = ATBTreeKeyPtrBase(Page);                                          // Figure out where the key ptrs are
+    KeysBase = ATBTreeKeyBase(KeyPtrs);                                         // and where the keys themselves are
+    CB = ATBTreeKey(KeyPtrs, KeysBase, Page->NumberKeys - 1);                   // Anything below the last key is inside the leaf's range
+    return CompareEntry(inKey, inBlock, inTuple, (void*)(CB + 1), CB->TBlock, CB->TTuple) < 0;
+}
+// **************************************************************************** CompareEntry
+long ATBTree::CompareEntry(                                                     // Internal routine to compare two keys the way the tree orders them- secondaries go by table block & tuple as well
+                                void            *inKey1,                        // First key
+                                long            inBlock1,                       // and its table block & tuple
+                                long            inTuple1,
+                                void            *inKey2,                        // Second key
+                                long            inBlock2,                       // and its table block & tuple
+                                long            inTuple2
+                                ) {
+    long    Result;
+    if ( (Result = (Compare)(inKey1, inKey2, KeyLength)) || IndexType == AT_BTREE_PRIMARY )
+        return Result;
+    if ( (Result = inBlock1 - inBlock2) )
+        return Result;
+    return inTuple1 - inTuple2;
+}
+// **************************************************************************** SortBatch
+void ATBTree::SortBatch(                                                        // Internal routine to sort a batch of keys into tree order- a bottom up merge sort, so runs already in order cost next to nothing
+                                long            *ioOrder,                       // The key numbers to sort
+                                long            *inSpare,                       // Room for as many again
+                                long            inCount,                        // Number of keys
+                                char            *inKeys,                        // The keys, KeyLength apart
+                                long            *inBlocks,                      // Their table blocks & tuples
+                                long            *inTuples
+                                ) {
+    long    *From = ioOrder, *To = inSpare, *Swap, Width, Low, Mid, High, l, r, o;
+
+    for ( Width = 1; Width < inCount; Width <<= 1 ) {                           // Merge runs of Width into runs of twice that
+        for ( Low = 0; Low < inCount; Low += (Width << 1) ) {
+            Mid = Low + Width;              if ( Mid > inCount ) Mid = inCount;
+            High = Mid + Width;             if ( High > inCount ) High = inCount;
+            l = Low; r = Mid; o = Low;
+            if ( Mid < High && CompareEntry(inKeys + (From[Mid - 1] * KeyLength), inBlocks[From[Mid - 1]], inTuples[From[Mid - 1]],
+                    inKeys + (From[Mid] * KeyLength), inBlocks[From[Mid]], inTuples[From[Mid]]) > 0 ) {// Unless the two are already in order
+                while ( l < Mid && r < High ) {
+                    if ( CompareEntry(inKeys + (From[r] * KeyLength), inBlocks[From[r]], inTuples[From[r]],
+                            inKeys + (From[l] * KeyLength), inBlocks[From[l]], inTuples[From[l]]) < 0 )
+                        To[o++] = From[r++];
+                    else                                                        // Ties keep their order
+                        To[o++] = From[l++];
+                }
+            }
+            while ( l < Mid )   To[o++] = From[l++];
+            while ( r < High )  To[o++] = From[r++];
+        }
+        Swap = From; From = To; To = Swap;
+    }
+    if ( From != ioOrder )                                                      // Make sure the answer ends up where the caller wants it
+        memcpy((void*)ioOrder, (void*)From, inCount * sizeof(long));
+}
 // **************************************************************************** Constructor
 ATBTree::ATBTree() {
     Reset();
@@ -1088,6 +1302,18 @@ void ATBTree::InitNewPage(
     CB->TTuple = AT_BTREE_END_CHAIN;                                            // Mark the last guy as the end of the chain
 }
 
+// **************************************************************************** SetCreateOptions
+int ATBTree::SetCreateOptions(                                                  // Set the AT_TABLE_* options for the page table made by the next Create() call
+                                long        inOptions                           // Any of the AT_TABLE_* flags or'd together, zero for the defaults
+                                ) {
+    return PageMan.SetCreateOptions(inOptions);                                 // Our pages live in a table, so let it handle it
+}
+// **************************************************************************** PreAttachPages
+int ATBTree::PreAttachPages(                                                    // Attach every block of the page table now, rather than as each is first touched- for a warm start after Open()
+                                int         inThreads                           // Threads to spread the attaching over, zero for one per processor we can run on
+                                ) {
+    return PageMan.PreAttachBlocks(inThreads);                                  // Our pages live in a table, so let it handle it
+}
 // **************************************************************************** Create
 int ATBTree::Create(                                                            // Create a BTree
                                 int         inKey,                              // Systemwide unique IPC ID for this BTree- BECOMES A SHARED MEMORY KEY as well, so, again, it must be system wide IPC unique
@@ -1151,6 +1377,7 @@ int ATBTree::Create(
     Info->IndexType =       IndexType;
     Info->SystemKey =       inKey;
     Info->TotalPageSize =   StartAlloc;
+    memset((void*)(Info->RootSlots), 0, sizeof(Info->RootSlots));
 
     if ( !(Root = (volatile ATBTPH*)PageMan.AllocateTuple()) )                  // Set up our root page
         return ATERR_OUT_OF_MEMORY;
@@ -1159,6 +1386,7 @@ int ATBTree::Create(
     Root->PageType =        AT_BTREE_LEAF;
     Root->PageKey =         AT_BTREE_ROOT;
     Root->ALock =           0;
+    Root->Owner =           0;
     Root->NumberKeys =      0;
     Root->Low.BBlock =      AT_BTREE_END_CHAIN;
     Root->Low.BTuple =      AT_BTREE_END_CHAIN;
@@ -1227,7 +1455,7 @@ int ATBTree::Open(
 // **************************************************************************** Close
 int ATBTree::Close() {                                                          // Close the BTree & free all resources
     if ( CursorPage )                                                           // Clean up any open cursor locks
-        ATFreeShare(&(CursorPage->ALock));
+        FreePageShare(&(CursorPage->ALock));
     CursorPage = NULL;
     PageMan.CloseTable();                                                       // Close the BTree table
     if ( Table )
@@ -1282,7 +1510,7 @@ retry:
         CB = (((volatile ATBTCB*)SearchVal) - 1);
         Tuple = Table->SetTuple(CB->TBlock, CB->TTuple);                        // Set the table's cursor to the tuple
         if ( LockMode && !CursorOp )                                            // If this in not a cursor op and we did locking, we can now free our lock(s)
-            ATFreeShare(&(SearchFoundPage->ALock));
+            FreePageShare(&(SearchFoundPage->ALock));
         return Tuple;
     }
     if ( !LockMode ) {                                                          // If I'm not in locking mode
@@ -1290,7 +1518,7 @@ retry:
         goto retry;
     }
     if ( LockMode && !CursorOp )                                                // If this in not a cursor op and we did locking, we can now free our read lock
-        ATFreeShare(&(SearchFoundPage->ALock));
+        FreePageShare(&(SearchFoundPage->ALock));
     return NULL;
 }
 // **************************************************************************** SetCursor
@@ -1306,7 +1534,7 @@ ATTuple *ATBTree::SetCursor(
     ATTuple *Return;
 
     if ( CursorPage )                                                           // In case we forgot we have an open lock
-        ATFreeShare(&(CursorPage->ALock));
+        FreePageShare(&(CursorPage->ALock));
     // BTW, we ALWAYS have to use crab locks with cursors because of the FINDFIRST thing- see FindInPage to see why
     CursorOp = 1;                                                               // Let class know this is a cursor op
     if ( (Return = FindTuple(inKey, AT_BTREE_READ_CRABLOCK, FindMode, inMatchLength)) ) {// Try to find it
@@ -1330,8 +1558,8 @@ found_it:
         while ( SearchFoundPage->NextPage.BBlock != AT_BTREE_END_CHAIN ) {      // As long as there are more pages left
             PH = (volatile ATBTPH*)PageMan.LocateTuple(                         // Find that next page
                     SearchFoundPage->NextPage.BBlock, SearchFoundPage->NextPage.BTuple);
-            ATGetShare(&(PH->ALock));                                           // Get a shared lock on it
-            ATFreeShare(&(SearchFoundPage->ALock));                             // Free up our old lock
+            GetPageShare(&(PH->ALock));                                         // Get a shared lock on it
+            FreePageShare(&(SearchFoundPage->ALock));                           // Free up our old lock
             CursorPage = SearchFoundPage = PH;
             Found = FindInPage(SearchFoundPage, inKey, 0, 0);                   // Is it in this page?
             if ( Found ) {                                                      // If we find it
@@ -1352,8 +1580,8 @@ found_it:
         while ( SearchFoundPage->PrevPage.BBlock != AT_BTREE_END_CHAIN ) {      // As long as there are more pages left
             PH = (volatile ATBTPH*)PageMan.LocateTuple(                         // Find that next page
                     SearchFoundPage->PrevPage.BBlock, SearchFoundPage->PrevPage.BTuple);
-            ATGetShare(&(PH->ALock));                                           // Get a shared lock on it
-            ATFreeShare(&(SearchFoundPage->ALock));                             // Free up our old lock
+            GetPageShare(&(PH->ALock));                                         // Get a shared lock on it
+            FreePageShare(&(SearchFoundPage->ALock));                           // Free up our old lock
             CursorPage = SearchFoundPage = PH;
             Found = FindInPage(SearchFoundPage, inKey, 0, 0);                   // Is it in this page?
             if ( Found ) {                                                      // If we find it
@@ -1378,12 +1606,12 @@ ATTuple *ATBTree::SetCursorToStart() {
     long            Result;
 
     if ( CursorPage )                                                           // In case we forgot we have an open lock
-        ATFreeShare(&(CursorPage->ALock));
+        FreePageShare(&(CursorPage->ALock));
     SearchLockMode = AT_BTREE_READ_CRABLOCK;                                    // Set our locking mode
 
 restart:
     SearchFoundPage = Root;                                                     // Start at the root
-    ATGetShare(&(Root->ALock));                                                 // Start with a share lock on the root
+    GetPageShare(&(Root->ALock));                                               // Start with a share lock on the root
 
     while ( SearchFoundPage->PageType != AT_BTREE_LEAF ) {                      // Until we get to the leaf page...
         NextPage = (volatile ATBTPH*)PageMan.LocateTuple(SearchFoundPage->Low.BBlock,// Get the first page in the tree
@@ -1408,12 +1636,12 @@ ATTuple *ATBTree::SetCursorToEnd() {
     long            Result;
 
     if ( CursorPage )                                                           // In case we forgot we have an open lock
-        ATFreeShare(&(CursorPage->ALock));
+        FreePageShare(&(CursorPage->ALock));
     SearchLockMode = AT_BTREE_READ_CRABLOCK;                                    // Set our locking mode
 
 restart:
     SearchFoundPage = Root;                                                     // Start at the root
-    ATGetShare(&(Root->ALock));                                                 // Start with a share lock on the root
+    GetPageShare(&(Root->ALock));                                               // Start with a share lock on the root
 
     while ( SearchFoundPage->PageType != AT_BTREE_LEAF ) {                      // Until we get to the leaf page...
         CB = ATBTreeKeyDirect(SearchFoundPage, SearchFoundPage->NumberKeys - 1, T1, T2);// Find the last record in the page
@@ -1455,8 +1683,8 @@ retry:
                 volatile ATBTPH *OldPH = CursorPage;                            // Save the old page ptr
                 CursorPage = (volatile ATBTPH*)PageMan.LocateTuple(CursorPage->NextPage.BBlock,// Move to the next page
                                                CursorPage->NextPage.BTuple);
-                ATGetShare(&(CursorPage->ALock));                               // Get lock on the next page
-                ATFreeShare(&(OldPH->ALock));                                   // Free up the old lock
+                GetPageShare(&(CursorPage->ALock));                             // Get lock on the next page
+                FreePageShare(&(OldPH->ALock));                                 // Free up the old lock
                 CursorTuple = 0;                                                // Start at zero
                 goto retry;                                                     // And give 'er another go
             }
@@ -1494,8 +1722,8 @@ retry:
                 volatile ATBTPH *OldPH = CursorPage;                            // Save the old page ptr
                 CursorPage = (volatile ATBTPH*)PageMan.LocateTuple(CursorPage->PrevPage.BBlock,// Move to the prev page
                                                 CursorPage->PrevPage.BTuple);
-                ATGetShare(&(CursorPage->ALock));                               // Get lock on the next page
-                ATFreeShare(&(OldPH->ALock));                                   // Free up the old lock
+                GetPageShare(&(CursorPage->ALock));                             // Get lock on the next page
+                FreePageShare(&(OldPH->ALock));                                 // Free up the old lock
                 CursorTuple = CursorPage->NumberKeys - 1;                       // Start at the end
                 goto retry;                                                     // And give 'er another go
             }
@@ -1510,7 +1738,7 @@ retry:
 // **************************************************************************** FreeCursor
 int ATBTree::FreeCursor() {                                                     // Call to release any locks the cursor holds, and reset it
     if ( CursorPage )                                                           // If it was in use
-        ATFreeShare(&(CursorPage->ALock));                                      // Free the last page lock held
+        FreePageShare(&(CursorPage->ALock));                                    // Free the last page lock held
 
     CursorPage = NULL;                                                          // Then reset the cursor
     CursorTuple = 0;
@@ -1544,7 +1772,7 @@ int ATBTree::DeleteKey(
     PagesSplit = 0;                                                             // Make sure our page split ctr is starting from zero
     Result = DeleteKeyFromPage(inKey, inBlock, inTuple);                        // Delete the key from the page we located
 
-    ATRemoveQueueShareExclusive(&(SearchFoundPage->ALock));                     // Release the lock on the leaf page- cautiously in case of an error where I did not wait
+    RemovePageExclusive(&(SearchFoundPage->ALock));                             // Release the lock on the leaf page- cautiously in case of an error where I did not wait
     return Result;
 }
 // **************************************************************************** DeleteKeyFromPage
@@ -1565,7 +1793,7 @@ int ATBTree::DeleteKeyFromPage(
     CB = ATBTreeKey(KeyPtrs, KeysBase, SearchContainedIn);                      // Get a CB ptr to the key
     if ( CB->TTuple != inTuple || CB->TBlock != inBlock )                       // But we MUST double check, because it might be that someone tried to insert a dupe, and we are now in rollback mode
         return ATERR_NOT_FOUND;
-    ATWaitQueueShareExclusive(&(SearchFoundPage->ALock));                       // Now we need to wait for the readers to leave
+    WaitPageExclusive(&(SearchFoundPage->ALock));                               // Now we need to wait for the readers to leave
     CB->TTuple = SearchFoundPage->AvailableChain;                               // Make myself part of the chain
     SearchFoundPage->AvailableChain = KeyPtrs[SearchContainedIn];               // Point the chain to me
 
@@ -28,6 +28,8 @@
 #include <memory.h>
 #include <assert.h>
 #include <ctype.h>
+#include <stdio.h>
+#include <errno.h>
 
 #ifdef      AT_WIN32
     #include	<windows.h>
@@ -36,11 +38,45 @@
     #include    <sys/types.h>
     #include    <sys/ipc.h>
     #include    <sys/shm.h>
+    #include    <sys/mman.h>
+    #include    <sys/stat.h>
+    #include    <fcntl.h>
 #endif
 
 #include "memory.h"
 #include "general.h"
-
+#include "sem.h"
+
+
+// Name of the POSIX object for a key- under / for shm_open, or under AT_SHMEM_HUGE_DIR on the huge page mount
+#define     AT_SHMEM_NAME           "/atlas.%d"
+// Most arenas one process keeps track of- past this, each attach maps its own (and a second one in the same process fails)
+#define     AT_SHMEM_MAX_ARENAS     (64)
+
+struct ATArenaMapping {                                                         // An arena this process has mapped
+    char            *Address;                                                   // Where, NULL for a free entry
+    long            Users;                                                      // Objects in this process attached to it
+};
+// Arenas mapped in this process- every table object (one per thread) attached to an arena shares the one mapping,
+// since it can only go at the one address
+static struct ATArenaMapping ATArenaMaps[AT_SHMEM_MAX_ARENAS];
+static ATLOCK   ATArenaLock = 0;                                                // Process local lock for the above
+
+static long ATHugePageSize();
+static int  ATShareArena(
+                    char        *inAddress
+                    );
+static void ATAddArena(
+                    char        *inAddress
+                    );
+static long ATDropArena(
+                    char        *inAddress
+                    );
+static void ATSharedMemName(
+                    int         Key,
+                    int         Kind,
+                    char        *Name
+                    );
 
 // ****************************************************************************
 // ****************************************************************************
@@ -50,6 +86,9 @@
 
 // **************************************************************************** Constructor
 ATSharedMem::ATSharedMem() {
+    Backend = AT_SHMEM_SYSV;                                                    // SysV, like always, unless told otherwise
+    BackendFlags = 0;
+    Handle = -1;
     Reset();                                                                    // Clean up the object
 }
 
@@ -59,21 +98,59 @@ ATSharedMem::~ATSharedMem() {
     Reset();                                                                    // Clean up the object
 }
 
+// **************************************************************************** SetBackend
+int     ATSharedMem::SetBackend(                                                // Set where the next CreateSharedMem() puts the memory- attaching finds it wherever it is
+                            int             inBackend,                          // AT_SHMEM_SYSV (the default) or AT_SHMEM_POSIX
+                            int             inFlags                             // AT_SHMEM_* flags or'd together, zero for none
+                            ) {
+    if ( inBackend != AT_SHMEM_SYSV && inBackend != AT_SHMEM_POSIX ) return ATERR_BAD_PARAMETERS;
+    if ( inFlags & ~AT_SHMEM_HUGEPAGES ) return ATERR_BAD_PARAMETERS;           // Don't know what that is
+    Backend = inBackend;
+    BackendFlags = inFlags;
+    return ATERR_SUCCESS;
+}
+
 // **************************************************************************** CreateSharedMem
 int    ATSharedMem::CreateSharedMem(                                            // Create a shared memory object- returns a handle to the object & automatically attaches to it
                             int             Key,                                // Key ID for the object
-                            int             Size                                // Size in bytes to be allocated
+                            long            Size                                // Size in bytes to be allocated
                             ) {
+    ATSMHeader      *Header;
+    long            Mapped, Huge = 0;
+
     if ( Base != NULL ) return ATERR_OBJECT_IN_USE;                             // Don't allow this object to be screwed up
 
-    SysID = shmget((key_t)Key, Size + sizeof(int), IPC_CREAT | IPC_EXCL | 0666 );// Try to alloc the memory ( with a little extra for us )
+    Mapped = Size + sizeof(ATSMHeader);                                         // With a little extra for us
+    if ( Backend == AT_SHMEM_POSIX )
+        return CreatePOSIX(Key, Mapped);
+
+    SysID = -1;
+    if ( BackendFlags & AT_SHMEM_HUGEPAGES ) {                                  // Try for real huge pages first- they only come whole
+        Huge = ATHugePageSize();
+        Huge = (Mapped + (Huge - 1)) & ~(Huge - 1);
+        if ( (SysID = shmget((key_t)Key, Huge, IPC_CREAT | IPC_EXCL | SHM_HUGETLB | 0666 )) > -1 )
+            Mapped = Huge;
+        else
+            Huge = 0;                                                           // None reserved, most likely- settle for normal pages
+    }
+    if ( SysID < 0 )
+        SysID = shmget((key_t)Key, Mapped, IPC_CREAT | IPC_EXCL | 0666 );       // Try to alloc the memory
 
     if ( SysID > -1 ) {                                                         // If we could allocate the memory...
         Base = (char *)shmat(SysID, 0, 0);                                      // Now attach to it
-        if ( (int)Base == -1 ) return ATERR_OUT_OF_MEMORY;
-        Allocated = Size;
-        UserBase = Base + sizeof(long);                                         // Save a ptr to the user memory
-        *((long *)Base) = Allocated;                                            // We write out the size of the block as the first int
+        if ( Base == (char *)-1 ) {
+            shmctl(SysID, IPC_RMID, NULL);                                      // Nobody else can have it yet, so don't leave it lying around
+            Reset();
+            return ATERR_OUT_OF_MEMORY;
+        }
+        if ( (BackendFlags & AT_SHMEM_HUGEPAGES) && !Huge )                     // Let transparent huge pages have a go at it
+            madvise(Base, Mapped, MADV_HUGEPAGE);
+        Header = (ATSMHeader *)Base;                                            // We write out what we made at the front of the block
+        Header->Allocated = Allocated = Size;
+        Header->Kind = AT_SHMEM_SYSV;
+        Header->Mapped = Mapped;
+        Header->SysID = SysID;
+        UserBase = Base + sizeof(ATSMHeader);                                   // Save a ptr to the user memory
         IAmCreator = 1;                                                         // Save the fact that I am the creator of the memory
         return ATERR_SUCCESS;
     }
@@ -81,6 +158,259 @@ int    ATSharedMem::CreateSharedMem(
     return ATERR_OUT_OF_MEMORY;
 }
 
+// **************************************************************************** CreatePOSIX
+int     ATSharedMem::CreatePOSIX(                                               // Internal routine to create the memory as a POSIX shared memory object
+                            int             Key,                                // Key ID for the object
+                            long            Size                                // Size in bytes to be allocated, header included
+                            ) {
+    char            Name[AT_MAX_PATH];
+    int             Handle = -1, Kind = AT_SHMEM_POSIX;
+    long            Length = Size, Huge;
+    void            *Map = MAP_FAILED;
+    ATSMHeader      *Header;
+
+    if ( BackendFlags & AT_SHMEM_HUGEPAGES ) {                                  // Try for real huge pages first- a file on the hugetlbfs mount
+        Huge = ATHugePageSize();
+        Length = (Size + (Huge - 1)) & ~(Huge - 1);                             // They only come whole
+        ATSharedMemName(Key, AT_SHMEM_HUGEFS, Name);
+        if ( (Handle = open(Name, O_RDWR | O_CREAT | O_EXCL, 0666)) > -1 ) {
+            if ( ftruncate(Handle, Length) == 0 )
+                Map = mmap(NULL, Length, PROT_READ | PROT_WRITE, MAP_SHARED, Handle, 0);
+            if ( Map == MAP_FAILED ) {                                          // None reserved, most likely- settle for normal pages
+                close(Handle);
+                unlink(Name);
+            }
+            else
+                Kind = AT_SHMEM_HUGEFS;
+        }
+        else if ( errno == EEXIST ) {                                           // Somebody already has this key
+            Reset();
+            return ATERR_OUT_OF_MEMORY;
+        }
+    }
+
+    if ( Map == MAP_FAILED ) {                                                  // Plain POSIX shared memory
+        Length = Size;
+        ATSharedMemName(Key, AT_SHMEM_POSIX, Name);
+        if ( (Handle = shm_open(Name, O_RDWR | O_CREAT | O_EXCL, 0666)) < 0 ) {
+            Reset();
+            return ATERR_OUT_OF_MEMORY;
+        }
+        if ( ftruncate(Handle, Length) == 0 )
+            Map = mmap(NULL, Length, PROT_READ | PROT_WRITE, MAP_SHARED, Handle, 0);
+        if ( Map == MAP_FAILED ) {
+            close(Handle);
+            shm_unlink(Name);
+            Reset();
+            return ATERR_OUT_OF_MEMORY;
+        }
+        if ( BackendFlags & AT_SHMEM_HUGEPAGES )                                // Let transparent huge pages have a go at it
+            madvise(Map, Length, MADV_HUGEPAGE);
+    }
+    fchmod(Handle, 0666);                                                       // Open to everyone, same as the SysV ones- the umask doesn't get a say
+    close(Handle);                                                              // The mapping keeps it alive
+
+    Base = (char *)Map;
+    SysID = Key;                                                                // The key is all anyone needs to find it again
+    Header = (ATSMHeader *)Base;                                                // We write out what we made at the front of the block
+    Header->Allocated = Allocated = Size - sizeof(ATSMHeader);
+    Header->Kind = Kind;
+    Header->Mapped = Length;
+    Header->SysID = SysID;
+    UserBase = Base + sizeof(ATSMHeader);                                       // Save a ptr to the user memory
+    IAmCreator = 1;                                                             // Save the fact that I am the creator of the memory
+    return ATERR_SUCCESS;
+}
+
+// **************************************************************************** CreateArena
+int     ATSharedMem::CreateArena(                                               // Create a POSIX shared memory object that grows in place, at the same address in every process- automatically attaches to it
+                            int             Key,                                // Key ID for the object
+                            long            Reserve,                            // Most bytes it can ever grow to- address space only, until grown into
+                            long            Size                                // Size in bytes usable right away
+                            ) {
+    char            Name[AT_MAX_PATH];
+    int             NewHandle;
+
+    if ( Base != NULL ) return ATERR_OBJECT_IN_USE;                             // Don't allow this object to be screwed up
+    if ( Size < 0 || Size > Reserve ) return ATERR_BAD_PARAMETERS;
+
+    ATSharedMemName(Key, AT_SHMEM_ARENA, Name);
+    if ( (NewHandle = shm_open(Name, O_RDWR | O_CREAT | O_EXCL, 0666)) < 0 ) {
+        Reset();
+        return ATERR_OUT_OF_MEMORY;
+    }
+    SysID = Key;                                                                // The key is all anyone needs to find it again
+    if ( SetUpArena(NewHandle, Reserve, Size, AT_SHMEM_ARENA) != ATERR_SUCCESS ) {
+        close(NewHandle);
+        shm_unlink(Name);
+        Reset();
+        return ATERR_OUT_OF_MEMORY;
+    }
+    fchmod(NewHandle, 0666);                                                    // Open to everyone, same as the SysV ones- the umask doesn't get a say
+    close(NewHandle);                                                           // The mapping keeps it alive
+    return ATERR_SUCCESS;
+}
+
+// **************************************************************************** CreateFileArena
+int     ATSharedMem::CreateFileArena(                                           // Create an arena kept in a file, so it outlives us- automatically attaches to it
+                            char            *inPath,                            // File to keep it in- must not exist yet
+                            long            Reserve,                            // Most bytes it can ever grow to- address space only, until grown into
+                            long            Size                                // Size in bytes usable right away
+                            ) {
+    int             NewHandle;
+
+    if ( Base != NULL ) return ATERR_OBJECT_IN_USE;                             // Don't allow this object to be screwed up
+    if ( !inPath || Size < 0 || Size > Reserve ) return ATERR_BAD_PARAMETERS;
+
+    if ( (NewHandle = open(inPath, O_RDWR | O_CREAT | O_EXCL, 0666)) < 0 ) {
+        Reset();
+        return ATERR_FILE_ERROR;
+    }
+    if ( SetUpArena(NewHandle, Reserve, Size, AT_SHMEM_FILE) != ATERR_SUCCESS ) {
+        close(NewHandle);
+        unlink(inPath);
+        Reset();
+        return ATERR_OUT_OF_MEMORY;
+    }
+    Handle = NewHandle;                                                         // Keep it open- growing it needs it
+    return ATERR_SUCCESS;
+}
+
+// **************************************************************************** SetUpArena
+int     ATSharedMem::SetUpArena(                                                // Internal routine to size, map & stamp a new arena- the caller cleans up the handle if it fails
+                            int             inHandle,                           // Open shared memory object or file
+                            long            Reserve,                            // Most bytes it can ever grow to
+                            long            Size,                               // Size in bytes usable right away
+                            int             inKind                              // AT_SHMEM_ARENA or AT_SHMEM_FILE
+                            ) {
+    void            *Map;
+    ATSMHeader      *Header;
+
+    if ( ftruncate(inHandle, Size + sizeof(ATSMHeader)) )                       // Only back what we need now
+        return ATERR_OUT_OF_MEMORY;
+    Map = mmap(NULL, Reserve + sizeof(ATSMHeader), PROT_READ | PROT_WRITE,      // But claim the address space for all of it
+        MAP_SHARED | MAP_NORESERVE, inHandle, 0);
+    if ( Map == MAP_FAILED )
+        return ATERR_OUT_OF_MEMORY;
+    if ( BackendFlags & AT_SHMEM_HUGEPAGES )                                    // Let transparent huge pages have a go at it
+        madvise(Map, Reserve + sizeof(ATSMHeader), MADV_HUGEPAGE);
+
+    Base = (char *)Map;
+    ATAddArena(Base);                                                           // So other objects in this process can share it
+    Header = (ATSMHeader *)Base;                                                // We write out what we made at the front of the block
+    Header->Allocated = Allocated = Size;
+    Header->Kind = inKind;
+    Header->Mapped = Reserve + sizeof(ATSMHeader);
+    Header->SysID = SysID;
+    Header->Address = Base;                                                     // Everyone else goes here too
+    UserBase = Base + sizeof(ATSMHeader);                                       // Save a ptr to the user memory
+    IAmCreator = 1;                                                             // Save the fact that I am the creator of the memory
+    return ATERR_SUCCESS;
+}
+
+// **************************************************************************** MapArena
+int     ATSharedMem::MapArena(                                                  // Internal routine to map an existing arena, where its header says to
+                            int             inHandle,                           // Open shared memory object or file
+                            ATSMHeader      *inHeader,                          // Copy of its header
+                            int             inAnywhere                          // Set to true to map it wherever it fits, and make that its address from now on
+                            ) {
+    int             Flags = MAP_SHARED | MAP_NORESERVE;
+    void            *Map;
+
+    if ( !inAnywhere && ATShareArena(inHeader->Address) ) {                     // Already mapped in this process- just use it
+        Map = inHeader->Address;
+    }
+    else if ( inAnywhere ) {
+        if ( (Map = mmap(NULL, inHeader->Mapped, PROT_READ | PROT_WRITE, Flags, inHandle, 0)) == MAP_FAILED )
+            return ATERR_OUT_OF_MEMORY;
+        ((ATSMHeader *)Map)->Address = (char *)Map;                             // Everyone after us comes here
+        ATAddArena((char *)Map);
+    }
+    else {                                                                      // It has to go where everyone else has it
+#ifdef      MAP_FIXED_NOREPLACE
+        Flags |= MAP_FIXED_NOREPLACE;                                           // Never on top of something else- older kernels just take it as a hint
+#endif
+        Map = mmap(inHeader->Address, inHeader->Mapped, PROT_READ | PROT_WRITE, Flags, inHandle, 0);
+        if ( Map != (void *)inHeader->Address ) {                               // Something is in the way
+            if ( Map != MAP_FAILED ) munmap(Map, inHeader->Mapped);
+            return ATERR_UNSAFE_OPERATION;
+        }
+        ATAddArena((char *)Map);
+    }
+    Base = (char *)Map;
+    Allocated = ((ATSMHeader *)Base)->Allocated;                                // Get the size from the header
+    UserBase = Base + sizeof(ATSMHeader);                                       // Save a ptr to the user memory
+    return ATERR_SUCCESS;
+}
+
+// **************************************************************************** AttachFileArena
+int     ATSharedMem::AttachFileArena(                                           // Attach to an arena kept in a file
+                            char            *inPath,                            // File it is kept in
+                            int             inRestart                           // Set to true if nobody has it attached (first one up after a restart)- maps it wherever it fits
+                            ) {
+    int             NewHandle, Result;
+    ATSMHeader      Header;
+
+    if ( Base != NULL ) return ATERR_OBJECT_IN_USE;                             // Don't allow this object to be screwed up
+    if ( !inPath ) return ATERR_BAD_PARAMETERS;
+
+    if ( (NewHandle = open(inPath, O_RDWR)) < 0 ) {
+        Reset();
+        return ATERR_NOT_FOUND;
+    }
+    if ( pread(NewHandle, &Header, sizeof(ATSMHeader), 0) != sizeof(ATSMHeader) ||// Make sure it is one of ours
+            Header.Kind != AT_SHMEM_FILE ) {
+        close(NewHandle);
+        Reset();
+        return ATERR_BAD_PARAMETERS;
+    }
+    if ( (Result = MapArena(NewHandle, &Header, inRestart)) != ATERR_SUCCESS ) {
+        close(NewHandle);
+        Reset();
+        return Result;
+    }
+    SysID = Header.SysID;
+    Handle = NewHandle;                                                         // Keep it open- growing it needs it
+    return ATERR_SUCCESS;
+}
+
+// **************************************************************************** SyncSharedMem
+int     ATSharedMem::SyncSharedMem() {                                          // Write a file arena's changes out to its file, returning once they are there- nothing to do for the other kinds
+    volatile ATSMHeader *Header = (volatile ATSMHeader *)Base;
+
+    if ( !Base ) return ATERR_BAD_PARAMETERS;
+    if ( Header->Kind != AT_SHMEM_FILE ) return ATERR_SUCCESS;
+    if ( msync(Base, Header->Allocated + sizeof(ATSMHeader), MS_SYNC) )         // Only the pages that changed get written
+        return ATERR_FILE_ERROR;
+    return ATERR_SUCCESS;
+}
+
+// **************************************************************************** GrowArena
+int     ATSharedMem::GrowArena(                                                 // Make more of an arena usable- every process attached sees it at once
+                            long            Size                                // Size in bytes it should have- it never shrinks
+                            ) {
+    volatile ATSMHeader *Header = (volatile ATSMHeader *)Base;
+    char            Name[AT_MAX_PATH];
+    int             GrowHandle, Result;
+
+    if ( !Base || (Header->Kind != AT_SHMEM_ARENA && Header->Kind != AT_SHMEM_FILE) ) return ATERR_BAD_PARAMETERS;
+    if ( Size + (long)sizeof(ATSMHeader) > Header->Mapped ) return ATERR_OUT_OF_MEMORY;// Past the end of the reserve
+    if ( Size <= Header->Allocated ) return ATERR_SUCCESS;                      // Someone already grew it this far
+
+    if ( Header->Kind == AT_SHMEM_FILE )                                        // We kept the file open for this
+        Result = ftruncate(Handle, Size + sizeof(ATSMHeader));
+    else {
+        ATSharedMemName(Header->SysID, AT_SHMEM_ARENA, Name);
+        if ( (GrowHandle = shm_open(Name, O_RDWR, 0)) < 0 )
+            return ATERR_OUT_OF_MEMORY;
+        Result = ftruncate(GrowHandle, Size + sizeof(ATSMHeader));              // The mappings already cover it, so that's all it takes
+        close(GrowHandle);
+    }
+    if ( Result ) return ATERR_OUT_OF_MEMORY;
+    Header->Allocated = Allocated = Size;
+    return ATERR_SUCCESS;
+}
+
 // **************************************************************************** AttachSharedMem
 int     ATSharedMem::AttachSharedMem(                                           // Attach to an already created shared memory object- returns a handle
                             int             Key                                 // Key ID for the object
@@ -90,13 +420,79 @@ int     ATSharedMem::AttachSharedMem(
     SysID = shmget((key_t)Key, 0, 0);                                           // Try to access the memory
     if ( SysID > -1 ) {                                                         // If we could access the memory...
         Base = (char *)shmat(SysID, 0, 0);                                      // Now attach to it
-        if ( (int)Base == -1 ) return ATERR_OUT_OF_MEMORY;
-        Allocated = *((long *)Base);                                            // Get the size from the first int
-        UserBase = Base + sizeof(long);                                         // Save a ptr to the user memory
+        if ( Base == (char *)-1 ) {
+            Reset();
+            return ATERR_OUT_OF_MEMORY;
+        }
+        Allocated = ((ATSMHeader *)Base)->Allocated;                            // Get the size from the header
+        UserBase = Base + sizeof(ATSMHeader);                                   // Save a ptr to the user memory
         return ATERR_SUCCESS;
     }
-    Reset();                                                                    // Clean up the object
-    return ATERR_OUT_OF_MEMORY;
+    return AttachPOSIX(Key);                                                    // Not SysV, so maybe it is POSIX
+}
+
+// **************************************************************************** AttachSharedMemID
+int     ATSharedMem::AttachSharedMemID(                                         // Attach to an already created SysV shared memory object by its system ID- skips looking the key up
+                            int             inSysID                             // System ID for the object (see GetSystemID)
+                            ) {
+    if ( Base != NULL ) return ATERR_OBJECT_IN_USE;                             // Don't allow this object to be screwed up
+
+    Base = (char *)shmat(inSysID, 0, 0);                                        // Straight to it
+    if ( Base == (char *)-1 ) {                                                 // Gone, or never was
+        Reset();
+        return ATERR_NOT_FOUND;
+    }
+    SysID = inSysID;
+    Allocated = ((ATSMHeader *)Base)->Allocated;                                // Get the size from the header
+    UserBase = Base + sizeof(ATSMHeader);                                       // Save a ptr to the user memory
+    return ATERR_SUCCESS;
+}
+
+// **************************************************************************** AttachPOSIX
+int     ATSharedMem::AttachPOSIX(                                               // Internal routine to attach to a POSIX shared memory object
+                            int             Key                                 // Key ID for the object
+                            ) {
+    char            Name[AT_MAX_PATH];
+    int             ObjHandle, Result;
+    struct stat     Info;
+    void            *Map;
+    ATSMHeader      Header;
+
+    ATSharedMemName(Key, AT_SHMEM_POSIX, Name);
+    if ( (ObjHandle = shm_open(Name, O_RDWR, 0)) < 0 ) {                        // Not plain shared memory...
+        ATSharedMemName(Key, AT_SHMEM_HUGEFS, Name);
+        if ( (ObjHandle = open(Name, O_RDWR)) < 0 ) {                           // ...or on the huge page mount
+            Reset();
+            return ATERR_OUT_OF_MEMORY;
+        }
+    }
+    if ( pread(ObjHandle, &Header, sizeof(ATSMHeader), 0) != sizeof(ATSMHeader) ) {// See what kind it is
+        close(ObjHandle);
+        Reset();
+        return ATERR_OUT_OF_MEMORY;
+    }
+    if ( Header.Kind == AT_SHMEM_ARENA ) {                                      // An arena has to go where everyone else has it
+        Result = MapArena(ObjHandle, &Header, 0);
+        close(ObjHandle);                                                       // The mapping keeps it alive
+        if ( Result != ATERR_SUCCESS ) {
+            Reset();
+            return Result;
+        }
+    }
+    else {
+        if ( fstat(ObjHandle, &Info) ||
+            (Map = mmap(NULL, Info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, ObjHandle, 0)) == MAP_FAILED ) {
+            close(ObjHandle);
+            Reset();
+            return ATERR_OUT_OF_MEMORY;
+        }
+        close(ObjHandle);                                                       // The mapping keeps it alive
+        Base = (char *)Map;
+        Allocated = ((ATSMHeader *)Base)->Allocated;                            // Get the size from the header
+        UserBase = Base + sizeof(ATSMHeader);                                   // Save a ptr to the user memory
+    }
+    SysID = Key;
+    return ATERR_SUCCESS;
 }
 
 // **************************************************************************** GetBasePointer
@@ -113,7 +509,7 @@ volatile void *ATSharedMem::GetTrueBasePointer() {
 // **************************************************************************** DetachSharedMem
 int     ATSharedMem::DetachSharedMem(                                           // Detach from a shared memory object
                             ){
-    if ( Base ) shmdt(Base);                                                    // If a valid attach, detach from it
+    if ( Base ) ATDetachSharedMem(Base);                                        // If a valid attach, detach from it
     Reset();                                                                    // Clean up the object
     return ATERR_SUCCESS;
 }
@@ -125,10 +521,8 @@ int     ATSharedMem::FreeSharedMem() {
 
     if ( !IAmCreator )                                                          // If I did NOT create it
         DetachSharedMem();                                                      // Just detach from it
-    else {                                                                      // If I DID create it, then destroy it
-        struct shmid_ds Dummy;
-        shmctl(SysID, IPC_RMID, &Dummy);                                        // Ask system to remove it
-    }
+    else                                                                        // If I DID create it, then destroy it
+        ATDestroySharedMemAt(Base);                                             // Ask system to remove it
     Reset();                                                                    // Clean up the object
     return ATERR_SUCCESS;
 }
@@ -143,6 +537,8 @@ int     ATSharedMem::FreeThisInstanceOnly() {
 void     ATSharedMem::Reset() {                                                 // Reset the object members
     Base = UserBase = NULL;
     Allocated = SysID = IAmCreator = 0;
+    if ( Handle >= 0 ) close(Handle);                                           // Done growing it
+    Handle = -1;
 }
 
 // **************************************************************************** GetSystemID
@@ -161,56 +557,160 @@ int     ATSharedMem::GetSystemID() {
 ATScratchMem::ATScratchMem(                                                     // Construct the object with a given size in bytes
                             int             Size
                             ) {
-    if ( (Base = new char[Size]) ) {                                            // If I can alloc the mem....
-        Allocated = Size;                                                       // Initialize the data members
-        Top = Base + Size;
-        CurrentOffset = HighWater = Base;
-    }
-    else                                                                        // Couldn't do it
-        Reset();                                                                // Clean up the object
-
+    Reset();                                                                    // Start clean
+    Allocated = Size;
+    NextChunk();                                                                // Get the first chunk now- if it fails we try again when asked for memory
 }
 
 // **************************************************************************** Destructor
 ATScratchMem::~ATScratchMem() {
-    if ( Base )     delete Base;                                                // If the allocation exists, delete it
+    ATScratchChunk  *Chunk;
+
+    FreeBig(NULL);                                                              // Free the large allocations
+    while ( (Chunk = First) ) {                                                 // And all the chunks
+        First = Chunk->Next;
+        delete[] (char *)Chunk;
+    }
 }
 
 // **************************************************************************** GetScratchMem
-void    *ATScratchMem::GetScratchMem(                                           // Get a block of the scratch area- returns a ptr to the block, will be processor aligned
+void    *ATScratchMem::GetScratchMem(                                           // Get a block of the scratch area- returns a ptr to the block, will be processor aligned, NULL if out of memory
                             int             Size                                // Size in bytes to get
                             ) {
-    char            *Original = CurrentOffset;                                  // Save existing ptr
+    char            *Original;
+    ATScratchBig    *Block;
+    long            Need = (Size + AT_MEM_ALIGN - 1) & ~(long)(AT_MEM_ALIGN - 1);// Size rounded up to the alignment
+
+    if ( Allocated / AT_SCRATCH_BIG_SHARE < Need ) {                            // Too big to carve from a chunk- give it its own block
+        if ( ! (Block = (ATScratchBig *)new char[sizeof(ATScratchBig) + Need + AT_MEM_ALIGN]) )
+            goto failed;
+        Block->Next = Big;                                                      // Newest first
+        Block->Size = Need;
+        Big = Block;
+        Stats.BigAllocs++;
+        Stats.BigBlocks++;
+        Stats.Reserved += sizeof(ATScratchBig) + Need + AT_MEM_ALIGN;
+        Original = ATAlignPtr((char *)(Block + 1));
+        goto got_it;
+    }
 
-    CurrentOffset += Size + AT_MEM_ALIGN;                                       // Add the size & alignment space to the current position
-    CurrentOffset = ATAlignPtr(CurrentOffset);                                  // Align the ptr
+    if ( ! Current || CurrentOffset + Need > Top ) {                            // Doesn't fit in this chunk, move on to the next
+        if ( ! NextChunk() )
+            goto failed;
+    }
+    Original = CurrentOffset;                                                   // Carve it
+    CurrentOffset += Need;
 
-    if ( CurrentOffset > HighWater ) HighWater = CurrentOffset;                 // Check against the high water mark
+got_it:
+    Stats.Allocs++;
+    Stats.InUse += Need;
+    if ( Stats.InUse > Stats.HighWater ) Stats.HighWater = Stats.InUse;         // Check against the high water mark
+    return Original;
 
-    if ( CurrentOffset < Top ) {                                                // Make sure valid & then return the spot
-        return Original;
-    }
-    CurrentOffset = Original;                                                   // Reset & return NULL
+failed:
+    Stats.Failures++;
     return NULL;
 }
 
 // **************************************************************************** ResetScratchMem
-void ATScratchMem::ResetScratchMem() {                                          // Reset the scratch memory object (does not reset high water mark)
-    CurrentOffset = Base;                                                       // Just adjust the offset ptr back
+void ATScratchMem::ResetScratchMem() {                                          // Reset the scratch memory object (does not reset high water mark)- keeps the chunks for reuse, frees the large allocations
+    FreeBig(NULL);
+    if ( (Current = First) ) {                                                  // Back to the start of the first chunk
+        CurrentOffset = First->Data;
+        Top = First->Top;
+    }
+    Stats.InUse = 0;
+    Stats.Rewinds++;
+}
+
+// **************************************************************************** MarkScratchMem
+void ATScratchMem::MarkScratchMem(                                              // Take a save point, to rewind to later
+                            ATScratchMark   *outMark                            // Where to put the save point
+                            ) {
+    outMark->Chunk = Current;
+    outMark->Offset = CurrentOffset;
+    outMark->Big = Big;
+    outMark->InUse = Stats.InUse;
+}
+
+// **************************************************************************** RewindScratchMem
+void ATScratchMem::RewindScratchMem(                                            // Give back everything gotten since a save point- later save points are no good after this
+                            ATScratchMark   *inMark                             // Save point from MarkScratchMem(), since the last reset
+                            ) {
+    FreeBig(inMark->Big);                                                       // Large allocations since the mark go back to the heap
+    if ( inMark->Chunk ) {                                                      // Chunks since the mark stay in the chain for reuse
+        Current = inMark->Chunk;
+        CurrentOffset = inMark->Offset;
+        Top = Current->Top;
+    }
+    else if ( (Current = First) ) {                                             // Marked before there were any chunks- back to the start
+        CurrentOffset = First->Data;
+        Top = First->Top;
+    }
+    Stats.InUse = inMark->InUse;
+    Stats.Rewinds++;
 }
 
 // **************************************************************************** GetHighWater
-int ATScratchMem::GetHighWater() {                                              // Returns the high water mark in bytes for the object (highest point allocated for the object)
-    return HighWater - Base;
+int ATScratchMem::GetHighWater() {                                              // Returns the high water mark in bytes for the object (most bytes ever handed out at once)
+    return Stats.HighWater;
+}
+
+// **************************************************************************** GetScratchStats
+void ATScratchMem::GetScratchStats(                                             // Get the statistics for the object
+                            ATScratchStats  *outStats                           // Where to put them
+                            ) {
+    *outStats = Stats;
+}
+
+// **************************************************************************** NextChunk
+ATScratchChunk  *ATScratchMem::NextChunk() {                                    // Move on to the next chunk in the chain, adding one if need be- returns NULL if out of memory
+    ATScratchChunk  *Chunk;
+
+    if ( Current && Current->Next )                                             // One left from before a reset or rewind- reuse it
+        Chunk = Current->Next;
+    else if ( ! Current && First )                                              // Same, for the first
+        Chunk = First;
+    else {                                                                      // Need a new one
+        if ( ! (Chunk = (ATScratchChunk *)new char[sizeof(ATScratchChunk) + Allocated + AT_MEM_ALIGN]) )
+            return NULL;
+        Chunk->Next = NULL;
+        Chunk->Data = ATAlignPtr((char *)(Chunk + 1));
+        Chunk->Top = Chunk->Data + Allocated;
+        if ( Current )  Current->Next = Chunk;                                  // Chain it on the end
+        else            First = Chunk;
+        Stats.Chunks++;
+        Stats.Reserved += sizeof(ATScratchChunk) + Allocated + AT_MEM_ALIGN;
+    }
+    Current = Chunk;
+    CurrentOffset = Chunk->Data;
+    Top = Chunk->Top;
+    return Chunk;
+}
+
+// **************************************************************************** FreeBig
+void ATScratchMem::FreeBig(                                                     // Free the large allocations newer than a given one
+                            ATScratchBig    *inKeep                             // Newest one to keep, NULL to free them all
+                            ) {
+    ATScratchBig    *Block;
+
+    while ( (Block = Big) && Block != inKeep ) {
+        Big = Block->Next;
+        Stats.BigBlocks--;
+        Stats.Reserved -= sizeof(ATScratchBig) + Block->Size + AT_MEM_ALIGN;
+        delete[] (char *)Block;
+    }
 }
 
 // **************************************************************************** Reset
 void     ATScratchMem::Reset() {                                                // Reset the object members
     Allocated = 0;
-    Base = Top = CurrentOffset = HighWater = NULL;
+    First = Current = NULL;
+    Top = CurrentOffset = NULL;
+    Big = NULL;
+    memset(&Stats, 0, sizeof(Stats));
 }
 
-
 // ****************************************************************************
 // ****************************************************************************
 //                             HELPER ROUTINES
@@ -240,8 +740,132 @@ int     ATDestroySharedMem(
 int     ATDetachSharedMem(                                                      // Detach from a shared memory alloc
                     volatile void *Base                                         // Base ptr of the alloc to detach from
                     ) {
-    if ( Base ) shmdt((void*)Base);                                             // If not null, ask the OS to detach me from the object
+    volatile ATSMHeader *Header = (volatile ATSMHeader *)Base;
+
+    long        Mapped;
+
+    if ( !Base ) return ATERR_SUCCESS;
+    if ( Header->Kind == AT_SHMEM_SYSV )                                        // Ask the OS to detach me from the object
+        shmdt((void*)Base);
+    else {
+        Mapped = Header->Mapped;
+        if ( (Header->Kind == AT_SHMEM_ARENA || Header->Kind == AT_SHMEM_FILE) &&// Others in this process may still be using an arena
+                ATDropArena((char *)Base) > 0 )
+            return ATERR_SUCCESS;
+        munmap((void*)Base, Mapped);
+    }
+    return ATERR_SUCCESS;
+}
+
+// **************************************************************************** ATDestroySharedMemAt
+int     ATDestroySharedMemAt(                                                   // Like ATDestroySharedMem, but works out which kind of memory it is from the block itself- still attached
+                                                                                // Only the owner, creator, or superuser can call.
+                    volatile void *Base                                         // TRUE base ptr of the alloc to destroy
+                    ) {
+    volatile ATSMHeader *Header = (volatile ATSMHeader *)Base;
+    char        Name[AT_MAX_PATH];
+
+    if ( !Base ) return ATERR_SUCCESS;
+    switch ( Header->Kind ) {                                                   // Ask the OS to remove the object- it goes once everyone detaches
+    case AT_SHMEM_SYSV:
+        return ATDestroySharedMem(Header->SysID);
+    case AT_SHMEM_POSIX:
+    case AT_SHMEM_ARENA:
+        ATSharedMemName(Header->SysID, AT_SHMEM_POSIX, Name);
+        shm_unlink(Name);
+        break;
+    case AT_SHMEM_HUGEFS:
+        ATSharedMemName(Header->SysID, AT_SHMEM_HUGEFS, Name);
+        unlink(Name);
+        break;
+    case AT_SHMEM_FILE:                                                         // Outliving us is the whole point of a file
+        break;
+    }
     return ATERR_SUCCESS;
 }
 
+// **************************************************************************** ATHugePageSize
+static long ATHugePageSize() {                                                  // Internal routine to find the system's huge page size
+    FILE        *Input;
+    char        Line[128];
+    long        Size = 0;
+
+    if ( (Input = fopen("/proc/meminfo", "r")) ) {
+        while ( fgets(Line, sizeof(Line), Input) ) {
+            if ( sscanf(Line, "Hugepagesize: %ld kB", &Size) == 1 ) {
+                Size *= 1024;
+                break;
+            }
+        }
+        fclose(Input);
+    }
+    return (Size > 0) ? Size : AT_SHMEM_HUGE_SIZE;
+}
+
+// **************************************************************************** ATShareArena
+static int  ATShareArena(                                                       // Internal routine to count another user of an arena, if this process has it mapped- returns true if it does
+                    char        *inAddress                                      // Where the arena goes
+                    ) {
+    int         i, Found = 0;
+
+    ATGetSpinLock((unsigned long)getpid(), &ATArenaLock);                       // Process local, so the pid makes as good a kilroy as any
+    for ( i = 0; i < AT_SHMEM_MAX_ARENAS; ++i ) {
+        if ( ATArenaMaps[i].Address == inAddress ) {
+            ATArenaMaps[i].Users++;
+            Found = 1;
+            break;
+        }
+    }
+    ATFreeSpinLock((unsigned long)getpid(), &ATArenaLock);
+    return Found;
+}
+
+// **************************************************************************** ATAddArena
+static void ATAddArena(                                                         // Internal routine to note an arena this process just mapped
+                    char        *inAddress                                      // Where it is mapped
+                    ) {
+    int         i;
+
+    ATGetSpinLock((unsigned long)getpid(), &ATArenaLock);
+    for ( i = 0; i < AT_SHMEM_MAX_ARENAS; ++i ) {
+        if ( !ATArenaMaps[i].Address ) {                                        // If they are all taken, it just goes untracked
+            ATArenaMaps[i].Address = inAddress;
+            ATArenaMaps[i].Users = 1;
+            break;
+        }
+    }
+    ATFreeSpinLock((unsigned long)getpid(), &ATArenaLock);
+}
+
+// **************************************************************************** ATDropArena
+static long ATDropArena(                                                        // Internal routine to count one less user of an arena- returns the users left, zero if it should be unmapped
+                    char        *inAddress                                      // Where it is mapped
+                    ) {
+    int         i;
+    long        Users = 0;                                                      // Untracked ones have no one else
+
+    ATGetSpinLock((unsigned long)getpid(), &ATArenaLock);
+    for ( i = 0; i < AT_SHMEM_MAX_ARENAS; ++i ) {
+        if ( ATArenaMaps[i].Address == inAddress ) {
+            if ( !(Users = --ATArenaMaps[i].Users) )
+                ATArenaMaps[i].Address = NULL;
+            break;
+        }
+    }
+    ATFreeSpinLock((unsigned long)getpid(), &ATArenaLock);
+    return Users;
+}
+
+// **************************************************************************** ATSharedMemName
+static void ATSharedMemName(                                                    // Internal routine to name the POSIX object for a key
+                    int         Key,                                            // Key ID for the object
+                    int         Kind,                                           // AT_SHMEM_POSIX or AT_SHMEM_HUGEFS
+                    char        *Name                                           // Gets the name- AT_MAX_PATH long
+                    ) {
+    if ( Kind == AT_SHMEM_HUGEFS )
+        snprintf(Name, AT_MAX_PATH, AT_SHMEM_HUGE_DIR AT_SHMEM_NAME, Key);
+    else
+        snprintf(Name, AT_MAX_PATH, AT_SHMEM_NAME, Key);
+}
+
 
@@ -42,6 +42,7 @@ This basic methodology of making SysV stuff useable is based on "UNIX Network Pr
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 
 #ifdef      AT_WIN32
     #include	<windows.h>
@@ -50,12 +51,47 @@ This basic methodology of making SysV stuff useable is based on "UNIX Network Pr
     #include    <sys/types.h>
     #include    <sys/ipc.h>
     #include    <sys/sem.h>
+    #include    <sys/syscall.h>
+    #include    <linux/futex.h>
+    #include    <time.h>
+    #include    <sched.h>
+    #include    <signal.h>
 #endif
 
 #include "general.h"
+#include "memory.h"
 #include "sem.h"
+#include "timing.h"
+
+#ifdef      AT_WIN32
+    #define AT_THREADLOCAL  __declspec(thread)
+#else
+    #define AT_THREADLOCAL  __thread
+#endif
 
 #define     AT_BIGCOUNT        ((int)10000)
+// Number of adaptive spins an SMP box makes on a contended lock before parking on it (the default spin-then-park policy)
+#define     AT_PARK_ATTEMPTS   ((long)5)
+// Number of spin iterations timed by ATInitSems
+#define     AT_PAUSE_CALIBRATE ((long)16384)
+// Time a spin iteration is taken to be when it can't be measured, in picoseconds
+#define     AT_PAUSE_PICOS     ((long)10000)
+// First nap taken by a backed off waiter that can't park, in microseconds
+#define     AT_NAP_FIRST       ((long)10)
+// Cache line size assumed when the system won't say
+#define     AT_CACHE_LINE      ((int)64)
+// Longest a parked waiter sleeps before looking at the lock on its own, in nanoseconds
+#define     AT_PARK_TIMEOUT    ((long)10000000)
+// Nanoseconds a ticket waiter spins for each waiter ahead of it in line
+#define     AT_TICKET_BACKOFF  ((long)100)
+// Number of backoffs a ticket waiter makes before it starts yielding the CPU
+#define     AT_TICKET_SPINS    ((long)64)
+// Pack the two values of a free list entry into a public list head
+#define     AT_NLFL_PACK(V1, V2)    ((int64)(((unsigned int64)(unsigned int)(V2) << 32) | (unsigned int)(V1)))
+// Pull the first value back out of a public list head
+#define     AT_NLFL_VALUE1(Start)   ((long)(int)(Start))
+// Pull the second value back out of a public list head
+#define     AT_NLFL_VALUE2(Start)   ((long)(int)((unsigned int64)(Start) >> 32))
 
 // Following are our semaphore operations defines (Have I mentioned I hate SysV?)
 static struct sembuf    op_lock[2] = {
@@ -95,6 +131,35 @@ union {
 
 ATCPUInfo   CPUInfo;
 
+struct ATLockBackoff {                                                          // A lock class's policy, worked out in spin iterations for this CPU
+    long            MinSpins;                                                   // Length of the first spin
+    long            MaxSpins;                                                   // Longest spin
+    long            TopAttempts;                                                // Tries it takes the spin to double up to MaxSpins
+};
+
+static ATLockStatBlock          *LockStats = NULL;                              // Lock contention statistics- NULL while they are off
+static ATLockStatBlock          LocalLockStats;                                 // Where the statistics are kept when they are for this process only
+static ATSharedMem              LockStatMem;                                    // The statistics segment when they are shared
+static AT_THREADLOCAL long      NextLockClass;                                  // Class the thread's next lock acquisition counts against
+static AT_THREADLOCAL ATLockStats *WaitStats;                                   // Class stats of the lock the thread is waiting on, if any
+static AT_THREADLOCAL int64     WaitStart;                                      // Clock ticks when that wait began
+static AT_THREADLOCAL long      WaitClass;                                      // Class of the lock the thread is trying for, whose policy it backs off by
+static AT_THREADLOCAL unsigned long BackoffSeed;                                // The thread's backoff jitter generator
+static ATLockPolicy             LockPolicies[AT_LOCKCLASSES] = {                // Backoff policy for each lock class, indexed by AT_LOCKCLASS_*
+    { AT_LOCKPOLICY_SPINPARK,   50, 20000,  AT_PARK_ATTEMPTS,   4,  10000 },    // Other
+    { AT_LOCKPOLICY_SPINPARK,   50, 20000,  2,                  4,  10000 },    // Table block headers- held across a block add, so don't spin on them long
+    { AT_LOCKPOLICY_SPIN,       50, 5000,   AT_PARK_ATTEMPTS,   8,  1000 },     // Add segments- held for a couple of stores
+    { AT_LOCKPOLICY_SPIN,       50, 5000,   AT_PARK_ATTEMPTS,   8,  1000 },     // Delete segments (unused)
+    { AT_LOCKPOLICY_SPINPARK,   50, 20000,  AT_PARK_ATTEMPTS,   4,  10000 },    // BTree pages
+    { AT_LOCKPOLICY_SPINPARK,   100, 50000, AT_PARK_ATTEMPTS,   4,  10000 }     // Template cache
+};
+static ATLockBackoff            Backoffs[AT_LOCKCLASSES];                       // The policies in spin iterations- set up by ATInitSems and ATSetLockPolicy
+static int                      PolicySet[AT_LOCKCLASSES];                      // True for the classes whose policy the caller set, which ATInitSems leaves alone
+static ATOwnerBlock             *Owners = NULL;                                 // The owner registry- NULL while it is off
+static ATOwnerBlock             LocalOwners;                                    // Where the registry is kept when it is for this process only
+static ATSharedMem              OwnerMem;                                       // The registry segment when it is shared
+static AT_THREADLOCAL volatile unsigned long *NextLockOwner;                    // Owner cell of the lock the thread's next blocking sharelock call is for
+
 // ****************************************************************************
 // ****************************************************************************
 //                           KERNEL SEMAPHORE METHODS
@@ -242,14 +307,193 @@ int  ATKernelSem::SemOpBounce(
 /*  Spinlocks are simple, fast, exclusive locks.  If you need mixed read/write
 locks, see the sharelocks below.
 */
+// **************************************************************************** ATSpin
+long    ATSpin(long Number, volatile long *RedHerring) {                        // An internal routine to just spin waiting for a lock rather than give up our time slice and enter the scheduler
+    volatile int i;
+    if ( WaitStats )                                                            // Count it against the lock we are waiting on
+        ATAtomicExchangeAdd(&(WaitStats->Spins), (unsigned long)Number);
+    for ( i = 0; i < Number; ++i ) {                                            // Churn, working with a variable the optimizer is afraid to ignore
+        __asm__ __volatile__( "pause" : : : "memory" );                         // Let the other hyperthread on our core have the pipeline while we wait
+        *RedHerring = i;
+    }
+    return i;                                                                   // Try to keep optimizer from getting too smart...
+}
+// **************************************************************************** ATYield
+static inline void ATYield() {                                                  // Give up the rest of our time slice, but stay runnable
+#ifdef      AT_WIN32
+    Sleep(0);
+#else
+    sched_yield();
+#endif
+}
+// **************************************************************************** ATSetBackoff
+static void ATSetBackoff(                                                       // Work a lock class's policy out in spin iterations
+                    long            Class                                       // One of AT_LOCKCLASS_*
+                    ) {
+    ATLockPolicy    *Policy = &(LockPolicies[Class]);
+    ATLockBackoff   *Backoff = &(Backoffs[Class]);
+    long            Picos = CPUInfo.PausePicos ? CPUInfo.PausePicos : AT_PAUSE_PICOS;
+    long            MinSpins, MaxSpins, TopAttempts = 0;
+
+    MinSpins = (long)(((int64)Policy->MinSpinNanos * 1000) / Picos);
+    MaxSpins = (long)(((int64)Policy->MaxSpinNanos * 1000) / Picos);
+    if ( MinSpins < 1 ) MinSpins = 1;
+    if ( MaxSpins < MinSpins ) MaxSpins = MinSpins;
+    while ( (MinSpins << TopAttempts) < MaxSpins )                              // How many doublings it takes to top out
+        TopAttempts++;
+    Backoff->MinSpins = MinSpins;                                               // Waiters may be reading these, but any mix of old & new will do
+    Backoff->MaxSpins = MaxSpins;
+    Backoff->TopAttempts = TopAttempts;
+}
+// **************************************************************************** ATCalibrateSpin
+static void ATCalibrateSpin() {                                                 // Time a spin iteration, and set up the backoffs from it
+    int64           Ticks, Best = 0;
+    volatile long   RH;
+    long            i;
+
+    for ( i = 0; i < 5; i++ ) {                                                 // Keep the best of a few, in case we were scheduled out for one
+        Ticks = ATGetTicks();
+        ATSpin(AT_PAUSE_CALIBRATE, &RH);
+        Ticks = ATGetTicks() - Ticks;
+        if ( Ticks > 0 && (!Best || Ticks < Best) ) Best = Ticks;
+    }
+    CPUInfo.PausePicos = (long)((ATTicksToNanos(Best) * 1000) / AT_PAUSE_CALIBRATE);
+    if ( CPUInfo.PausePicos <= 0 )                                              // Couldn't time it, so guess
+        CPUInfo.PausePicos = AT_PAUSE_PICOS;
+    for ( i = 0; i < AT_LOCKCLASSES; i++ )
+        ATSetBackoff(i);
+}
+// **************************************************************************** ATReadSysLong
+static long ATReadSysLong(                                                      // Read a number out of a sysfs (or procfs) file- returns the default if it can't
+                    const char      *Path,                                      // File to read
+                    long            Default                                     // What to return if the file isn't there
+                    ) {
+    FILE            *File;
+    long            Value;
+
+    if ( !(File = fopen(Path, "r")) ) return Default;
+    if ( fscanf(File, "%ld", &Value) != 1 ) Value = Default;
+    fclose(File);
+    return Value;
+}
+// **************************************************************************** ATCountSysList
+static int ATCountSysList(                                                      // Count the entries in a sysfs list file ("0-3,8,10-11")- returns zero if it can't
+                    const char      *Path                                       // File to read
+                    ) {
+    FILE            *File;
+    char            Buffer[512], *Token;
+    long            First, Last;
+    int             Count = 0;
+
+    if ( !(File = fopen(Path, "r")) ) return 0;
+    if ( fgets(Buffer, sizeof(Buffer), File) ) {
+        for ( Token = strtok(Buffer, ",\n"); Token; Token = strtok(NULL, ",\n") ) {
+            if ( sscanf(Token, "%ld-%ld", &First, &Last) == 2 )                 // A range
+                Count += (int)(Last - First + 1);
+            else if ( sscanf(Token, "%ld", &First) == 1 )                       // A single entry
+                Count++;
+        }
+    }
+    fclose(File);
+    return Count;
+}
+// **************************************************************************** ATReadCGroupQuota
+static int ATReadCGroupQuota() {                                                // Find the CPU quota our cgroup runs under, in hundredths of a processor- zero if unlimited
+    FILE            *File, *Max;
+    char            Buffer[512], Limit[32], *Group, *Slash;
+    char            Path[sizeof(Buffer) + sizeof("/sys/fs/cgroup/cpu.max")];    // Room for any group a line of Buffer can hold, between the two
+    long            Quota, Period;
+    int             Best = 0, This;
+
+    if ( (File = fopen("/proc/self/cgroup", "r")) ) {                           // cgroup v2- find our group, then every group above it may have a cpu.max
+        while ( fgets(Buffer, sizeof(Buffer), File) ) {
+            if ( strncmp(Buffer, "0::", 3) ) continue;
+            Group = Buffer + 3;
+            Group[strcspn(Group, "\n")] = '\0';
+            for ( ;; ) {                                                        // Our group, then each one above it, up to the root
+                snprintf(Path, sizeof(Path), "/sys/fs/cgroup%s/cpu.max", Group[1] ? Group : "");
+                if ( (Max = fopen(Path, "r")) ) {
+                    if ( fscanf(Max, "%31s %ld", Limit, &Period) == 2 && strcmp(Limit, "max") && Period > 0 ) {
+                        This = (int)((atol(Limit) * 100) / Period);             // The tightest limit on the way up is the one that binds
+                        if ( This > 0 && (!Best || This < Best) ) Best = This;
+                    }
+                    fclose(Max);
+                }
+                if ( !Group[0] || !Group[1] ) break;                            // That was the root
+                Slash = strrchr(Group, '/');
+                if ( Slash == Group )   Group[1] = '\0';
+                else                    *Slash = '\0';
+            }
+        }
+        fclose(File);
+    }
+    if ( Best ) return Best;
+
+    Quota = ATReadSysLong("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", -1);           // cgroup v1, as mounted in a container
+    Period = ATReadSysLong("/sys/fs/cgroup/cpu/cpu.cfs_period_us", 0);
+    if ( Quota <= 0 || Period <= 0 ) {
+        Quota = ATReadSysLong("/sys/fs/cgroup/cpu,cpuacct/cpu.cfs_quota_us", -1);
+        Period = ATReadSysLong("/sys/fs/cgroup/cpu,cpuacct/cpu.cfs_period_us", 0);
+    }
+    if ( Quota > 0 && Period > 0 )
+        return (int)((Quota * 100) / Period);
+    return 0;
+}
+// **************************************************************************** ATFindTopology
+static void ATFindTopology() {                                                  // Fill in the CPU topology and limits- NumberProcs must already be counted
+    int             Procs;
+
+    if ( CPUInfo.NumberProcs <= 0 )                                             // Nothing from cpuinfo, so ask the system
+        CPUInfo.NumberProcs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if ( CPUInfo.NumberProcs <= 0 )
+        CPUInfo.NumberProcs = 1;
+
+    CPUInfo.ThreadsPerCore = ATCountSysList("/sys/devices/system/cpu/cpu0/topology/thread_siblings_list");
+    if ( CPUInfo.ThreadsPerCore <= 0 ) CPUInfo.ThreadsPerCore = 1;
+    CPUInfo.NumberCores = CPUInfo.NumberProcs / CPUInfo.ThreadsPerCore;
+    if ( CPUInfo.NumberCores <= 0 ) CPUInfo.NumberCores = 1;
+    CPUInfo.NumberNodes = ATCountSysList("/sys/devices/system/node/online");
+    if ( CPUInfo.NumberNodes <= 0 ) CPUInfo.NumberNodes = 1;
+    CPUInfo.CacheLine = (int)ATReadSysLong("/sys/devices/system/cpu/cpu0/cache/index0/coherency_line_size", 0);
+    if ( CPUInfo.CacheLine <= 0 ) CPUInfo.CacheLine = AT_CACHE_LINE;
+
+    Procs = CPUInfo.NumberProcs;                                                // What we may run on...
+#ifndef     AT_WIN32
+    cpu_set_t       Affinity;
+    if ( !sched_getaffinity(0, sizeof(Affinity), &Affinity) && CPU_COUNT(&Affinity) > 0 && CPU_COUNT(&Affinity) < Procs )
+        Procs = CPU_COUNT(&Affinity);
+#endif
+    CPUInfo.CPUQuota = ATReadCGroupQuota();                                     // ...and how much of it we get
+    if ( CPUInfo.CPUQuota && (CPUInfo.CPUQuota + 99) / 100 < Procs )
+        Procs = (CPUInfo.CPUQuota + 99) / 100;
+    CPUInfo.UsableProcs = ( Procs > 0 ) ? Procs : 1;
+}
+// **************************************************************************** ATPickLockPolicies
+static void ATPickLockPolicies() {                                              // Fit the backoff policies the caller hasn't set to the box we are on
+    long            i;
+
+    for ( i = 0; i < AT_LOCKCLASSES; i++ ) {
+        if ( PolicySet[i] ) continue;
+        if ( CPUInfo.UsableProcs <= 1 )                                         // The holder can't run while we spin, so don't
+            LockPolicies[i].Mode = AT_LOCKPOLICY_PARK;
+        else if ( CPUInfo.CPUQuota && LockPolicies[i].Mode == AT_LOCKPOLICY_SPIN )// Spinning burns the quota the holder needs to finish
+            LockPolicies[i].Mode = AT_LOCKPOLICY_SPINPARK;
+    }
+}
 // **************************************************************************** ATInitSems
 int ATInitSems() {                                                              // ALWAYS CALL THIS BEFORE USING THE SPINLOCKS or SHARELOCKS!!!!!
     FILE    *Info;
     char    Buffer[512], *Token;
 
+    ATInitTiming();                                                             // The lock statistics and the backoff calibration run off of the clock
     Info = fopen("/proc/cpuinfo", "r");                                         // Try to read CPU info
-    if ( !Info )                                                                // This will likely fail on many UNIX versions....
+    if ( !Info ) {                                                              // This will likely fail on many UNIX versions....
+        CPUInfo.NumberProcs = 0;
+        ATFindTopology();                                                       // The backoff still needs a guess at what we can run on...
+        ATPickLockPolicies();
+        ATCalibrateSpin();                                                      // ...and at the spin time
         return ATERR_BAD_PARAMETERS;
+    }
 
     CPUInfo.NumberProcs = 0;                                                    // Clear the struct for safety...
     CPUInfo.CPUMHz = 0;
@@ -271,6 +515,9 @@ int ATInitSems() {
     }
 
     fclose(Info);
+    ATFindTopology();                                                           // See what we can really run on...
+    ATPickLockPolicies();                                                       // ...and back off to suit it
+    ATCalibrateSpin();                                                          // Time a spin for the backoffs
     return ATERR_SUCCESS;
 }
 // **************************************************************************** GetCPUInfo
@@ -278,66 +525,186 @@ ATCPUInfo *ATGetCPUInfo() {
                                                                                 // YOU MUST HAVE CALLED AT INIT SEMS FOR THIS TO WORK
     return  &CPUInfo;
 }
-// **************************************************************************** ATSpin
-long    ATSpin(long Number, volatile long *RedHerring) {                        // An internal routine to just spin waiting for a lock rather than give up our time slice and enter the scheduler
-    volatile int i;
-    for ( i = 0; i < Number; ++i ) {                                            // Just churn, working with a variable the optimizer is afraid to ignore
-        *RedHerring = i;
+// **************************************************************************** ATLockStatsBegin
+static inline ATLockStats *ATLockStatsBegin() {                                 // Start a lock acquisition- picks up its class's backoff policy, and returns its stats (NULL when the statistics are off)
+    long            Class;
+
+    Class = NextLockClass;                                                      // Use up the caller's tag
+    NextLockClass = AT_LOCKCLASS_OTHER;
+    if ( Class < 0 || Class >= AT_LOCKCLASSES )
+        Class = AT_LOCKCLASS_OTHER;
+    WaitClass = Class;                                                          // Any backing off we do is by this class's policy
+    if ( !LockStats ) return NULL;
+    return &(LockStats->Classes[Class]);
+}
+// **************************************************************************** ATLockStatsLost
+static void ATLockStatsLost(                                                    // Count a try at a lock that lost the race for it
+                    ATLockStats     *Stats                                      // Class stats of the lock
+                    ) {
+    ATAtomicExchangeAdd(&(Stats->FailedCAS), 1);
+}
+// **************************************************************************** ATLockStatsWait
+static void ATLockStatsWait(                                                    // Note that we are about to wait on a lock- starts the clock on the first call
+                    ATLockStats     *Stats                                      // Class stats of the lock
+                    ) {
+    if ( WaitStats != Stats ) {                                                 // Spins and sleeps count against this class from here on
+        WaitStats = Stats;
+        WaitStart = ATGetTicks();
     }
-    return i;                                                                   // Try to keep optimizer from getting too smart...
+}
+// **************************************************************************** ATLockStatsHit
+static void ATLockStatsHit(                                                     // Count a lock acquisition, and the wait for it if there was one
+                    ATLockStats     *Stats                                      // Class stats of the lock
+                    ) {
+    unsigned long   Wait, Orig;
+
+    ATAtomicExchangeAdd(&(Stats->Acquisitions), 1);
+    if ( WaitStats == Stats ) {                                                 // We waited, so see if it is a new record
+        Wait = (unsigned long)(ATGetTicks() - WaitStart);
+        while ( Wait > (Orig = Stats->MaxWaitTicks) )
+            if ( ATCompareAndExchange(&(Stats->MaxWaitTicks), Orig, Wait) == ATERR_SUCCESS )
+                break;
+    }
+    WaitStats = NULL;
+}
+// **************************************************************************** ATLockOwnerBegin
+static inline volatile unsigned long *ATLockOwnerBegin() {                      // Pick up the owner cell the caller tagged this lock call with- returns NULL if none
+    volatile unsigned long *Owner;
+
+    if ( !Owners ) return NULL;
+    Owner = NextLockOwner;                                                      // Use up the caller's tag
+    NextLockOwner = NULL;
+    return Owner;
+}
+// **************************************************************************** ATNap
+static void ATNap(                                                              // Sleep while waiting on a lock
+                    long            Microseconds                                // How long to sleep
+                    ) {
+    if ( WaitStats )                                                            // Count it against the lock we are waiting on
+        ATAtomicExchangeAdd(&(WaitStats->Sleeps), 1);
+    if ( Microseconds >= 1000000 )
+        sleep(Microseconds / 1000000);
+    else
+        usleep(Microseconds);
 }
 // **************************************************************************** ATAdaptiveControl
 void    ATAdaptiveControl(                                                      // Routine to handle contested locks
                     long            NumberAttempts                              // Number of attempts made to date to get the lock
                         ) {
-    volatile long RH;
-
-//    if ( NumberAttempts > 7 ) {                                                 // Uncomment for debug message
-//        printf("Extreme lock contention... %i\r\n", NumberAttempts);
-//    }
-
-    if ( CPUInfo.NumberProcs > 1 ) {                                            // Change behavior on non-SMP boxes
-        switch( NumberAttempts ) {                                              // Change behavior over time
-            case    0:  ATSpin(3, &RH);     break;                              // At first, try assuming the spinlock is being held for a quickly used & freed resource
-            case    1:  ATSpin(7, &RH);     break;
-            case    2:  ATSpin(9, &RH);     break;
-            case    3:  ATSpin(101, &RH);   break;
-            case    4:  ATSpin(1007, &RH);  break;
-            case    5:  usleep(10);         break;                              // Okay, at this point something is wrong, this was not a good spinlock candidate, or maybe the scheduler is letting us down, or it is a hotspot, etc.
-            case    6:  ATSpin(7, &RH);     break;
-            case    7:  ATSpin(101, &RH);   break;
-            case    8:  usleep(10);         break;
-            case    9:  ATSpin(103, &RH);   break;
-            case    10: usleep(10);         break;                              // Okay, at this point something is wrong, this was not a good spinlock candidate, or maybe the scheduler is letting us down, or it is a hotspot, etc.
-            case    11: usleep(100);        break;                              // Let's try freeing up the CPU a tiny bit so we have a chance at this thing
-            case    12: ATSpin(101, &RH);   break;
-            case    13: usleep(100);        break;
-            case    14: usleep(100);        break;
-            case    15: ATSpin(103, &RH);   break;
-            case    16: usleep(1000);       break;                              // Looks like something is wrong, or this is a poor spinlock candidate, or maybe just a fluke
-            case    17: usleep(1000);       break;
-            case    18: ATSpin(101, &RH);   break;
-            case    19: usleep(10000);      break;
-            case    20: sleep(1);           break;
-            default:    sleep(1);                                               // By this time we are probably locked up, so let's give it plenty of free CPU
+    ATLockPolicy    *Policy = &(LockPolicies[WaitClass]);                       // Back off by the policy of the lock we are after
+    ATLockBackoff   *Backoff = &(Backoffs[WaitClass]);
+    long            Spins, Over, Nap;
+    volatile long   RH;
+
+    if ( !Backoff->MinSpins )                                                   // ATInitSems hasn't been called- work it out from the guess
+        ATSetBackoff(WaitClass);
+    Over = NumberAttempts - Backoff->TopAttempts;                               // Tries made since the spin topped out
+    if ( Policy->Mode == AT_LOCKPOLICY_PARK )                                   // We'd be parked if we could, so don't spin at all
+        Over = NumberAttempts;
+    if ( Over < 0 ) {                                                           // Still doubling the spin
+        if ( CPUInfo.UsableProcs <= 1 ) {                                       // On a single proc box, the holder can't run while we spin
+            ATYield();
+            return;
         }
+        Spins = Backoff->MinSpins << NumberAttempts;
+        if ( !BackoffSeed )                                                     // Seed the jitter off of our stack, which is different for every thread
+            BackoffSeed = (unsigned long)(((unsigned long)&Spins) >> 4) | 1;
+        BackoffSeed ^= BackoffSeed << 13;                                       // Xorshift
+        BackoffSeed ^= BackoffSeed >> 17;
+        BackoffSeed ^= BackoffSeed << 5;
+        Spins -= BackoffSeed % ((Spins >> 1) + 1);                              // Take up to half off, so waiters let go together don't all come back together
+        ATSpin(Spins, &RH);
+        return;
     }
-    else {                                                                      // This is a SINGLE proc version
-        switch( NumberAttempts ) {                                              // Change behavior over time
-            case    0:  usleep(10);         break;                              // On a single proc box, spinning is likely the stupidest thing you can do...
-            case    1:  usleep(10);         break;                              // Let's try freeing up the CPU a tiny bit so we have a chance at this thing
-            case    2:  usleep(100);        break;
-            case    3:  usleep(100);        break;
-            case    4:  usleep(1000);       break;
-            case    5:  usleep(1000);       break;
-            case    6:  usleep(10000);      break;                              // Looks like something is wrong, or this is a poor spinlock candidate, or maybe just a fluke
-            case    7:  usleep(10000);      break;
-            case    8:  usleep(100000);     break;
-            case    9:  usleep(100000);     break;
-            case    10: sleep(1);           break;
-            case    11: sleep(1);           break;
-            default:    sleep(1);                                               // By this time we are probably locked up, so let's give it plenty of free CPU
-        }
+    if ( Policy->Mode == AT_LOCKPOLICY_SPIN || Over < Policy->YieldAttempts ) { // Let whoever has the lock run
+        ATYield();
+        if ( Policy->Mode == AT_LOCKPOLICY_SPIN && CPUInfo.UsableProcs > 1 )
+            ATSpin(Backoff->MaxSpins, &RH);
+        return;
+    }
+    Over -= Policy->YieldAttempts;                                              // It is taking a while, so get out of the way
+    Nap = Policy->MaxNapMicros;
+    if ( Over < 20 && (AT_NAP_FIRST << Over) < Nap )
+        Nap = AT_NAP_FIRST << Over;
+    ATNap(Nap);
+}
+// **************************************************************************** ATShouldPark
+static inline int ATShouldPark(                                                 // Returns true once a waiter has spun long enough that it should go to sleep on the lock
+                    long            NumberAttempts                              // Number of attempts made to date to get the lock
+                    ) {
+    ATLockPolicy    *Policy = &(LockPolicies[WaitClass]);                       // Go by the policy of the lock we are after
+
+    if ( Policy->Mode == AT_LOCKPOLICY_PARK ) return 1;
+    if ( Policy->Mode == AT_LOCKPOLICY_SPIN ) return 0;
+    if ( CPUInfo.UsableProcs > 1 )                                              // Short holds are best handled by the spin phase on SMP boxes
+        return ( NumberAttempts >= Policy->ParkAttempts );
+    return 1;                                                                   // On a single proc, the holder can't run while we spin
+}
+// **************************************************************************** ATParkOnLock
+static void ATParkOnLock(                                                       // Sleep in the kernel until the lock word changes from what we saw
+                                                                                // The lock lives in SysV memory, so this must NOT be a process private futex
+                    ATLOCK          *ALock,                                     // Lock to wait on
+                    unsigned long   Observed                                    // What the caller last saw in the lock
+                    ) {
+    if ( !(Observed & AT_LOCK_WAITERS) ) {                                      // Tell the holder someone needs waking
+        if ( ATCompareAndExchange(ALock, Observed, Observed | AT_LOCK_WAITERS) != ATERR_SUCCESS )
+            return;                                                             // The lock moved under us, so let the caller look again
+        Observed |= AT_LOCK_WAITERS;
+    }
+    if ( WaitStats )                                                            // Count it against the lock we are waiting on
+        ATAtomicExchangeAdd(&(WaitStats->Sleeps), 1);
+#ifdef      AT_WIN32
+    Sleep(AT_PARK_TIMEOUT / 1000000);                                           // No futex, so just nap for the timeout
+#else
+    struct timespec Timeout;                                                    // The timeout covers anyone clearing a lock without a wake (loaders, etc.)
+    Timeout.tv_sec = 0;
+    Timeout.tv_nsec = AT_PARK_TIMEOUT;
+    syscall(SYS_futex, (volatile int *)ALock, FUTEX_WAIT, (int)Observed, &Timeout, NULL, 0);// Returns at once if the lock is no longer what we saw
+#endif
+}
+// **************************************************************************** ATWakeLock
+static void ATWakeLock(                                                         // Wake sleepers parked on a lock
+                    ATLOCK          *ALock,                                     // Lock to wake
+                    int             Number                                      // Max number of sleepers to wake
+                    ) {
+#ifndef     AT_WIN32
+    syscall(SYS_futex, (volatile int *)ALock, FUTEX_WAKE, Number, NULL, NULL, 0);
+#endif
+}
+// **************************************************************************** ATClearWaiters
+static void ATClearWaiters(                                                     // Strip the waiter flag from a lock and wake everyone parked on it- they re-flag it if they go back to sleep
+                    ATLOCK          *ALock                                      // Lock to wake
+                    ) {
+    unsigned long   Orig;
+    do {
+        Orig = *ALock;
+        if ( !(Orig & AT_LOCK_WAITERS) ) break;                                 // Someone beat us to it
+    } while ( ATCompareAndExchange(ALock, Orig, Orig & ~AT_LOCK_WAITERS) != ATERR_SUCCESS );
+    ATWakeLock(ALock, INT_MAX);
+}
+// **************************************************************************** ATShareRelease
+static void ATShareRelease(                                                     // Pull one reader off a sharelock, waking an exclusive waiting on the readers if we were the last
+                    ATLOCK          *ALock                                      // Lock to release
+                    ) {
+    unsigned long   Orig = ATAtomicExchangeAdd(ALock, (unsigned long)-1);       // Dec the lock, and see what it was
+    if ( (Orig & AT_LOCK_WAITERS) && !((Orig - 1) & AT_SHARE_COUNT) )           // Last reader out with sleepers on the lock
+        ATClearWaiters(ALock);
+}
+// **************************************************************************** ATShareDrainWait
+static void ATShareDrainWait(                                                   // With our exclusive flag in the lock, wait for the readers to leave
+                    ATLOCK          *ALock,                                     // Lock to wait on
+                    ATLockStats     *Stats                                      // Class stats of the lock, NULL if not counting
+                    ) {
+    unsigned long   Orig;
+    long            NumberAttempts = 0;
+
+    while ( (Orig = *ALock) & AT_SHARE_COUNT ) {                                // Wait until everyone else is out...
+        if ( Stats ) ATLockStatsWait(Stats);
+        if ( ATShouldPark(NumberAttempts) )
+            ATParkOnLock(ALock, Orig);                                          // Last reader out will wake us
+        else
+            ATAdaptiveControl(NumberAttempts);                                  // Adaptive behavior for lock contention
+        NumberAttempts++;
     }
 }
 // **************************************************************************** ATGetSpinLock
@@ -345,13 +712,33 @@ int ATGetSpinLock(
                                                                                 // These are process local locks, UNLESS they are located in shared memory
                     unsigned long   Kilroy,                                     // Unique, non-zero ID, such a the Proc ID and ThreadID rolled into one, etc.
                                                                                 // Can't figure out a reasonable way to auto-gen this under Linux.  Too many possibilities for thread libraries, etc.
+                                                                                // The AT_LOCK_WAITERS bit (bit 27) is reserved for the lock itself- a Kilroy with it set is refused with ATERR_BAD_PARAMETERS
                     ATLOCK          *ALock                                      // Ptr to the lock (any 32bit sized piece of memory initialized to zero will do just fine, shared memory if you want a global lock)
                     ) {
-    long    Result, NumberAttempts = 0;                                         // Number of attempts made to get the lock
+    long            Result, NumberAttempts = 0;                                 // Number of attempts made to get the lock
+    unsigned long   Orig, Mine = Kilroy;                                        // What we put in the lock- once we have slept, others may be asleep too, so keep the waiter flag up
+    ATLockStats     *Stats;
+
+    if ( Kilroy & AT_LOCK_WAITERS ) return ATERR_BAD_PARAMETERS;                // It would look like the waiter flag
+    Stats = ATLockStatsBegin();                                                 // Contention statistics, if they are on
 retry:
-    if ( !(*ALock) ) {                                                          // No point even trying if it is locked
-        if ( (Result = ATCompareAndExchange(ALock, 0, Kilroy)) == ATERR_SUCCESS )// Try the lock
+    if ( !(Orig = *ALock) ) {                                                   // No point even trying if it is locked
+        if ( (Result = ATCompareAndExchange(ALock, 0, Mine)) == ATERR_SUCCESS ) {// Try the lock
+            if ( Stats ) ATLockStatsHit(Stats);
             return ATERR_SUCCESS;
+        }
+        if ( Stats ) ATLockStatsLost(Stats);
+    }
+    if ( Stats ) ATLockStatsWait(Stats);
+    if ( Orig && ATReclaimSpinLock(Kilroy, ALock, NumberAttempts) == ATERR_SUCCESS ) {// If the holder has died, the lock is ours
+        if ( Stats ) ATLockStatsHit(Stats);
+        return ATERR_SUCCESS;
+    }
+    if ( Orig && ATShouldPark(NumberAttempts) ) {                               // Done spinning, so sleep until the holder frees it
+        ATParkOnLock(ALock, Orig);
+        Mine = Kilroy | AT_LOCK_WAITERS;
+        NumberAttempts++;
+        goto retry;
     }
     ATAdaptiveControl(NumberAttempts);                                          // Adaptive behavior for lock contention
     NumberAttempts++;                                                           // Inc our number of attempts
@@ -362,13 +749,21 @@ int ATBounceSpinLock(
                                                                                 // These are process local locks, UNLESS they are located in shared memory
                     unsigned long   Kilroy,                                     // Unique, non-zero ID, such a the Proc ID and ThreadID rolled into one, etc.
                                                                                 // Can't figure out a reasonable way to auto-gen this under Linux.  Too many possibilities for thread libraries, etc.
+                                                                                // The AT_LOCK_WAITERS bit (bit 27) is reserved for the lock itself- a Kilroy with it set is refused with ATERR_BAD_PARAMETERS
                     ATLOCK          *ALock                                      // Ptr to the lock (any 32bit sized piece of memory initialized to zero will do just fine, shared memory if you want a global lock)
                     ) {
-    int     Result;
+    int             Result;
+    ATLockStats     *Stats;
+
+    if ( Kilroy & AT_LOCK_WAITERS ) return ATERR_BAD_PARAMETERS;                // It would look like the waiter flag
+    Stats = ATLockStatsBegin();                                                 // Contention statistics, if they are on
     if ( !(*ALock) ) {                                                          // No point even trying if it is locked
-        if ( (Result = ATCompareAndExchange(ALock, 0, Kilroy)) == ATERR_SUCCESS )// Try the lock
+        if ( (Result = ATCompareAndExchange(ALock, 0, Kilroy)) == ATERR_SUCCESS ) {// Try the lock
+            if ( Stats ) ATLockStatsHit(Stats);
             return ATERR_SUCCESS;
+        }
     }
+    if ( Stats ) ATLockStatsLost(Stats);
     return ATERR_OBJECT_IN_USE;
 }
 // **************************************************************************** ATFreeSpinLock
@@ -376,10 +771,10 @@ int ATFreeSpinLock(
                     unsigned long   Kilroy,                                     // The Kilroy value you used to get the lock
                     ATLOCK          *ALock                                      // Ptr to the lock (any 32bit sized piece of memory initialized to zero will do just fine, shared memory if you want a global lock)
                     ) {
-    if ( *ALock == Kilroy )                                                     // As long as it is yours...
-        *ALock = 0;                                                             // Free it
-    else                                                                        // You don't have it!
+    if ( (Kilroy & AT_LOCK_WAITERS) || (*ALock & ~AT_LOCK_WAITERS) != Kilroy )  // You don't have it!
         return ATERR_BAD_PARAMETERS;
+    if ( ATAtomicExchange(ALock, 0) & AT_LOCK_WAITERS )                         // Free it, and if anyone is asleep on it hand it to one of them
+        ATWakeLock(ALock, 1);
     return ATERR_SUCCESS;
 }
 // **************************************************************************** ATSpinLockArbitrate
@@ -404,28 +799,45 @@ Very useful for shared data structures.  More overhead, but increased parallelis
 int ATBounceShare(                                                              // Try to get a sharelock, return immediately if failed
                     ATLOCK          *ALock                                      // Lock to get
                     ) {
+    ATLockStats     *Stats = ATLockStatsBegin();                                // Contention statistics, if they are on
+
     if ( !(*ALock & AT_SHARE_EXC) ) {                                           // No use even trying if it is already locked
         ATAtomicInc((volatile long*)ALock);                                     // Try getting it
         if ( !(*ALock & AT_SHARE_EXC) ) {                                       // Make sure we were successful
+            if ( Stats ) ATLockStatsHit(Stats);
             return ATERR_SUCCESS;
         }
-        ATAtomicDec((volatile long*)ALock);                                     // We didn't get it, so pull our inc off of it
+        ATShareRelease(ALock);                                                  // We didn't get it, so pull our inc off of it
     }
+    if ( Stats ) ATLockStatsLost(Stats);
     return ATERR_OBJECT_IN_USE;
 }
 // **************************************************************************** ATGetShare
 int ATGetShare(                                                                 // Try to get a sharelock, don't return until you get it
                     ATLOCK          *ALock                                      // Lock to get
                     ) {
-    long    NumberAttempts = 0;                                                 // Number of attempts made to get the lock
-    volatile long RH;
+    long            NumberAttempts = 0;                                         // Number of attempts made to get the lock
+    unsigned long   Orig;
+    ATLockStats     *Stats = ATLockStatsBegin();                                // Contention statistics, if they are on
+    volatile unsigned long *Owner = ATLockOwnerBegin();                         // Owner cell of the lock, if the caller gave us one
 retry:
-    if ( !(*ALock & AT_SHARE_EXC) ) {                                           // No use even trying if it is already locked
+    if ( !((Orig = *ALock) & AT_SHARE_EXC) ) {                                  // No use even trying if it is already locked
         ATAtomicInc((volatile long*)ALock);                                     // Try getting it
         if ( !(*ALock & AT_SHARE_EXC) ) {                                       // Make sure we were successful
+            if ( Stats ) ATLockStatsHit(Stats);
             return ATERR_SUCCESS;
         }
-        ATAtomicDec((volatile long*)ALock);                                     // We didn't get it, so pull our inc off of it
+        ATShareRelease(ALock);                                                  // We didn't get it, so pull our inc off of it
+        if ( Stats ) ATLockStatsLost(Stats);
+    }
+    if ( Stats ) ATLockStatsWait(Stats);
+    if ( (Orig & AT_SHARE_EXC) && Owner &&
+         ATReclaimShareExclusive(ALock, Owner, NumberAttempts) == ATERR_SUCCESS )
+        goto retry;                                                             // The exclusive's holder died, and it is gone now
+    if ( (Orig & AT_SHARE_EXC) && ATShouldPark(NumberAttempts) ) {              // Done spinning, so sleep until the exclusive goes away
+        ATParkOnLock(ALock, Orig);
+        NumberAttempts++;
+        goto retry;
     }
     ATAdaptiveControl(NumberAttempts);                                          // Adaptive behavior for lock contention
     NumberAttempts++;                                                           // Inc our number of attempts
@@ -435,12 +847,14 @@ retry:
 int ATFreeShare(                                                                // Frees a sharelock
                     ATLOCK          *ALock                                      // Lock to free
                     ) {
-    ATAtomicDec((volatile long*)ALock);                                         // Dec the lock
+    ATShareRelease(ALock);                                                      // Dec the lock
     return ATERR_SUCCESS;
 }
-// **************************************************************************** ATGetShareExclusive
-int ATGetShareExclusive(                                                        // Gets a sharelock in exclusive mode, blocks until all other readers are out
-                    ATLOCK          *ALock                                      // Lock to get
+// **************************************************************************** ATShareTakeExclusive
+static void ATShareTakeExclusive(                                               // Get our exclusive flag into a sharelock- does NOT wait for the readers
+                    ATLOCK          *ALock,                                     // Lock to get
+                    ATLockStats     *Stats,                                     // Class stats of the lock, NULL if not counting
+                    volatile unsigned long *Owner                               // Owner cell of the lock, NULL if the caller gave us none
                     ) {
     unsigned int    Orig, New, Result, NumberAttempts = 0;
 
@@ -450,26 +864,38 @@ retry_exclusive:
         New = Orig | AT_SHARE_EXC;                                              // Add in our exclusive flag
         // Note that we HAVE to use compare & exchange here, since with no kilroys we don't want two different guys thinking they are the one with the exclusive
         if ( (Result = ATCompareAndExchange(ALock, Orig, New)) != ATERR_SUCCESS ){// Try the lock
-            ATAdaptiveControl(NumberAttempts);                                   // Adaptive behavior for lock contention
+            if ( Stats ) {
+                ATLockStatsLost(Stats);
+                ATLockStatsWait(Stats);
+            }
+            ATAdaptiveControl(NumberAttempts);                                  // Adaptive behavior for lock contention
             NumberAttempts++;
             goto retry_exclusive;
         }
     }
     else {
-        ATAdaptiveControl(NumberAttempts);                                      // Adaptive behavior for lock contention
+        if ( Stats ) ATLockStatsWait(Stats);
+        if ( Owner && ATReclaimShareExclusive(ALock, Owner, NumberAttempts) == ATERR_SUCCESS )
+            goto retry_exclusive;                                               // The other exclusive's holder died, and it is gone now
+        if ( ATShouldPark(NumberAttempts) )                                     // Done spinning, so sleep until the other exclusive goes away
+            ATParkOnLock(ALock, Orig);
+        else
+            ATAdaptiveControl(NumberAttempts);                                  // Adaptive behavior for lock contention
         NumberAttempts++;
         goto retry_exclusive;
     }
+}
+// **************************************************************************** ATGetShareExclusive
+int ATGetShareExclusive(                                                        // Gets a sharelock in exclusive mode, blocks until all other readers are out
+                    ATLOCK          *ALock                                      // Lock to get
+                    ) {
+    ATLockStats     *Stats = ATLockStatsBegin();                                // Contention statistics, if they are on
 
-    // Once we are here, we have the exclusive but we still might have shares active... need to wait fot them to clear
-    NumberAttempts = 0;
-share_wait:
-    if ( *ALock != AT_SHARE_EXC ) {                                             // Wait until everyone else is out...
-        ATAdaptiveControl(NumberAttempts);                                      // Adaptive behavior for lock contention
-        NumberAttempts++;
-        goto share_wait;
-    }
+    ATShareTakeExclusive(ALock, Stats, ATLockOwnerBegin());
 
+    // Once we are here, we have the exclusive but we still might have shares active... need to wait fot them to clear
+    ATShareDrainWait(ALock, Stats);
+    if ( Stats ) ATLockStatsHit(Stats);
     return ATERR_SUCCESS;
 }
 // **************************************************************************** ATBounceShareExclusive
@@ -494,14 +920,7 @@ retry_exclusive:
     }
 
     // Once we are here, we have the exclusive but we still might have shares active... need to wait for them to clear
-    NumberAttempts = 0;
-share_wait:
-    if ( *ALock != AT_SHARE_EXC ) {                                             // Wait until everyone else is out...
-        ATAdaptiveControl(NumberAttempts);                                      // Adaptive behavior for lock contention
-        NumberAttempts++;
-        goto share_wait;
-    }
-
+    ATShareDrainWait(ALock, NULL);
     return ATERR_SUCCESS;
 }
 
@@ -514,6 +933,7 @@ int ATQueueShareExclusive(
                     ATLOCK          *ALock                                      // Lock to get
                     ) {
     unsigned int    Orig, New, Result, NumberAttempts = 0;
+    ATLockStats     *Stats = ATLockStatsBegin();                                // Contention statistics, if they are on
 
 retry_exclusive:
     Orig = *ALock;                                                              // What is the lock now
@@ -521,14 +941,17 @@ retry_exclusive:
         New = Orig | AT_SHARE_EXC;                                              // Add in our exclusive flag
         // Note that we HAVE to use compare & exchange here, since with no kilroys we don't want two different guys thinking they are the one with the exclusive
         if ( (Result = ATCompareAndExchange(ALock, Orig, New)) != ATERR_SUCCESS ){// Try the lock
+            if ( Stats ) ATLockStatsLost(Stats);
             ATAdaptiveControl(NumberAttempts);                                  // Adaptive behavior for lock contention
             NumberAttempts++;
             goto retry_exclusive;                                               // We retry here because it could be just a share lock interfering... if it is an exclusive we will find out and exit
         }
     }
     else {
+        if ( Stats ) ATLockStatsLost(Stats);
         return ATERR_OBJECT_IN_USE;                                             // The moment we see another exclusive, just bail
     }
+    if ( Stats ) ATLockStatsHit(Stats);
     return ATERR_SUCCESS;                                                       // We got out EXC flag in there, so leave it up to the caller to wait for the shares to be gone
 }
 // **************************************************************************** ATWaitQueueShareExclusive
@@ -536,12 +959,7 @@ int ATWaitQueueShareExclusive(
                                                                                 // In other words, wait until (*ALock == AT_SHARE_EXC)
                     ATLOCK          *ALock                                      // Lock to get
                     ) {
-    long    Attempts = 0;
-
-    while ( *ALock != AT_SHARE_EXC ) {                                          // Wait for nothing but caller's exclusive
-        ATAdaptiveControl(Attempts);                                            // Try to wait intelligently
-        Attempts++;
-    }
+    ATShareDrainWait(ALock, NULL);                                              // Wait for nothing but caller's exclusive
     return ATERR_SUCCESS;
 }
 // **************************************************************************** ATRemoveQueueShareExclusive
@@ -552,13 +970,15 @@ int ATRemoveQueueShareExclusive(
 
 retry_remove:
     Orig = *ALock;                                                              // What is the lock now
-    New = (Orig & AT_SHARE_EXC_I);                                              // Figure out what it will be without my lock on it
+    New = (Orig & AT_SHARE_EXC_I & ~AT_LOCK_WAITERS);                           // Figure out what it will be without my lock on it
     // Note that we HAVE to use compare & exchange here, since other folks might be screwing with the read count
     if ( (Result = ATCompareAndExchange(ALock, Orig, New)) != ATERR_SUCCESS ){  // Try the removal
         ATAdaptiveControl(NumberAttempts);                                  // Adaptive behavior for lock contention
         NumberAttempts++;
         goto retry_remove;                                                  // We retry here because it could be just a share lock interfering... if it is an exclusive we will find out and exit
     }
+    if ( Orig & AT_LOCK_WAITERS )                                               // Let anyone sleeping on the exclusive have a go
+        ATWakeLock(ALock, INT_MAX);
     return ATERR_SUCCESS;                                                       // We got out EXC flag in there, so leave it up to the caller to wait for the shares to be gone
 }
 // **************************************************************************** ATFreeShareExclusive
@@ -567,111 +987,492 @@ retry_remove:
 int ATFreeShareExclusive(                                                       // Free an exclusively held share lock
                     ATLOCK          *ALock                                      // The lock to free
                     ) {
+    if ( ATAtomicExchange(ALock, 0) & AT_LOCK_WAITERS )                         // Free it, and wake any readers & writers asleep on it
+        ATWakeLock(ALock, INT_MAX);
+    return ATERR_SUCCESS;
+}
+
+
+
+// ****************************************************************************
+// ****************************************************************************
+//                         BIG-READER SHARELOCKS
+// ****************************************************************************
+// ****************************************************************************
+/*  Readers count themselves in the slot for the CPU they are on, then look for an exclusive in the
+lock word.  Writers put their exclusive in the word, then add up the slots.  Both sides do a locked op
+before they look at the other side's memory, so either the reader sees the exclusive and backs out,
+or the writer sees the reader's count and waits for it.
+A reader may well be freed from a different CPU (slot) than it came in on, so a single slot can go
+negative- only the sum of the slots means anything.  The back-out in the acquire path always uses
+the slot it incremented, so a writer never sees a reader it hasn't also seen the increment for.
+*/
+// **************************************************************************** ATBRSlot
+static inline int ATBRSlot() {                                                  // Pick the reader slot for the caller- the CPU we are running on
+    int             CPU;
+#ifdef      AT_WIN32
+    CPU = (int)GetCurrentProcessorNumber();
+#else
+    if ( (CPU = sched_getcpu()) < 0 )                                           // No per-CPU number, so spread by stack address (one stack per thread)
+        CPU = (int)(((unsigned long)&CPU) >> 16);
+#endif
+    return CPU & (AT_BRLOCK_SLOTS - 1);
+}
+// **************************************************************************** ATBRReaders
+static long ATBRReaders(                                                        // Add up the readers in all the slots of a big-reader lock
+                    ATBRSLOT        *Slots                                      // Slots to count
+                    ) {
+    long            i, Total = 0;
+    for ( i = 0; i < AT_BRLOCK_SLOTS; ++i )
+        Total += (long)Slots[i].Readers;
+    return Total;
+}
+// **************************************************************************** ATBRRelease
+static void ATBRRelease(                                                        // Pull one reader out of a slot, waking a writer asleep on the lock word
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slot                                       // The slot to pull the reader from
+                    ) {
+    ATAtomicExchangeAdd(&(Slot->Readers), (unsigned long)-1);                   // Locked, so our dec is out before we look at the word
+    if ( *ALock & AT_LOCK_WAITERS )                                             // Somebody is asleep- it may be a writer waiting on the slots
+        ATClearWaiters(ALock);
+}
+// **************************************************************************** ATBRDrainWait
+static void ATBRDrainWait(                                                      // With our exclusive flag in the lock word, wait for the readers in the word and the slots to leave
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots,                                     // Slots to drain
+                    ATLockStats     *Stats                                      // Class stats of the lock, NULL if not counting
+                    ) {
+    unsigned long   Orig;
+    long            NumberAttempts = 0;
+
+    while ( ((Orig = *ALock) & AT_SHARE_COUNT) || ATBRReaders(Slots) ) {        // Wait until everyone else is out...
+        if ( Stats ) ATLockStatsWait(Stats);
+        if ( !ATShouldPark(NumberAttempts) )
+            ATAdaptiveControl(NumberAttempts);                                  // Adaptive behavior for lock contention
+        else if ( !(Orig & AT_LOCK_WAITERS) )                                   // Flag ourselves first, and go around to look at the slots again
+            ATCompareAndExchange(ALock, Orig, Orig | AT_LOCK_WAITERS);          // Any reader leaving a slot after our next look will see the flag and wake us
+        else
+            ATParkOnLock(ALock, Orig);
+        NumberAttempts++;
+    }
+}
+// **************************************************************************** ATInitBRLock
+int ATInitBRLock(                                                               // Zero out a big-reader sharelock and its slots
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    ) {
+    if ( !ALock || !Slots ) return ATERR_BAD_PARAMETERS;
     *ALock = 0;
+    memset((void*)Slots, 0, sizeof(ATBRSLOT) * AT_BRLOCK_SLOTS);
     return ATERR_SUCCESS;
 }
+// **************************************************************************** ATBounceBRShare
+int ATBounceBRShare(                                                            // Try to get a big-reader share, return immediately if failed
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    ) {
+    ATBRSLOT        *Slot;
+    ATLockStats     *Stats = ATLockStatsBegin();                                // Contention statistics, if they are on
 
+    if ( !(*ALock & AT_SHARE_EXC) ) {                                           // No use even trying if it is already locked
+        Slot = Slots + ATBRSlot();
+        ATAtomicExchangeAdd(&(Slot->Readers), 1);                               // Try getting it
+        if ( !(*ALock & AT_SHARE_EXC) ) {                                       // Make sure we were successful
+            if ( Stats ) ATLockStatsHit(Stats);
+            return ATERR_SUCCESS;
+        }
+        ATBRRelease(ALock, Slot);                                               // We didn't get it, so pull our inc off of the same slot
+    }
+    if ( Stats ) ATLockStatsLost(Stats);
+    return ATERR_OBJECT_IN_USE;
+}
+// **************************************************************************** ATGetBRShare
+int ATGetBRShare(                                                               // Get a big-reader share, don't return until you get it
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    ) {
+    long            NumberAttempts = 0;                                         // Number of attempts made to get the lock
+    unsigned long   Orig;
+    ATBRSLOT        *Slot;
+    ATLockStats     *Stats = ATLockStatsBegin();                                // Contention statistics, if they are on
+    volatile unsigned long *Owner = ATLockOwnerBegin();                         // Owner cell of the lock, if the caller gave us one
+retry:
+    if ( !((Orig = *ALock) & AT_SHARE_EXC) ) {                                  // No use even trying if it is already locked
+        Slot = Slots + ATBRSlot();
+        ATAtomicExchangeAdd(&(Slot->Readers), 1);                               // Try getting it
+        if ( !(*ALock & AT_SHARE_EXC) ) {                                       // Make sure we were successful
+            if ( Stats ) ATLockStatsHit(Stats);
+            return ATERR_SUCCESS;
+        }
+        ATBRRelease(ALock, Slot);                                               // We didn't get it, so pull our inc off of the same slot
+        if ( Stats ) ATLockStatsLost(Stats);
+    }
+    if ( Stats ) ATLockStatsWait(Stats);
+    if ( (Orig & AT_SHARE_EXC) && Owner &&
+         ATReclaimShareExclusive(ALock, Owner, NumberAttempts) == ATERR_SUCCESS )
+        goto retry;                                                             // The exclusive's holder died, and it is gone now
+    if ( (Orig & AT_SHARE_EXC) && ATShouldPark(NumberAttempts) ) {              // Done spinning, so sleep until the exclusive goes away
+        ATParkOnLock(ALock, Orig);
+        NumberAttempts++;
+        goto retry;
+    }
+    ATAdaptiveControl(NumberAttempts);                                          // Adaptive behavior for lock contention
+    NumberAttempts++;                                                           // Inc our number of attempts
+    goto retry;                                                                 // Give it another try
+}
+// **************************************************************************** ATFreeBRShare
+int ATFreeBRShare(                                                              // Frees a big-reader share
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    ) {
+    ATBRRelease(ALock, Slots + ATBRSlot());                                     // Any slot will do- writers only look at the sum
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATGetBRShareExclusive
+int ATGetBRShareExclusive(                                                      // Gets a big-reader sharelock in exclusive mode, blocks until all readers in the word AND the slots are out
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    ) {
+    ATLockStats     *Stats = ATLockStatsBegin();                                // Contention statistics, if they are on
 
+    ATShareTakeExclusive(ALock, Stats, ATLockOwnerBegin());                     // Same exclusive as a plain sharelock...
+    ATBRDrainWait(ALock, Slots, Stats);                                         // ...but the readers are spread out
+    if ( Stats ) ATLockStatsHit(Stats);
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATWaitQueueBRShareExclusive
+int ATWaitQueueBRShareExclusive(                                                // After a successful ATQueueShareExclusive on the lock word, wait for the readers in the word AND the slots to leave
+                    ATLOCK          *ALock,                                     // Lock word
+                    ATBRSLOT        *Slots                                      // The lock's AT_BRLOCK_SLOTS reader slots
+                    ) {
+    ATBRDrainWait(ALock, Slots, NULL);                                          // Wait for nothing but caller's exclusive
+    return ATERR_SUCCESS;
+}
 
+// ****************************************************************************
+// ****************************************************************************
+//                               TICKET LOCKS
+// ****************************************************************************
+// ****************************************************************************
+/*  Fair, FIFO exclusive locks.  The high half of the lock is the next ticket to hand out, the
+low half is the ticket being served.  Only the holder ever writes the low half, so a free is a plain store.
+*/
+// **************************************************************************** ATGetTicketLock
+int ATGetTicketLock(                                                            // Take a ticket and don't return until it is served
+                    ATLOCK          *ALock                                      // Ptr to the lock (any 32bit sized piece of memory initialized to zero, shared memory if you want a global lock)
+                    ) {
+    unsigned long   Ticket, Serving;
+    long            NumberAttempts = 0;                                         // Number of times we have looked at the lock
+    volatile long   RH;
+    ATLockStats     *Stats = ATLockStatsBegin();                                // Contention statistics, if they are on
+
+    Ticket = (ATAtomicExchangeAdd(ALock, AT_TICKET_NEXT) >> 16) & AT_TICKET_MASK;// Take a number
+    while ( (Serving = (*ALock & AT_TICKET_MASK)) != Ticket ) {                 // Until our number comes up
+        if ( Stats ) ATLockStatsWait(Stats);
+        if ( CPUInfo.UsableProcs > 1 && NumberAttempts < AT_TICKET_SPINS )      // Those ahead of us should be through soon- back off in proportion to the line ahead
+            ATSpin(((Ticket - Serving) & AT_TICKET_MASK) * AT_TICKET_BACKOFF * 1000 / CPUInfo.PausePicos, &RH);
+        else                                                                    // Someone in line has likely been preempted, so let them run
+            ATYield();
+        NumberAttempts++;
+    }
+    if ( Stats ) ATLockStatsHit(Stats);
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATBounceTicketLock
+int ATBounceTicketLock(                                                         // Get the lock only if nobody holds it or is waiting in line, else return immediately
+                    ATLOCK          *ALock                                      // Ptr to the lock
+                    ) {
+    unsigned long   Orig = *ALock;                                              // What is the lock now
+    ATLockStats     *Stats = ATLockStatsBegin();                                // Contention statistics, if they are on
 
+    if ( ((Orig >> 16) & AT_TICKET_MASK) != (Orig & AT_TICKET_MASK) ||          // Held, or there is a line- no cutting
+         ATCompareAndExchange(ALock, Orig, Orig + AT_TICKET_NEXT) != ATERR_SUCCESS ) {// Take the next ticket, which is the one being served
+        if ( Stats ) ATLockStatsLost(Stats);
+        return ATERR_OBJECT_IN_USE;
+    }
+    if ( Stats ) ATLockStatsHit(Stats);
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATFreeTicketLock
+int ATFreeTicketLock(                                                           // Free up a ticket lock- MAKE SURE YOU HAVE IT FIRST!  Serves the next ticket in line.
+                    ATLOCK          *ALock                                      // Ptr to the lock
+                    ) {
+    __asm__ __volatile__( "" : : : "memory" );                                  // Keep the compiler from sinking our critical section stores past the free
+    *((volatile unsigned short *)ALock) = (unsigned short)((*ALock & AT_TICKET_MASK) + 1);// Only the holder writes the low half, and IA stores are ordered, so no lock prefix needed
+    return ATERR_SUCCESS;
+}
 
-/* This is destined to be a lockless freelist.  I want to come back and finish it.
-Beautiful (and solid) concept.  But just too special purpose for what I need right now.
-The issue is that for good performance, the users need to be marginally balanced (though
-you can easily make up for a bit of imbalance with simple balancing thresholds).
-So, for something like what MK Worker Threads it would be gorgeous- zero locking!  But for
-general purpose use like Atlas, it might degrade too easily, even with the mechanisms I devised
-to dynamically join & leave the list.  Sigh.
 
-struct  ATNLFreeListList {                                                      // Each list should have this structure
-    volatile long           Start1;                                             // First entry in list (first of two values)
-    volatile long           Start2;
-    volatile ULONG ULONG    Taken;                                              // Number of items I have taken from the list
-    volatile ULONG ULONG    Added;                                              // Number of items that have been added to the list
-    volatile long           Private1;                                           // First entry in my private list
-    volatile long           Private2;
-    volatile long           InUse;                                              // True if this list is in use
-    volatile long           ForwardRequest;                                     // Area used to receive messages from lists above yours
-    volatile long           BackwardRequest;                                    // Area used to receive messages from lists below yours
-};
-typedef struct ATNLFreeListList ATNLFLL;
+// ****************************************************************************
+// ****************************************************************************
+//                             LOCK STATISTICS
+// ****************************************************************************
+// ****************************************************************************
+/*  The lock calls pick up LockStats once at the top, so a call that started with the statistics on
+finishes counting into that block.  That makes enabling safe at any time, but a shared segment is
+detached by ATDisableLockStats, so only disable once this process's other threads are done locking.
+*/
+// **************************************************************************** ATEnableLockStats
+int ATEnableLockStats(                                                          // Start keeping lock contention statistics
+                    int             Key                                         // IPC key of the shared statistics segment (created or attached), zero to keep them for this process only
+                    ) {
+    if ( LockStats ) return ATERR_OBJECT_IN_USE;
 
-struct ATNLFreeListInfo {
-    long                AllocatedLists;                                         // Number of lists allocated
-    long                NullValue;                                              // Value to use for the null value
-    ATLOCK              ALock;                                                  // Lock used to add lists
-};
-typedef struct ATNLFreeListInfo ATNLFLI;
+    if ( !Key ) {                                                               // Just for us
+        memset((void*)&LocalLockStats, 0, sizeof(ATLockStatBlock));
+        LockStats = &LocalLockStats;
+        return ATERR_SUCCESS;
+    }
+    if ( LockStatMem.CreateSharedMem(Key, sizeof(ATLockStatBlock)) == ATERR_SUCCESS )// First one up makes the segment...
+        memset((void*)LockStatMem.GetBasePointer(), 0, sizeof(ATLockStatBlock));
+    else if ( LockStatMem.AttachSharedMem(Key) != ATERR_SUCCESS )               // ...everyone else joins it
+        return ATERR_OUT_OF_MEMORY;
+    LockStats = (ATLockStatBlock*)LockStatMem.GetBasePointer();
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATDisableLockStats
+int ATDisableLockStats() {                                                      // Stop keeping lock contention statistics, detaching from (or removing, if we created it) the segment
+    if ( !LockStats ) return ATERR_SUCCESS;
 
-struct ATNLFreeListChain {                                                      // Structure that defines a chain for the class
-    long                Value1;                                                 // User defined & used value- the class only passes it, and doesn't care what is in it
-    long                Value2;                                                 // User defined & used value- the class only passes it, and doesn't care what is in it
-};
-typedef struct ATNLFreeListChain ATNLFLC;
-
-// A message that tells a list to refind its neighbor- once it does, it sends a FOUNDYOU message to that neighbor
-#define     AT_NLFL_REFINDNEIGHBOR      1
-// See above
-#define     AT_NLFL_FOUNDYOU            2
-// The list has not yet sent a REFINDNEIGHBOR message to its lesser neighbor
-#define     AT_NLFL_WAITTOSTART         3
-// The list has sent the above message, but has not yet gotten confirmation that it can start yet
-#define     AT_NLFL_WAITTOWRITE         4
-// The list is chugging along in normal status
-#define     AT_NLFL_NORMAL              5
-
-// **************************************************************************** ATNLFreeList
-class   ATNLFreeList {                                                          // No locking free list class
-private:
-    ATNLFLL         *Lists;                                                     // Ptr to the base of the lists in memory
-    ATNLFLI         *Info;                                                      // Ptr to the base of the free list info in memory
-    long            MyList;                                                     // My list handle
-    long            NumberLists;                                                // The number of lists being tracked
-    long            Null;                                                       // My locally cached NULL value
-    long            MyNeighbor;                                                 // Cached value of my neighbor
-    long            Status;                                                     // My current status
-
-    (void *(*GetNext)(long, long));                                             // Function to get our next list location from stored values
-    ATNLFLC         *LastLooked;                                                // Ptr to the last place we looked
-
-    void            Reset();
-    int             DetermineNextNeighbor();                                    // Finds the nearest occupied neighbor above you- the one you will write to
-    int             DeterminePrevNeighbor();                                    // Finds the nearest occupied neighbor below you- the one who will write to you
-public:
-    ATNLFreeList();
-    ~ATNLFreeList();
-    int             Create(                                                     // Call to create the freelist (OUTSIDE ATOMICITY ASSUMED- ONLY CALL ONCE)
-                            int         inLists,                                // Number of lists to maintain
-                            char        *inListsMemory,                         // A chunk of global memory, (inLists * sizeof(ATNFLL)) in size for the class to use
-                            ATNLFLI     *inInfo,                                // Ptr to a global section of memory that has the info struct allocated
-                            (ATNLFLC *(*func)(long, long)) inNext,              // Function that takes the 2 user specified longs and returns a pointer to the next item in the list
-                                                                                // Should look something like: ATNLFLC *NextPtr(long V1, long V2);
-                            long        inNull                                  // Value to use for NULL
-                            );
-    int             Open(                                                       // Call to open an initialized free list (OUTSIDE ATOMICITY ASSUMED)
-                            char        *inListsMemory                          // A chunk of global memory, (inLists * sizeof(ATNFLL)) in size
-                            ATNLFLI     *inInfo,                                // Ptr to a global section of memory that has the info struct allocated
-                            (ATNLFLC *(*func)(long, long)) inNext,              // Function that takes the 2 user specified longs and returns a pointer to the next item in the list
-                                                                                // Should look something like: ATNLFLC *NextPtr(long V1, long V2);
-                            );
-    int             Close();                                                    // Call to detach from the freelist
-    int             AddToList(                                                  // Call to add 2 values to the list
-                            ATNLFLL     *Lists,                                 // Ptr to the base of the free lists
-                            long        Value1,                                 // First value to add
-                            long        Value2
-                            );
-    int             TakeFromList(                                               // Returns the next item on caller's list, if anything
-                            long        *Value1,                                // Ptr to return first value
-                            long        *Value2                                 // Ptr to return next value
-                            );
+    LockStats = NULL;                                                           // Stop counting first
+    if ( LockStatMem.GetBasePointer() )                                         // Then let go of the segment, if it is one
+        LockStatMem.FreeSharedMem();
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATSetLockClass
+void ATSetLockClass(                                                            // Tag the calling thread's next lock acquisition with a lock class
+                    long            Class                                       // One of AT_LOCKCLASS_*
+                    ) {
+    NextLockClass = Class;                                                      // Picks the backoff policy too, so set it even with the statistics off
+}
+// **************************************************************************** ATGetLockStats
+int ATGetLockStats(                                                             // Copy out the current statistics for a lock class
+                    long            Class,                                      // One of AT_LOCKCLASS_*
+                    ATLockStats     *Stats                                      // Where to copy them
+                    ) {
+    if ( !Stats || Class < 0 || Class >= AT_LOCKCLASSES ) return ATERR_BAD_PARAMETERS;
+    if ( !LockStats ) return ATERR_NOT_FOUND;
+
+    memcpy((void*)Stats, (void*)&(LockStats->Classes[Class]), sizeof(ATLockStats));
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATResetLockStats
+int ATResetLockStats() {                                                        // Zero all the lock statistics
+    if ( !LockStats ) return ATERR_NOT_FOUND;
+
+    memset((void*)LockStats, 0, sizeof(ATLockStatBlock));
+    return ATERR_SUCCESS;
+}
+
+
+// ****************************************************************************
+// ****************************************************************************
+//                            LOCK BACKOFF POLICIES
+// ****************************************************************************
+// ****************************************************************************
+// **************************************************************************** ATSetLockPolicy
+int ATSetLockPolicy(                                                            // Set the backoff policy for a lock class
+                    long            Class,                                      // One of AT_LOCKCLASS_*
+                    ATLockPolicy    *Policy                                     // The policy to use
+                    ) {
+    if ( !Policy || Class < 0 || Class >= AT_LOCKCLASSES ) return ATERR_BAD_PARAMETERS;
+    if ( Policy->Mode < AT_LOCKPOLICY_SPIN || Policy->Mode > AT_LOCKPOLICY_PARK ||
+         Policy->MinSpinNanos <= 0 || Policy->MaxSpinNanos < Policy->MinSpinNanos ||
+         Policy->ParkAttempts < 0 || Policy->YieldAttempts < 0 || Policy->MaxNapMicros <= 0 )
+        return ATERR_BAD_PARAMETERS;
+
+    memcpy((void*)&(LockPolicies[Class]), (void*)Policy, sizeof(ATLockPolicy));
+    PolicySet[Class] = 1;                                                       // Yours from here on
+    ATSetBackoff(Class);
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATGetLockPolicy
+int ATGetLockPolicy(                                                            // Copy out the backoff policy for a lock class
+                    long            Class,                                      // One of AT_LOCKCLASS_*
+                    ATLockPolicy    *Policy                                     // Where to copy it
+                    ) {
+    if ( !Policy || Class < 0 || Class >= AT_LOCKCLASSES ) return ATERR_BAD_PARAMETERS;
+
+    memcpy((void*)Policy, (void*)&(LockPolicies[Class]), sizeof(ATLockPolicy));
+    return ATERR_SUCCESS;
+}
+
+
+// ****************************************************************************
+// ****************************************************************************
+//                            DEAD OWNER RECOVERY
+// ****************************************************************************
+// ****************************************************************************
+/*  Entries are claimed with a CAS on the Kilroy, and the PID is filled in after, so a lookup that
+finds a zero PID treats the owner as alive.  A dead process's entries are left in place- every
+waiter on its locks needs to find them- until a new process registers the same Kilroy.
+*/
+// **************************************************************************** ATProcessIsGone
+static int ATProcessIsGone(                                                     // Returns true if a process no longer exists
+                    long            PID                                         // The process to look for
+                    ) {
+#ifdef      AT_WIN32
+    HANDLE          Process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)PID);
+    int             Gone;
+
+    if ( !Process ) return ( GetLastError() == ERROR_INVALID_PARAMETER );       // No such process
+    Gone = ( WaitForSingleObject(Process, 0) == WAIT_OBJECT_0 );                // Signalled once it has exited
+    CloseHandle(Process);
+    return Gone;
+#else
+    return ( kill((pid_t)PID, 0) == -1 && errno == ESRCH );                     // EPERM means it is there, just not ours
+#endif
+}
+// **************************************************************************** ATFindOwner
+static volatile ATOwner *ATFindOwner(                                           // Find a Kilroy's registry entry- returns NULL if it isn't registered
+                    unsigned long   Kilroy                                      // The Kilroy to look up
+                    ) {
+    long            i;
+
+    Kilroy &= ~AT_LOCK_WAITERS;                                                 // Lock words may carry the waiter flag
+    for ( i = 0; i < AT_MAX_OWNERS; i++ )
+        if ( (Owners->Owners[i].Kilroy & ~AT_LOCK_WAITERS) == Kilroy )
+            return &(Owners->Owners[i]);
+    return NULL;
 }
+// **************************************************************************** ATEnableOwnerRegistry
+int ATEnableOwnerRegistry(                                                      // Start the owner registry, so waiters can recover locks from dead processes
+                    int             Key                                         // IPC key of the shared registry segment (created or attached), zero to keep it for this process only
+                    ) {
+    if ( Owners ) return ATERR_OBJECT_IN_USE;
+
+    if ( !Key ) {                                                               // Just for us
+        memset((void*)&LocalOwners, 0, sizeof(ATOwnerBlock));
+        Owners = &LocalOwners;
+        return ATERR_SUCCESS;
+    }
+    if ( OwnerMem.CreateSharedMem(Key, sizeof(ATOwnerBlock)) == ATERR_SUCCESS ) // First one up makes the segment...
+        memset((void*)OwnerMem.GetBasePointer(), 0, sizeof(ATOwnerBlock));
+    else if ( OwnerMem.AttachSharedMem(Key) != ATERR_SUCCESS )                  // ...everyone else joins it
+        return ATERR_OUT_OF_MEMORY;
+    Owners = (ATOwnerBlock*)OwnerMem.GetBasePointer();
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATDisableOwnerRegistry
+int ATDisableOwnerRegistry() {                                                  // Stop using the owner registry, detaching from (or removing, if we created it) the segment
+    if ( !Owners ) return ATERR_SUCCESS;
+
+    Owners = NULL;                                                              // Stop looking first
+    if ( OwnerMem.GetBasePointer() )                                            // Then let go of the segment, if it is one
+        OwnerMem.FreeSharedMem();
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATRegisterKilroy
+int ATRegisterKilroy(                                                           // Register a Kilroy as belonging to the calling process
+                    unsigned long   Kilroy                                      // The Kilroy the caller's locks will carry- non-zero, with the AT_LOCK_WAITERS bit clear
+                    ) {
+    volatile ATOwner *Entry;
+    long            i;
+
+    if ( !Kilroy || (Kilroy & AT_LOCK_WAITERS) ) return ATERR_BAD_PARAMETERS;   // The waiter flag would make it ambiguous in a lock word
+    if ( !Owners ) return ATERR_NOT_FOUND;
+
+    if ( (Entry = ATFindOwner(Kilroy)) ) {                                      // Already there- likely left by a dead process, so it is ours now
+        Entry->PID = (long)getpid();
+        return ATERR_SUCCESS;
+    }
+    for ( i = 0; i < AT_MAX_OWNERS; i++ ) {                                     // Claim a free entry
+        Entry = &(Owners->Owners[i]);
+        if ( !Entry->Kilroy && ATCompareAndExchange(&(Entry->Kilroy), 0, Kilroy) == ATERR_SUCCESS ) {
+            Entry->PID = (long)getpid();
+            return ATERR_SUCCESS;
+        }
+    }
+    return ATERR_MAXIMUM_USERS;
+}
+// **************************************************************************** ATUnregisterKilroy
+int ATUnregisterKilroy(                                                         // Drop a Kilroy from the registry- free its locks first
+                    unsigned long   Kilroy                                      // The Kilroy to drop
+                    ) {
+    volatile ATOwner *Entry;
+
+    if ( !Kilroy ) return ATERR_BAD_PARAMETERS;
+    if ( !Owners ) return ATERR_NOT_FOUND;
+    if ( !(Entry = ATFindOwner(Kilroy)) ) return ATERR_NOT_FOUND;
+
+    Entry->PID = 0;                                                             // Looks alive to anyone still reading it...
+    Entry->Kilroy = 0;                                                          // ...and then free
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATIsKilroyDead
+int ATIsKilroyDead(                                                             // Returns true if the Kilroy is registered to a process that no longer exists
+                    unsigned long   Kilroy                                      // The Kilroy to look up
+                    ) {
+    volatile ATOwner *Entry;
+    long            PID;
+
+    if ( !Owners || !(Kilroy & ~AT_LOCK_WAITERS) ) return 0;
+    if ( !(Entry = ATFindOwner(Kilroy)) ) return 0;                             // Never registered, so we can't know
+    if ( !(PID = Entry->PID) ) return 0;                                        // Still being registered
+    return ATProcessIsGone(PID);
+}
+// **************************************************************************** ATReclaimSpinLock
+int ATReclaimSpinLock(                                                          // Take a spinlock over from a dead holder- ATERR_SUCCESS means the caller now holds it
+                    unsigned long   Kilroy,                                     // The caller's Kilroy, put in the lock if we take it
+                    ATLOCK          *ALock,                                     // Lock to take over
+                    long            Attempts                                    // Number of tries the caller has made at the lock- nothing is done before AT_DEADOWNER_ATTEMPTS
+                    ) {
+    unsigned long   Orig;
+
+    if ( !Owners || Attempts < AT_DEADOWNER_ATTEMPTS ) return ATERR_OBJECT_IN_USE;
+
+    Orig = *ALock;
+    if ( !(Orig & ~AT_LOCK_WAITERS) || !ATIsKilroyDead(Orig) ) return ATERR_OBJECT_IN_USE;
+    return ATCompareAndExchange(ALock, Orig, Kilroy | (Orig & AT_LOCK_WAITERS));// Only one waiter gets it- the flag stays up for the others asleep on it
+}
+// **************************************************************************** ATReclaimShareExclusive
+int ATReclaimShareExclusive(                                                    // Strip a dead holder's exclusive off of a sharelock- ATERR_SUCCESS means it is gone, and the caller should try for the lock again
+                    ATLOCK          *ALock,                                     // The sharelock
+                    volatile unsigned long *Owner,                              // The lock's owner cell
+                    long            Attempts                                    // Number of tries the caller has made at the lock- nothing is done before AT_DEADOWNER_ATTEMPTS
+                    ) {
+    unsigned long   Holder, Orig;
 
+    if ( !Owners || !Owner || Attempts < AT_DEADOWNER_ATTEMPTS ) return ATERR_OBJECT_IN_USE;
+
+    Holder = *Owner;
+    if ( !Holder || !(*ALock & AT_SHARE_EXC) || !ATIsKilroyDead(Holder) ) return ATERR_OBJECT_IN_USE;
+    if ( ATCompareAndExchange(Owner, Holder, 0) != ATERR_SUCCESS )              // Only one of us does the reclaim
+        return ATERR_OBJECT_IN_USE;
+    // Holders set the cell after they get the exclusive and clear it before they let it go, so it is still the dead one's
+    do {
+        Orig = *ALock;
+    } while ( ATCompareAndExchange(ALock, Orig, Orig & AT_SHARE_EXC_I & ~AT_LOCK_WAITERS) != ATERR_SUCCESS );
+    if ( Orig & AT_LOCK_WAITERS )                                               // Let anyone sleeping on the exclusive have a go
+        ATWakeLock(ALock, INT_MAX);
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATSetLockOwner
+void ATSetLockOwner(                                                            // Give the calling thread's next blocking sharelock call the lock's owner cell, so it can recover a dead exclusive
+                    volatile unsigned long *Owner                               // The lock's owner cell
+                    ) {
+    if ( Owners )                                                               // Don't even touch it when the registry is off
+        NextLockOwner = Owner;
+}
+
+
+// ****************************************************************************
+// ****************************************************************************
+//                           NO LOCKING FREE LISTS
+// ****************************************************************************
+// ****************************************************************************
+/*  Everything on a private chain belongs to its owner alone, so the private fields are plain loads
+and stores.  The public lists see just two operations- push a chain on, and take the whole list- so
+a head that shows up again between a look and a CAS is harmless: a push still links to what is
+really there, and a take walks the links only after the list is already its own.
+*/
 // **************************************************************************** Constructor
-ATNLFreeList::ANNLFreeList(){
+ATNLFreeList::ATNLFreeList() {
     Reset();
 }
 // **************************************************************************** Destructor
 ATNLFreeList::~ATNLFreeList() {
+    Close();                                                                    // Don't strand anything on my private chain
 }
 // **************************************************************************** Reset
 void ATNLFreeList::Reset() {
@@ -679,116 +1480,263 @@ void ATNLFreeList::Reset() {
     Info = NULL;
     MyList = -1;
     Null = -1;
+    Balance = AT_NLFL_BALANCE;
     GetNext = NULL;
-    LastLooked = NULL;
+    Context = NULL;
     NumberLists = 0;
-    MyNeighbor = 1;
-    Status = AT_NLFL_WAITTOWRITE;
+    MyNeighbor = -1;
 }
 // **************************************************************************** Create
-int ATNLFreeList::Create(                                                       // Call to create the freelist (OUTSIDE ATOMICITY ASSUMED- ONLY CALL ONCE)
-                            int         inLists,                                // Number of lists to maintain
-                            char        *inListsMemory,                         // A chunk of global memory, (inLists * sizeof(ATNFLL)) in size
+int ATNLFreeList::Create(                                                       // Call to create the freelist, and open the first list for the caller (OUTSIDE ATOMICITY ASSUMED- ONLY CALL ONCE)
+                            int         inLists,                                // Number of lists to maintain- one per concurrent owner
+                            char        *inListsMemory,                         // A chunk of global memory, (inLists * sizeof(ATNLFLL)) in size & 8 byte aligned, for the class to use
                             ATNLFLI     *inInfo,                                // Ptr to a global section of memory that has the info struct allocated
-                            (ATNLFLC *(*func)(long, long)) inNext,              // Function that takes the 2 user specified longs and returns a pointer to the next item in the list
-                                                                                // Should look something like: ATNLFLC *NextPtr(long V1, long V2);
-                            long        inNull                                  // Value to use for NULL
+                            ATNLFLNEXT  inNext,                                 // Function that takes the 2 user specified longs and returns a pointer to the item's chain
+                            void        *inContext,                             // Passed back to inNext, untouched
+                            long        inNull,                                 // Value1 to use for NULL- never a real item
+                            long        inBalance                               // Entries moved to a neighbor at a time, zero for AT_NLFL_BALANCE
                             ) {
     int     i;
 
-    if ( inLists < 1 || !inListsMemory || !inInfo || !inNext )
+    if ( inLists < 1 || !inListsMemory || !inInfo || !inNext || ((unsigned long)inListsMemory & 7) )
         return ATERR_BAD_PARAMETERS;
+    if ( MyList > -1 ) return ATERR_OBJECT_IN_USE;                              // Don't allow this object to be screwed up
+    if ( inBalance < 1 ) inBalance = AT_NLFL_BALANCE;
 
-    Lists =         inListsMemory;                                              // Init the class members
+    Lists =         (ATNLFLL*)inListsMemory;                                    // Init the class members
     Info =          inInfo;
     GetNext =       inNext;
-    MyList =        0;
+    Context =       inContext;
     Null =          inNull;
     NumberLists =   inLists;
-    Status =        AT_NLFL_WAITTOSTART;
+    Balance =       inBalance;
 
     Info->NullValue =       inNull;                                             // Init the info structure
-    Info->ALock =           0;
+    Info->Balance =         inBalance;
     Info->AllocatedLists =  inLists;
 
     for ( i = 0; i < NumberLists; ++i) {                                        // Init all of the lists
-        Lists[i]->Start1 = Lists[i]->Start2 =       Null;
-        Lists[i]->Private1 = Lists[i]->Private2 =   Null;
-        Lists[i]->Taken = Lists[i]->Added =         0;
-        Lists[i]->InUse =                           0;
-        Lists[i]->ForwardRequests =                 0;
-        Lists[i]->BackwardRequests =                0;
+        Lists[i].Start =                        AT_NLFL_PACK(Null, Null);
+        Lists[i].Private1 = Lists[i].Private2 = Null;
+        Lists[i].PrivateCount =                 0;
+        Lists[i].Taken = Lists[i].Added =       0;
+        Lists[i].InUse =                        0;
+        Lists[i].ForwardRequest =               0;
     }
 
-    Lists[MyList]->InUse = 1;                                                   // Init my own list
-
+    MyList = 0;                                                                 // Init my own list
+    Lists[MyList].InUse = 1;
+    MyNeighbor = DetermineNextNeighbor();
     return ATERR_SUCCESS;
 }
 // **************************************************************************** Open
-int ATNLFreeList::Open(                                                         // Call to open an initialized free list (OUTSIDE ATOMICITY ASSUMED)
-                            char        *inListsMemory                          // A chunk of global memory, (inLists * sizeof(ATNFLL)) in size
+int ATNLFreeList::Open(                                                         // Call to open an initialized free list, claiming a list of my own
+                            char        *inListsMemory,                         // The same chunk of global memory given to Create()
                             ATNLFLI     *inInfo,                                // Ptr to a global section of memory that has the info struct allocated
-                            (ATNLFLC *(*func)(long, long)) inNext,              // Function that takes the 2 user specified longs and returns a pointer to the next item in the list
-                                                                                // Should look something like: ATNLFLC *NextPtr(long V1, long V2);
+                            ATNLFLNEXT  inNext,                                 // Function that takes the 2 user specified longs and returns a pointer to the item's chain
+                            void        *inContext                              // Passed back to inNext, untouched
                             ) {
     int     i;
 
-    if ( inLists < 1 || !inListsMemory || !inInfo || !inNext )
+    if ( !inListsMemory || !inInfo || !inNext || ((unsigned long)inListsMemory & 7) )
         return ATERR_BAD_PARAMETERS;
+    if ( MyList > -1 ) return ATERR_OBJECT_IN_USE;                              // Don't allow this object to be screwed up
 
-    NumberLists =   inLists;                                                    // Init the class members
-    Lists =         inListsMemory;
+    Lists =         (ATNLFLL*)inListsMemory;                                    // Init the class members
     Info =          inInfo;
     GetNext =       inNext;
-    MyList =        0;
+    Context =       inContext;
     Null =          Info->NullValue;
     NumberLists =   Info->AllocatedLists;
+    Balance =       Info->Balance;
 
-    GetSpinLock(Info->ALock);                                                   // Get a lock on the freelist
-    for ( i = 0; i < NumberLists; ++i) {
-        if ( !(Lists[i].InUse) ) {                                              // Look for the first empty spot
-            Lists[i].InUse = 1;                                                 // Make it mine
-            FreeSpinLock(Info->Alock);                                          // Release the lock
-            MyList = i;
-        }
+    for ( i = 0; i < NumberLists; ++i) {                                        // Look for the first empty spot, and make it mine
+        if ( !Lists[i].InUse && ATCompareAndExchange(&(Lists[i].InUse), 0, 1) == ATERR_SUCCESS )
+            break;
     }
     if ( i >= NumberLists ) {                                                   // If there are no lists open, I am out of luck
-        FreeSpinLock(Info->Alock);
-        return ATERR_OUT_OF_MEMORY;
+        Reset();
+        return ATERR_MAXIMUM_USERS;
     }
 
-    MyNeighbor = DetermineNextNeighbor();                                       // Try to someone to write to
-    if ( (i = DeterminePrevNeighbor()) > -1 ) {                                 // Try to find someone to write to me
-You left off right here....
+    MyList = i;                                                                 // Anything left on the private chain (an owner that died, say) is simply mine now
+    Lists[MyList].ForwardRequest = 0;
+    MyNeighbor = DetermineNextNeighbor();                                       // Try to find someone to write to
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** Close
+int ATNLFreeList::Close() {                                                     // Call to detach from the freelist- anything on my private chain is left up for the others
+    volatile ATNLFLL *My;
+    volatile ATNLFLC *Link;
+    long    Last1, Last2;
+
+    if ( MyList < 0 ) return ATERR_SUCCESS;                                     // Safe to call repeatedly
+    My = &(Lists[MyList]);
+
+    if ( My->PrivateCount ) {                                                   // Put my private chain up on my public list, where anyone can take it
+        Last1 = My->Private1;
+        Last2 = My->Private2;
+        while ( (Link = GetNext(Context, Last1, Last2))->Value1 != Null ) {     // Find the end of the chain
+            Last1 = Link->Value1;
+            Last2 = Link->Value2;
+        }
+        PushChain(MyList, My->Private1, My->Private2, Last1, Last2);
+        My->Private1 = My->Private2 = Null;
+        My->PrivateCount = 0;
+    }
+    My->ForwardRequest = 0;
+    My->InUse = 0;                                                              // And give up the list
+    Reset();
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** AddToList
+int ATNLFreeList::AddToList(                                                    // Call to add 2 values to the list
+                            long        Value1,                                 // First value to add
+                            long        Value2
+                            ) {
+    volatile ATNLFLL *My;
+    volatile ATNLFLC *Link;
+
+    if ( MyList < 0 ) return ATERR_OPERATION_FAILED;                            // Not open
+    if ( Value1 == Null ) return ATERR_BAD_PARAMETERS;
+    My = &(Lists[MyList]);
+
+    Link = GetNext(Context, Value1, Value2);                                    // Link the item in at the top of my private chain
+    Link->Value1 = My->Private1;
+    Link->Value2 = My->Private2;
+    My->Private1 = Value1;
+    My->Private2 = Value2;
+    My->PrivateCount++;
+    My->Added++;
+
+    if ( !ServeNeighbor() && My->PrivateCount > (Balance * AT_NLFL_HIGHWATER) ) // I'm hoarding- pass everything past half the high water along
+        Forward(My->PrivateCount - ((Balance * AT_NLFL_HIGHWATER) / 2));
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** TakeFromList
+int ATNLFreeList::TakeFromList(                                                 // Returns the next item on caller's list, if anything- ATERR_NOT_FOUND if every list is empty
+                            long        *Value1,                                // Ptr to return first value
+                            long        *Value2                                 // Ptr to return next value
+                            ) {
+    volatile ATNLFLL *My;
+    volatile ATNLFLC *Link;
+    long    i;
+
+    if ( MyList < 0 ) return ATERR_OPERATION_FAILED;                            // Not open
+    if ( !Value1 || !Value2 ) return ATERR_BAD_PARAMETERS;
+    My = &(Lists[MyList]);
+
+    if ( !My->PrivateCount ) {                                                  // Private chain is empty
+        if ( TakeChain(MyList) )                                                // Anything forwarded to me?
+            My->ForwardRequest = 0;
+        else {                                                                  // I have run dry
+            My->ForwardRequest = 1;                                             // Ask the list below me to send a batch the next time it frees
+            for ( i = 1; i < NumberLists; ++i ) {                               // And meanwhile, take whatever anyone else has sitting on their public list
+                if ( TakeChain((MyList + i) % NumberLists) )
+                    break;
+            }
+            if ( i >= NumberLists ) return ATERR_NOT_FOUND;                     // Nothing free anywhere
+        }
     }
 
-
+    *Value1 = My->Private1;                                                     // Pop the top of my private chain
+    *Value2 = My->Private2;
+    Link = GetNext(Context, *Value1, *Value2);
+    My->Private1 = Link->Value1;
+    My->Private2 = Link->Value2;
+    My->PrivateCount--;
+    My->Taken++;
+    ServeNeighbor();                                                            // Allocating doesn't excuse me from helping out
     return ATERR_SUCCESS;
 }
 // **************************************************************************** DetermineNextNeighbor
 int ATNLFreeList::DetermineNextNeighbor() {                                     // Finds the nearest occupied neighbor above you- the one you will write to
-    int N = MyList;                                                             // Start with MyList
+    long    i, N;
 
-    while ( N != MyList - 1 && N != MyList) {                                   // Loop, but don't make a complete circle
-        N++;
-        if ( N >= NumberLists ) N = 0;
+    for ( i = 1; i < NumberLists; ++i ) {                                       // Loop, but don't make a complete circle
+        N = (MyList + i) % NumberLists;
         if ( Lists[N].InUse ) return N;
     }
     return -1;
 }
-// **************************************************************************** DeterminePrevNeighbor
-int ATNLFreeList::DeterminePrevNeighbor() {                                     // Finds the nearest occupied neighbor below you- the one who will write to you
-    int N = MyList;                                                             // Start with MyList
-
-    while ( N != MyList + 1 && N != MyList) {                                   // Loop, but don't make a complete circle
-        N--;
-        if ( N < 0 ) N = NumberLists - 1;
-        if ( Lists[N].InUse ) return N;
-    }
-    return -1;
+// **************************************************************************** ServeNeighbor
+int ATNLFreeList::ServeNeighbor() {                                             // Forward a batch if my neighbor has asked for one and I can spare it- returns true if I did
+    if ( MyNeighbor < 0 || !Lists[MyNeighbor].InUse )                           // Keep track of my neighbor coming & going
+        MyNeighbor = DetermineNextNeighbor();
+    if ( MyNeighbor < 0 || !Lists[MyNeighbor].ForwardRequest || Lists[MyList].PrivateCount <= Balance )
+        return 0;
+    Forward(Balance);
+    return 1;
 }
-*/
-
+// **************************************************************************** PushChain
+void ATNLFreeList::PushChain(                                                   // Push a chain of entries onto a list's public list
+                            long        List,                                   // List to push onto
+                            long        First1,                                 // First entry of the chain
+                            long        First2,
+                            long        Last1,                                  // Last entry of the chain
+                            long        Last2
+                            ) {
+    volatile ATNLFLC *Link = GetNext(Context, Last1, Last2);
+    int64   Start;
 
+retry:
+    Start = Lists[List].Start;                                                  // Hook the end of my chain to whatever is there now
+    Link->Value1 = AT_NLFL_VALUE1(Start);
+    Link->Value2 = AT_NLFL_VALUE2(Start);
+    if ( ATCompareAndExchange64(&(Lists[List].Start), Start, AT_NLFL_PACK(First1, First2)) != ATERR_SUCCESS )
+        goto retry;                                                             // Someone pushed or took in the meantime
+}
+// **************************************************************************** TakeChain
+int ATNLFreeList::TakeChain(                                                    // Take a list's public list whole, as my private chain (WHICH MUST BE EMPTY)- returns true if it got anything
+                            long        List                                    // List to take from
+                            ) {
+    volatile ATNLFLL *My = &(Lists[MyList]);
+    volatile ATNLFLC *Link;
+    int64   Start;
+    long    V1, V2, Count = 0;
 
+retry:
+    Start = Lists[List].Start;
+    if ( AT_NLFL_VALUE1(Start) == Null ) return 0;                              // Nothing there
+    if ( ATCompareAndExchange64(&(Lists[List].Start), Start, AT_NLFL_PACK(Null, Null)) != ATERR_SUCCESS )
+        goto retry;                                                             // Someone pushed or took in the meantime
+
+    V1 = My->Private1 = AT_NLFL_VALUE1(Start);                                  // It's all mine now
+    V2 = My->Private2 = AT_NLFL_VALUE2(Start);
+    while ( V1 != Null ) {                                                      // Count what I got, for the balancing
+        Link = GetNext(Context, V1, V2);
+        V1 = Link->Value1;
+        V2 = Link->Value2;
+        Count++;
+    }
+    My->PrivateCount = Count;
+    return 1;
+}
+// **************************************************************************** Forward
+void ATNLFreeList::Forward(                                                     // Move entries off of my private chain to my neighbor
+                            long        Count                                   // Number of entries to move
+                            ) {
+    volatile ATNLFLL *My = &(Lists[MyList]);
+    volatile ATNLFLC *Link;
+    long    i, First1, First2, Last1, Last2;
+
+    MyNeighbor = DetermineNextNeighbor();                                       // Lists come & go, so look again
+    if ( MyNeighbor < 0 ) return;                                               // All alone- nobody to give to
+    if ( Count > My->PrivateCount ) Count = My->PrivateCount;
+    if ( Count < 1 ) return;
+
+    First1 = Last1 = My->Private1;                                              // Cut the first Count entries off of my chain
+    First2 = Last2 = My->Private2;
+    for ( i = 1; i < Count; ++i ) {
+        Link = GetNext(Context, Last1, Last2);
+        Last1 = Link->Value1;
+        Last2 = Link->Value2;
+    }
+    Link = GetNext(Context, Last1, Last2);
+    My->Private1 = Link->Value1;
+    My->Private2 = Link->Value2;
+    My->PrivateCount -= Count;
 
+    Lists[MyNeighbor].ForwardRequest = 0;                                       // Answer any request for help
+    PushChain(MyNeighbor, First1, First2, Last1, Last2);                        // And send them along
+}
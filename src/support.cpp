@@ -71,7 +71,7 @@ ATLog::~ATLog() {
 }
 // **************************************************************************** Write
 void    ATLog::Write(                                                           // Write a string to the log file- SHOULD NOT EXCEED AT_MAX_LOG_WRITE IN LENGTH!!!
-                        char *Format,                                           // Format of string, printf style flags standard
+                        const char *Format,                                     // Format of string, printf style flags standard
                         ...                                                     // Variable # of following arguments
                         ) {
     va_list	Args;
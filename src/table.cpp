@@ -24,11 +24,10 @@
 // ****************************************************************************
 
 /*
-Low priority:  I'd like to implement an allocate-ahead strategy for the new
-table page creation, since that should be the only possible high-contention
-point left- right as the last page is just a couple of tuples short of full...
-I haven't quite figured out what the threshold should be, or the cheapest way
-to ensure the previous page.  Someday.
+The new table page creation used to be the one high-contention point left- right
+as the last page is just a couple of tuples short of full, everybody waits on
+whoever is making the next one.  Pages are now made ahead of need (see
+PrepareBlock), so that is down to linking one on.
 */
 #include <stdlib.h>
 #include <string.h>
@@ -45,6 +44,13 @@ to ensure the previous page.  Someday.
     #include    <sys/types.h>
     #include    <sys/ipc.h>
     #include    <sys/sem.h>
+    #include    <sys/stat.h>
+    #include    <sys/mman.h>
+    #include    <fcntl.h>
+    #include    <pthread.h>
+#endif
+#ifdef      __SSE2__
+    #include    <emmintrin.h>
 #endif
 
 #include "general.h"
@@ -74,9 +80,11 @@ struct ATTupleControlBlock {
 
 struct ATTableAllocHeader {                                                     // Header for each alloc in LOCAL MEMORY
                                                                                 // Contains only the local pointers we need
-    volatile char        *Data;                                                 // Start of data in this block
+    volatile char        *Data;                                                 // Start of data in this block- the first tuple control block
+    volatile char        *Tuples;                                               // Start of the tuple data in this block- right behind the first control block, or an array of its own when split
     volatile ATTBAHG     *SharedHeader;                                         // Ptr to the shared header
     volatile ATTListSegs *AddSegs;                                              // Ptr to the add segments for the block
+    ATLOCK               *HeaderLock;                                           // Ptr to the block header lock- in the shared header, or on a line of its own when padded
     volatile ATTBAH      *PrevHeader;                                           // Previous header in the list of blocks
     volatile ATTBAH      *NextHeader;                                           // Next header in the list of blocks
     volatile char        *Base;                                                 // Ptr to this block's allocation in process local memory
@@ -88,6 +96,38 @@ struct ATTableListSegments {
     volatile    long        Tuple;                                              // Last tuple in this list
 };
 
+struct ATTableDeleteList {                                                      // Head of a delete list- a lock-free stack of deleted tuples
+    volatile    int64       Head;                                               // Low half is the top tuple's reference (see MakeTupleRef), high half an ABA generation
+};
+
+struct ATPreAttachJob {                                                         // One PreAttachBlocks() thread's share of the blocks
+    ATSharedTable   *Table;                                                     // Table to attach them for
+    long            First;                                                      // First block to attach
+    long            Step;                                                       // Then every this many after
+    long            Last;                                                       // Up to (not including) this one
+    int             Result;                                                     // ATERR_SUCCESS, or the last failure
+};
+
+struct ATScanJob {                                                              // One ScanTable() thread's share of the scan
+    ATSharedTable   *Table;                                                     // Table to scan
+    ATLOCK          *NextBlock;                                                 // The next block nobody has taken yet- shared by all the workers
+    long            Blocks;                                                     // Blocks to scan
+    long            Worker;                                                     // Which worker this is
+    ATSCANFILTER    Filter;                                                     // The caller's functions...
+    ATSCANACCUMULATE Accumulate;
+    void            *Context;                                                   // ...and their context
+    void            *Accum;                                                     // This worker's accumulator
+    unsigned long   *Valid;                                                     // This worker's validity bitmap, with room for the biggest block
+    long            Matched;                                                    // Tuples this worker accumulated
+};
+
+struct ATImportJob {                                                            // One ImportMappedTable() thread's share of a chunk
+    char            *From;                                                      // First record to copy, in the mapped file
+    ATTuple         **To;                                                       // Where each one goes
+    long            Count;                                                      // Number of records
+    long            TupleSize;                                                  // Bytes per record
+};
+
 // Sentinel for a deleted tuple
 #define     AT_DELETED_TUPLE    ((unsigned long)0xFFFFFFFF)
 // Sentinel for a normal tuple
@@ -96,6 +136,51 @@ struct ATTableListSegments {
 #define     AT_CHAIN_END        (-2)
 // Marker for a pristine, virgin, unspoiled touple
 #define     AT_VIRGIN_TUPLE     (-3)
+// Delete list reference for an empty list
+#define     AT_EMPTY_REF        ((unsigned long)0)
+// Alignment of the delete list heads, so the 64bit CAS never splits a cache line
+#define     AT_DELLIST_ALIGN    ((int)8)
+// Line size to pad to with AT_TABLE_PAD_LOCKS, if ATInitSems hasn't found one- also where a split block's tuple data starts
+#define     AT_TABLE_PAD_DEFAULT    ((int)64)
+// Pack a delete list head from a tuple reference and a generation
+#define     AT_MAKE_DELHEAD(Ref, Gen)   ((int64)(((unsigned int64)(unsigned int)(Gen) << 32) | (unsigned int)(Ref)))
+// Pull the tuple reference back out of a delete list head
+#define     AT_DELHEAD_REF(Head)        ((unsigned long)(unsigned int)(Head))
+// Pull the generation back out of a delete list head
+#define     AT_DELHEAD_GEN(Head)        ((unsigned long)(unsigned int)((unsigned int64)(Head) >> 32))
+// Live tuples in each run of four, by the four bits MarkLive() packs them to
+static const long   ATLiveInFour[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+#ifdef      __SSE2__
+// **************************************************************************** ATSplatWord
+static inline __m128i ATSplatWord(                                              // A vector holding a word in each of its word sized slots
+                                unsigned long Value                             // Word to fill it with
+                                ) {
+    if ( sizeof(unsigned long) == 8 ) return _mm_set1_epi64x((int64)Value);
+    return _mm_set1_epi32((int)Value);
+}
+// **************************************************************************** ATMatchFourCBs
+static inline unsigned long ATMatchFourCBs(                                     // Compare every word of four packed control blocks with a value- returns a bit per word, set if it matches
+                                                                                // Four CBs of three words each come to exactly three vectors (six on a 64bit build), so no word is left over
+                                volatile ATTupleCB *CBs,                        // The first of the four
+                                __m128i     Value                               // Value to look for, in every word of it (see ATSplatWord)
+                                ) {
+    __m128i         Same;
+    unsigned long   Mask = 0;
+    long            v;
+
+    for ( v = 0; v < (long)(4 * sizeof(ATTupleCB)) / 16; ++v ) {
+        Same = _mm_cmpeq_epi32(_mm_loadu_si128(((__m128i *)CBs) + v), Value);
+        if ( sizeof(unsigned long) == 4 )
+            Mask |= (unsigned long)_mm_movemask_ps(_mm_castsi128_ps(Same)) << (v * 4);
+        else {                                                                  // Both halves of a word have to match
+            Same = _mm_and_si128(Same, _mm_shuffle_epi32(Same, _MM_SHUFFLE(2, 3, 0, 1)));
+            Mask |= (unsigned long)_mm_movemask_pd(_mm_castsi128_pd(Same)) << (v * 2);
+        }
+    }
+    return Mask;
+}
+#endif
 
 
 // ****************************************************************************
@@ -109,7 +194,7 @@ int ATSharedTable::WriteTable(
                             char        *inFileName                             // Filename to write the table to
                             ) {
     FILE    *Output;
-    long    Written, i, NumberBlocks, SHMID;
+    long    Written, i, ac, NumberBlocks, SHMID;
     volatile ATTBAH     *TBAH;
     volatile ATTBAHG    *GTBAH;
 
@@ -126,36 +211,44 @@ int ATSharedTable::WriteTable(
     if ( !(Written = fwrite((void *)TB, sizeof(ATTableInfo), 1, Output) ) )     // Write out the table information block
         goto file_error;
 
-    if ( !(Written = fwrite((void *)DelSegs, (sizeof(ATTListSegs) * TB->NumDelLists), // Write out the delete tracking lists
-        1, Output) ) )
-        goto file_error;
+    for ( i = 0; i < NumDelLists; ++i )                                         // Write out the delete tracking lists- one at a time, so padded & packed tables write the same file
+        if ( !(Written = fwrite((void *)DelSeg(i), sizeof(ATTDelList), 1, Output) ) )
+            goto file_error;
 
-    TBAH = GetHeaderPointer(0);                                                 // The first blocks are a special case, so let's do them first...
+    if ( !(TBAH = GetHeaderPointer(0)) )                                        // The first blocks are a special case, so let's do them first...
+        goto attach_error;
     GTBAH = TBAH->SharedHeader;
     if ( !(Written = fwrite((void*)GTBAH, sizeof(ATTBAHG), 1, Output) ) )       // Write out the global header for this block
         goto file_error;
 
-    if ( !(Written = fwrite((void*)TBAH->AddSegs,                               // Now write out the add lists
-        (sizeof(ATTListSegs) * TB->NumAddLists), 1, Output) ) )
-        goto file_error;
+    for ( ac = 0; ac < NumAddLists; ++ac )                                      // Now write out the add lists
+        if ( !(Written = fwrite((void*)AddSeg(TBAH, ac), sizeof(ATTListSegs), 1, Output) ) )
+            goto file_error;
 
-    if ( !(Written = fwrite((void*)TBAH->Data,                                  // Now write out the tuples for this block
-        (GTBAH->TuplesAllocated * TB->TrueTupleSize), 1, Output) ) )
+    if ( !(Written = fwrite((void*)TBAH->Data,                                  // Now write out the tuples for this block- just the control blocks when split
+        (GTBAH->TuplesAllocated * CBStride), 1, Output) ) )
+        goto file_error;
+    if ( SplitCBs && !(Written = fwrite((void*)TBAH->Tuples,                    // Then the tuple data, if it is kept apart
+        (GTBAH->TuplesAllocated * TupleStride), 1, Output) ) )
         goto file_error;
 
     for ( i = 1; i < TB->NumberBlocks; ++i ) {                                  // Now let's write out all the remaining blocks
-        TBAH = GetHeaderPointer(i);                                             // Get pointers to the block
+        if ( !(TBAH = GetHeaderPointer(i)) )                                    // Get pointers to the block
+            goto attach_error;
         GTBAH = TBAH->SharedHeader;
 
         if ( !(Written = fwrite((void*)GTBAH, sizeof(ATTBAHG), 1, Output) ) )   // Write out the global header for this block
             goto file_error;
 
-        if ( !(Written = fwrite((void*)TBAH->AddSegs,                           // Now write out the add lists
-            (sizeof(ATTListSegs) * TB->NumAddLists), 1, Output) ) )
-            goto file_error;
+        for ( ac = 0; ac < NumAddLists; ++ac )                                  // Now write out the add lists
+            if ( !(Written = fwrite((void*)AddSeg(TBAH, ac), sizeof(ATTListSegs), 1, Output) ) )
+                goto file_error;
 
-        if ( !(Written = fwrite((void*)TBAH->Data,                              // Now write out the tuples for this block
-            (GTBAH->TuplesAllocated * TB->TrueTupleSize), 1, Output) ) )
+        if ( !(Written = fwrite((void*)TBAH->Data,                              // Now write out the tuples for this block- just the control blocks when split
+            (GTBAH->TuplesAllocated * CBStride), 1, Output) ) )
+            goto file_error;
+        if ( SplitCBs && !(Written = fwrite((void*)TBAH->Tuples,                // Then the tuple data, if it is kept apart
+            (GTBAH->TuplesAllocated * TupleStride), 1, Output) ) )
             goto file_error;
     }
 
@@ -165,6 +258,9 @@ int ATSharedTable::WriteTable(
 file_error:
     fclose(Output);
     return ATERR_FILE_ERROR;
+attach_error:
+    fclose(Output);
+    return ATERR_NOT_FOUND;
 }
 // **************************************************************************** LoadTable
 int ATSharedTable::LoadTable(                                                   // Load a table from a disk file- this must be a file written previously by WriteTable
@@ -174,7 +270,7 @@ int ATSharedTable::LoadTable(
                             long        inBufferSize                            // The size of the I/O buffer provided (recommend at least 32-64k)
                             ) {
     FILE    *Input;
-    long    Read, i, NumberBlocks, SHMID, ac, cz, OldKey, OldInstances;
+    long    Read, i, NumberBlocks, SHMID, ac, cz, OldKey, OldInstances, OldOptions, OldPadSize, OldFirst, OldShift, OldEpoch, OldDirectory, OldAhead, OldSpare;
     volatile ATTBAH     *TBAH;
     volatile ATTBAHG    *GTBAH, OrigGTBAH;
     char    Scratch[25];
@@ -200,26 +296,41 @@ int ATSharedTable::LoadTable(
     if (    NTB.TrueTupleSize != TB->TrueTupleSize ||                           // Let's make a few comparisons to ensure that this will be a safe match
             NTB.InitialAlloc != TB->InitialAlloc ||
             NTB.NumAddLists != TB->NumAddLists ||
-            NTB.NumDelLists != TB->NumDelLists )
+            NTB.NumDelLists != TB->NumDelLists ||
+            ((NTB.Options ^ TB->Options) & AT_TABLE_SPLIT_CBS) )
         goto mismatch_error;
 
     OldKey = TB->Key;                                                           // Save the existing key...
     OldInstances = TB->InstanceCount;                                           // Save the old instance count
+    OldOptions = TB->Options;                                                   // Save the options- everyone attached is already using these locks
+    OldPadSize = TB->PadSize;                                                   // And this layout
+    OldFirst = TB->ArenaFirst;                                                  // And this arena
+    OldShift = TB->ArenaShift;
+    OldEpoch = TB->Epoch;                                                       // And this epoch- every block we load is good for it
+    OldDirectory = TB->DirectorySize;                                           // And this directory
+    OldAhead = TB->AheadTuples;                                                 // And our own idea of when to make blocks
+    OldSpare = TB->SpareBlock;                                                  // And any block made ahead- AddBlock will pick it up
     memcpy((void*)TB, (void*)&NTB, sizeof(ATTableInfo));                        // Copy over the new block
     TB->Key = OldKey;                                                           // Restore the key ID
     TB->InstanceCount = OldInstances;                                           // Restore the key ID
-
-    if ( !(Read = fread((void *)DelSegs, (sizeof(ATTListSegs) * TB->NumDelLists), 1, Input) ) )// Read in the delete tracking lists
-        goto file_error;
-
-    cz = TB->NumAddLists;                                                       // Let the optimizer cache the value
-    for ( ac = 0; ac < cz; ++ac )                                               // Loop thru all of the del segments
-        DelSegs[ac].ALock = 0;                                                  // And make sure the locks are cleared
+    TB->Options = OldOptions;                                                   // Restore the options
+    TB->PadSize = OldPadSize;                                                   // Restore the layout
+    TB->ArenaFirst = OldFirst;                                                  // Restore the arena
+    TB->ArenaShift = OldShift;
+    TB->Epoch = OldEpoch;
+    TB->DirectorySize = OldDirectory;
+    TB->AheadTuples = OldAhead;
+    TB->SpareBlock = OldSpare;
+
+    for ( i = 0; i < NumDelLists; ++i )                                         // Read in the delete tracking lists- no locks to clear, they are lock-free
+        if ( !(Read = fread((void *)DelSeg(i), sizeof(ATTDelList), 1, Input) ) )
+            goto file_error;
 
     NumberBlocks = TB->NumberBlocks;                                            // We need to fool the AddBlock routine...
     TB->NumberBlocks = 1;
 
-    TBAH = GetHeaderPointer(0);                                                 // The first header will already be allocated
+    if ( !(TBAH = GetHeaderPointer(0)) )                                        // The first header will already be allocated
+        goto attach_error;
     GTBAH = TBAH->SharedHeader;
     memcpy((void*)&OrigGTBAH, (void*)GTBAH, sizeof(ATTBAHG));                   // Save a copy of the original global header
     if ( !(Read = fread((void*)GTBAH, sizeof(ATTBAHG), 1, Input) ) )            // Read in the global header for this block
@@ -229,17 +340,20 @@ int ATSharedTable::LoadTable(
         return ATERR_BAD_PARAMETERS;
     }
     GTBAH->SHMID = OrigGTBAH.SHMID;                                             // Save some stuff from the original block...
+    GTBAH->Epoch = TB->Epoch;                                                   // We clear its locks right here
+    *(TBAH->HeaderLock) = 0;                                                    // Whoever held the header lock when it was written is long gone
 
-    if ( !(Read = fread((void*)TBAH->AddSegs,                                   // Now read in the add lists
-        (sizeof(ATTListSegs) * TB->NumAddLists), 1, Input) ) )
-        goto file_error;
-
-    cz = TB->NumAddLists;                                                       // Let the optimizer cache the value
-    for ( ac = 0; ac < TB->NumAddLists; ++ac )                                  // Loop thru all of the add segments
-        TBAH->AddSegs[ac].ALock = 0;                                            // And make sure the locks are cleared
+    for ( ac = 0; ac < NumAddLists; ++ac ) {                                    // Now read in the add lists
+        if ( !(Read = fread((void*)AddSeg(TBAH, ac), sizeof(ATTListSegs), 1, Input) ) )
+            goto file_error;
+        AddSeg(TBAH, ac)->ALock = 0;                                            // And make sure the locks are cleared
+    }
 
-    if ( !(Read = fread((void*)TBAH->Data,                                      // Now read in the tuples for this block
-        (GTBAH->TuplesAllocated * TB->TrueTupleSize), 1, Input) ) )
+    if ( !(Read = fread((void*)TBAH->Data,                                      // Now read in the tuples for this block- just the control blocks when split
+        (GTBAH->TuplesAllocated * CBStride), 1, Input) ) )
+        goto file_error;
+    if ( SplitCBs && !(Read = fread((void*)TBAH->Tuples,                        // Then the tuple data, if it is kept apart
+        (GTBAH->TuplesAllocated * TupleStride), 1, Input) ) )
         goto file_error;
 
     CB = (ATTupleCB *)TBAH->Data;                                               // Set a ptr to the start of the data in the block
@@ -248,7 +362,7 @@ int ATSharedTable::LoadTable(
         if (CB->ALock > 0) {                                                    // As long as it could be a valid kilroy
             if (CB->ALock != AT_DELETED_TUPLE) CB->ALock = 0;                   // And it isn't the delete flag, then make sure it is clear
         }
-        CB = (ATTupleCB *)(((char*)CB) + TB->TrueTupleSize);                    // Move to the next tuple
+        CB = (ATTupleCB *)(((char*)CB) + CBStride);                             // Move to the next tuple
     }
 
     for ( i = 1; i < NumberBlocks; ++i ) {                                      // Now let's read in all the remaining blocks
@@ -264,17 +378,20 @@ int ATSharedTable::LoadTable(
             return ATERR_BAD_PARAMETERS;
         }
         GTBAH->SHMID = SHMID;                                                   // Write real SHMID
+        GTBAH->Epoch = TB->Epoch;                                               // We clear its locks right here
+        *(TBAH->HeaderLock) = 0;                                                // Whoever held the header lock when it was written is long gone
 
-        if ( !(Read = fread((void*)TBAH->AddSegs,                               // Now read in the add lists
-            (sizeof(ATTListSegs) * TB->NumAddLists), 1, Input) ) )
-            goto file_error;
-
-        cz = TB->NumAddLists;                                                   // Let the optimizer cache the value
-        for ( ac = 0; ac < TB->NumAddLists; ++ac )                              // Loop thru all of the add segments
-            TBAH->AddSegs[ac].ALock = 0;                                        // And make sure the locks are cleared
+        for ( ac = 0; ac < NumAddLists; ++ac ) {                                // Now read in the add lists
+            if ( !(Read = fread((void*)AddSeg(TBAH, ac), sizeof(ATTListSegs), 1, Input) ) )
+                goto file_error;
+            AddSeg(TBAH, ac)->ALock = 0;                                        // And make sure the locks are cleared
+        }
 
-        if ( !(Read = fread((void*)TBAH->Data,                                  // Now read in the tuples for this block
-            (GTBAH->TuplesAllocated * TB->TrueTupleSize), 1, Input) ) )
+        if ( !(Read = fread((void*)TBAH->Data,                                  // Now read in the tuples for this block- just the control blocks when split
+            (GTBAH->TuplesAllocated * CBStride), 1, Input) ) )
+            goto file_error;
+        if ( SplitCBs && !(Read = fread((void*)TBAH->Tuples,                    // Then the tuple data, if it is kept apart
+            (GTBAH->TuplesAllocated * TupleStride), 1, Input) ) )
             goto file_error;
 
         CB = (ATTupleCB *)TBAH->Data;                                           // Set a ptr to the start of the data in the block
@@ -283,7 +400,7 @@ int ATSharedTable::LoadTable(
             if (CB->ALock > 0) {                                                // As long as it could be a valid kilroy
                 if (CB->ALock != AT_DELETED_TUPLE) CB->ALock = 0;               // And it isn't the delete flag, then make sure it is clear
             }
-            CB = (ATTupleCB *)(((char*)CB) + TB->TrueTupleSize);                // Move to the next tuple
+            CB = (ATTupleCB *)(((char*)CB) + CBStride);                         // Move to the next tuple
         }
     }
 
@@ -299,6 +416,9 @@ mem_error:
 mismatch_error:
     fclose(Input);
     return ATERR_UNSAFE_OPERATION;
+attach_error:
+    fclose(Input);
+    return ATERR_NOT_FOUND;
 }
 // **************************************************************************** CreateFromFile
 int ATSharedTable::CreateFromFile(                                              // Load and Create a table from a disk file- this must be a file written previously by WriteTable
@@ -333,6 +453,8 @@ int ATSharedTable::CreateFromFile(
 
     fclose(Input);                                                              // Done with this now
 
+    if ( (i = SetCreateOptions(Info.Options)) != ATERR_SUCCESS )                // Make it just like the one that was written
+        return i;
     if ( (i = CreateTable(                                                      // Create the table from the stored info block
                             inKey,                                              // Systemwide unique IPC ID for this table- BECOMES A SHARED MEMORY KEY as well, so, again, it must be system wide IPC unique
                             Info.TupleSize,                                     // Size of the tuples in bytes
@@ -403,23 +525,26 @@ ATTuple *ATSharedTable::GetTupleLong(
                             ) {
     *Block = CursorBlock;
     *Tuple = CursorTupleNumber;
-    return (ATTuple*)(CursorCB + 1);
+    if ( !CursorCB ) return NULL;                                               // No cursor setup has taken place
+    return TupleAt(CursorTBAH, CursorTupleNumber);
 }
 // **************************************************************************** SetTuple
 ATTuple *ATSharedTable::SetTuple(                                               // Set the cursor to a given spot and return the tuple ptr- returns null if setting not valid
                             long        Block,                                  // Specific block
                             long        Tuple                                   // Specific tuple
                             ) {
+    volatile    ATTBAH  *TBAH;
+
     if ( Block < 0 || Tuple < 0 ) return NULL;                                  // Hallmark of non locking access gone bad
-    CursorTBAH = GetHeaderPointer(Block);                                       // Adjust the cursor
+    if ( !(TBAH = GetHeaderPointer(Block)) ) return NULL;                       // Couldn't get at the block- leave the cursor be
+    CursorTBAH = TBAH;                                                          // Adjust the cursor
     CursorTupleNumber = Tuple;
     CursorBlock = Block;
-    CursorCB = (ATTupleCB*)(CursorTBAH->Data +                                  // Figure out where the tuple is
-            (TB->TrueTupleSize * CursorTupleNumber) );
+    CursorCB = CBAt(CursorTBAH, CursorTupleNumber);                             // Figure out where the tuple is
     CursorStatus = AT_CURSOR_NORMAL;
 
     if ( CursorCB->ALock != AT_DELETED_TUPLE && CursorCB->Block == AT_NORMAL_TUPLE)// As long as this is a safe tuple
-        return (ATTuple *)(CursorCB + 1);
+        return TupleAt(CursorTBAH, CursorTupleNumber);
     else
         return NULL;
 }
@@ -429,11 +554,13 @@ ATTuple *ATSharedTable::LocateTuple(
                             long        Tuple                                   // Specific tuple
                             ) {
     if ( Block < 0 || Tuple < 0 ) return NULL;                                  // Hallmark of non locking access gone bad
+    if ( ArenaBase ) {                                                          // Every block is right where the arena says it is- no need to look it up
+        if ( !Block ) return (ATTuple *)(ArenaTuples0 + (TupleStride * Tuple));
+        return (ATTuple *)(ArenaTuplesN + ((Block - 1) << ArenaShift) + (TupleStride * Tuple));
+    }
     volatile    ATTBAH  *TBAH = GetHeaderPointer(Block);                        // Get a ptr to the block
-    volatile    ATTupleCB   *CB;
-    CB = (ATTupleCB*)(TBAH->Data +                                              // Figure out where the tuple is
-                (TB->TrueTupleSize * Tuple) );
-    return (ATTuple *)(CB + 1);
+    if ( !TBAH ) return NULL;                                                   // Couldn't get at it
+    return TupleAt(TBAH, Tuple);                                                // Figure out where the tuple is
 }
 // **************************************************************************** UnlockTuple
 int ATSharedTable::UnlockTuple() {                                              // Unlocks the current tuple
@@ -452,6 +579,8 @@ retry:
     }
     if ( CursorCB && CursorCB->ALock != AT_DELETED_TUPLE &&                     // As long as the tuple continues to look normal
             CursorCB->Block == AT_NORMAL_TUPLE) {
+        if ( ATReclaimSpinLock(Kilroy, &(CursorCB->ALock), NumberAttempts) == ATERR_SUCCESS )
+            return TupleAt(CursorTBAH, CursorTupleNumber);                      // The holder died with it locked, so it is ours now
         ATSpinLockArbitrate(NumberAttempts);                                    // Behave intelligently (hopefully) while spinning
         NumberAttempts++;                                                       // Increment our number of attempts
         goto retry;                                                             // And just keep trying
@@ -461,11 +590,13 @@ retry:
 // **************************************************************************** BounceLockTuple
 ATTuple *ATSharedTable::BounceLockTuple() {                                     // Locks the current tuple for changes, and return a ptr to it-will return null if tuple not valid
     int Result;
+    if ( CursorTBAH && CursorTBAH->SharedHeader->Epoch != TB->Epoch )           // Its locks may be from before a restart
+        FreshenBlock(CursorTBAH);
     if ( CursorCB && CursorCB->ALock != AT_DELETED_TUPLE &&
             CursorCB->Block == AT_NORMAL_TUPLE) {
         if ( (Result = ATBounceSpinLock(Kilroy, &(CursorCB->ALock)) ==          // Try to lock it
             ATERR_SUCCESS) ) {
-            return (ATTuple *)(CursorCB + 1);                                   // Return the ptr
+            return TupleAt(CursorTBAH, CursorTupleNumber);                      // Return the ptr
         }
         else
             return NULL;                                                        // Could not get a lock
@@ -476,7 +607,7 @@ ATTuple *ATSharedTable::BounceLockTuple() {
 ATTuple *ATSharedTable::GetTuple() {                                            // Return the current tuple ptr w/no lock- a null return means the current tuple is not valid (may have been deleted)...
     if ( CursorCB && CursorCB->ALock != AT_DELETED_TUPLE &&                     // As long as this is a safe tuple
             CursorCB->Block == AT_NORMAL_TUPLE) {
-        return (ATTuple *)(CursorCB + 1);
+        return TupleAt(CursorTBAH, CursorTupleNumber);
     }
     return NULL;                                                                // No cursor setup has taken place
 }
@@ -492,7 +623,8 @@ ATTuple *ATSharedTable::PrevTuple() {
     long        OrigCursor = CursorBlock;
     volatile    ATTBAH      *OrigTBAH;
 
-    ( CursorTBAH ) ? OrigTBAH = CursorTBAH:CursorTBAH = GetHeaderPointer(CursorBlock);
+    if ( !(OrigTBAH = CursorTBAH) && !(CursorTBAH = GetHeaderPointer(CursorBlock)) )
+        return NULL;                                                            // Couldn't get at the block
 
     if ( CursorStatus == AT_CURSOR_NORMAL )                                     // In normal mode...
         CursorTupleNumber--;                                                    // Just dec the cursor #
@@ -505,22 +637,23 @@ ATTuple *ATSharedTable::PrevTuple() {
 
 retry:
     if ( CursorTupleNumber >= 0 ) {                                             // As long as there are still tuples in this block
-        CB =    (ATTupleCB*)(CursorTBAH->Data +                                 // Figure out where the tuple is
-                (TB->TrueTupleSize * CursorTupleNumber) );
+        CB =    CBAt(CursorTBAH, CursorTupleNumber);                            // Figure out where the tuple is
         if ( CB->ALock != AT_DELETED_TUPLE && CB->Block == AT_NORMAL_TUPLE) {   // As long as this is a safe tuple
             CursorCB = CB;                                                      // Save this for speed later
-            return (ATTuple*)(CB + 1);                                          // Return the ptr
+            return TupleAt(CursorTBAH, CursorTupleNumber);                      // Return the ptr
         }
         CursorTupleNumber--;                                                    // Was a delete, so let's just move to the next one
         goto retry;
     }
     if ( CursorBlock >= 1 ) {                                                   // Are there any more block to check?
         CursorBlock--;                                                          // Move to the next block
-        CursorTBAH = GetHeaderPointer(CursorBlock);                             // Get ptr to current block
-        CursorTupleNumber = CursorTBAH->SharedHeader->TuplesAllocated - 1;      // Start at the last tuple (previous pages will be packed before additional adds...)
+        if ( !(CursorTBAH = GetHeaderPointer(CursorBlock)) )                    // Get ptr to current block
+            goto restore;                                                       // Couldn't get at it- put the cursor back
+        CursorTupleNumber = CursorTBAH->SharedHeader->HighWater - 1;            // Start at the last tuple ever handed out- nothing above it has been used
         goto retry;
     }
-    CursorTupleNumber = OrigTuple;                                              // We have reached the start of the table
+restore:                                                                        // We have reached the start of the table
+    CursorTupleNumber = OrigTuple;
     CursorBlock = OrigCursor;
     CursorTBAH = OrigTBAH;
     return NULL;
@@ -543,10 +676,12 @@ ATTuple *ATSharedTable::NextTuple() {
     volatile    ATTupleCB   *CB;
     long        OrigTuple = CursorTupleNumber;                                  // Save for restore
     long        OrigCursor = CursorBlock;
+    long        OrigStatus = CursorStatus;
     volatile    ATTBAH      *OrigTBAH;
-    long        i, MaxTuples;
+    long        MaxTuples;
 
-    ( CursorTBAH ) ? OrigTBAH = CursorTBAH:CursorTBAH = GetHeaderPointer(CursorBlock);
+    if ( !(OrigTBAH = CursorTBAH) && !(CursorTBAH = GetHeaderPointer(CursorBlock)) )
+        return NULL;                                                            // Couldn't get at the block
 
     if ( CursorStatus == AT_CURSOR_NORMAL )                                     // In normal mode...
         CursorTupleNumber++;                                                    // Just inc the cursor #
@@ -558,26 +693,13 @@ ATTuple *ATSharedTable::NextTuple() {
     }
 
 retry:
-    if ( CursorTBAH->NextHeader )                                               // If there is a next page, this is easy
-        MaxTuples = CursorTBAH->SharedHeader->TuplesAllocated;
-    else {                                                                      // We are in the last page, so number allocated is unknown
-        MaxTuples = 0;                                                          // This gives poor, but fairly consistent performance (imagine a page with 1,000,000 tuples as a bad case...)
-        for ( i = 0; i < NumAddLists; ++i) {                                    // The top tuple can be no more than the highest number found in these lists
-            if (CursorTBAH->AddSegs[i].Tuple > MaxTuples)
-                MaxTuples = CursorTBAH->AddSegs[i].Tuple;
-            if (CursorTBAH->AddSegs[i].Tuple == AT_NORMAL_TUPLE ) {
-                MaxTuples = CursorTBAH->SharedHeader->TuplesAllocated;
-                break;
-            }
-        }
-    }
+    MaxTuples = CursorTBAH->SharedHeader->HighWater;                            // Nothing at or above the high-water mark has ever been handed out
 
     if ( CursorTupleNumber < MaxTuples ) {                                      // As long as there are still tuples in this block
-        CB =    (ATTupleCB*)(CursorTBAH->Data +                                 // Figure out where the tuple is
-                (TB->TrueTupleSize * CursorTupleNumber) );
+        CB =    CBAt(CursorTBAH, CursorTupleNumber);                            // Figure out where the tuple is
         if ( CB->ALock != AT_DELETED_TUPLE && CB->Block == AT_NORMAL_TUPLE) {   // As long as this is a safe tuple
             CursorCB = CB;                                                      // Save this for speed later
-            return (ATTuple*)(CB + 1);                                          // Return the ptr
+            return TupleAt(CursorTBAH, CursorTupleNumber);                      // Return the ptr
         }
         CursorTupleNumber++;                                                    // Was a delete, so let's just move to the next one
         goto retry;
@@ -585,13 +707,16 @@ retry:
     if ( CursorBlock < (TB->NumberBlocks - 1) ) {                               // Are there any more block to check?
         CursorBlock++;                                                          // Move to the next block
         CursorTupleNumber = 0;                                                  // Start at first tuple
-        CursorTBAH = GetHeaderPointer(CursorBlock);                             // Get ptr to current block
+        if ( !(CursorTBAH = GetHeaderPointer(CursorBlock)) )                    // Get ptr to current block
+            goto restore;                                                       // Couldn't get at it- put the cursor back just as it was
         goto retry;
     }
-    CursorTupleNumber = OrigTuple;                                              // We have reached the end of the table
+    OrigStatus = AT_CURSOR_EOT;                                                 // We have reached the end of the table
+restore:
+    CursorTupleNumber = OrigTuple;
     CursorBlock = OrigCursor;
     CursorTBAH = OrigTBAH;
-    CursorStatus = AT_CURSOR_EOT;
+    CursorStatus = OrigStatus;
     return NULL;
 }
 // **************************************************************************** LockedNextTuple
@@ -605,6 +730,313 @@ ATTuple *ATSharedTable::LockedNextTuple() {
     }
     return NULL;                                                                // Could not find any next tuples
 }
+// **************************************************************************** ScanBlock
+/*  A scan through NextTuple() pays a call, a cursor update and a pair of sentinel checks for every
+tuple.  ScanBlock() does the checks for a whole block in one pass over its control blocks, and
+hands back a bitmap of the live ones along with where the data starts and how far apart the
+tuples are- the caller then walks the data however it likes.  Only the tuples below the block's
+high-water mark are looked at, since nothing above it has ever been handed out.
+*/
+int     ATSharedTable::ScanBlock(                                               // Hand back a whole block at a time- where its tuples are, and which of them are live, no locking
+                            long        inBlock,                                // Block to scan, zero based
+                            ATBlockScan *outScan                                // Gets the block- its bitmap is good until the next ScanBlock(), SelectTuples() or CloseTable()
+                            ) {
+    volatile ATTBAH *TBAH;
+
+    if ( !TB || !outScan || inBlock < 0 )                                       // Simple checks
+        return ATERR_BAD_PARAMETERS;
+    if ( inBlock >= TB->NumberBlocks )                                          // Past the end of the table
+        return ATERR_NOT_FOUND;
+    if ( !(TBAH = GetHeaderPointer(inBlock)) )                                  // Couldn't get at it
+        return ATERR_OPERATION_FAILED;
+
+    if ( !ScanBitmap(TBAH) )
+        return ATERR_OUT_OF_MEMORY;
+    outScan->Block = inBlock;
+    outScan->Tuples = TupleAt(TBAH, 0);
+    outScan->Stride = TupleStride;
+    outScan->Count = TBAH->SharedHeader->HighWater;                             // Take it once- the bitmap covers exactly this many
+    outScan->Valid = ScanValid;
+    outScan->Live = MarkLive(TBAH, outScan->Count, ScanValid);
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ScanBitmap
+unsigned long *ATSharedTable::ScanBitmap(                                       // Internal routine to make sure ScanValid has room for a block's bitmap- returns it, NULL if out of memory
+                            volatile ATTBAH *TBAH                               // Block it has to hold
+                            ) {
+    long            Words;
+
+    Words = (TBAH->SharedHeader->TuplesAllocated + AT_TABLE_SCAN_BITS - 1) / AT_TABLE_SCAN_BITS;
+    if ( Words > ScanWords ) {                                                  // Room for the whole block, so a filling block never makes us grow it again
+        if ( ScanValid ) delete[] (char*)ScanValid;
+        ScanWords = 0;
+        if ( !(ScanValid = (unsigned long*)new char[Words * sizeof(unsigned long)]) )
+            return NULL;
+        ScanWords = Words;
+    }
+    return ScanValid;
+}
+// **************************************************************************** MarkLive
+long    ATSharedTable::MarkLive(                                                // Internal routine to build the validity bitmap of a block's tuples- returns how many are live
+                            volatile ATTBAH *TBAH,                              // Block to check
+                            long        inCount,                                // Tuples to check, from the first
+                            unsigned long *outValid                             // Gets a bit per tuple, set if it is live- needs room for inCount bits, rounded up to a whole word
+                            ) {
+    volatile ATTupleCB *CB;
+    unsigned long   Bits, Match;
+    long            i = 0, Live = 0;
+#ifdef      __SSE2__
+    __m128i         Deleted, Normal;
+#endif
+
+    memset(outValid, 0, ((inCount + AT_TABLE_SCAN_BITS - 1) / AT_TABLE_SCAN_BITS) * sizeof(unsigned long));
+#ifdef      __SSE2__
+    if ( SplitCBs ) {                                                           // The CBs are packed, so check them four at a time, a vector of words at once
+        Deleted = ATSplatWord(AT_DELETED_TUPLE);
+        Normal = ATSplatWord((unsigned long)AT_NORMAL_TUPLE);
+        for ( ; i + 4 <= inCount; i += 4 ) {
+            CB = CBAt(TBAH, i);
+            _mm_prefetch((char *)CBAt(TBAH, i + AT_TABLE_SCAN_AHEAD), _MM_HINT_T0);// A prefetch never faults, even past the end of the block
+            Match = ATMatchFourCBs(CB, Normal);                                 // On a 32bit build both sentinels are all ones, so one compare finds them both
+            if ( AT_DELETED_TUPLE != (unsigned long)AT_NORMAL_TUPLE )
+                Bits = (Match >> 1) & ~ATMatchFourCBs(CB, Deleted);
+            else
+                Bits = (Match >> 1) & ~Match;                                   // Bit 3N is now set if tuple N's status word matched, and its lock word didn't
+            Bits = (Bits & 1) | ((Bits >> 2) & 2) | ((Bits >> 4) & 4) | ((Bits >> 6) & 8);
+            outValid[i / AT_TABLE_SCAN_BITS] |= Bits << (i % AT_TABLE_SCAN_BITS);// Runs of four never straddle a word
+            Live += ATLiveInFour[Bits];
+        }
+    }
+#endif
+    for ( ; i < inCount; ++i ) {                                                // The rest, one at a time
+        CB = CBAt(TBAH, i);
+#ifdef      __SSE2__
+        _mm_prefetch((char *)CBAt(TBAH, i + AT_TABLE_SCAN_AHEAD), _MM_HINT_T0);
+#endif
+        if ( CB->ALock != AT_DELETED_TUPLE && CB->Block == AT_NORMAL_TUPLE ) {  // The same test NextTuple() makes
+            outValid[i / AT_TABLE_SCAN_BITS] |= (unsigned long)1 << (i % AT_TABLE_SCAN_BITS);
+            Live++;
+        }
+    }
+    return Live;
+}
+// **************************************************************************** SelectTuples
+/*  Scans that copy whole tuples out with NextTuple() only to throw most of them away spend their
+time on calls & copies.  SelectTuples() does the work a block at a time, right here: the live
+bitmap first (see MarkLive), then each term of the predicate clears the bits of the tuples that
+fail it, in a loop of its own made for the term's type & comparison (see FilterTerm), and only
+then are the chosen fields of the tuples left copied out.  A predicate the terms can't say is
+better done with ScanTable().
+*/
+int     ATSharedTable::SelectTuples(                                            // Copy the chosen fields of each tuple that passes a predicate into a buffer, picking up after the cursor, no locking
+                            ATScanTerm  *inTerms,                               // The predicate- every term has to hold
+                            long        inNumTerms,                             // Number of terms, zero to take every tuple
+                            ATScanField *inFields,                              // Fields to copy out of each tuple, in order, packed one after another- NULL for the whole tuple
+                            long        inNumFields,                            // Number of fields
+                            void        *outRows,                               // Gets the rows, one after another
+                            long        inRowSpace,                             // Bytes there is room for in outRows- at least one row
+                            long        *outRowCount                            // Gets the number of rows copied out
+                            ) {
+    volatile ATTBAH *TBAH;
+    unsigned long   *Valid, Bits;
+    char            *Data, *From, *Out = (char *)outRows;
+    long            i, f, Size, RowSize, MaxRows, Rows = 0, Blocks, Block, Tuple, Count, Word, Words;
+    long            LastBlock = -1, LastTuple = 0;
+
+    if ( outRowCount ) *outRowCount = 0;
+    if ( !TB || !outRows || !outRowCount || inNumTerms < 0 || (inNumTerms && !inTerms) ||// Simple checks
+            (inFields && inNumFields < 1) )
+        return ATERR_BAD_PARAMETERS;
+    for ( i = 0; i < inNumTerms; ++i ) {                                        // Make sure every term makes sense, so the loops don't have to check
+        Size = (inTerms[i].Type == AT_SCAN_LONG) ? sizeof(long) : (inTerms[i].Type == AT_SCAN_CURRENCY) ? sizeof(int64) : 0;
+        if ( !Size || inTerms[i].Op < AT_SCAN_EQ || inTerms[i].Op > AT_SCAN_GE ||
+                inTerms[i].Offset < 0 || inTerms[i].Offset + Size > TB->TupleSize )
+            return ATERR_BAD_PARAMETERS;
+    }
+    RowSize = inFields ? 0 : TB->TupleSize;
+    for ( f = 0; inFields && f < inNumFields; ++f ) {
+        if ( inFields[f].Offset < 0 || inFields[f].Length < 1 || inFields[f].Offset + inFields[f].Length > TB->TupleSize )
+            return ATERR_BAD_PARAMETERS;
+        RowSize += inFields[f].Length;
+    }
+    if ( (MaxRows = inRowSpace / RowSize) < 1 )                                 // Not even room for one
+        return ATERR_BAD_PARAMETERS;
+
+    if ( CursorStatus == AT_CURSOR_EOT ) return ATERR_NOT_FOUND;                // Pick up after the cursor, just like NextTuple()
+    Block = (CursorStatus == AT_CURSOR_BOT) ? 0 : CursorBlock;
+    Tuple = (CursorStatus == AT_CURSOR_BOT) ? 0 : CursorTupleNumber + 1;
+    Blocks = TB->NumberBlocks;                                                  // Anything added past here is left for the next scan
+
+    for ( ; Block < Blocks; ++Block, Tuple = 0 ) {
+        if ( !(TBAH = GetHeaderPointer(Block)) )
+            return ATERR_OPERATION_FAILED;
+        Count = TBAH->SharedHeader->HighWater;
+        if ( Tuple >= Count ) continue;                                         // Nothing left in this one
+        if ( !(Valid = ScanBitmap(TBAH)) )
+            return ATERR_OUT_OF_MEMORY;
+        if ( !MarkLive(TBAH, Count, Valid) ) continue;
+        for ( i = 0; i < inNumTerms; ++i )                                      // Each term takes out the ones that fail it
+            FilterTerm(TBAH, &inTerms[i], Tuple, Count, Valid);
+
+        Data = (char *)TupleAt(TBAH, 0);
+        Words = (Count + AT_TABLE_SCAN_BITS - 1) / AT_TABLE_SCAN_BITS;
+        for ( Word = Tuple / AT_TABLE_SCAN_BITS; Word < Words; ++Word ) {
+            Bits = Valid[Word];
+            if ( Word == Tuple / AT_TABLE_SCAN_BITS )                           // We were here before the buffer filled last time
+                Bits &= ~(unsigned long)0 << (Tuple % AT_TABLE_SCAN_BITS);
+            for ( i = Word * AT_TABLE_SCAN_BITS; Bits; Bits >>= 1, ++i ) {
+                if ( !(Bits & 1) ) continue;
+                From = Data + (i * TupleStride);
+                if ( !inFields )
+                    memcpy(Out, From, RowSize);
+                else
+                    for ( f = 0, Size = 0; f < inNumFields; Size += inFields[f].Length, ++f )
+                        memcpy(Out + Size, From + inFields[f].Offset, inFields[f].Length);
+                Out += RowSize;
+                LastBlock = Block;
+                LastTuple = i;
+                if ( ++Rows == MaxRows ) {                                      // Full- the cursor marks where to pick up
+                    *outRowCount = Rows;
+                    SetTuple(LastBlock, LastTuple);
+                    return ATERR_SUCCESS;
+                }
+            }
+        }
+    }
+    *outRowCount = Rows;
+    if ( LastBlock >= 0 ) SetTuple(LastBlock, LastTuple);                       // Otherwise the cursor stays put, like NextTuple() leaves it at the end
+    return ATERR_NOT_FOUND;
+}
+// **************************************************************************** FilterTerm
+// One pass of FilterTerm()- clear the bit of every tuple whose field, read as a TYPE, fails (field OP value)
+#define     AT_SCAN_TERM_PASS(TYPE, OP)                                                             \
+    for ( Word = inFirst / AT_TABLE_SCAN_BITS; Word < Words; ++Word )                               \
+        for ( Bits = ioValid[Word], i = Word * AT_TABLE_SCAN_BITS; Bits; Bits >>= 1, ++i )          \
+            if ( (Bits & 1) && !(*(TYPE *)(Data + (i * TupleStride)) OP (TYPE)inTerm->Value) )      \
+                ioValid[Word] &= ~((unsigned long)1 << (i % AT_TABLE_SCAN_BITS))
+// A pass for each comparison a term can make on a TYPE
+#define     AT_SCAN_TERM_OPS(TYPE)                                                                  \
+    switch ( inTerm->Op ) {                                                                         \
+        case AT_SCAN_EQ:    AT_SCAN_TERM_PASS(TYPE, ==);  break;                                    \
+        case AT_SCAN_NE:    AT_SCAN_TERM_PASS(TYPE, !=);  break;                                    \
+        case AT_SCAN_LT:    AT_SCAN_TERM_PASS(TYPE, <);   break;                                    \
+        case AT_SCAN_LE:    AT_SCAN_TERM_PASS(TYPE, <=);  break;                                    \
+        case AT_SCAN_GT:    AT_SCAN_TERM_PASS(TYPE, >);   break;                                    \
+        case AT_SCAN_GE:    AT_SCAN_TERM_PASS(TYPE, >=);  break;                                    \
+    }
+void    ATSharedTable::FilterTerm(                                              // Internal routine to clear the bit of every tuple in a block's bitmap that fails a SelectTuples() term
+                            volatile ATTBAH *TBAH,                              // Block the bitmap is for
+                            ATScanTerm  *inTerm,                                // Term to test
+                            long        inFirst,                                // First tuple that matters
+                            long        inCount,                                // Tuples the bitmap covers
+                            unsigned long *ioValid                              // The bitmap
+                            ) {
+    char            *Data = (char *)TupleAt(TBAH, 0) + inTerm->Offset;          // The field in the first tuple- the loops step from there
+    unsigned long   Bits;
+    long            i, Word, Words = (inCount + AT_TABLE_SCAN_BITS - 1) / AT_TABLE_SCAN_BITS;
+
+    if ( inTerm->Type == AT_SCAN_LONG ) {                                       // The switches are out here, so each loop makes just the one compare
+        AT_SCAN_TERM_OPS(long)
+    }
+    else {
+        AT_SCAN_TERM_OPS(int64)
+    }
+}
+// **************************************************************************** ScanWorker
+void    *ATSharedTable::ScanWorker(                                             // Internal thread routine for ScanTable()
+                            void        *inJob                                  // The worker's share of the scan
+                            ) {
+    ATScanJob       *Job = (ATScanJob *)inJob;
+    ATSharedTable   *Table = Job->Table;
+    volatile ATTBAH *TBAH;
+    ATTuple         *Tuple;
+    unsigned long   Bits;
+    long            Block, Count, Word, i;
+
+    while ( (Block = (long)ATAtomicExchangeAdd(Job->NextBlock, 1)) < Job->Blocks ) {// Take the blocks one at a time, so a worker on a busy processor just takes fewer
+        TBAH = Table->HeaderSlot(Block);                                        // ScanTable() attached them all
+        Count = TBAH->SharedHeader->HighWater;
+        if ( !Table->MarkLive(TBAH, Count, Job->Valid) ) continue;
+        for ( Word = 0; Word * AT_TABLE_SCAN_BITS < Count; ++Word ) {
+            for ( Bits = Job->Valid[Word], i = Word * AT_TABLE_SCAN_BITS; Bits; Bits >>= 1, ++i ) {
+                if ( !(Bits & 1) ) continue;
+                Tuple = Table->TupleAt(TBAH, i);
+                if ( Job->Filter && !Job->Filter(Job->Context, Job->Worker, Tuple) ) continue;
+                Job->Accumulate(Job->Context, Job->Worker, Tuple, Job->Accum);
+                Job->Matched++;
+            }
+        }
+    }
+    return NULL;
+}
+// **************************************************************************** ScanTable
+/*  A scan needs nothing from the table object but the block headers, the layout and its own
+bitmap, and it takes no tuple locks, so the workers share the caller's object rather than each
+opening the table- the blocks are all attached up front (see PreAttachBlocks) so that nothing
+in the object changes while they run.  Each worker keeps its own bitmap & accumulator, and
+takes the next block off a shared counter whenever it finishes one.  The accumulators are
+merged on the calling thread, in worker order, once they are all done.
+*/
+int     ATSharedTable::ScanTable(                                               // Run the whole table through a filter & an accumulator, the blocks spread over several threads, no locking
+                            int         inThreads,                              // Threads to spread the scan over, zero for one per processor we can run on
+                            ATSCANFILTER inFilter,                              // Picks the tuples to accumulate, NULL to take them all
+                            ATSCANACCUMULATE inAccumulate,                      // Folds a tuple into a worker's accumulator
+                            ATSCANMERGE inMerge,                                // Folds a worker's accumulator into the result
+                            void        *inContext,                             // Passed along to all three
+                            void        *ioAccum,                               // The result- must start out empty.  Each worker starts from a copy of it, and they all get merged back in.
+                            long        inAccumSize,                            // Bytes in an accumulator
+                            long        *outMatched                             // If not NULL, gets the number of tuples accumulated
+                            ) {
+    ATScanJob       Jobs[AT_TABLE_THREADS_MAX];
+    ATLOCK          NextBlock = 0;
+    char            *Accums = NULL;
+    unsigned long   *Valid = NULL;
+    long            i, Blocks, Words, Matched = 0;
+    int             Result;
+
+    if ( outMatched ) *outMatched = 0;
+    if ( !TB || inThreads < 0 || !inAccumulate || !inMerge || !ioAccum || inAccumSize < 1 )// Simple checks
+        return ATERR_BAD_PARAMETERS;
+
+    SynchBlockAccess();                                                         // Get headers for everything there is now- anything added later is left out
+    Blocks = MyNumberBlocks;
+    inThreads = WorkerThreads(inThreads);
+    if ( inThreads > Blocks ) inThreads = Blocks;                               // A block is as fine as the work gets split
+    if ( (Result = PreAttachBlocks(inThreads)) != ATERR_SUCCESS )               // So the workers only ever read the headers
+        return Result;
+
+    Words = ((TB->InitialAlloc > TB->GrowthAlloc ? TB->InitialAlloc : TB->GrowthAlloc) + AT_TABLE_SCAN_BITS - 1) / AT_TABLE_SCAN_BITS;
+    if ( !(Accums = new char[inThreads * inAccumSize]) ||
+         !(Valid = (unsigned long*)new char[inThreads * Words * sizeof(unsigned long)]) ) {
+        Result = ATERR_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    for ( i = 0; i < inThreads; ++i ) {                                         // This thread takes the first share
+        Jobs[i].Table = this;
+        Jobs[i].NextBlock = &NextBlock;
+        Jobs[i].Blocks = Blocks;
+        Jobs[i].Worker = i;
+        Jobs[i].Filter = inFilter;
+        Jobs[i].Accumulate = inAccumulate;
+        Jobs[i].Context = inContext;
+        Jobs[i].Accum = Accums + (i * inAccumSize);
+        Jobs[i].Valid = Valid + (i * Words);
+        Jobs[i].Matched = 0;
+        memcpy(Jobs[i].Accum, ioAccum, inAccumSize);                            // Everyone starts out empty
+    }
+    RunWorkers(inThreads, ScanWorker, Jobs, sizeof(ATScanJob));
+    for ( i = 0; i < inThreads; ++i ) {                                         // All done, so put the results together
+        inMerge(inContext, i, ioAccum, Jobs[i].Accum);
+        Matched += Jobs[i].Matched;
+    }
+    if ( outMatched ) *outMatched = Matched;
+
+done:
+    if ( Accums ) delete[] Accums;
+    if ( Valid ) delete[] (char*)Valid;
+    return Result;
+}
 // **************************************************************************** ImportTable
 int ATSharedTable::ImportTable(                                                 // Import a table from a disk file- this should be a binary file of fixed length records
                                                                                 // Function may be called any number of times to add more files sequentially into the table
@@ -612,11 +1044,11 @@ int ATSharedTable::ImportTable(
                             char        *inBuffer,                              // A buffer that may be used for file I/O
                             long        inBufferSize                            // The size of the I/O buffer provided (recommend at least 32-64k)
                             ) {
-    int     Loaded;
+    int     Loaded, Result = ATERR_SUCCESS;
     FILE    *Input;
-    long    NumberRecords, FileLength, BufferRecords, i;
+    long    BufferRecords;
 
-    if ( !inFileName || !inBuffer || inBufferSize < TB->TupleSize )
+    if ( !TB || !inFileName || !inBuffer || inBufferSize < TB->TupleSize )
         return ATERR_BAD_PARAMETERS;
 
     BufferRecords = inBufferSize / TB->TupleSize;                               // How many records can we buffer
@@ -624,15 +1056,125 @@ int ATSharedTable::ImportTable(
         return ATERR_NOT_FOUND;
 
     while ( (Loaded = fread(inBuffer, TB->TupleSize, BufferRecords, Input)) ) { // Read the file in, a buffer load at a time
-        for ( i = 0; i < Loaded; ++i) {                                         // Loop thru all the records
-            if( !AddTuple((inBuffer + (i * TB->TupleSize))) )                   // Load the tuple
-                return ATERR_OUT_OF_MEMORY;
-            UnlockTuple();                                                      // Unlock it
-        }
+        if ( (Result = AddTuples(inBuffer, Loaded, NULL)) != ATERR_SUCCESS )    // Load the lot
+            break;
     }
     fclose(Input);
 
-    return ATERR_SUCCESS;
+    return Result;
+}
+// **************************************************************************** ImportWorker
+void    *ATSharedTable::ImportWorker(                                           // Internal thread routine for ImportMappedTable()
+                            void        *inJob                                  // The records to copy
+                            ) {
+    ATImportJob *Job = (ATImportJob *)inJob;
+    long        i;
+
+    for ( i = 0; i < Job->Count; ++i )                                          // Nothing but copying- the slots are already ours
+        memcpy((void*)Job->To[i], (void*)(Job->From + (i * Job->TupleSize)), Job->TupleSize);
+    return NULL;
+}
+// **************************************************************************** ImportMappedTable
+/*  The fast way in for a big load.  Rather than reading into a buffer and adding a record at a time, the file
+is mapped and taken a chunk (AT_TABLE_IMPORT_CHUNK records) at a time, and only the chunk in hand is ever mapped-
+a window from the page the chunk starts in, let go again once it's copied, so a file bigger than the address
+space we can spare still goes in.  Slots for the whole chunk are reserved
+a run per lock trip (see ReserveTuples), the threads split the chunk between them and copy straight out of
+the mapping, and only then are the indexes brought up to date- sorted, one batch per index (see
+ATBTree::InsertTuples).  The copying threads never lock anything, since every slot they write to is already
+locked to us, so they don't need table objects or kilroys of their own.  Records an index turns away are
+deleted again, just as AddTuple() would, and the first such failure is returned once the file is all in.
+*/
+int ATSharedTable::ImportMappedTable(                                           // Import a file of fixed length records by mapping it & copying it in with several threads- the same file ImportTable() takes
+                                                                                // Like AddTuples(), the tuples are NOT left locked, and the cursor is left wherever the last chunk ended
+                            char        *inFileName,                            // Filename to load the table from
+                            int         inThreads,                              // Threads to spread the copying over, zero for one per processor we can run on
+                            long        *outImported                            // If not NULL, gets the number of records actually added
+                            ) {
+    ATImportJob     Jobs[AT_TABLE_THREADS_MAX];
+    struct stat     Info;
+    char            *Map, *Scratch;
+    ATTuple         **Ptrs;
+    off_t           Start, Aligned;
+    size_t          Window;
+    long            *Blocks, *Tuples, Records, Chunk, Done = 0, Added = 0, Got, Share, Page, n, i, j;
+    int             *Results, File, Result = ATERR_SUCCESS, Failed, Workers, Full = 0;
+
+    if ( outImported ) *outImported = 0;
+    if ( !TB || !inFileName || inThreads < 0 )
+        return ATERR_BAD_PARAMETERS;
+    if ( (File = open(inFileName, O_RDONLY)) < 0 )                              // Open the file
+        return ATERR_NOT_FOUND;
+    if ( fstat(File, &Info) ) {
+        close(File);
+        return ATERR_FILE_ERROR;
+    }
+    if ( (off_t)(Records = (long)(Info.st_size / TB->TupleSize)) != Info.st_size / TB->TupleSize ) {
+        close(File);                                                            // More records than we can count
+        return ATERR_FILE_ERROR;
+    }
+    if ( !Records ) {                                                           // A partial record at the end is ignored, same as ImportTable()
+        close(File);
+        return ATERR_SUCCESS;
+    }
+
+    Page = sysconf(_SC_PAGESIZE);                                               // Windows have to start on a page
+    Chunk = ( Records < AT_TABLE_IMPORT_CHUNK ) ? Records:AT_TABLE_IMPORT_CHUNK;
+    if ( (size_t)TB->TupleSize > ((size_t)-1 - Page) / Chunk )                  // And a window, with the bit of page in front of it, has to fit in a size_t
+        Chunk = ((size_t)-1 - Page) / TB->TupleSize;
+    if ( !(Scratch = BatchLists(Chunk, &Ptrs, &Blocks, &Tuples, &Results)) ) {
+        close(File);
+        return ATERR_OUT_OF_MEMORY;
+    }
+
+    inThreads = WorkerThreads(inThreads);
+
+    while ( Done < Records && !Full ) {                                         // A chunk at a time
+        n = Records - Done;
+        if ( n > Chunk ) n = Chunk;
+        Start = (off_t)Done * TB->TupleSize;                                    // Map just this chunk- in off_t, since the file can be bigger than a long
+        Aligned = Start & ~((off_t)Page - 1);
+        Window = (size_t)(Start - Aligned) + ((size_t)n * TB->TupleSize);
+        Map = (char *)mmap(NULL, Window, PROT_READ, MAP_PRIVATE, File, Aligned);
+        if ( Map == (char *)MAP_FAILED ) {
+            if ( Result == ATERR_SUCCESS ) Result = ATERR_FILE_ERROR;
+            break;
+        }
+        madvise(Map, Window, MADV_SEQUENTIAL);                                  // Just a hint- we go thru it once, front to back
+
+        for ( i = 0; i < n; i += Got ) {                                        // Get room for the whole chunk, a run at a time
+            if ( !(Got = ReserveTuples(n - i, Tuples + i)) ) {
+                Full = 1;                                                       // Out of space- just finish up what we did get
+                n = i;
+                break;
+            }
+            for ( j = i; j < i + Got; ++j ) {
+                Blocks[j] = CursorBlock;
+                Ptrs[j] = TupleAt(CursorTBAH, Tuples[j]);
+                Results[j] = ATERR_SUCCESS;
+            }
+        }
+
+        Share = (n + inThreads - 1) / inThreads;                                // Now split the copying up
+        Workers = Share ? (n + Share - 1) / Share:0;                            // Only as many as have something to copy
+        for ( i = 0; i < Workers; ++i ) {
+            Jobs[i].From = Map + (Start - Aligned) + ((size_t)(i * Share) * TB->TupleSize);
+            Jobs[i].To = Ptrs + (i * Share);
+            Jobs[i].Count = ( (i + 1) * Share <= n ) ? Share:n - (i * Share);
+            Jobs[i].TupleSize = TB->TupleSize;
+        }
+        RunWorkers(Workers, ImportWorker, Jobs, sizeof(ATImportJob));
+        munmap(Map, Window);                                                    // Copied- the window can go
+
+        Failed = IndexBatch(n, Ptrs, Blocks, Tuples, Results, &Added);          // Bring the indexes up to date & let the chunk go
+        if ( Result == ATERR_SUCCESS ) Result = Failed;                         // Pass the first failure back
+        Done += n;
+    }
+    delete[] Scratch;
+    close(File);
+    if ( outImported ) *outImported = Added;
+    if ( Full ) return ATERR_OUT_OF_MEMORY;
+    return Result;
 }
 // **************************************************************************** Constructor
 ATSharedTable::ATSharedTable() {
@@ -642,6 +1184,19 @@ ATSharedTable::ATSharedTable() {
 void    ATSharedTable::ResetVariables() {                                       // Internal routine to reset the variables
     TB = NULL;
     IAmCreator = Kilroy = 0;
+    CreateOptions = FairLocks = 0;
+    SetPadding(0);
+    SetTupleLayout(0, 0);
+    ArenaBase = NULL;
+    ArenaFirst = ArenaShift = 0;
+    ArenaReserve = AT_TABLE_ARENA_RESERVE;
+    AllocateAhead = -1;
+    ArenaCBs0 = ArenaTuples0 = ArenaCBsN = ArenaTuplesN = NULL;
+    TableFile[0] = 0;
+    Directory = NULL;
+    DirectorySize = 0;
+    ScanValid = NULL;
+    ScanWords = 0;
     TBAHBlocks = NULL;
     LastTBAH = NULL;
     NumberTBAHs = 0;
@@ -671,6 +1226,44 @@ void    ATSharedTable::ResetVariables() {
 ATSharedTable::~ATSharedTable() {
     if ( TB ) CloseTable();
 }
+// **************************************************************************** SetCreateOptions
+int ATSharedTable::SetCreateOptions(                                            // Set the options used by the next CreateTable() call- CreateFromFile() always uses the options stored in the file
+                            long        inOptions                               // Any of the AT_TABLE_* flags or'd together, zero for the defaults
+                            ) {
+    if ( TB ) return ATERR_OBJECT_IN_USE;                                       // Too late, the table is already up
+    if ( inOptions & ~AT_TABLE_ALL_OPTIONS )                                    // Don't know what that is
+        return ATERR_BAD_PARAMETERS;
+    if ( inOptions & AT_TABLE_PERSISTENT ) inOptions |= AT_TABLE_ARENA;         // The file is just where the arena lives
+    CreateOptions = inOptions;
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** SetArenaReserve
+int ATSharedTable::SetArenaReserve(                                             // Set the address space the next CreateTable() reserves when AT_TABLE_ARENA is on
+                            long        inBytes                                 // Bytes to reserve- the table can never grow past this
+                            ) {
+    if ( TB ) return ATERR_OBJECT_IN_USE;                                       // Too late, the table is already up
+    if ( inBytes < 1 ) return ATERR_BAD_PARAMETERS;
+    ArenaReserve = inBytes;
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** SetTableFile
+int ATSharedTable::SetTableFile(                                                // Set the file the next CreateTable() keeps the table in when AT_TABLE_PERSISTENT is on
+                            char        *inPath                                 // File to keep it in- must not exist yet
+                            ) {
+    if ( TB ) return ATERR_OBJECT_IN_USE;                                       // Too late, the table is already up
+    if ( !inPath || strlen(inPath) >= AT_MAX_PATH ) return ATERR_BAD_PARAMETERS;
+    strcpy(TableFile, inPath);
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** SetAllocateAhead
+int ATSharedTable::SetAllocateAhead(                                            // Set how near the end of the last block the next CreateTable()'d table makes the next one, so it is there before it is needed
+                            long        inTuples                                // Tuples from the end of the block, zero to only make blocks when one fills
+                            ) {
+    if ( TB ) return ATERR_OBJECT_IN_USE;                                       // Too late, the table is already up
+    if ( inTuples < 0 ) return ATERR_BAD_PARAMETERS;
+    AllocateAhead = inTuples;
+    return ATERR_SUCCESS;
+}
 // **************************************************************************** CreateTable
 int ATSharedTable::CreateTable(                                                 // Create a table
                             int         inKey,                                  // Systemwide unique IPC ID for this table- BECOMES A SHARED MEMORY KEY as well, so, again, it must be system wide IPC unique
@@ -680,31 +1273,80 @@ int ATSharedTable::CreateTable(
                             int         inInitialAlloc,                         // Number of records to alloc initially
                             int         inGrowthAlloc,                          // Chunks of records to alloc as the table grows
                             int         inSoftWrites,                           // Set to true means that changes made to the table are queued until flushed, false means always flush changes to disk
-                            int         inDelLists,                             // Number of delete lists to maintain for entire table- good default might be around 20- systems w/many procs might want even more
-                            int         inAddLists,                             // Number of add lists to maintain for each page- good default might be around 5- systems w/many procs might want even more
+                            int         inDelLists,                             // Number of delete lists to maintain for entire table- zero picks a number to suit the processors we can run on
+                            int         inAddLists,                             // Number of add lists to maintain for each page- zero picks a number to suit the processors we can run on
                             ULONG       inKilroy                                // My kilroy- a unique ID for the caller, like maybe the proc ID & the thread ID combined....
                             ) {
-    long            StartAlloc, Result, i, Count, Seg, Add;
+    long            StartAlloc, Result, i, Count, Seg, Add, Procs, Align, Page;
     unsigned long   TrueTupleSize;
     volatile ATTBAH *FirstHeader;
     ATTupleCB       *CB;
 
     if ( !inKey || !inTupleSize || !inInitialAlloc || !inGrowthAlloc || !inKilroy ||// Simple error checks
-        inKilroy == AT_DELETED_TUPLE || (inTupleSize < 1) || !inDelLists || !inAddLists )
+        inKilroy == AT_DELETED_TUPLE || (inTupleSize < 1) || inDelLists < 0 || inAddLists < 0 )
         return ATERR_BAD_PARAMETERS;
 
-    TrueTupleSize = inTupleSize + sizeof(ATTupleCB);                            // Figure out my true tuple size
-    TrueTupleSize = ((TrueTupleSize + (AT_MEM_ALIGN - 1)) & ~(AT_MEM_ALIGN - 1));
+    Procs = ATGetCPUInfo()->UsableProcs;                                        // Fit any lists left to us to what we can run on
+    if ( Procs < 1 ) Procs = 1;                                                 // ATInitSems hasn't been called
+    if ( !inDelLists ) {
+        inDelLists = Procs * AT_TABLE_DELLISTS_PER_PROC;
+        if ( inDelLists < AT_TABLE_DELLISTS_MIN ) inDelLists = AT_TABLE_DELLISTS_MIN;
+        if ( inDelLists > AT_TABLE_LISTS_MAX ) inDelLists = AT_TABLE_LISTS_MAX;
+    }
+    if ( !inAddLists ) {
+        inAddLists = Procs * AT_TABLE_ADDLISTS_PER_PROC;
+        if ( inAddLists < AT_TABLE_ADDLISTS_MIN ) inAddLists = AT_TABLE_ADDLISTS_MIN;
+        if ( inAddLists > AT_TABLE_LISTS_MAX ) inAddLists = AT_TABLE_LISTS_MAX;
+    }
 
+    if ( CreateOptions & AT_TABLE_SPLIT_CBS ) {                                 // Figure out my true tuple size
+        TrueTupleSize = ((inTupleSize + (AT_MEM_ALIGN - 1)) & ~(AT_MEM_ALIGN - 1));// The data is aligned on its own when the CBs live elsewhere
+        TrueTupleSize += sizeof(ATTupleCB);
+    }
+    else {
+        TrueTupleSize = inTupleSize + sizeof(ATTupleCB);
+        TrueTupleSize = ((TrueTupleSize + (AT_MEM_ALIGN - 1)) & ~(AT_MEM_ALIGN - 1));
+    }
+    SetTupleLayout(TrueTupleSize, (CreateOptions & AT_TABLE_SPLIT_CBS) ? 1 : 0);
+
+    if ( CreateOptions & AT_TABLE_PAD_LOCKS ) {                                 // Pad the lists out to the cache line size
+        Align = ATGetCPUInfo()->CacheLine;
+        if ( Align < AT_TABLE_PAD_DEFAULT ) Align = AT_TABLE_PAD_DEFAULT;       // ATInitSems hasn't been called, or the line is smaller than a list
+        SetPadding(Align);
+    }
+    else
+        SetPadding(0);
+    Align = PadSize ? PadSize : AT_MEM_ALIGN;
+
+    DirectorySize = (CreateOptions & AT_TABLE_ARENA) ? 0 : AT_TABLE_DIRECTORY_SIZE;// An arena finds its blocks without one
     StartAlloc =    (TrueTupleSize * inInitialAlloc) + sizeof(ATTableInfo) +    // Figure out how much memory we need to allocate
-                    sizeof(ATTBAHG) + (sizeof(ATTListSegs) * inDelLists) +
-                    (sizeof(ATTListSegs) * inAddLists) +
-                    (AT_MEM_ALIGN * 5);                                         // The 5 is four structs + data align
+                    sizeof(ATTBAHG) + (DelStride * inDelLists) + (sizeof(long) * DirectorySize) +
+                    (AddStride * inAddLists) +
+                    (Align * 5) + AT_DELLIST_ALIGN + PadSize +                  // The 5 is four structs + data align, plus the delete lists' own alignment & the block lock's own line
+                    (SplitCBs ? AT_TABLE_PAD_DEFAULT + PadSize : 0);            // And the split tuple data's align
 
-    if ( (Result = Mem.CreateSharedMem(inKey, StartAlloc)) != ATERR_SUCCESS)    // Try to create the shared memory
-        return ATERR_OUT_OF_MEMORY;
     NumDelLists = inDelLists;                                                   // Need to set this before calling FirstDeterminePointers
     NumAddLists = inAddLists;                                                   // Need to set this before calling FirstDeterminePointers
+    Mem.SetBackend((CreateOptions & (AT_TABLE_POSIX_SHM | AT_TABLE_ARENA)) ? AT_SHMEM_POSIX : AT_SHMEM_SYSV,// Put it where we were asked to
+        (CreateOptions & AT_TABLE_HUGE_PAGES) ? AT_SHMEM_HUGEPAGES : 0);
+    if ( CreateOptions & AT_TABLE_ARENA ) {                                     // The growth blocks go end to end behind the first one
+        Page = sysconf(_SC_PAGESIZE);
+        ArenaFirst = ((StartAlloc + sizeof(ATSMHeader) + (Page - 1)) & ~(Page - 1)) - sizeof(ATSMHeader);// Each one starts on a page of its own
+        for ( ArenaShift = 0; ((long)1 << ArenaShift) < Page ||                 // And takes a power of two, so finding one is a shift
+                ((long)1 << ArenaShift) < GrowthBlockSize(TrueTupleSize, inGrowthAlloc); ++ArenaShift);
+        if ( ArenaFirst + ((long)1 << ArenaShift) > ArenaReserve )              // Not even room to grow once
+            return ATERR_BAD_PARAMETERS;
+        if ( !(CreateOptions & AT_TABLE_PERSISTENT) )
+            Result = Mem.CreateArena(inKey, ArenaReserve, ArenaFirst);          // Try to create the arena, with just the first block usable
+        else if ( TableFile[0] )
+            Result = Mem.CreateFileArena(TableFile, ArenaReserve, ArenaFirst);  // Same thing, in the file
+        else
+            return ATERR_BAD_PARAMETERS;                                        // Nowhere to keep it
+    }
+    else
+        Result = Mem.CreateSharedMem(inKey, StartAlloc);                        // Try to create the shared memory
+    if ( Result != ATERR_SUCCESS )
+        return ATERR_OUT_OF_MEMORY;
     if ( (Result = FirstDeterminePointers(1)) != ATERR_SUCCESS )                // Set up my local space pointers
         return ATERR_OUT_OF_MEMORY;
 
@@ -719,26 +1361,40 @@ int ATSharedTable::CreateTable(
 //    TB->ALock =         0;
     TB->NumDelLists =   inDelLists;
     TB->NumAddLists =   inAddLists;
+    TB->Options =       CreateOptions;
+    TB->PadSize =       PadSize;
+    TB->ArenaFirst =    (CreateOptions & AT_TABLE_ARENA) ? ArenaFirst : 0;
+    TB->ArenaShift =    (CreateOptions & AT_TABLE_ARENA) ? ArenaShift : 0;
+    TB->Epoch =         0;
+    TB->DirectorySize = DirectorySize;
+    TB->AheadTuples =   (AllocateAhead < 0) ? (inGrowthAlloc + AT_TABLE_AHEAD_SHARE - 1) / AT_TABLE_AHEAD_SHARE : AllocateAhead;
+    TB->SpareBlock =    0;
+    FairLocks =         (CreateOptions & AT_TABLE_FAIR_LOCKS) ? 1 : 0;
 
     FirstHeader = TBAHBlocks[0];                                                // Init the first header struct in local memory
+    SetTuplePointers(FirstHeader, inInitialAlloc);                              // Couldn't place the tuples until we knew how many
+    SetArena();                                                                 // Now we know where everything goes
 
     FirstHeader->SharedHeader->TuplesAllocated =    inInitialAlloc;
     FirstHeader->SharedHeader->NumberTuples =       0;
+    FirstHeader->SharedHeader->HighWater =          0;
     FirstHeader->SharedHeader->ALock =              0;
+    *(FirstHeader->HeaderLock) =                    0;
     FirstHeader->SharedHeader->SHMID =              Mem.GetSystemID();
-    Mem.FreeThisInstanceOnly();                                                 // Then tell my object not to track it anymore (only the creator needs to track it)
+    if ( !ArenaBase )                                                           // An arena stays in my object, to grow into
+        Mem.FreeThisInstanceOnly();                                             // Then tell my object not to track it anymore (only the creator needs to track it)
     FirstHeader->SharedHeader->NextSHMID =          0;
     FirstHeader->SharedHeader->ThisBlock =          0;
+    FirstHeader->SharedHeader->Epoch =              TB->Epoch;
 
     Kilroy = inKilroy;
     MyNumberBlocks = 1;                                                         // I have local access to the first block
     IAmCreator = 1;                                                             // Remember that I created this guy
 
-    for ( i = 0; i < NumDelLists; ++i) {                                        // Init the segments for delete tracking
-        DelSegs[i].ALock =  0;
-        DelSegs[i].Block =  AT_NORMAL_TUPLE;
-        DelSegs[i].Tuple =  AT_NORMAL_TUPLE;
-    }
+    for ( i = 0; i < NumDelLists; ++i)                                          // Init the segments for delete tracking
+        DelSeg(i)->Head =   AT_MAKE_DELHEAD(AT_EMPTY_REF, 0);
+    for ( i = 0; i < DirectorySize; ++i)                                        // No growth blocks yet
+        Directory[i] =      0;
 
     InitBlock(FirstHeader);                                                     // Init the structures in the new block
 
@@ -756,7 +1412,7 @@ int ATSharedTable::OpenTable(
 
     // When we create a table, our key is also our shared memory key, so we just need to access that block of shared memory
     if ( (Result = Mem.AttachSharedMem(inKey)) != ATERR_SUCCESS )
-        return ATERR_NOT_FOUND;
+        return (Result == ATERR_UNSAFE_OPERATION) ? Result : ATERR_NOT_FOUND;   // An arena we can't put where everyone else has it is not the same as no table
     if ( (Result = FirstDeterminePointers(0)) != ATERR_SUCCESS )                // Set up my local space pointers
         return ATERR_OUT_OF_MEMORY;
 
@@ -764,38 +1420,221 @@ int ATSharedTable::OpenTable(
     Kilroy = inKilroy;
     NumDelLists = TB->NumDelLists;
     NumAddLists = TB->NumAddLists;
+    FairLocks = (TB->Options & AT_TABLE_FAIR_LOCKS) ? 1 : 0;                    // Use the same kind of segment locks everyone else is
     MyNumberBlocks = 1;                                                         // I have local access to the first block
-    Mem.FreeThisInstanceOnly();                                                 // Then tell my object not to track it anymore (only the creator needs to track it)
+    SetArena();                                                                 // Needs the list counts
+    if ( !ArenaBase )                                                           // An arena stays in my object, to grow into
+        Mem.FreeThisInstanceOnly();                                             // Then tell my object not to track it anymore (only the creator needs to track it)
+
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** OpenTableFile
+/*  A restart does not touch the tuples.  The block & list locks are few, so they just get
+cleared, but the tuple locks are left where they are and the table's epoch moves on instead.
+Each block remembers the epoch its tuple locks are good for, and the first one to lock or hand
+out a tuple in a block that is behind clears that block's locks (FreshenBlock)- so a restart
+costs a pass over the blocks that actually get used, when they get used.
+*/
+int ATSharedTable::OpenTableFile(                                               // Open a table kept in a file (AT_TABLE_PERSISTENT)
+                            char        *inPath,                                // File the table is kept in
+                            int         inRestart,                              // Set to true if nobody has it open- the first one up after a restart.  Every lock left in it goes stale.
+                            ULONG       inKilroy                                // My kilroy- a unique ID for the caller, like maybe the proc ID & the thread ID combined....
+                            ) {
+    int     Result;
+    long    i, Seg;
+    volatile ATTBAH *TBAH;
+
+    if ( !inPath || !inKilroy || inKilroy == AT_DELETED_TUPLE )
+        return ATERR_BAD_PARAMETERS;
+    if ( TB ) return ATERR_OBJECT_IN_USE;
+
+    if ( (Result = Mem.AttachFileArena(inPath, inRestart)) != ATERR_SUCCESS )
+        return Result;
+    if ( (Result = FirstDeterminePointers(0)) != ATERR_SUCCESS )                // Set up my local space pointers
+        return ATERR_OUT_OF_MEMORY;
 
+    Kilroy = inKilroy;
+    NumDelLists = TB->NumDelLists;
+    NumAddLists = TB->NumAddLists;
+    FairLocks = (TB->Options & AT_TABLE_FAIR_LOCKS) ? 1 : 0;                    // Use the same kind of segment locks everyone else is
+    MyNumberBlocks = 1;                                                         // I have local access to the first block
+    SetArena();                                                                 // Needs the list counts
+
+    if ( inRestart ) {                                                          // Whoever had it open before is gone
+        TB->InstanceCount = 0;
+        TB->Epoch += 1;                                                         // So every tuple lock in it is stale
+        SynchBlockAccess();                                                     // It's all mapped already- this just gets us the headers
+        for ( i = 0; i < MyNumberBlocks; ++i ) {                                // The block & list locks are few enough to just clear
+            if ( !(TBAH = GetHeaderPointer(i)) )
+                return ATERR_NOT_FOUND;
+            TBAH->SharedHeader->ALock = 0;
+            *(TBAH->HeaderLock) = 0;
+            for ( Seg = 0; Seg < NumAddLists; ++Seg )
+                AddSeg(TBAH, Seg)->ALock = 0;
+        }
+    }
+    ATAtomicInc(&(TB->InstanceCount));                                          // Inc the instance count for the table
     return ATERR_SUCCESS;
 }
+// **************************************************************************** Checkpoint
+int ATSharedTable::Checkpoint() {                                               // Write a persistent table's changes out to its file, returning once they are there- the CALLERS keep the table steady meanwhile
+    if ( !TB ) return ATERR_BAD_PARAMETERS;
+    if ( !(TB->Options & AT_TABLE_PERSISTENT) ) return ATERR_UNSAFE_OPERATION;  // Nowhere to write it- use WriteTable
+    return Mem.SyncSharedMem();                                                 // The whole table is the one mapping
+}
 // **************************************************************************** AddTuple
 ATTuple *ATSharedTable::AddTuple(                                               // Add a tuple to the table & return a ptr to its location
                             void        *Tuple                                  // Ptr to the tuple to add to the table
                             ) {
     ATTuple *Insert;
-    int     Result, i;
 
     if ( (Insert = AllocateTuple()) ) {                                         // As long as the allocation goes okay...
         memcpy((void*)Insert, (void*)Tuple, TB->TupleSize);                     // Copy in the tuple
-        if ( PrimaryBTree ) {                                                   // If there is a primary BTree on the table
-            if ( (Result = PrimaryBTree->InsertTuple((void*)Tuple,              // Try to insert the key
-                    CursorBlock, CursorTupleNumber)) != ATERR_SUCCESS) {
-                DeleteTuple();                                                  // A failure here means we have to delete this tuple
-                return NULL;
+        if ( CommitTuple() != ATERR_SUCCESS )                                   // And index it
+            return NULL;
+    }
+    return Insert;
+}
+// **************************************************************************** CommitTuple
+/*  The other half of AllocateTuple(), for building a tuple right where it lives rather than copying it in
+from somewhere else- AddTuple() is just the two with a memcpy in between.  Until this is called the tuple
+is in the table but none of its indexes, so a failure here (a duplicate primary key, say) takes it back
+out of the table again, exactly as AddTuple() does.
+*/
+int ATSharedTable::CommitTuple() {                                              // Insert the tuple at the cursor, reserved with AllocateTuple() & built in place, into all associated BTrees
+                                                                                // MUST STILL HOLD THE LOCK ALLOCATETUPLE() RETURNED IT WITH- it still holds it on success, and the tuple is deleted on failure
+    ATTuple *Tuple;
+    int     Result, i;
+
+    if ( !CursorCB || CursorCB->ALock != Kilroy )                               // Make SURE it is ours- the rollback delete needs the lock too
+        return ATERR_UNSAFE_OPERATION;
+    Tuple = TupleAt(CursorTBAH, CursorTupleNumber);
+    if ( PrimaryBTree ) {                                                       // If there is a primary BTree on the table
+        if ( (Result = PrimaryBTree->InsertTuple(Tuple,                         // Try to insert the key
+                CursorBlock, CursorTupleNumber)) != ATERR_SUCCESS) {
+            DeleteTuple();                                                      // A failure here means we have to delete this tuple
+            return Result;
+        }
+    }
+    if ( NumberBTrees ) {                                                       // If there are any secondary keys
+        for ( i = 0; i < NumberBTrees; ++i ) {                                  // For any and all BTrees associated
+            if ( (Result = (BTrees[i])->InsertTuple(Tuple,                      // Insert the tuple into the BTree
+                CursorBlock, CursorTupleNumber)) != ATERR_SUCCESS) {
+            DeleteTuple();                                                      // A failure here means we have to delete this tuple
+            return Result;
             }
         }
-        if ( NumberBTrees ) {                                                   // If there are any secondary keys
-            for ( i = 0; i < NumberBTrees; ++i ) {                              // For any and all BTrees associated
-                if ( (Result = (BTrees[i])->InsertTuple((void *)Tuple,          // Insert the tuple into the BTree
-                    CursorBlock, CursorTupleNumber)) != ATERR_SUCCESS) {
-                DeleteTuple();                                                  // A failure here means we have to delete this tuple
-                return NULL;
+    }
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** AddTuples
+/*  The bulk version of AddTuple(), for big loads.  Tuples are taken a run at a time (see ReserveTuples) and
+copied in, then each index is handed the whole batch at once, so that it can sort the keys and walk them
+into the tree in order.  Everything stays locked until all of the indexes have had their go, and any tuple
+an index turns away (a duplicate primary key, say) is deleted again, just like AddTuple() does.
+*/
+int ATSharedTable::AddTuples(                                                   // Add a run of tuples to the table- this call automatically inserts them into all associated BTrees
+                                                                                // Unlike AddTuple(), the tuples are NOT left locked, and the cursor is left wherever the last batch ended
+                            void        *inTuples,                              // Ptr to the tuples to add, one after another
+                            long        inCount,                                // Number of tuples to add
+                            long        *outAdded                               // If not NULL, gets the number actually added
+                            ) {
+    ATTuple     **Ptrs;
+    long        *Blocks, *Tuples, Batch, Done = 0, Added = 0, Got, n, i, j;
+    int         *Results, Result = ATERR_SUCCESS, Failed, Reclaim = 1, Full = 0;
+    char        *Scratch;
+
+    if ( outAdded ) *outAdded = 0;
+    if ( !TB || !inTuples || inCount < 0 )
+        return ATERR_BAD_PARAMETERS;
+    if ( !inCount )
+        return ATERR_SUCCESS;
+
+    Batch = ( inCount < AT_TABLE_BULK_BATCH ) ? inCount:AT_TABLE_BULK_BATCH;    // Work a batch at a time, so the key sorts stay a sensible size
+    if ( !(Scratch = BatchLists(Batch, &Ptrs, &Blocks, &Tuples, &Results)) )
+        return ATERR_OUT_OF_MEMORY;
+
+    while ( Done < inCount && !Full ) {                                         // A batch at a time
+        n = inCount - Done;
+        if ( n > Batch ) n = Batch;
+        for ( i = 0; i < n; i += Got ) {                                        // Get room for the whole batch
+            if ( Reclaim && GetDeletedRecord() ) {                              // Deleted records still go first- until they run out
+                Tuples[i] = CursorTupleNumber;
+                Got = 1;
+            }
+            else {
+                Reclaim = 0;                                                    // No need to keep looking for them this call
+                if ( !(Got = ReserveTuples(n - i, Tuples + i)) ) {              // Otherwise a whole run at once
+                    Full = 1;                                                   // Out of space- just finish up what we did get
+                    n = i;
+                    break;
                 }
             }
+            for ( j = i; j < i + Got; ++j ) {                                   // Copy the run in
+                Blocks[j] = CursorBlock;
+                Ptrs[j] = TupleAt(CursorTBAH, Tuples[j]);
+                memcpy((void*)Ptrs[j], (void*)((char*)inTuples + ((Done + j) * TB->TupleSize)), TB->TupleSize);
+                Results[j] = ATERR_SUCCESS;
+            }
         }
+
+        Failed = IndexBatch(n, Ptrs, Blocks, Tuples, Results, &Added);          // Bring the indexes up to date & let the batch go
+        if ( Result == ATERR_SUCCESS ) Result = Failed;                         // Pass the first failure back
+        Done += n;
     }
-    return Insert;
+    delete[] Scratch;
+    if ( outAdded ) *outAdded = Added;
+    if ( Full ) return ATERR_OUT_OF_MEMORY;
+    return Result;
+}
+// **************************************************************************** BatchLists
+char *ATSharedTable::BatchLists(                                                // Internal routine to allocate the lists a bulk add works a batch at a time thru- returns the one allocation to delete[], NULL if out of memory
+                            long        inSize,                                 // Most tuples in a batch
+                            ATTuple     ***outPtrs,                             // Gets the list of tuple ptrs
+                            long        **outBlocks,                            // Gets the list of blocks
+                            long        **outTuples,                            // Gets the list of tuple numbers
+                            int         **outResults                            // Gets the list of results
+                            ) {
+    char        *Scratch;
+
+    if ( !(Scratch = new char[inSize * (sizeof(ATTuple*) + (2 * sizeof(long)) + sizeof(int))]) )
+        return NULL;
+    *outPtrs = (ATTuple**)Scratch;                                              // Carve the lists out of the one allocation
+    *outBlocks = (long*)(*outPtrs + inSize);
+    *outTuples = *outBlocks + inSize;
+    *outResults = (int*)(*outTuples + inSize);
+    return Scratch;
+}
+// **************************************************************************** IndexBatch
+int ATSharedTable::IndexBatch(                                                  // Internal routine to hand a batch of locked tuples to every index, then let them go- returns the first failure, if any
+                                                                                // Tuples an index turns away are deleted, the rest are unlocked, and the cursor is left on the last one
+                            long        inCount,                                // Tuples in the batch
+                            ATTuple     **inPtrs,                               // Ptr to each tuple
+                            long        *inBlocks,                              // Block of each tuple
+                            long        *inTuples,                              // Tuple number of each tuple
+                            int         *ioResults,                             // Result for each tuple- must come in as ATERR_SUCCESS
+                            long        *ioAdded                                // Has the number of tuples kept added to it
+                            ) {
+    long        i;
+    int         Result = ATERR_SUCCESS;
+
+    if ( PrimaryBTree )                                                         // If there is a primary BTree on the table
+        PrimaryBTree->InsertTuples(inCount, inPtrs, inBlocks, inTuples, ioResults);// Hand it the whole batch
+    for ( i = 0; i < NumberBTrees; ++i )                                        // And the same for any and all secondaries
+        BTrees[i]->InsertTuples(inCount, inPtrs, inBlocks, inTuples, ioResults);
+
+    for ( i = 0; i < inCount; ++i ) {                                           // Now let them all go
+        SetTuple(inBlocks[i], inTuples[i]);
+        if ( ioResults[i] != ATERR_SUCCESS ) {                                  // A failure here means we have to delete this tuple
+            DeleteTuple();
+            if ( Result == ATERR_SUCCESS ) Result = ioResults[i];               // Pass the first failure back
+        }
+        else {
+            UnlockTuple();
+            (*ioAdded)++;
+        }
+    }
+    return Result;
 }
 // **************************************************************************** AllocateTuple
 /*  The add lists are stored by page.  At some point I would like to come back and improve
@@ -806,42 +1645,76 @@ in the prev page to make sure we cleaned out all the adds- or maybe store a flag
 ATTuple *ATSharedTable::AllocateTuple() {                                       // Reserve a tuple in the table & return a ptr to its location- exactly like AddTuple() except it does not copy the new tuple over for the caller
                                                                                 // IMPORTANT: TUPLE IS ALWAYS RETURNED LOCKED- CALLER MUST FREE.  Returning them unlocked is just silly, really.  WAY too error prone.
     ATTuple     *Insert;
+    long        Tuple;
     if ( (Insert = GetDeletedRecord()) != NULL )                                // First try to reclaim a deleted record
         return Insert;
-
-    long        Result, Tries = 0, StillFree = 0, VeryBad = 0;
+    if ( !ReserveTuples(1, &Tuple) )                                            // Otherwise take one off of an add list
+        return NULL;
+    return TupleAt(CursorTBAH, CursorTupleNumber);                              // Return the tuple
+}
+// **************************************************************************** ReserveTuples
+/*  Takes a run of tuples off of one add list with a single trip through its segment lock, rather than
+a trip per tuple.  The run is cut from the head of the chain while the lock is held, and then the tuples
+are locked & cleared once it is free again- nobody else can reach them by then.  A run never spans
+blocks, so the caller just comes back for more if it got less than it wanted.
+*/
+long    ATSharedTable::ReserveTuples(                                           // Internal routine to reserve up to inWanted tuples from one add list of the last block- returns how many it got, zero if out of space
+                                                                                // They all come back locked, in the block at CursorBlock, with the cursor on the last one
+                            long        inWanted,                               // Most tuples to reserve
+                            long        *outTuples                              // Gets the tuple numbers of the ones reserved
+                            ) {
+    long        Result, Tries = 0, StillFree = 0, VeryBad = 0, Got, Next, Highest, Old, i;
     long        Seg = LastAddSegment + 1;                                       // Start at the list after the last one I used
     if ( Seg >= NumAddLists ) Seg = 0;
     volatile    ATTBAH      *EndTBAH, *NewTBAH;
+    volatile    ATTupleCB   *CB;
 
 new_retry:
-    EndTBAH = GetHeaderPointer((TB->NumberBlocks) - 1);                         // Get a pointer to the last block
-retry:                                                                          // Keep going until I get one (or space runs out)
+    if ( !(EndTBAH = GetHeaderPointer((TB->NumberBlocks) - 1)) )                // Get a pointer to the last block
+        return 0;
+    if ( EndTBAH->SharedHeader->Epoch != TB->Epoch )                            // Its locks may be from before a restart- clear them before we hand out a tuple
+        FreshenBlock(EndTBAH);
+retry:                                                                          // Keep going until I get some (or space runs out)
 
-    if ( EndTBAH->AddSegs[Seg].Tuple != AT_NORMAL_TUPLE ) {                     // Is there anything here?
+    if ( AddSeg(EndTBAH, Seg)->Tuple != AT_NORMAL_TUPLE ) {                     // Is there anything here?
         StillFree++;
-        if ( (Result = ATBounceSpinLock(Kilroy, &(EndTBAH->AddSegs[Seg].ALock))) == ATERR_SUCCESS) {//Can we get a lock on it w/o fighting?
-            if ( EndTBAH->AddSegs[Seg].Tuple != AT_NORMAL_TUPLE ) {             // Make sure someone didn't swipe it before we could get it locked....
-                CursorTupleNumber = EndTBAH->AddSegs[Seg].Tuple;                // Get BEFORE you release the lock
-                CursorCB = (ATTupleCB*)((EndTBAH->Data) + (TB->TrueTupleSize *
-                    CursorTupleNumber));
-                if ( CursorCB->Tuple != AT_CHAIN_END )                          // If this is not the end of the chain
-                    EndTBAH->AddSegs[Seg].Tuple = CursorCB->Tuple;              // Set the list to point to the next guy
+        if ( (Result = BounceSegmentLock(&(AddSeg(EndTBAH, Seg)->ALock), AT_LOCKCLASS_ADDSEG)) == ATERR_SUCCESS ||//Can we get a lock on it w/o fighting?
+             (Result = ReclaimSegmentLock(&(AddSeg(EndTBAH, Seg)->ALock), VeryBad)) == ATERR_SUCCESS ) {// Or, after enough trips around, from a holder that has died
+            if ( AddSeg(EndTBAH, Seg)->Tuple != AT_NORMAL_TUPLE ) {             // Make sure someone didn't swipe it before we could get it locked....
+                Got = Highest = 0;
+                Next = AddSeg(EndTBAH, Seg)->Tuple;                             // Get BEFORE you release the lock
+                do {                                                            // Cut as much of the chain as we want off of the front
+                    outTuples[Got++] = Next;
+                    if ( Next > Highest ) Highest = Next;
+                    Next = CBAt(EndTBAH, Next)->Tuple;
+                } while ( Got < inWanted && Next != AT_CHAIN_END );
+                if ( Next != AT_CHAIN_END )                                     // If this is not the end of the chain
+                    AddSeg(EndTBAH, Seg)->Tuple = Next;                         // Set the list to point to the next guy
                 else                                                            // This is the end...
-                    EndTBAH->AddSegs[Seg].Tuple = AT_NORMAL_TUPLE;              // Clear the list header
-                ATFreeSpinLock(Kilroy, &(EndTBAH->AddSegs[Seg].ALock));         // Free the segment lock
-                CursorCB->ALock = Kilroy;                                       // Get it locked to this caller
-
-                CursorBlock = EndTBAH->SharedHeader->ThisBlock;                 // Set up remaining cursor stuff
+                    AddSeg(EndTBAH, Seg)->Tuple = AT_NORMAL_TUPLE;              // Clear the list header
+                FreeSegmentLock(&(AddSeg(EndTBAH, Seg)->ALock));                // Free the segment lock
+
+                while ( Highest >= (Old = EndTBAH->SharedHeader->HighWater) )   // Raise the block's high-water mark past them, unless another adder already has
+                    if ( ATCompareAndExchange((volatile unsigned long*)&(EndTBAH->SharedHeader->HighWater), Old, Highest + 1) == ATERR_SUCCESS )
+                        break;
+                for ( i = 0; i < Got; ++i ) {                                   // They are off of the list, so nobody else can get at them now
+                    CB = CBAt(EndTBAH, outTuples[i]);
+                    CB->ALock = Kilroy;                                         // Get it locked to this caller
+                    CB->Block = CB->Tuple = AT_NORMAL_TUPLE;                    // MAKE SURE YOU HAVE TUPLE LOCKED BEFORE CLEARING THESE
+                }
+                CursorTupleNumber = outTuples[Got - 1];                         // Set up remaining cursor stuff
+                CursorCB = CBAt(EndTBAH, CursorTupleNumber);
+                CursorBlock = EndTBAH->SharedHeader->ThisBlock;
                 CursorTBAH = EndTBAH;
                 LastAddSegment = Seg;                                           // Save the last seg we used
                 CursorStatus = AT_CURSOR_NORMAL;
 
-                Insert = (ATTuple*)(CursorCB + 1);
-                CursorCB->Block = CursorCB->Tuple = AT_NORMAL_TUPLE;            // MAKE SURE YOU HAVE TUPLE LOCKED BEFORE CLEARING THESE
-                return Insert;                                                  // Return the tuple
+                if ( TB->AheadTuples && TB->SpareBlock != TB->NumberBlocks &&   // Getting near the end- make the next block while nobody is waiting on it
+                        Highest >= EndTBAH->SharedHeader->TuplesAllocated - TB->AheadTuples )
+                    PrepareBlock(EndTBAH);
+                return Got;                                                     // Return how many we got
             }
-            ATFreeSpinLock(Kilroy, &(EndTBAH->AddSegs[Seg].ALock));             // Free the segment lock- someone stole it from us!
+            FreeSegmentLock(&(AddSeg(EndTBAH, Seg)->ALock));                    // Free the segment lock- someone stole it from us!
         }
     }
     ++Tries;
@@ -858,98 +1731,158 @@ retry:
     goto retry;
 
 new_block:                                                                      // I only hit here when the page is full
-    ATGetSpinLock(Kilroy, &(EndTBAH->SharedHeader->ALock));                     // Lock the block
+    GetSegmentLock(EndTBAH->HeaderLock, AT_LOCKCLASS_TABLEBLOCK);               // Lock the block
     if ( MyNumberBlocks != TB->NumberBlocks ) {                                 // If someone managed to add a block before we got the lock... just restart
-        ATFreeSpinLock(Kilroy, &(EndTBAH->SharedHeader->ALock));                // Free it and retry
+        FreeSegmentLock(EndTBAH->HeaderLock);                                   // Free it and retry
         goto new_retry;
     }
 
     if ( !(NewTBAH = AddBlock()) ) {                                            // Add a block to the table
-        ATFreeSpinLock(Kilroy, &(EndTBAH->SharedHeader->ALock));                // Hmmm... bad error...
-        return NULL;
+        FreeSegmentLock(EndTBAH->HeaderLock);                                   // Hmmm... bad error...
+        return 0;
     }
-    ATFreeSpinLock(Kilroy, &(EndTBAH->SharedHeader->ALock));                    // Hmmm... bad error...
+    FreeSegmentLock(EndTBAH->HeaderLock);                                       // Hmmm... bad error...
     EndTBAH = NewTBAH;
     goto retry;
 }
 // **************************************************************************** AddBlock
 ATTBAH *ATSharedTable::AddBlock() {                                             // Internal call to add a block to the table- complete with header & pointers for the calling process, which it returns
                                                                                 // CALLER SHOULD HOLD ANY NEEDED LOCKS
-    ATTuple     *Base, *Tuple;
-    volatile    ATTBAH      *EndTBAH, *NewTBAH;
-    long        StartAlloc, Result, Count, Add, Seg;
-
-    EndTBAH = GetHeaderPointer((TB->NumberBlocks) - 1);                         // Get a pointer to the last block
-
-    StartAlloc =    (TB->TrueTupleSize * TB->GrowthAlloc) +                     // Figure out how much memory we need to allocate
-                    (sizeof(ATTListSegs) * NumAddLists) +
-                    sizeof(ATTBAHG) + (AT_MEM_ALIGN * 3);                       // The 3 is two structs plus data align
+    volatile    ATTBAH      *EndTBAH, *NewTBAH, *Prev, *Next;
+    ATTBAH      Made;
+    long        Block = TB->NumberBlocks;                                       // The one we're adding
 
-    if ( (Result = Mem.CreateSharedMem((TB->Key + TB->NumberBlocks), StartAlloc))// Try to create the shared memory
-            != ATERR_SUCCESS)
+    if ( !(EndTBAH = GetHeaderPointer(Block - 1)) )                             // Get a pointer to the last block
         return NULL;
-    Base = (char*)Mem.GetBasePointer();                                         // Get the base pointer
-    NewTBAH = GetNewTBAH();                                                     // Now that we have allocated the block globally, now let's allocate it locally
-    DeterminePointers(Base, (ATTBAH*)NewTBAH);                                  // Initialize the shared ptrs in our local TBAH
 
-    NewTBAH->SharedHeader->TuplesAllocated =    TB->GrowthAlloc;                // Init the global block header
-    NewTBAH->SharedHeader->NumberTuples =       0;
-    NewTBAH->SharedHeader->ALock =              0;
-    NewTBAH->SharedHeader->SHMID =              Mem.GetSystemID();
-    NewTBAH->SharedHeader->NextSHMID =          0;
-    NewTBAH->SharedHeader->ThisBlock =          TB->NumberBlocks;
-
-    InitBlock(NewTBAH);                                                         // Init the structures in the new block
+    if ( TB->SpareBlock == Block ) {                                            // Somebody made it ahead of time (see PrepareBlock)- just pick it up
+        if ( AttachBlock(&Made, Block, &Mem) != ATERR_SUCCESS )
+            return NULL;
+    }
+    else if ( MakeBlock(Block, &Made) != ATERR_SUCCESS )                        // Otherwise make it now
+        return NULL;
+    if ( !(NewTBAH = GetNewTBAH()) )                                            // Now that we have it globally, let's give it a header locally
+        return NULL;
+    Prev = NewTBAH->PrevHeader;                                                 // Keep the chain GetNewTBAH() set up
+    Next = NewTBAH->NextHeader;
+    *(ATTBAH *)NewTBAH = Made;
+    NewTBAH->PrevHeader = Prev;
+    NewTBAH->NextHeader = Next;
 
     EndTBAH->SharedHeader->NextSHMID = NewTBAH->SharedHeader->SHMID;            // Add this to our global chain
-    TB->NumberBlocks += 1;                                                      // Inc number of blocks in table
-    // MAKE SURE NEVER TO RELOCATE THE FOLLOWING CALL PRIOR TO THE DETERMINEPOINTERS()
-    Mem.FreeThisInstanceOnly();                                                 // Then tell my object not to track it anymore (only the creator needs to track it)
+    TB->SpareBlock = 0;                                                         // Used up, if that's where it came from
+    TB->NumberBlocks += 1;                                                      // Inc number of blocks in table- only now can anyone else go looking for it
     MyNumberBlocks += 1;                                                        // I have local access to this block since I created it
 
     return (ATTBAH*)NewTBAH;
 }
+// **************************************************************************** MakeBlock
+int     ATSharedTable::MakeBlock(                                               // Internal routine to create & init a growth block, ready to be linked onto the table
+                            long        inBlock,                                // Which block it will be
+                            volatile ATTBAH *TBAH                               // Header to set up for it- it stays attached
+                            ) {
+    ATTuple     *Base;
+    long        StartAlloc, Offset, ID;
 
+    if ( ArenaBase ) {                                                          // The arena already has a spot for it, mapped everywhere
+        Offset = ArenaFirst + ((inBlock - 1) << ArenaShift);
+        if ( Mem.GrowArena(Offset + ((long)1 << ArenaShift)) != ATERR_SUCCESS ) // Just make it usable
+            return ATERR_OUT_OF_MEMORY;
+        Base = ArenaBase + Offset;
+        ID = Offset;                                                            // An arena block is known by where it is
+    }
+    else {
+        StartAlloc = GrowthBlockSize(TB->TrueTupleSize, TB->GrowthAlloc);       // Figure out how much memory we need to allocate
+        Mem.SetBackend((TB->Options & AT_TABLE_POSIX_SHM) ? AT_SHMEM_POSIX : AT_SHMEM_SYSV,// Put it where the rest of the table is
+            (TB->Options & AT_TABLE_HUGE_PAGES) ? AT_SHMEM_HUGEPAGES : 0);
+        if ( Mem.CreateSharedMem((TB->Key + inBlock), StartAlloc) != ATERR_SUCCESS )// Try to create the shared memory
+            return ATERR_OUT_OF_MEMORY;
+        Base = (char*)Mem.GetBasePointer();                                     // Get the base pointer
+        ID = Mem.GetSystemID();
+    }
+    DeterminePointers(Base, (ATTBAH*)TBAH);                                     // Initialize the shared ptrs in the header
+
+    TBAH->SharedHeader->TuplesAllocated =       TB->GrowthAlloc;                // Init the global block header
+    TBAH->SharedHeader->NumberTuples =          0;
+    TBAH->SharedHeader->HighWater =             0;
+    TBAH->SharedHeader->ALock =                 0;
+    *(TBAH->HeaderLock) =                       0;
+    TBAH->SharedHeader->SHMID =                 ID;
+    TBAH->SharedHeader->NextSHMID =             0;
+    TBAH->SharedHeader->ThisBlock =             inBlock;
+    TBAH->SharedHeader->Epoch =                 TB->Epoch;                      // Nothing in it to be stale
+
+    InitBlock(TBAH);                                                            // Init the structures in the new block
+
+    if ( inBlock < DirectorySize && !(TB->Options & AT_TABLE_POSIX_SHM) )       // Put it in the directory, so nobody has to look it up by key
+        Directory[inBlock] = TBAH->SharedHeader->SHMID + 1;
+    // MAKE SURE NEVER TO RELOCATE THE FOLLOWING CALL PRIOR TO THE DETERMINEPOINTERS()
+    if ( !ArenaBase )                                                           // The arena stays, it is the first block too
+        Mem.FreeThisInstanceOnly();                                             // Then tell my object not to track it anymore (only the creator needs to track it)
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** PrepareBlock
+/*  Without this, every inserter finds the last block full at about the same moment, and
+they all wait on its header lock while one of them makes the next block- InitBlock() has to
+thread every tuple in it onto the add lists, so that is no short wait.  Instead, the first
+inserter handed a tuple from the tail end of the last block (TB->AheadTuples) makes the next
+one right then, while the rest carry on with what is left, and AddBlock() only has to link it on.
+*/
+void    ATSharedTable::PrepareBlock(                                            // Internal routine to make the next block ahead of need, unless someone is already at it
+                            volatile ATTBAH *EndTBAH                            // The last block in the table
+                            ) {
+    ATTBAH      Made;
+    long        Block;
+
+    if ( BounceSegmentLock(EndTBAH->HeaderLock, AT_LOCKCLASS_TABLEBLOCK) != ATERR_SUCCESS )
+        return;                                                                 // Someone is making it, or adding a block right now
+    Block = TB->NumberBlocks;
+    if ( EndTBAH->SharedHeader->ThisBlock == Block - 1 &&                       // Still the last block, and nobody beat us to it
+            TB->SpareBlock != Block &&
+            MakeBlock(Block, &Made) == ATERR_SUCCESS ) {
+        if ( !ArenaBase )                                                       // Whoever links it on attaches it then
+            ATDetachSharedMem(Made.Base);
+        TB->SpareBlock = Block;                                                 // Stores stay in order, so it is all set up before anyone sees this
+    }
+    FreeSegmentLock(EndTBAH->HeaderLock);
+}
 // **************************************************************************** DeleteTuple
 int ATSharedTable::DeleteTuple() {                                              // Delete the tuple at the current record position
                                                                                 // WILL REFUSE TO WORK IF YOU DO NOT HAVE A LOCK ON THE TUPLE!
-    long        Result, Interval = 0;
+    int64       Head;
+    unsigned long Ref;
+    long        NextBlock, NextTuple;
     long        Seg = LastDelSegment + 1;                                       // Start at the list after the last one I used
     long        OrigBlock = CursorBlock, OrigTuple = CursorTupleNumber;         // Save these values to use for deleting the keys
     if ( Seg >= NumDelLists ) Seg = 0;
     if ( Kilroy == CursorCB->ALock ) {                                          // Make SURE they have a tuple lock and it is a valid tuple.  Multiple deletes could put the same tuple in different lists- and that would be very bad.
         CursorCB->ALock = AT_DELETED_TUPLE;                                     // IMMEDIATELY set this tuple to invalid, BEFORE it gets added to delete list
-        while( (Result = ATBounceSpinLock(Kilroy, &(DelSegs[Seg].ALock))) !=ATERR_SUCCESS) { // Loop until I get a segment I can write to
-            Seg++;
-            if ( Seg >= NumDelLists ) Seg = 0;
-            ++Interval;
-            if ( Interval > 100 ) {                                             // This is entirely just in case someone made a mess of the startup settings!
-                Interval = 0;
-                usleep(1000);}                                                  // Help make sure we don't take the system down due to bad config...
+
+        if ( PrimaryBTree )                                                     // If there is a primary key
+            PrimaryBTree->DeleteTuple((void*)TupleAt(CursorTBAH, CursorTupleNumber), OrigBlock, OrigTuple);// Delete this key
+        if ( NumberBTrees ) {                                                   // If there are any secondary keys
+            for ( int i = 0; i < NumberBTrees; ++i)                             // Loop though them all
+                BTrees[i]->DeleteTuple((void*)TupleAt(CursorTBAH, CursorTupleNumber), OrigBlock, OrigTuple);// And remove the key for this tuple
         }
-        if ( DelSegs[Seg].Block > AT_NORMAL_TUPLE ) {                           // If there is already an entry in the list...
-            CursorCB->Block = DelSegs[Seg].Block;                               // Point to the next guy in the list
-            CursorCB->Tuple = DelSegs[Seg].Tuple;
-            DelSegs[Seg].Block = CursorBlock;                                   // Make the header point to me
-            DelSegs[Seg].Tuple = CursorTupleNumber;
+        // Note I wait until the keys are gone to push the tuple.  They require a valid tuple ptr to create the keys from, and
+        // nobody can reclaim the tuple until it is on a list, so it has to stay off of the list until then.
+
+        Ref = MakeTupleRef(CursorBlock, CursorTupleNumber);                     // What the list head will hold for me
+retry:
+        Head = DelSeg(Seg)->Head;                                               // Take a look at the top of the list
+        if ( AT_DELHEAD_REF(Head) != AT_EMPTY_REF ) {                           // If there is already an entry in the list...
+            SplitTupleRef(AT_DELHEAD_REF(Head), &NextBlock, &NextTuple);
+            CursorCB->Block = NextBlock;                                        // Point to the next guy in the list
+            CursorCB->Tuple = NextTuple;
         }
-        else {                                                                  // Nobody in the list, so add myself in
-            DelSegs[Seg].Block = CursorBlock;
-            DelSegs[Seg].Tuple = CursorTupleNumber;
+        else {                                                                  // Nobody in the list
             CursorCB->Block = AT_CHAIN_END;                                     // Mark myself as the end of the chain
             CursorCB->Tuple = AT_CHAIN_END;
         }
+        if ( ATCompareAndExchange64(&(DelSeg(Seg)->Head), Head,                 // Make the header point to me, as long as nobody beat me to it
+                AT_MAKE_DELHEAD(Ref, AT_DELHEAD_GEN(Head) + 1)) != ATERR_SUCCESS )
+            goto retry;                                                         // Somebody else got there first- a push or pop went thru, so just try again
         LastDelSegment = Seg;
-
-        if ( PrimaryBTree )                                                     // If there is a primary key
-            PrimaryBTree->DeleteTuple((void*)(CursorCB + 1), OrigBlock, OrigTuple);// Delete this key
-        if ( NumberBTrees ) {                                                   // If there are any secondary keys
-            for ( int i = 0; i < NumberBTrees; ++i)                             // Loop though them all
-                BTrees[i]->DeleteTuple((void*)(CursorCB + 1), OrigBlock, OrigTuple);// And remove the key for this tuple
-        }
-        // Note I wait until this point to release the segment lock.  Kinda long, but I HAVE to get the keys deleted first, which require a valid tuple ptr to create the keys from.
-        // So either I would have to make a copy of the tuple (certainly possible), or make sure that nobody else reclaims this tuple just yet.  For now, I choose not to make an arbitrarily large copy. ;^)
-        ATFreeSpinLock(Kilroy, &(DelSegs[Seg].ALock));                          // Free the segment lock
         return ATERR_SUCCESS;
     }
     return ATERR_UNSAFE_OPERATION;
@@ -959,43 +1892,74 @@ volatile ATTupleCB *ATSharedTable::MakeCBPointer(
                             long        Block,                                  // Block to use
                             long        Tuple                                   // Tuple to use
                             ) {
+    if ( ArenaBase ) {                                                          // Every block is right where the arena says it is- no need to look it up
+        if ( !Block ) return (volatile ATTupleCB *)(ArenaCBs0 + (CBStride * Tuple));
+        return (volatile ATTupleCB *)(ArenaCBsN + ((Block - 1) << ArenaShift) + (CBStride * Tuple));
+    }
     volatile    ATTBAH  *TBAH = GetHeaderPointer(Block);
-    return  (ATTupleCB*)((TBAH->Data) + (TB->TrueTupleSize * Tuple));
+    if ( !TBAH ) return NULL;                                                   // Couldn't get at it
+    return  CBAt(TBAH, Tuple);
+}
+// **************************************************************************** MakeTupleRef
+unsigned long ATSharedTable::MakeTupleRef(                                      // Internal routine to pack a block/tuple combo into a delete list reference
+                                                                                // A reference is the tuple's ordinal within the whole table, plus one so that zero can mean an empty list
+                            long        Block,                                  // Block to use
+                            long        Tuple                                   // Tuple to use
+                            ) {
+    if ( !Block ) return (unsigned long)(Tuple + 1);                            // The first block is the only one sized by the initial alloc
+    return (unsigned long)(TB->InitialAlloc + ((Block - 1) * TB->GrowthAlloc) + Tuple + 1);
+}
+// **************************************************************************** SplitTupleRef
+void ATSharedTable::SplitTupleRef(                                              // Internal routine to unpack a delete list reference into a block/tuple combo
+                            unsigned long Ref,                                  // Reference to unpack (never the empty one)
+                            long        *Block,                                 // Gets the block
+                            long        *Tuple                                  // Gets the tuple
+                            ) {
+    long        Ordinal = (long)(Ref - 1);
+    if ( Ordinal < TB->InitialAlloc ) {                                         // In the first block
+        *Block = 0;
+        *Tuple = Ordinal;
+        return;
+    }
+    Ordinal -= TB->InitialAlloc;                                                // Everything past the first block comes in growth sized chunks
+    *Block = (Ordinal / TB->GrowthAlloc) + 1;
+    *Tuple = Ordinal % TB->GrowthAlloc;
 }
 // **************************************************************************** GetDeletedRecord
-// In certain fairly unusual instances, this routine will not return a free tuple even
-// if there is one, rather than fight over it.  Bad configs could make this not so unusual!
 ATTuple *ATSharedTable::GetDeletedRecord() {                                    // Internal call to try to reclaim deleted records- returns NULL if none found, otherwise a ptr to a reclaimed tuple
-    long        Result, Tests = 0, Tries = NumDelLists, Harder = NumDelLists * 2;
+    int64       Head, Next;
+    long        Tests = 0, Block, Tuple;
     long        Seg = LastDelSegment + 1;                                       // Start at the list after the last one I used
+    volatile ATTupleCB *CB;
+    volatile ATTBAH *TBAH;
     if ( Seg >= NumDelLists ) Seg = 0;
 
-    while ( Tests < Tries ) {                                                   // Go thru the segments, but only once
-        if ( DelSegs[Seg].Block != AT_NORMAL_TUPLE ) {                          // Is there anything here?
-            if ( (Result = ATBounceSpinLock(Kilroy, &(DelSegs[Seg].ALock))) == ATERR_SUCCESS) {//Can we get a lock on it w/o fighting?
-                if ( DelSegs[Seg].Block != AT_NORMAL_TUPLE ) {                  // Make sure someone didn't swipe it before we could get it locked....
-                    CursorBlock = DelSegs[Seg].Block;                           // Get these BEFORE you release the lock
-                    CursorTupleNumber = DelSegs[Seg].Tuple;
-                    CursorTBAH = GetHeaderPointer(CursorBlock);
-                    CursorCB = (ATTupleCB*)((CursorTBAH->Data) + (TB->TrueTupleSize * // Get a ptr to the existing entry
-                        CursorTupleNumber));
-                    if ( CursorCB->Block == AT_CHAIN_END ) {                    // If this is the end of the chain
-                        DelSegs[Seg].Block = DelSegs[Seg].Tuple = AT_NORMAL_TUPLE;// Clear the list header
-                    }
-                    else {                                                      // There is another tuple in the chain
-                        DelSegs[Seg].Block = CursorCB->Block;                   // Set the list to point to the next guy
-                        DelSegs[Seg].Tuple = CursorCB->Tuple;                   // Set the list to point to the next guy
-                    }
-                    ATFreeSpinLock(Kilroy, &(DelSegs[Seg].ALock));              // Free the segment lock
-                    CursorCB->Block = CursorCB->Tuple = AT_NORMAL_TUPLE;        // Clear the tuple
-                    CursorCB->ALock = Kilroy;                                   // Get it locked to this caller
-                    LastDelSegment = Seg;                                       // Save the last seg we used
-                    CursorStatus = AT_CURSOR_NORMAL;
-                    return (ATTuple*)(CursorCB + 1);                            // Return the tuple
-                }
-                ATFreeSpinLock(Kilroy, &(DelSegs[Seg].ALock));                  // Free the segment lock- someone stole it from us!
-            }
-            Tries = Harder;                                                     // If there is actually free space there, try harder
+    while ( Tests < NumDelLists ) {                                             // Go thru the segments, but only once
+        Head = DelSeg(Seg)->Head;                                               // Take a look at the top of the list
+        if ( AT_DELHEAD_REF(Head) != AT_EMPTY_REF ) {                           // Is there anything here?
+            SplitTupleRef(AT_DELHEAD_REF(Head), &Block, &Tuple);
+            if ( !(TBAH = GetHeaderPointer(Block)) )                            // Couldn't get at its block- leave it on the list
+                return NULL;
+            CB = CBAt(TBAH, Tuple);                                             // Get a ptr to the top entry
+            if ( CB->Block == AT_CHAIN_END )                                    // If this is the end of the chain, the list will be empty
+                Next = AT_MAKE_DELHEAD(AT_EMPTY_REF, AT_DELHEAD_GEN(Head) + 1);
+            else                                                                // There is another tuple in the chain, so the list will point to him
+                Next = AT_MAKE_DELHEAD(MakeTupleRef(CB->Block, CB->Tuple), AT_DELHEAD_GEN(Head) + 1);
+            // If the top tuple got popped (and maybe reused & pushed back) after I looked at it, the links I just read may be junk-
+            // but the generation will have moved on as well, so the CAS fails and I never use them.
+            if ( ATCompareAndExchange64(&(DelSeg(Seg)->Head), Head, Next) != ATERR_SUCCESS )
+                continue;                                                       // Lost the race- somebody else made progress on this list, so look at it again
+            CursorBlock = Block;                                                // It's mine now
+            CursorTupleNumber = Tuple;
+            CursorTBAH = TBAH;
+            if ( CursorTBAH->SharedHeader->Epoch != TB->Epoch )                 // Its locks may be from before a restart- clear them before we lock this one
+                FreshenBlock(CursorTBAH);
+            CursorCB = CB;
+            CursorCB->Block = CursorCB->Tuple = AT_NORMAL_TUPLE;                // Clear the tuple
+            CursorCB->ALock = Kilroy;                                           // Get it locked to this caller
+            LastDelSegment = Seg;                                               // Save the last seg we used
+            CursorStatus = AT_CURSOR_NORMAL;
+            return TupleAt(CursorTBAH, CursorTupleNumber);                      // Return the tuple
         }
         Tests++;
         Seg++;
@@ -1008,12 +1972,15 @@ volatile ATTBAH  *ATSharedTable::GetHeaderPointer(
                                                                                 // We do it this way to help make sure we ALWAYS use locked access- never access the list directly!
                             int         Header                                  // Header to get
                             ) {
-    long    Block = ((long)(Header / AT_TH_ALLOC));                             // Which block are we accessing?
-    long    Offset = ((long)(Header % AT_TH_ALLOC));                            // What is our offset from the start of the block?
+    volatile ATTBAH *TBAH;
 
 retry:
-    if ( Header < MyNumberBlocks )                                              // As long as it is in range of my existing access
-        return ((TBAHBlocks[Block]) + Offset);
+    if ( Header < MyNumberBlocks ) {                                            // As long as it is in range of my existing access
+        TBAH = HeaderSlot(Header);
+        if ( !TBAH->SharedHeader && AttachBlock(TBAH, Header, &Mem) != ATERR_SUCCESS )// First touch- attach just this one
+            return NULL;
+        return TBAH;
+    }
     if ( Header < TB->NumberBlocks ) {                                          // If it is valid
         SynchBlockAccess();                                                     // Otherwise, synchronize the access first, then return it
         goto retry;
@@ -1021,73 +1988,314 @@ retry:
     return NULL;                                                                // Invalid request
 }
 // **************************************************************************** SynchBlockAccess
-void    ATSharedTable::SynchBlockAccess() {                                     // Internal routine to synch the local process memory to global memory
-    volatile ATTBAH      *TBAH, *NewTBAH;
-    ATTuple *Base;
-
-    TBAH = GetHeaderPointer(MyNumberBlocks - 1);                                // Start with the last block we have access to
-    while ( TBAH->SharedHeader->NextSHMID ) {                                   // As long as there are more blocks to gain access to
-        NewTBAH = GetNewTBAH();                                                 // Get a new TBAH allocated/init'd in our local memory
-        Mem.AttachSharedMem((TB->Key + MyNumberBlocks));                        // Get access to the shared block
-        Base = (char*)Mem.GetBasePointer();                                     // Get the base pointer
-        DeterminePointers(Base, (ATTBAH *)NewTBAH);                             // Initialize the shared ptrs
-        Mem.FreeThisInstanceOnly();                                             // Then tell my object not to track it anymore (only the creator needs to track it)
-        TBAH = NewTBAH;                                                         // Move to the next block
+/*  Opening a table used to walk the whole block chain, attaching each block in turn, the first
+time anything past the first block was asked for- a long stall for a big table in a fresh process.
+Now we just make headers for the blocks we haven't seen, and GetHeaderPointer() attaches each one
+the first time it is touched, straight from the directory in the first block.  PreAttachBlocks()
+gets them all up front instead, when a warm start is worth more than a quick open.
+*/
+void    ATSharedTable::SynchBlockAccess() {                                     // Internal routine to give us headers for the blocks added since we last looked- they are attached when first touched
+    volatile ATTBAH *NewTBAH;
+    long            Blocks = TB->NumberBlocks;                                  // Every block under this is all set up
+
+    while ( MyNumberBlocks < Blocks ) {
+        if ( !(NewTBAH = GetNewTBAH()) ) return;                                // Get a new TBAH allocated/init'd in our local memory
+        NewTBAH->SharedHeader = NULL;                                           // Not attached yet
+        NewTBAH->Base = NULL;
         MyNumberBlocks++;
     }
 }
+// **************************************************************************** HeaderSlot
+volatile ATTBAH *ATSharedTable::HeaderSlot(                                     // Internal routine to find our header for a block, attached or not
+                            long        Header                                  // Header to find- must be one we have
+                            ) {
+    return ((TBAHBlocks[Header / AT_TH_ALLOC]) + (Header % AT_TH_ALLOC));
+}
+// **************************************************************************** AttachBlock
+int     ATSharedTable::AttachBlock(                                             // Internal routine to attach a growth block & set up its header
+                            volatile ATTBAH *TBAH,                              // Its header, not yet attached
+                            long        Block,                                  // Which block it is
+                            ATSharedMem *inMem                                  // Shared memory object to attach with- left free again
+                            ) {
+    long        ID;
+
+    if ( ArenaBase )                                                            // It is already mapped, just further along the arena
+        return DeterminePointers(ArenaBase + ArenaFirst + ((Block - 1) << ArenaShift), (ATTBAH *)TBAH);
+
+    ID = (Block < DirectorySize) ? Directory[Block] : 0;
+    if ( !(ID && inMem->AttachSharedMemID(ID - 1) == ATERR_SUCCESS) &&          // Straight to it if the directory knows it...
+            inMem->AttachSharedMem(TB->Key + Block) != ATERR_SUCCESS )          // ...otherwise by key
+        return ATERR_NOT_FOUND;
+    DeterminePointers((char *)inMem->GetBasePointer(), (ATTBAH *)TBAH);         // Initialize the shared ptrs
+    TBAH->Base = (char *)inMem->GetTrueBasePointer();                           // It came in on this object, not mine
+    inMem->FreeThisInstanceOnly();                                              // Then tell the object not to track it anymore (only the creator needs to track it)
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** WorkerThreads
+int     ATSharedTable::WorkerThreads(                                           // Internal routine to settle how many threads a job is spread over- from 1 to AT_TABLE_THREADS_MAX
+                            int         inThreads                               // Threads asked for, zero for one per processor we can run on
+                            ) {
+    if ( !inThreads ) inThreads = ATGetCPUInfo()->UsableProcs;
+    if ( inThreads < 1 ) inThreads = 1;                                         // ATInitSems hasn't been called
+    if ( inThreads > AT_TABLE_THREADS_MAX ) inThreads = AT_TABLE_THREADS_MAX;
+    return inThreads;
+}
+// **************************************************************************** RunWorkers
+void    ATSharedTable::RunWorkers(                                              // Internal routine to run a worker per job, one on this thread & the rest on threads of their own, and wait for them all
+                            int         inThreads,                              // Number of jobs, no more than AT_TABLE_THREADS_MAX
+                            void        *(*inWorker)(void *),                   // Thread routine to run each job
+                            void        *inJobs,                                // The jobs, one after another
+                            long        inJobSize                               // Bytes in each job
+                            ) {
+    pthread_t       Threads[AT_TABLE_THREADS_MAX];
+    int             Started[AT_TABLE_THREADS_MAX];
+    int             i;
+
+    for ( i = 0; i < inThreads; ++i )                                           // This thread takes the first job
+        Started[i] = i && !pthread_create(&Threads[i], NULL, inWorker, (char *)inJobs + (i * inJobSize));
+    for ( i = 0; i < inThreads; ++i ) {
+        if ( Started[i] )
+            pthread_join(Threads[i], NULL);
+        else                                                                    // Mine, or a thread we couldn't get- do it here
+            inWorker((char *)inJobs + (i * inJobSize));
+    }
+}
+// **************************************************************************** PreAttachWorker
+void    *ATSharedTable::PreAttachWorker(                                        // Internal thread routine for PreAttachBlocks()
+                            void        *inJob                                  // The blocks to attach
+                            ) {
+    ATPreAttachJob  *Job = (ATPreAttachJob *)inJob;
+    ATSharedMem     BlockMem;                                                   // Each thread attaches with its own
+    volatile ATTBAH *TBAH;
+    long            Block;
+    int             Result;
+
+    for ( Block = Job->First; Block < Job->Last; Block += Job->Step ) {
+        TBAH = Job->Table->HeaderSlot(Block);
+        if ( !TBAH->SharedHeader &&
+                (Result = Job->Table->AttachBlock(TBAH, Block, &BlockMem)) != ATERR_SUCCESS )
+            Job->Result = Result;
+    }
+    return NULL;
+}
+// **************************************************************************** PreAttachBlocks
+int     ATSharedTable::PreAttachBlocks(                                         // Attach every block now, rather than as each is first touched- for a warm start
+                            int         inThreads                               // Threads to spread the attaching over, zero for one per processor we can run on
+                            ) {
+    ATPreAttachJob  Jobs[AT_TABLE_THREADS_MAX];
+    long            i;
+    int             Result = ATERR_SUCCESS;
+
+    if ( !TB || inThreads < 0 ) return ATERR_BAD_PARAMETERS;
+    SynchBlockAccess();                                                         // Get headers for everything there is
+    inThreads = ArenaBase ? 1:WorkerThreads(inThreads);                         // In an arena there are no system calls to overlap
+    if ( inThreads > MyNumberBlocks - 1 ) inThreads = MyNumberBlocks - 1;       // The first block is always attached
+    if ( inThreads < 1 ) return ATERR_SUCCESS;
+
+    for ( i = 0; i < inThreads; ++i ) {                                         // Deal the blocks out round robin- this thread takes the first share
+        Jobs[i].Table = this;
+        Jobs[i].First = i + 1;
+        Jobs[i].Step = inThreads;
+        Jobs[i].Last = MyNumberBlocks;
+        Jobs[i].Result = ATERR_SUCCESS;
+    }
+    RunWorkers(inThreads, PreAttachWorker, Jobs, sizeof(ATPreAttachJob));
+    for ( i = 0; i < inThreads; ++i )
+        if ( Jobs[i].Result != ATERR_SUCCESS ) Result = Jobs[i].Result;
+    return Result;
+}
 // **************************************************************************** DeterminePointers
 int     ATSharedTable::DeterminePointers(                                       // An internal function to make sure everyone looks for structures in the same place
                             ATTuple     *Base,                                  // Ptr to the base of the block
                             ATTBAH      *TBAH                                   // Block header to initialize
                             ) {
-    unsigned long   Test;
+    unsigned long   Test, Align;
 
-    Test = (unsigned int)(Base);                                                // Align & set a pointer to the shared header
-    Test = ((Test + (AT_MEM_ALIGN - 1)) & ~(AT_MEM_ALIGN - 1));
+    Align = PadSize ? PadSize : AT_MEM_ALIGN;                                   // A padded table starts everything on a fresh line
+    Test = (unsigned long)(Base);                                               // Align & set a pointer to the shared header
+    Test = ((Test + (Align - 1)) & ~(Align - 1));
     TBAH->SharedHeader = (ATTBAHG*)Test;                                        // Set the pointer to the shared header
 
-    Test += sizeof(ATTBAHG);                                                    // Now align & set a pointer to the add lists
-    Test = ((Test + (AT_MEM_ALIGN - 1)) & ~(AT_MEM_ALIGN - 1));
+    Test += sizeof(ATTBAHG);
+    if ( PadSize ) {                                                            // When padded, the block lock gets a line to itself, away from NumberTuples
+        Test = ((Test + (Align - 1)) & ~(Align - 1));
+        TBAH->HeaderLock = (ATLOCK *)Test;
+        Test += PadSize;
+    }
+    else
+        TBAH->HeaderLock = &(TBAH->SharedHeader->ALock);
+    Test = ((Test + (Align - 1)) & ~(Align - 1));                               // Now align & set a pointer to the add lists
     TBAH->AddSegs = (ATTListSegs *)Test;
 
-    Test = (unsigned int)(TBAH->AddSegs + NumAddLists);                         // Now align & set a ptr to the start of the data
-    Test = ((Test + (AT_MEM_ALIGN - 1)) & ~(AT_MEM_ALIGN - 1));
+    Test += AddStride * NumAddLists;                                            // Now align & set a ptr to the start of the data
+    Test = ((Test + (Align - 1)) & ~(Align - 1));
     TBAH->Data = (char *)Test;                                                  // Store the start of data ptr
-    TBAH->Base = (char*)Mem.GetTrueBasePointer();                               // Save the true base ptr for cleaning up later
+    SetTuplePointers(TBAH, TB->GrowthAlloc);                                    // Every block past the first is a growth block
+    TBAH->Base = ArenaBase ? NULL : (char*)Mem.GetTrueBasePointer();            // Save the true base ptr for cleaning up later- arena blocks go with the first one
     return ATERR_SUCCESS;
 }
 // **************************************************************************** FirstDeterminePointers
 int     ATSharedTable::FirstDeterminePointers(                                  // An internal function to make sure everyone looks for structures in the same place when a table is first created/opened
                             int         Create                                  // Set to true if calling from Create(), false if calling from Open()
                             ) {
-    unsigned long   Test, NumberSegs;
+    unsigned long   Test, NumberSegs, Align;
     volatile ATTBAH *TBAH;
 
     TB = (ATTableInfo *)Mem.GetBasePointer();                                   // Set my ptr to the ATTableInfo struct
+    if ( !Create ) {                                                            // If opening, lay things out the way the creator did
+        SetPadding(TB->PadSize);
+        SetTupleLayout(TB->TrueTupleSize, (TB->Options & AT_TABLE_SPLIT_CBS) ? 1 : 0);
+    }
+    Align = PadSize ? PadSize : AT_MEM_ALIGN;                                   // A padded table starts everything on a fresh line
 
-    Test = (unsigned int)(TB + 1);                                              // Align & set a pointer to the delete segments
-    Test = ((Test + (AT_MEM_ALIGN - 1)) & ~(AT_MEM_ALIGN - 1));
-    DelSegs = (ATTListSegs *)Test;
+    Test = (unsigned long)(TB + 1);                                             // Align & set a pointer to the delete segments
+    if ( PadSize )
+        Test = ((Test + (Align - 1)) & ~(Align - 1));
+    else
+        Test = ((Test + (AT_DELLIST_ALIGN - 1)) & ~(AT_DELLIST_ALIGN - 1));
+    DelSegs = (ATTDelList *)Test;
 
     (Create) ? NumberSegs = NumDelLists:NumberSegs = TB->NumDelLists;           // Depending on whether I am creating or opening, I will find the number of segments in different places
-    Test = (unsigned int)(DelSegs + NumberSegs);                                // Now align & set a ptr to the first shared header
-    Test = ((Test + (AT_MEM_ALIGN - 1)) & ~(AT_MEM_ALIGN - 1));
+    Test += DelStride * NumberSegs;                                             // The block directory comes right behind them- still aligned for a long
+    if ( !Create ) DirectorySize = TB->DirectorySize;
+    Directory = (volatile long *)Test;
+    Test += sizeof(long) * DirectorySize;                                       // Now align & set a ptr to the first shared header
+    Test = ((Test + (Align - 1)) & ~(Align - 1));
     TBAH = GetNewTBAH();                                                        // Get a TBAH allocated
     if ( !TBAH ) return ATERR_OUT_OF_MEMORY;
     TBAH->SharedHeader = (ATTBAHG*)Test;                                        // Set the pointer to the shared header
 
-    Test += sizeof(ATTBAHG);                                                    // Now align & set a pointer to the add lists
-    Test = ((Test + (AT_MEM_ALIGN - 1)) & ~(AT_MEM_ALIGN - 1));
+    Test += sizeof(ATTBAHG);
+    if ( PadSize ) {                                                            // When padded, the block lock gets a line to itself, away from NumberTuples
+        Test = ((Test + (Align - 1)) & ~(Align - 1));
+        TBAH->HeaderLock = (ATLOCK *)Test;
+        Test += PadSize;
+    }
+    else
+        TBAH->HeaderLock = &(TBAH->SharedHeader->ALock);
+    Test = ((Test + (Align - 1)) & ~(Align - 1));                               // Now align & set a pointer to the add lists
     TBAH->AddSegs = (ATTListSegs *)Test;
 
     (Create) ? NumberSegs = NumAddLists:NumberSegs = TB->NumAddLists;           // Depending on whether I am creating or opening, I will find the number of segments in different places
-    Test = (unsigned int)(TBAH->AddSegs + NumberSegs);                          // Now align & set a ptr to the start of the data
-    Test = ((Test + (AT_MEM_ALIGN - 1)) & ~(AT_MEM_ALIGN - 1));
+    Test += AddStride * NumberSegs;                                             // Now align & set a ptr to the start of the data
+    Test = ((Test + (Align - 1)) & ~(Align - 1));
     TBAH->Data = (char *)Test;                                                  // Store the start of data ptr
+    if ( !Create ) SetTuplePointers(TBAH, TB->InitialAlloc);                    // The creator does this once it has filled TB in
     TBAH->Base = (char*)Mem.GetTrueBasePointer();                               // Save the true base ptr for cleaning up later
     return ATERR_SUCCESS;
 }
+// **************************************************************************** SetArena
+void    ATSharedTable::SetArena() {                                             // Internal routine to cache where the blocks sit in an arena table, once the first is up
+    ATTBAH          Probe;
+
+    if ( !(TB->Options & AT_TABLE_ARENA) ) {
+        ArenaBase = NULL;
+        return;
+    }
+    ArenaBase = (char *)TB;                                                     // The first block starts the arena
+    ArenaFirst = TB->ArenaFirst;
+    ArenaShift = TB->ArenaShift;
+    ArenaCBs0 = TBAHBlocks[0]->Data;
+    ArenaTuples0 = TBAHBlocks[0]->Tuples;
+    DeterminePointers(ArenaBase + ArenaFirst, &Probe);                          // Every growth block is laid out like the first one- it needn't be there yet
+    ArenaCBsN = Probe.Data;
+    ArenaTuplesN = Probe.Tuples;
+}
+// **************************************************************************** FreshenBlock
+void    ATSharedTable::FreshenBlock(                                            // Internal routine to clear the tuple locks a block kept from before a restart- call before locking anything in a block whose epoch is behind
+                            volatile ATTBAH *TBAH                               // Block to freshen
+                            ) {
+    volatile ATTupleCB *CB;
+    long            i, Count;
+
+    GetSegmentLock(TBAH->HeaderLock, AT_LOCKCLASS_TABLEBLOCK);                  // Only one of us does it
+    if ( TBAH->SharedHeader->Epoch != TB->Epoch ) {                             // Nobody beat us to it
+        // Nobody in this epoch can hold a lock in here yet- they all come through here first
+        Count = TBAH->SharedHeader->HighWater;                                  // Nothing above the high-water mark was ever locked
+        for ( i = 0; i < Count; ++i ) {
+            CB = CBAt(TBAH, i);
+            if ( CB->ALock && CB->ALock != AT_DELETED_TUPLE ) CB->ALock = 0;    // A kilroy from before the restart
+        }
+        TBAH->SharedHeader->Epoch = TB->Epoch;                                  // Stores stay in order, so the locks are clear before anyone sees this
+    }
+    FreeSegmentLock(TBAH->HeaderLock);
+}
+// **************************************************************************** GrowthBlockSize
+long    ATSharedTable::GrowthBlockSize(                                         // Internal routine to work out the bytes a growth block needs
+                            long        inTrueTupleSize,                        // Bytes per tuple, control block included
+                            long        inGrowthAlloc                           // Tuples per growth block
+                            ) {
+    long            Align = PadSize ? PadSize : AT_MEM_ALIGN;
+
+    return  (inTrueTupleSize * inGrowthAlloc) +
+            (AddStride * NumAddLists) +
+            sizeof(ATTBAHG) + (Align * 3) + PadSize +                           // The 3 is two structs plus data align, plus the block lock's own line
+            (SplitCBs ? AT_TABLE_PAD_DEFAULT + PadSize : 0);                    // And the split tuple data's align
+}
+// **************************************************************************** SetTupleLayout
+void    ATSharedTable::SetTupleLayout(                                          // Internal routine to set up the control block & tuple strides
+                            long        inTrueTupleSize,                        // Bytes per tuple, control block included
+                            long        inSplit                                 // Set to true if the control blocks are kept apart from the data
+                            ) {
+    SplitCBs = inSplit;
+    if ( SplitCBs ) {                                                           // A dense array of CBs, then a dense array of tuples
+        CBStride = sizeof(ATTupleCB);
+        TupleStride = inTrueTupleSize - sizeof(ATTupleCB);
+    }
+    else                                                                        // Each tuple right behind its CB
+        CBStride = TupleStride = inTrueTupleSize;
+}
+// **************************************************************************** SetTuplePointers
+void    ATSharedTable::SetTuplePointers(                                        // Internal routine to find where the tuple data starts in a block
+                            volatile ATTBAH *TBAH,                              // Block to set up- its data ptr must already be set
+                            long        inTuples                                // Number of tuples the block holds
+                            ) {
+    unsigned long   Test, Align;
+
+    if ( !SplitCBs ) {                                                          // The tuple data is right behind each CB
+        TBAH->Tuples = TBAH->Data + sizeof(ATTupleCB);
+        return;
+    }
+    Align = (PadSize > AT_TABLE_PAD_DEFAULT) ? PadSize : AT_TABLE_PAD_DEFAULT;  // Start the tuple data on a fresh line, so the CB array's last line isn't shared with it
+    Test = (unsigned long)(TBAH->Data + (CBStride * inTuples));
+    Test = ((Test + (Align - 1)) & ~(Align - 1));
+    TBAH->Tuples = (char *)Test;
+}
+// **************************************************************************** CBAt
+volatile ATTupleCB *ATSharedTable::CBAt(                                        // Internal routine to find a tuple's control block in a block
+                            volatile ATTBAH *TBAH,                              // Block the tuple is in
+                            long        Tuple                                   // Tuple to find
+                            ) {
+    return (volatile ATTupleCB *)(TBAH->Data + (CBStride * Tuple));
+}
+// **************************************************************************** TupleAt
+ATTuple *ATSharedTable::TupleAt(                                                // Internal routine to find a tuple's data in a block
+                            volatile ATTBAH *TBAH,                              // Block the tuple is in
+                            long        Tuple                                   // Tuple to find
+                            ) {
+    return (ATTuple *)(TBAH->Tuples + (TupleStride * Tuple));
+}
+// **************************************************************************** SetPadding
+void    ATSharedTable::SetPadding(                                              // Internal routine to set up the list strides for a padded or packed layout
+                            long        inPadSize                               // Line size to pad to, zero to pack
+                            ) {
+    PadSize = inPadSize;
+    AddStride = PadSize ? PadSize : sizeof(ATTListSegs);
+    DelStride = PadSize ? PadSize : sizeof(ATTDelList);
+}
+// **************************************************************************** AddSeg
+volatile ATTListSegs *ATSharedTable::AddSeg(                                    // Internal routine to find an add segment in a block
+                            volatile ATTBAH *TBAH,                              // Block the segment is in
+                            long        Seg                                     // Segment to find
+                            ) {
+    return (volatile ATTListSegs *)(((volatile char *)TBAH->AddSegs) + (AddStride * Seg));
+}
+// **************************************************************************** DelSeg
+volatile ATTDelList *ATSharedTable::DelSeg(                                     // Internal routine to find a delete list
+                            long        Seg                                     // List to find
+                            ) {
+    return (volatile ATTDelList *)(((volatile char *)DelSegs) + (DelStride * Seg));
+}
 // **************************************************************************** GetNewTBAH
 // The table allocation headers are themselves allocated in chunks.  This routine
 // keeps track of all of them, and allocates new ones for growth as needed.  It
@@ -1141,6 +2349,7 @@ TBAH_retry:
 int     ATSharedTable::CloseTable() {                                           // Close down the table
     long List, NumHeaders, Headers;
     volatile ATTBAH  *TBAH;
+    ATSharedMem Spare;
 
     if ( !TB ) return ATERR_SUCCESS;
 //printf("Number table blocks: %i\r\n", TB->NumberBlocks);
@@ -1148,6 +2357,20 @@ int     ATSharedTable::CloseTable() {
     ATAtomicDec(&(TB->InstanceCount));                                          // Decrease the instance count
 
     SynchBlockAccess();                                                         // Make sure I can see all the blocks
+    if ( IAmCreator ) {                                                         // I take them all down, so I need them all attached
+        for ( Headers = 1; Headers < MyNumberBlocks; ++Headers )
+            GetHeaderPointer(Headers);
+        if ( TB->SpareBlock && !ArenaBase ) {                                   // And one made ahead was never linked on, so it isn't in there
+            if ( (TBAH = GetHeaderPointer(TB->NumberBlocks - 1)) )
+                GetSegmentLock(TBAH->HeaderLock, AT_LOCKCLASS_TABLEBLOCK);      // Nobody links it on while we're at it
+            if ( TB->SpareBlock && Spare.AttachSharedMem(TB->Key + TB->SpareBlock) == ATERR_SUCCESS ) {
+                ATDestroySharedMemAt(Spare.GetTrueBasePointer());
+                Spare.DetachSharedMem();
+            }
+            TB->SpareBlock = 0;                                                 // Anyone left adding makes it over again
+            if ( TBAH ) FreeSegmentLock(TBAH->HeaderLock);
+        }
+    }
     for ( List = 0; List < NumberTBAHBlocks; ++List) {                          // Run through the entire tracking list
         if ( List < NumberTBAHBlocks - 1 )
             NumHeaders = AT_TH_ALLOC;                                           // For all except the last block, this will be a full block
@@ -1156,13 +2379,14 @@ int     ATSharedTable::CloseTable() {
         for ( Headers = 0; Headers < NumHeaders; Headers++) {                   // Loop thru all the headers in this block
             TBAH = ((TBAHBlocks[List]) + Headers);                              // Determine ptr to this header
             if ( IAmCreator )                                                   // If I created this table, I will try to take it down (won't actually go until everyone else goes too...)
-                ATDestroySharedMem(TBAH->SharedHeader->SHMID);                  // Free up this shared memory
+                ATDestroySharedMemAt((volatile void *)TBAH->Base);              // Free up this shared memory
             ATDetachSharedMem((volatile void *)TBAH->Base);                     // Decrement the instance count for the mem
         }
         if ( TBAHBlocks && TBAHBlocks[List] ) delete TBAHBlocks[List];          // After freeing the shared segments above, now delete the actual block itself
     }
-    if ( IAmCreator ) Mem.FreeThisInstanceOnly();                               // Clear the shared memory object
+    Mem.FreeThisInstanceOnly();                                                 // Clear the shared memory object- an arena table's opener still has it too
     if ( TBAHBlocks ) delete TBAHBlocks;                                        // Delete the list itself
+    if ( ScanValid ) delete[] (char*)ScanValid;                                 // And ScanBlock()'s bitmap
 
     ResetVariables();
     TB = NULL;
@@ -1173,38 +2397,68 @@ void    ATSharedTable::InitBlock(
                             volatile ATTBAH  *TBAH                              // Block to init
                             ) {
     long        i, Count, Add, Seg;
-    ATTuple     *Tuple;
     ATTupleCB   *CB;// Note the NON volatile dec...
 
     for ( i = 0; i < NumAddLists; ++i)  {                                       // Clear the segment locks for adds tracking
-        TBAH->AddSegs[i].ALock =  0;
-        TBAH->AddSegs[i].Tuple = -1;
+        AddSeg(TBAH, i)->ALock =  0;
+        AddSeg(TBAH, i)->Tuple = -1;
     }
 
     Seg = 0;                                                                    // This loop will add all of the tuples to the add lists
     Count = TBAH->SharedHeader->TuplesAllocated;                                // Since it is a safe loop (and possibly very large), let's cache that volatile value
     Add = Count - 1;                                                            // Start at the end (so tuples get used starting at the beginning- makes for a faster NextTuple())
-    Tuple = (ATTuple *)(TBAH->Data + (Add * TB->TrueTupleSize));
-    CB = (ATTupleCB*)Tuple;
+    CB = (ATTupleCB*)CBAt(TBAH, Add);
     while ( Add > -1 ) {                                                        // Loop thru all the tuples
-        if ( TBAH->AddSegs[Seg].Tuple > -1 ) {                                  // If this is an ongoing list
-            CB->Tuple = TBAH->AddSegs[Seg].Tuple;                               // Make this tuple point to the previous tuple stored in the list
-            TBAH->AddSegs[Seg].Tuple = Add;                                     // Then make the list point to me
+        if ( AddSeg(TBAH, Seg)->Tuple > -1 ) {                                  // If this is an ongoing list
+            CB->Tuple = AddSeg(TBAH, Seg)->Tuple;                               // Make this tuple point to the previous tuple stored in the list
+            AddSeg(TBAH, Seg)->Tuple = Add;                                     // Then make the list point to me
         }
         else  {                                                                 // In each header...
-            TBAH->AddSegs[Seg].Tuple = Add;                                     // Start it with the highest free block left
+            AddSeg(TBAH, Seg)->Tuple = Add;                                     // Start it with the highest free block left
             CB->Tuple = AT_CHAIN_END;                                           // Mark this tuple as being at the end of this list
         }
         CB->ALock = 0;                                                          // As long as we are here, init the rest of the CB
         CB->Block = AT_VIRGIN_TUPLE;
 
-        Tuple = (ATTuple*)(((char*)Tuple) - TB->TrueTupleSize);                 // Move to the prev tuple
-        CB = (ATTupleCB*)Tuple;
+        CB = (ATTupleCB*)(((char*)CB) - CBStride);                              // Move to the prev tuple
         Add--;                                                                  // Move to the next tuple
         Seg++;
         if ( Seg == NumAddLists ) Seg = 0;                                      // This just keeps round-robining the segments...
     }
 }
+// **************************************************************************** GetSegmentLock
+int     ATSharedTable::GetSegmentLock(                                          // Internal routine to get a block header or add segment lock, whichever kind this table uses
+                            ATLOCK      *ALock,                                 // Lock to get
+                            long        inClass                                 // AT_LOCKCLASS_* the lock is counted under in the lock statistics
+                            ) {
+    ATSetLockClass(inClass);
+    if ( FairLocks ) return ATGetTicketLock(ALock);
+    return ATGetSpinLock(Kilroy, ALock);
+}
+// **************************************************************************** BounceSegmentLock
+int     ATSharedTable::BounceSegmentLock(                                       // Internal routine to try a block header or add segment lock, returning immediately if held
+                            ATLOCK      *ALock,                                 // Lock to get
+                            long        inClass                                 // AT_LOCKCLASS_* the lock is counted under in the lock statistics
+                            ) {
+    ATSetLockClass(inClass);
+    if ( FairLocks ) return ATBounceTicketLock(ALock);
+    return ATBounceSpinLock(Kilroy, ALock);
+}
+// **************************************************************************** FreeSegmentLock
+int     ATSharedTable::FreeSegmentLock(                                         // Internal routine to free a block header or add segment lock
+                            ATLOCK      *ALock                                  // Lock to free
+                            ) {
+    if ( FairLocks ) return ATFreeTicketLock(ALock);
+    return ATFreeSpinLock(Kilroy, ALock);
+}
+// **************************************************************************** ReclaimSegmentLock
+int     ATSharedTable::ReclaimSegmentLock(                                      // Internal routine to take a block header or add segment lock over from a dead holder
+                            ATLOCK      *ALock,                                 // Lock to take over
+                            long        inAttempts                              // Number of tries made at the lock so far
+                            ) {
+    if ( FairLocks ) return ATERR_OBJECT_IN_USE;                                // Ticket locks don't know who holds them
+    return ATReclaimSpinLock(Kilroy, ALock, inAttempts);
+}
 // **************************************************************************** RegisterBTree
 int ATSharedTable::RegisterBTree(                                               // Call to register a new BTree with the table
                             ATBTree     *inBTree,                               // Ptr to the BTree being registered
@@ -61,6 +61,7 @@
 struct  ATXTemplateInfoBlock {                                                  // Shared Info block for the cache
     volatile long   CurrentBlock;                                               // Current block in use
     ATLOCK          ALock;                                                      // Lock on the cache
+    ATBRSLOT        ReaderSlots[AT_BRLOCK_SLOTS];                               // Reader slots for ALock- every template fetch takes a share on the cache
     volatile long   BlocksAllocated;                                            // Number of cache blocks allocated
     volatile long   BlockSize;                                                  // The size of each block allocated
     volatile long   BlocksPerAlloc;                                             // Blocks to alloc each time
@@ -134,7 +135,8 @@ void    *CacheMakeKey(void *Tuple) {
 
 // **************************************************************************** EmptyCache
 void ATXTemplate::EmptyCache() {                                                // Forces all templates out of cache (mostly development use)
-    ATGetShareExclusive(&(Info->ALock));                                        // Get an exclusive lock
+    ATSetLockClass(AT_LOCKCLASS_TEMPLATE);
+    ATGetBRShareExclusive(&(Info->ALock), (ATBRSLOT*)(Info->ReaderSlots));      // Get an exclusive lock
     Info->CurrentBlock = 0;                                                     // Set ourselves back to the first block
     (Blocks[0])->Offset = sizeof(ATXTBH);                                       // Move the offset to just past the header
     (Blocks[0])->Offset += sizeof(ATXTInfo);                                    // Since this is the first block, also move it past our info block
@@ -259,7 +261,7 @@ long ATXTemplate::GetAuthorize() {
 // **************************************************************************** FreeTemplate
 int ATXTemplate::FreeTemplate() {                                               // Call to free up the template form- ALWAYS CALL ASAP TO FREE LOCKS
     if ( CurrForm )
-        ATFreeShare(&(Info->ALock));                                            // Release the share lock
+        ATFreeBRShare(&(Info->ALock), (ATBRSLOT*)(Info->ReaderSlots));          // Release the share lock
     CurrForm = NULL;
     return ATERR_SUCCESS;
 }
@@ -276,27 +278,28 @@ int ATXTemplate::GetTemplate(
     if ( !Name ) return ATERR_BAD_PARAMETERS;
 
     if ( CurrForm ) {                                                           // If they forgot to free the last one
-        ATFreeShare(&(Info->ALock));                                            // Release the share lock
+        ATFreeBRShare(&(Info->ALock), (ATBRSLOT*)(Info->ReaderSlots));          // Release the share lock
         CurrForm = NULL;
     }
     if ( MyBlocksAllocated < Info->BlocksAllocated )                            // Make sure I am up to date
         SynchBlocks();
 
 start_over:
-    ATGetShare(&(Info->ALock));                                                 // Get a read lock- no, I don't want to hold an old one if they had it- someone might need to write something
+    ATSetLockClass(AT_LOCKCLASS_TEMPLATE);
+    ATGetBRShare(&(Info->ALock), (ATBRSLOT*)(Info->ReaderSlots));               // Get a read lock- no, I don't want to hold an old one if they had it- someone might need to write something
     if ( (Found = (ATXCE*)Index.FindTuple((void*)Name,                          // If we already have it loaded
             AT_BTREE_READ_OPTIMISTIC, AT_BTREE_FINDDIRECT, AT_MAX_PATH)) ) {
         CurrForm = (ATXPFH*)(((char*)(Blocks[Found->Block])) + Found->Offset);  // Get a pointer to the header
         FormLength = (CurrForm->NumberItems * sizeof(ATXPFI)) + sizeof(ATXPFH); // Determine form length
         if ( !(Raw = (char*)Scratch->GetScratchMem(FormLength)) ) {             // Get space in local memory for the item list
-            ATFreeShare(&(Info->ALock));
+            ATFreeBRShare(&(Info->ALock), (ATBRSLOT*)(Info->ReaderSlots));
             return ATERR_OUT_OF_MEMORY;
         }
         memcpy((void*)Raw, (void*)CurrForm, FormLength);                        // Copy it into local space
         CurrForm = (volatile ATXPFH*)Raw;                                       // Now point to the local copy
         return ATERR_SUCCESS;
     }
-    ATFreeShare(&(Info->ALock));                                                // Free up our share
+    ATFreeBRShare(&(Info->ALock), (ATBRSLOT*)(Info->ReaderSlots));              // Free up our share
 
     // Okay, we are going to assume that nobody else is going to try to load this at the same time, and we'll start to work with no lock
     // so that we don't hold up the readers.  At the last moment possible, then, we'll get our exclusive.
@@ -320,7 +323,8 @@ start_over:
         return ATERR_FILE_ERROR;
     *(Raw + FileLength) = '\0';                                                 // Null term it
 
-    ATGetShareExclusive(&(Info->ALock));                                        // The Parser will now require us to get the exclusive lock so it can allocate memory safely from the cache
+    ATSetLockClass(AT_LOCKCLASS_TEMPLATE);
+    ATGetBRShareExclusive(&(Info->ALock), (ATBRSLOT*)(Info->ReaderSlots));      // The Parser will now require us to get the exclusive lock so it can allocate memory safely from the cache
     if ( (Found = (ATXCE*)Index.FindTuple((void*)Name,                          // If we already have it loaded
             AT_BTREE_READ_OPTIMISTIC, AT_BTREE_FINDDIRECT, AT_MAX_PATH)) ) {
         CurrForm = (ATXPFH*)(((char*)(Blocks[Found->Block])) + Found->Offset);  // Get a pointer to the header
@@ -389,6 +393,18 @@ ATXTemplate::ATXTemplate() {
 ATXTemplate::~ATXTemplate() {
     Close();
 }
+// **************************************************************************** SetCreateOptions
+int ATXTemplate::SetCreateOptions(                                              // Set the AT_TABLE_* options for the tables (and index pages) made by the next Create() call
+                            long            inOptions                           // Any of the AT_TABLE_* flags or'd together, zero for the defaults
+                            ) {
+    int         Result;
+
+    if ( (Result = CacheTable.SetCreateOptions(inOptions)) != ATERR_SUCCESS )   // The cache itself...
+        return Result;
+    if ( (Result = EntryTable.SetCreateOptions(inOptions)) != ATERR_SUCCESS )   // ...the page entries...
+        return Result;
+    return Index.SetCreateOptions(inOptions);                                   // ...and the index over them
+}
 // **************************************************************************** Create
 int ATXTemplate::Create(                                                        // Call to create
                             long            inAvgPageSize,                      // Your best guess at the average page size (probably 50k - 80k)
@@ -445,7 +461,7 @@ int ATXTemplate::Create(
     Info->EntryTableKey =       EntryTableKey;
     Info->IndexKey =            IndexKey;
     Info->CurrentBlock =        -1;
-    Info->ALock =               0;
+    ATInitBRLock(&(Info->ALock), (ATBRSLOT*)(Info->ReaderSlots));
 
     if ( !(BH = GetNewBlock()) ) {                                              // Add our first block to the cache
         CacheTable.CloseTable();
@@ -605,7 +621,7 @@ void ATXTemplate::Reset() {
 // **************************************************************************** Close
 int ATXTemplate::Close() {                                                      // Close the class & free resources
     if ( CurrForm )                                                             // If they forgot to free the last template
-        ATFreeShare(&(Info->ALock));                                            // Release the share lock
+        ATFreeBRShare(&(Info->ALock), (ATBRSLOT*)(Info->ReaderSlots));          // Release the share lock
     if ( Blocks )                                                               // Clear any tracking blocks if any exist
         delete Blocks;
     Index.Close();                                                              // Close the index btree
@@ -0,0 +1,158 @@
+// ****************************************************************************
+// * timing.cpp - The timing code for Atlas.                                  *
+// * (c) 2002,2003 Shawn Houser, All Rights Reserved                          *
+// * This property and it's ancillary properties are completely and solely    *
+// * owned by Shawn Houser, and no part of it is a work for hire or the work  *
+// * of any other.                                                            *
+// ****************************************************************************
+// ****************************************************************************
+// *  This program is free software; you can redistribute it and/or modify    *
+// *  it under the terms of the GNU General Public License as published by    *
+// *  the Free Software Foundation, version 2 of the License.                 *
+// *                                                                          *
+// *  This program is distributed in the hope that it will be useful,         *
+// *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+// *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+// *  GNU Library General Public License for more details.                    *
+// *                                                                          *
+// *  You should have received a copy of the GNU General Public License       *
+// *  along with this program; if not, write to the Free Software             *
+// *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,   *
+// *  USA.                                                                    *
+// *                                                                          *
+// *  Other license options may possibly be arranged with the author.         *
+// ****************************************************************************
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef      AT_WIN32
+    #include	<windows.h>
+#else
+    #include    <unistd.h>
+    #include    <time.h>
+    #include    <cpuid.h>
+#endif
+
+#include "general.h"
+#include "support.h"
+#include "timing.h"
+
+ATTimingInfo    TimingInfo = { AT_CLOCK_MONOTONIC, 1000000000, 1ULL << 32, 1ULL << 32 };// Nanoseconds until ATInitTiming says otherwise
+static int      TimingReady = 0;                                                // True once ATInitTiming has run
+
+
+// ****************************************************************************
+// ****************************************************************************
+//                             CLOCK ROUTINES
+// ****************************************************************************
+// ****************************************************************************
+
+// **************************************************************************** ATGetClockNanos
+int64 ATGetClockNanos() {                                                       // Read the system's monotonic clock, in nanoseconds- slower than ATGetTicks, but always right
+#ifdef      AT_WIN32
+    LARGE_INTEGER   Count, Frequency;
+
+    QueryPerformanceCounter(&Count);
+    QueryPerformanceFrequency(&Frequency);
+    return (int64)((Count.QuadPart / Frequency.QuadPart) * 1000000000 +
+                   ((Count.QuadPart % Frequency.QuadPart) * 1000000000) / Frequency.QuadPart);
+#else
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &Now);                                   // RAW, so NTP slewing doesn't bend our intervals
+    return ((int64)Now.tv_sec * 1000000000) + Now.tv_nsec;
+#endif
+}
+// **************************************************************************** ATInitTiming
+int ATInitTiming() {                                                            // Pick and calibrate the clock- only the first call does anything
+#ifndef     AT_WIN32
+    unsigned int    Eax, Ebx, Ecx, Edx;
+    int             Source = AT_CLOCK_TSC;
+    int64           StartNanos, EndNanos, StartTicks, EndTicks;
+#endif
+
+    if ( TimingReady ) return ATERR_SUCCESS;
+    TimingReady = 1;
+
+#ifndef     AT_WIN32
+    if ( __get_cpuid(0x80000000, &Eax, &Ebx, &Ecx, &Edx) == 0 || Eax < 0x80000007 )
+        return ATERR_SUCCESS;                                                   // Can't ask about the counter, so stay on the system clock
+    __get_cpuid(0x80000007, &Eax, &Ebx, &Ecx, &Edx);
+    if ( !(Edx & (1 << 8)) )                                                    // The counter's rate changes with the CPU's, so it is no clock
+        return ATERR_SUCCESS;
+    __get_cpuid(0x80000001, &Eax, &Ebx, &Ecx, &Edx);
+    if ( Edx & (1 << 27) )                                                      // Take rdtscp when we have it
+        Source = AT_CLOCK_RDTSCP;
+
+    TimingInfo.Source = Source;                                                 // Watch the counter against the system clock for a bit
+    StartNanos = ATGetClockNanos();
+    StartTicks = ATGetTicks();
+    do {
+        EndNanos = ATGetClockNanos();
+        EndTicks = ATGetTicks();
+    } while ( EndNanos - StartNanos < AT_CLOCK_CALIBRATE );
+    TimingInfo.Source = AT_CLOCK_MONOTONIC;
+    if ( EndTicks <= StartTicks )                                               // Something is badly off- don't trust it
+        return ATERR_OPERATION_FAILED;
+
+    EndTicks -= StartTicks;                                                     // Neither overflows 64 bits over the short calibration
+    EndNanos -= StartNanos;
+    TimingInfo.TicksPerSecond = (EndTicks * 1000000000) / EndNanos;
+    TimingInfo.NanosPerTick = ((unsigned int64)EndNanos << 32) / (unsigned int64)EndTicks;
+    TimingInfo.TicksPerNano = ((unsigned int64)EndTicks << 32) / (unsigned int64)EndNanos;
+    TimingInfo.Source = Source;                                                 // Only switch over once the rates are in
+#endif
+    return ATERR_SUCCESS;
+}
+// **************************************************************************** ATGetTimingInfo
+ATTimingInfo *ATGetTimingInfo() {                                               // Returns ptr to the clock information
+    return &TimingInfo;
+}
+
+
+// ****************************************************************************
+// ****************************************************************************
+//                             SCOPED TIMER METHODS
+// ****************************************************************************
+// ****************************************************************************
+
+// **************************************************************************** Constructor
+ATScopedTimer::ATScopedTimer(                                                   // Time the scope into a total
+                            int64           *inTotal                            // Total to add the nanoseconds to, NULL if just using Elapsed()
+                            ) {
+    Total = inTotal;
+    Log = NULL;
+    Name = NULL;
+    SlowTicks = 0;
+    Start = ATGetTicks();                                                       // Last, so the setup isn't timed
+}
+// **************************************************************************** Constructor
+ATScopedTimer::ATScopedTimer(                                                   // Time the scope, logging it if it is slow
+                            int64           *inTotal,                           // Total to add the nanoseconds to, NULL if none
+                            ATLog           *inLog,                             // Log to write slow times to
+                            const char      *inName,                            // Name of what is being timed
+                            int64           inSlowNanos                         // Times at least this long are logged
+                            ) {
+    Total = inTotal;
+    Log = inLog;
+    Name = inName;
+    SlowTicks = ATNanosToTicks(inSlowNanos);                                    // Compare in ticks, so a fast scope never pays for a conversion
+    Start = ATGetTicks();
+}
+// **************************************************************************** Destructor
+ATScopedTimer::~ATScopedTimer() {
+    int64           Ticks = ATGetTicks() - Start;
+
+    if ( Total )
+        *Total += ATTicksToNanos(Ticks);
+    if ( Log && Ticks >= SlowTicks )
+        Log->Write("Slow operation: %s took %lld ns", Name ? Name : "(unnamed)", ATTicksToNanos(Ticks));
+}
+// **************************************************************************** Elapsed
+int64 ATScopedTimer::Elapsed() {                                                // Nanoseconds since the timer started
+    return ATTicksToNanos(ATGetTicks() - Start);
+}
+
+